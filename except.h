@@ -29,8 +29,9 @@ struct __np_exceptstate_t
     np::event_t event;
 };
 
-/* in runner.cxx */
-extern __np_exceptstate_t __np_exceptstate;
+/* in runner.cxx; a thread which runs tests points this at its own */
+extern __thread __np_exceptstate_t *__np_exceptstatep;
+#define __np_exceptstate (*__np_exceptstatep)
 extern void __np_uncaught_event(void) __attribute__((noreturn));
 
 #define np_try \
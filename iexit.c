@@ -33,7 +33,8 @@ void init_exit_intercepts(testnode_t *tn)
 {
     tn->add_mock((np::spiegel::addr_t)&exit,
 		 "exit",
-		 (np::spiegel::addr_t)&mock_exit);
+		 (np::spiegel::addr_t)&mock_exit,
+		 /*got*/true);
 }
 
 // close the namespace
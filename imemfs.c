@@ -0,0 +1,279 @@
+/* imemfs.c - keep files the CUT writes in memory instead of on disk */
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np_priv.h"
+#include "except.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <map>
+
+namespace np {
+using namespace std;
+
+/*
+ * Each file under the prefix is an anonymous memfd, so once the CUT
+ * has opened it, read(), write(), fsync() and the rest go straight
+ * to the kernel at memory speed without being intercepted.  Only
+ * the calls which take a path are, and they open a new description
+ * of the memfd through /proc so each open() gets its own offset.
+ *
+ * The table of files is owned by the intercept on open(), so it's
+ * thrown away with the other dynamic intercepts at the end of the
+ * test, before the checks for leaked memory and descriptors.
+ */
+class memfs_t : public redirect_t
+{
+public:
+    memfs_t(const char *prefix, spiegel::addr_t to);
+    ~memfs_t();
+
+    bool is_under(const char *path) const;
+
+    string prefix_;
+    map<string, int> files_;	/* path -> memfd with the contents */
+};
+
+static memfs_t *memfs;
+
+memfs_t::memfs_t(const char *prefix, spiegel::addr_t to)
+ :  redirect_t((spiegel::addr_t)&open, "open", to),
+    prefix_(prefix)
+{
+    while (prefix_.length() > 1 && prefix_[prefix_.length()-1] == '/')
+	prefix_.resize(prefix_.length()-1);
+}
+
+memfs_t::~memfs_t()
+{
+    map<string, int>::iterator i;
+    for (i = files_.begin() ; i != files_.end() ; ++i)
+	close(i->second);
+    if (memfs == this)
+	memfs = 0;
+}
+
+bool
+memfs_t::is_under(const char *path) const
+{
+    size_t len = prefix_.length();
+    return (path && !strncmp(path, prefix_.c_str(), len) &&
+	    (path[len] == '/' || path[len] == '\0' || len == 1));
+}
+
+static bool
+is_memfs(const char *path)
+{
+    return (memfs && memfs->is_under(path));
+}
+
+static int
+memfs_open(const char *path, int flags)
+{
+    map<string, int>::iterator i = memfs->files_.find(path);
+    if (i == memfs->files_.end())
+    {
+	if (!(flags & O_CREAT))
+	{
+	    errno = ENOENT;
+	    return -1;
+	}
+	int fd = np::util::anon_file("novaprova.memfs");
+	i = memfs->files_.insert(make_pair(string(path), fd)).first;
+    }
+    else if ((flags & O_CREAT) && (flags & O_EXCL))
+    {
+	errno = EEXIST;
+	return -1;
+    }
+
+    char proc[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", i->second);
+    flags &= ~(O_CREAT|O_EXCL|O_NOFOLLOW|O_DIRECT);
+    return syscall(SYS_openat, AT_FDCWD, proc, flags, 0);
+}
+
+static void
+memfs_fail(const char *fmt, const char *path)
+{
+    static char buf[1024];
+    snprintf(buf, sizeof(buf), fmt, path);
+    np_throw(event_t(EV_ASSERT, buf).with_stack());
+}
+
+/*
+ * Paths outside the prefix are passed on to the kernel directly,
+ * because calling the functions we've intercepted would only bring
+ * us back here.
+ */
+static int
+mock_open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE)
+    {
+	va_list args;
+	va_start(args, flags);
+	mode = va_arg(args, int);
+	va_end(args);
+    }
+    if (is_memfs(path))
+	return memfs_open(path, flags);
+    return syscall(SYS_openat, AT_FDCWD, path, flags, mode);
+}
+
+static int
+mock_openat(int dirfd, const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE)
+    {
+	va_list args;
+	va_start(args, flags);
+	mode = va_arg(args, int);
+	va_end(args);
+    }
+    if (path && path[0] == '/' && is_memfs(path))
+	return memfs_open(path, flags);
+    return syscall(SYS_openat, dirfd, path, flags, mode);
+}
+
+static int
+mock_creat(const char *path, mode_t mode)
+{
+    return mock_open(path, O_CREAT|O_WRONLY|O_TRUNC, mode);
+}
+
+static int
+mock_rename(const char *from, const char *to)
+{
+    bool infrom = is_memfs(from);
+    bool into = is_memfs(to);
+    if (!infrom && !into)
+	return syscall(SYS_renameat, AT_FDCWD, from, AT_FDCWD, to);
+    if (infrom != into)
+    {
+	errno = EXDEV;
+	return -1;
+    }
+
+    map<string, int>::iterator i = memfs->files_.find(from);
+    if (i == memfs->files_.end())
+    {
+	errno = ENOENT;
+	return -1;
+    }
+    if (i->first == to)
+	return 0;
+    int fd = i->second;
+    memfs->files_.erase(i);
+    /* like the real thing, replaces any existing file */
+    i = memfs->files_.find(to);
+    if (i != memfs->files_.end())
+    {
+	close(i->second);
+	memfs->files_.erase(i);
+    }
+    memfs->files_[to] = fd;
+    return 0;
+}
+
+static int
+mock_unlink(const char *path)
+{
+    if (!is_memfs(path))
+	return syscall(SYS_unlinkat, AT_FDCWD, path, 0);
+
+    map<string, int>::iterator i = memfs->files_.find(path);
+    if (i == memfs->files_.end())
+    {
+	errno = ENOENT;
+	return -1;
+    }
+    /* descriptors the CUT still has open keep the contents */
+    close(i->second);
+    memfs->files_.erase(i);
+    return 0;
+}
+
+extern "C" void
+np_memfs_mount(const char *prefix)
+{
+    if (!prefix || prefix[0] != '/')
+	memfs_fail("np_memfs_mount: prefix \"%s\" is not an absolute path",
+		   (prefix ? prefix : ""));
+    if (memfs)
+	memfs_fail("np_memfs_mount: already mounted on \"%s\"",
+		   memfs->prefix_.c_str());
+
+    memfs = new memfs_t(prefix, (spiegel::addr_t)&mock_open);
+    add_dynamic_intercept(memfs);
+    add_dynamic_intercept(new redirect_t((spiegel::addr_t)&openat, "openat",
+					 (spiegel::addr_t)&mock_openat));
+    add_dynamic_intercept(new redirect_t((spiegel::addr_t)&creat, "creat",
+					 (spiegel::addr_t)&mock_creat));
+    add_dynamic_intercept(new redirect_t((spiegel::addr_t)&rename, "rename",
+					 (spiegel::addr_t)&mock_rename));
+    add_dynamic_intercept(new redirect_t((spiegel::addr_t)&unlink, "unlink",
+					 (spiegel::addr_t)&mock_unlink));
+}
+
+extern "C" void
+np_memfs_put(const char *path, const void *data, size_t len)
+{
+    if (!is_memfs(path))
+	memfs_fail("np_memfs_put: \"%s\" is not in an in-memory filesystem", path);
+
+    int fd = memfs_open(path, O_WRONLY|O_CREAT|O_TRUNC);
+    const char *p = (const char *)data;
+    while (len)
+    {
+	ssize_t n = write(fd, p, len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	{
+	    close(fd);
+	    memfs_fail("np_memfs_put: cannot write \"%s\"", path);
+	}
+	p += n;
+	len -= n;
+    }
+    close(fd);
+}
+
+extern "C" long
+np_memfs_get(const char *path, void *buf, size_t maxlen)
+{
+    if (!is_memfs(path))
+	memfs_fail("np_memfs_get: \"%s\" is not in an in-memory filesystem", path);
+
+    map<string, int>::iterator i = memfs->files_.find(path);
+    if (i == memfs->files_.end())
+	return -1;
+    struct stat sb;
+    if (fstat(i->second, &sb) < 0)
+	return -1;
+    size_t len = ((size_t)sb.st_size < maxlen ? (size_t)sb.st_size : maxlen);
+    if (len && pread(i->second, buf, len, 0) < 0)
+	return -1;
+    return sb.st_size;
+}
+
+// close the namespace
+};
@@ -162,7 +162,7 @@ static const char *
 syslog_priority_name(int prio)
 {
     const CODE *c;
-    static char buf[32];
+    static __thread char buf[32];
 
     prio &= LOG_PRIMASK;
     for (c = prioritynames ; c->c_name ; c++)
@@ -182,7 +182,8 @@ vlogmsg(int prio, const char *fmt, va_list args)
      * anything special to simulate that feature of syslog() */
      /* TODO: find and expand %m on non-glibc platforms */
     char *p;
-    static char buf[1024];
+    /* threaded tests share the mocks */
+    static __thread char buf[1024];
 
     strncpy(buf, syslog_priority_name(prio), sizeof(buf)-3);
     buf[sizeof(buf)-3] = '\0';
@@ -255,11 +256,13 @@ void init_syslog_intercepts(testnode_t *tn)
 {
     tn->add_mock((np::spiegel::addr_t)&syslog,
 		 "syslog",
-		 (np::spiegel::addr_t)&mock_syslog);
+		 (np::spiegel::addr_t)&mock_syslog,
+		 /*got*/true);
 #if defined(__GLIBC__)
     tn->add_mock((np::spiegel::addr_t)&__syslog_chk,
 		 "__syslog_chk",
-		 (np::spiegel::addr_t)&mock___syslog_chk);
+		 (np::spiegel::addr_t)&mock___syslog_chk,
+		 /*got*/true);
 #endif
 }
 
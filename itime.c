@@ -0,0 +1,166 @@
+/* itime.c - run the clock virtually for tests which ask for it */
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np_priv.h"
+#include "except.h"
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/syscall.h>
+
+namespace np {
+using namespace std;
+
+/*
+ * The virtual clock is the real one plus however long the test has
+ * slept so far.  It keeps running in between, so code which spins
+ * waiting for the time to pass still finishes.  Like the syslog
+ * matches, this starts at zero in every test thanks to fork().
+ */
+static int64_t clock_offset;
+
+extern "C" void
+np_clock_advance(unsigned long long ns)
+{
+    clock_offset += ns;
+}
+
+static void
+advance_timespec(const struct timespec *ts)
+{
+    clock_offset += ts->tv_sec * NANOSEC_PER_SEC + ts->tv_nsec;
+}
+
+static bool
+is_virtual(clockid_t clk)
+{
+    /* the CPU time clocks measure work, not waiting */
+    return (clk >= 0 &&
+	    clk != CLOCK_PROCESS_CPUTIME_ID &&
+	    clk != CLOCK_THREAD_CPUTIME_ID);
+}
+
+/*
+ * These call the kernel directly, because calling the functions
+ * we've intercepted would only bring us back here.
+ */
+static int
+mock_clock_gettime(clockid_t clk, struct timespec *ts)
+{
+    int r = syscall(SYS_clock_gettime, clk, ts);
+    if (!r && is_virtual(clk))
+    {
+	int64_t ns = ts->tv_sec * NANOSEC_PER_SEC + ts->tv_nsec + clock_offset;
+	ts->tv_sec = ns / NANOSEC_PER_SEC;
+	ts->tv_nsec = ns % NANOSEC_PER_SEC;
+    }
+    return r;
+}
+
+static unsigned int
+mock_sleep(unsigned int secs)
+{
+    clock_offset += (int64_t)secs * NANOSEC_PER_SEC;
+    return 0;
+}
+
+static int
+mock_usleep(useconds_t usecs)
+{
+    clock_offset += (int64_t)usecs * 1000;
+    return 0;
+}
+
+static int
+mock_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= NANOSEC_PER_SEC)
+    {
+	errno = EINVAL;
+	return -1;
+    }
+    advance_timespec(req);
+    if (rem)
+	rem->tv_sec = rem->tv_nsec = 0;
+    return 0;
+}
+
+static int
+mock_clock_nanosleep(clockid_t clk, int flags,
+		     const struct timespec *req, struct timespec *rem)
+{
+    if (req->tv_nsec < 0 || req->tv_nsec >= NANOSEC_PER_SEC)
+	return EINVAL;
+    if (!is_virtual(clk))
+	return syscall(SYS_clock_nanosleep, clk, flags, req, rem) < 0 ? errno : 0;
+    if ((flags & TIMER_ABSTIME))
+    {
+	struct timespec now;
+	if (mock_clock_gettime(clk, &now) < 0)
+	    return errno;
+	int64_t ns = (req->tv_sec - now.tv_sec) * NANOSEC_PER_SEC +
+		     (req->tv_nsec - now.tv_nsec);
+	if (ns > 0)
+	    clock_offset += ns;
+	return 0;
+    }
+    if (req->tv_sec >= 0)
+	advance_timespec(req);
+    if (rem)
+	rem->tv_sec = rem->tv_nsec = 0;
+    return 0;
+}
+
+static int
+mock_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    static const struct timespec zero = { 0, 0 };
+    int r = syscall(SYS_ppoll, fds, nfds, &zero, 0, 0);
+    if (r || !timeout)
+	return r;
+    if (timeout < 0)
+    {
+	/* there's no time to skip to, so wait for real */
+	return syscall(SYS_ppoll, fds, nfds, 0, 0, 0);
+    }
+    clock_offset += (int64_t)timeout * (NANOSEC_PER_SEC/1000);
+    return 0;
+}
+
+void init_time_intercepts(testnode_t *tn)
+{
+    tn->add_mock((np::spiegel::addr_t)&clock_gettime,
+		 "clock_gettime",
+		 (np::spiegel::addr_t)&mock_clock_gettime);
+    tn->add_mock((np::spiegel::addr_t)&sleep,
+		 "sleep",
+		 (np::spiegel::addr_t)&mock_sleep);
+    tn->add_mock((np::spiegel::addr_t)&usleep,
+		 "usleep",
+		 (np::spiegel::addr_t)&mock_usleep);
+    tn->add_mock((np::spiegel::addr_t)&nanosleep,
+		 "nanosleep",
+		 (np::spiegel::addr_t)&mock_nanosleep);
+    tn->add_mock((np::spiegel::addr_t)&clock_nanosleep,
+		 "clock_nanosleep",
+		 (np::spiegel::addr_t)&mock_clock_nanosleep);
+    tn->add_mock((np::spiegel::addr_t)&poll,
+		 "poll",
+		 (np::spiegel::addr_t)&mock_poll);
+}
+
+// close the namespace
+};
@@ -24,7 +24,7 @@
 static void
 usage(const char *argv0)
 {
-    fprintf(stderr, "Usage: %s [-f output-format] [test-spec...]\n", argv0);
+    fprintf(stderr, "Usage: %s [-f output-format] [--fail-fast[=N]] [--shard=K/N [--shard-by=hash|duration:FILE]] [test-spec...]\n", argv0);
     exit(1);
 }
 
@@ -37,12 +37,19 @@ main(int argc, char **argv)
     const char *output_formats = 0;
     enum { UNKNOWN, RUN, LIST } mode = UNKNOWN;
     int concurrency = -1;
-    int c;
+    int concurrency_max = -1;
+    unsigned int fail_fast = 0;
+    unsigned int shard = 0, nshards = 0;
+    const char *shard_history = 0;
+    int c, n;
     static const struct option opts[] =
     {
 	{ "format", required_argument, NULL, 'f' },
 	{ "jobs", required_argument, NULL, 'j' },
 	{ "list", no_argument, NULL, 'l' },
+	{ "shard", required_argument, NULL, 'S' },
+	{ "fail-fast", optional_argument, NULL, 'F' },
+	{ "shard-by", required_argument, NULL, 'B' },
 	{ NULL, 0, NULL, 0 },
     };
 
@@ -55,14 +62,46 @@ main(int argc, char **argv)
 	    output_formats = optarg;
 	    break;
 	case 'j':
+	    n = 0;
 	    if (!strcasecmp(optarg, "max"))
 		concurrency = 0;
-	    else if ((concurrency = atoi(optarg)) <= 0)
+	    else if (!strcasecmp(optarg, "auto"))
+		concurrency = 1, concurrency_max = 0;
+	    else if (sscanf(optarg, "%d:%d%n", &concurrency, &concurrency_max, &n) == 2)
+	    {
+		if (optarg[n] || concurrency <= 0 || concurrency_max < concurrency)
+		    usage(argv[0]);
+	    }
+	    else if (sscanf(optarg, "%d%n", &concurrency, &n) != 1 ||
+		     optarg[n] || concurrency <= 0)
 		usage(argv[0]);
 	    break;
 	case 'l':
 	    mode = LIST;
 	    break;
+	case 'S':
+	    n = 0;
+	    if (sscanf(optarg, "%u/%u%n", &shard, &nshards, &n) != 2 ||
+		optarg[n] || !shard || shard > nshards)
+		usage(argv[0]);
+	    break;
+	case 'F':
+	    n = 0;
+	    fail_fast = 1;
+	    if (optarg &&
+		(sscanf(optarg, "%u%n", &fail_fast, &n) != 1 || optarg[n]))
+		usage(argv[0]);
+	    if ((int)fail_fast <= 0)
+		usage(argv[0]);
+	    break;
+	case 'B':
+	    if (!strncmp(optarg, "duration:", 9) && optarg[9])
+		shard_history = optarg+9;
+	    else if (!strcmp(optarg, "hash"))
+		shard_history = 0;
+	    else
+		usage(argv[0]);
+	    break;
 	default:
 	    usage(argv[0]);
 	}
@@ -73,6 +112,18 @@ main(int argc, char **argv)
 	plan = np_plan_new();
 	np_plan_add_specs(plan, argc-optind, (const char **)argv+optind);
     }
+    if (nshards)
+    {
+	/* Run only some of the specified (or all the discovered) tests */
+	if (!plan)
+	    plan = np_plan_new();
+	np_plan_set_shard(plan, shard, nshards);
+	if (!np_plan_set_shard_history(plan, shard_history))
+	{
+	    fprintf(stderr, "np: cannot read history file %s\n", shard_history);
+	    exit(1);
+	}
+    }
 
     /* Initialise the NovaProva library */
     runner = np_init();
@@ -101,9 +152,15 @@ main(int argc, char **argv)
 	}
 
 	/* Set how many tests will be run in parallel */
-	if (concurrency >= 0)
+	if (concurrency_max >= 0)
+	    np_set_concurrency_range(runner, concurrency, concurrency_max);
+	else if (concurrency >= 0)
 	    np_set_concurrency(runner, concurrency);
 
+	/* Stop early if enough tests fail */
+	if (fail_fast)
+	    np_set_fail_fast(runner, fail_fast);
+
 	/* Run the specified tests */
 	ec = np_run_tests(runner, plan);
 	break;
@@ -24,22 +24,58 @@ using namespace std;
 
 /*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
 
-static void
-be_valground(void)
-{
 #if HAVE_VALGRIND
-    const char *env;
+/*
+ * Re-execute the current process under Valgrind, with the same
+ * arguments.  Does not return.
+ */
+void
+__np_exec_valgrind(void)
+{
     int argc;
     char **argv;
     const char **newargv;
     const char **p;
 
+    if (!np::spiegel::platform::get_argv(&argc, &argv))
+    {
+	fprintf(stderr, "np: cannot get arguments to re-run under valgrind\n");
+	exit(1);
+    }
+
+    p = newargv = (const char **)np::util::xmalloc(sizeof(char *) * (argc+6));
+    *p++ = VALGRIND_BINARY;
+    *p++ = "-q";
+    *p++ = "--tool=memcheck";
+#ifdef _NP_VALGRIND_SUPPRESSION_FILE
+    *p++ = "--gen-suppressions=all";
+    *p++ = "--suppressions=" _NP_VALGRIND_SUPPRESSION_FILE;
+#endif
+    while (*argv)
+	*p++ = *argv++;
+    *p = NULL;
+
+    execv(newargv[0], (char * const *)newargv);
+    perror(newargv[0]);
+    exit(1);
+}
+#endif
+
+static void
+be_valground(void)
+{
+#if HAVE_VALGRIND
+    const char *env;
+
     if (RUNNING_ON_VALGRIND)
 	return;
 
     env = getenv("NOVAPROVA_VALGRIND");
     if (env && !strcmp(env, "no"))
 	return;
+    /* run natively, the runner will re-run failed tests under Valgrind */
+    if (env && !strcmp(env, "failed"))
+	return;
 
     if (np::spiegel::platform::is_running_under_debugger())
     {
@@ -47,26 +83,14 @@ be_valground(void)
 	return;
     }
 
+    int argc;
+    char **argv;
     if (!np::spiegel::platform::get_argv(&argc, &argv))
 	return;
 
     fprintf(stderr, "[%s] np: starting valgrind\n",
 	    np::util::rel_timestamp());
-
-    p = newargv = (const char **)np::util::xmalloc(sizeof(char *) * (argc+6));
-    *p++ = VALGRIND_BINARY;
-    *p++ = "-q";
-    *p++ = "--tool=memcheck";
-#ifdef _NP_VALGRIND_SUPPRESSION_FILE
-    *p++ = "--gen-suppressions=all";
-    *p++ = "--suppressions=" _NP_VALGRIND_SUPPRESSION_FILE;
-#endif
-    while (*argv)
-	*p++ = *argv++;
-
-    execv(newargv[0], (char * const *)newargv);
-    perror(newargv[0]);
-    exit(1);
+    __np_exec_valgrind();
 #endif
 }
 
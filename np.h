@@ -40,6 +40,17 @@ typedef struct np_plan np_plan_t;
 extern np_runner_t *np_init(void);
 extern void np_list_tests(np_runner_t *, np_plan_t *);
 extern void np_set_concurrency(np_runner_t *, int);
+extern void np_set_concurrency_range(np_runner_t *, int min, int max);
+extern void np_set_fail_fast(np_runner_t *, unsigned int);
+/** Kinds of resource limit applied to each test, see @c np_set_limit() */
+enum np_limit
+{
+    NP_LIMIT_CPU,	/**< seconds of CPU time */
+    NP_LIMIT_MEM,	/**< KiB of memory the test may allocate */
+    NP_LIMIT_NOFILE,	/**< number of file descriptors */
+    NP_LIMIT_FSIZE	/**< KiB written to any one file */
+};
+extern void np_set_limit(np_runner_t *, enum np_limit, unsigned long);
 extern bool np_set_output_format(np_runner_t *, const char *);
 extern int np_run_tests(np_runner_t *, np_plan_t *);
 extern int np_get_timeout(void);   /* in seconds, or zero */
@@ -47,6 +58,8 @@ extern void np_done(np_runner_t *);
 
 extern np_plan_t *np_plan_new(void);
 extern bool np_plan_add_specs(np_plan_t *, int nspec, const char **spec);
+extern bool np_plan_set_shard(np_plan_t *, unsigned int k, unsigned int n);
+extern bool np_plan_set_shard_history(np_plan_t *, const char *path);
 extern void np_plan_delete(np_plan_t *);
 
 extern const char *np_rel_timestamp(void);
@@ -269,6 +282,144 @@ struct __np_param_dec
 	return &d; \
     }
 
+/**
+ * @}
+ * \defgroup limits Resource Limits
+ * @{
+ */
+
+struct __np_limit_dec
+{
+    unsigned long value;
+};
+/**
+ * Statically override a resource limit for tests.
+ *
+ * @param res	    which limit: @c cpu, @c mem, @c nofile or @c fsize
+ * @param val	    the limit, or 0 for no limit
+ *
+ * Declares that every test in the source file in which it appears runs
+ * with the given limit on resource @a res, instead of the default set
+ * with @c np_set_limit() or the environment.  The units are as for
+ * @c np_set_limit().  For example:
+ * @code
+ * NP_LIMIT(cpu, 60);
+ * @endcode
+ * lets the tests in the current file use a minute of CPU time each.
+ */
+#define NP_LIMIT(res, val) \
+    static const struct __np_limit_dec *__np_limit_##res(void) __attribute__((unused)); \
+    static const struct __np_limit_dec *__np_limit_##res(void) \
+    { \
+	static const struct __np_limit_dec d = { val }; \
+	return &d; \
+    }
+
+/**
+ * @}
+ * \defgroup threaded Running Tests In Threads
+ * @{
+ */
+
+/**
+ * Run tests in threads instead of separate processes.
+ *
+ * Declares that the tests in the source file in which it appears are
+ * safe to run in a thread, alongside other such tests in the same
+ * process, instead of each in a process of its own.  This is much
+ * cheaper for tests of pure functions which do nothing but compute
+ * and check a result.  Tests which have mocks, parameters or
+ * resource limits still run in their own process.  For example:
+ * @code
+ * NP_THREADED;
+ * @endcode
+ */
+#define NP_THREADED \
+    static void __np_threaded(void) __attribute__((used)); \
+    static void __np_threaded(void) \
+    { \
+    }
+
+/**
+ * @}
+ * \defgroup virtual_time Virtual Time
+ * @{
+ */
+
+/**
+ * Run tests against a virtual clock.
+ *
+ * Declares that the tests in the source file in which it appears run
+ * with a virtual clock.  The clock starts at the real time, and runs
+ * at the real rate, but @c sleep, @c usleep, @c nanosleep and
+ * @c clock_nanosleep return immediately and move the clock forward
+ * by the time slept instead.  A @c poll with nothing ready does the
+ * same with its timeout.  The time read with @c clock_gettime is
+ * advanced to match, so code under test which waits for timeouts,
+ * retries and backoff delays runs without waiting.  For example:
+ * @code
+ * NP_VIRTUAL_CLOCK;
+ * @endcode
+ */
+#define NP_VIRTUAL_CLOCK \
+    static void __np_virtual_clock(void) __attribute__((used)); \
+    static void __np_virtual_clock(void) \
+    { \
+    }
+
+/** Move the virtual clock forward.
+ *
+ * @param ns	    how many nanoseconds to advance by
+ *
+ * Advances the virtual clock, as if the test had slept for @a ns
+ * nanoseconds.  Has no effect on tests not declared with
+ * @c NP_VIRTUAL_CLOCK.
+ */
+extern void np_clock_advance(unsigned long long ns);
+
+/**
+ * @}
+ * \defgroup memfs In-Memory Files
+ * @{
+ */
+
+/** Keep files under a directory in memory for the rest of the test.
+ *
+ * @param prefix    absolute path of the directory
+ *
+ * From this point until the end of the test, files whose paths start
+ * with @a prefix are kept in memory instead of on disk.  The Code
+ * Under Test opens, renames and unlinks them with the usual system
+ * calls, and reads, writes and syncs them through the descriptors it
+ * gets back, without any disk I/O.  The files are thrown away at the
+ * end of the test.  Files are looked up by the exact path given, so
+ * paths must be absolute and not contain "." or ".." components, and
+ * directories need not be created first.  Only one prefix can be
+ * mounted in each test.
+ */
+extern void np_memfs_mount(const char *prefix);
+/** Create or replace an in-memory file.
+ *
+ * @param path	    absolute path under the mounted prefix
+ * @param data	    the file's new contents
+ * @param len	    length of @a data in bytes
+ *
+ * Sets the contents of the in-memory file @a path, for example to set
+ * up the files the Code Under Test expects to find.
+ */
+extern void np_memfs_put(const char *path, const void *data, size_t len);
+/** Read back an in-memory file.
+ *
+ * @param path	    absolute path under the mounted prefix
+ * @param buf	    buffer to copy the contents into
+ * @param maxlen    size of @a buf in bytes
+ * @return	    the length of the file, or -1 if there is no such file
+ *
+ * Copies up to @a maxlen bytes of the in-memory file @a path into
+ * @a buf, for example to check what the Code Under Test wrote.
+ */
+extern long np_memfs_get(const char *path, void *buf, size_t maxlen);
+
 /**
  * @}
  * \defgroup mocking Dynamic Mocking
@@ -336,6 +487,19 @@ extern void __np_mock_by_name(const char *fname, np_funcptr_t to);
  * might not even be necessary in your tests.
  */
 extern void np_unmock_by_name(const char *fname);
+
+/**
+ * Find a function by name.
+ *
+ * @param fname the name of the function, or its fully qualified C++ name
+ * @return the address of the function, or NULL if there's no such function
+ *
+ * Looks up a function in the index NovaProva builds of all the
+ * functions described in the debug information, which is the same
+ * index used by @c np_mock_by_name().  The lookup is cheap enough to
+ * do from every test.
+ */
+extern np_funcptr_t np_function_by_name(const char *fname);
 /**@}*/
 
 /**
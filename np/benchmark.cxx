@@ -0,0 +1,229 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np/benchmark.hxx"
+#include "np/discovery_cache.hxx"
+#include <sys/stat.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+namespace np {
+using namespace std;
+using namespace np::util;
+
+#define WARMUP_NS	(50 * NANOSEC_PER_SEC / 1000)
+#define SAMPLE_NS	(10 * NANOSEC_PER_SEC / 1000)
+#define DEFAULT_SAMPLES	30
+
+static double
+median(vector<double> &v)
+{
+    sort(v.begin(), v.end());
+    size_t n = v.size();
+    return (n & 1 ? v[n/2] : (v[n/2-1] + v[n/2]) / 2);
+}
+
+/*
+ * Measure how long @fn takes.  It's called repeatedly for a while
+ * first, to warm up caches and branch predictors and to estimate
+ * how many calls fill a sample of about 10 ms, which is long enough
+ * that the cost of reading the clock doesn't matter.  Then that many
+ * calls are timed $NOVAPROVA_BENCH_SAMPLES times.  The median and MAD
+ * are used because a sample is only ever slowed down by whatever
+ * else the machine is doing, never sped up.
+ */
+void
+benchmark_t::measure(void (*fn)(void))
+{
+    uint64_t calls = 0;
+    int64_t start = rel_now();
+    int64_t elapsed;
+    do
+    {
+	fn();
+	calls++;
+	elapsed = rel_now() - start;
+    } while (elapsed < WARMUP_NS);
+
+    iterations_ = (uint64_t)((double)SAMPLE_NS * calls / elapsed);
+    if (iterations_ < 1)
+	iterations_ = 1;
+
+    nsamples_ = DEFAULT_SAMPLES;
+    const char *env = getenv("NOVAPROVA_BENCH_SAMPLES");
+    if (env && *env && atoi(env) > 0)
+	nsamples_ = atoi(env);
+
+    vector<double> samples;
+    samples.reserve(nsamples_);
+    for (uint32_t s = 0 ; s < nsamples_ ; s++)
+    {
+	start = rel_now();
+	for (uint64_t i = 0 ; i < iterations_ ; i++)
+	    fn();
+	samples.push_back((double)(rel_now() - start) / iterations_);
+    }
+
+    median_ = median(samples);
+    min_ = samples[0];
+    vector<double> deviations;
+    deviations.reserve(nsamples_);
+    for (uint32_t s = 0 ; s < nsamples_ ; s++)
+	deviations.push_back(fabs(samples[s] - median_));
+    mad_ = median(deviations);
+}
+
+string
+benchmark_t::as_string() const
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+	     "median %.3f ns MAD %.3f ns min %.3f ns, %.0f calls/s "
+	     "(%u samples of %llu calls)",
+	     median_, mad_, min_, get_throughput(),
+	     nsamples_, (unsigned long long)iterations_);
+    return string(buf);
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+baseline_t::baseline_t()
+ :  threshold_(0.1),
+    update_(false),
+    dirty_(false)
+{
+}
+
+baseline_t::~baseline_t()
+{
+}
+
+/*
+ * Load the baseline from $NOVAPROVA_BENCH_BASELINE, or the cache
+ * directory.  A missing file just means there's nothing to compare
+ * against yet.  Each line is a median in nanoseconds and a name.
+ */
+void
+baseline_t::load()
+{
+    medians_.clear();
+    dirty_ = false;
+
+    const char *env = getenv("NOVAPROVA_BENCH_BASELINE");
+    path_ = (env && *env ? string(env) : cache_filename(".bench"));
+    env = getenv("NOVAPROVA_BENCH_THRESHOLD");
+    if (env && *env)
+	threshold_ = atof(env) / 100.0;
+    env = getenv("NOVAPROVA_BENCH_UPDATE");
+    update_ = (env && !strcmp(env, "yes"));
+
+    if (path_.empty())
+	return;
+    FILE *fp = fopen(path_.c_str(), "r");
+    if (!fp)
+	return;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp))
+    {
+	char *p = line + strlen(line);
+	while (p > line && isspace(p[-1]))
+	    *--p = '\0';
+	double median = strtod(line, &p);
+	if (p == line || !isspace(*p))
+	    continue;	    /* comment or junk */
+	while (isspace(*p))
+	    p++;
+	if (*p)
+	    medians_[p] = median;
+    }
+    fclose(fp);
+}
+
+/*
+ * Save the baseline if anything was added to it.  Failure is
+ * harmless, the benchmarks just won't be compared next time.
+ */
+void
+baseline_t::save()
+{
+    if (path_.empty() || !dirty_)
+	return;
+
+    if (!getenv("NOVAPROVA_BENCH_BASELINE"))
+	mkdir(cache_directory().c_str(), 0700);
+    char tmppath[PATH_MAX];
+    snprintf(tmppath, sizeof(tmppath), "%s.%d", path_.c_str(), (int)getpid());
+    FILE *fp = fopen(tmppath, "w");
+    if (!fp)
+	return;
+
+    fprintf(fp, "# NovaProva benchmark baseline: median ns per call, name\n");
+    map<string, double>::const_iterator i;
+    for (i = medians_.begin() ; i != medians_.end() ; ++i)
+	fprintf(fp, "%.3f %s\n", i->second, i->first.c_str());
+
+    if (ferror(fp) | fclose(fp) ||
+	rename(tmppath, path_.c_str()) < 0)
+    {
+	unlink(tmppath);
+	return;
+    }
+    dirty_ = false;
+}
+
+bool
+baseline_t::get(const string &name, double *medianp) const
+{
+    map<string, double>::const_iterator i = medians_.find(name);
+    if (i == medians_.end())
+	return false;
+    *medianp = i->second;
+    return true;
+}
+
+/*
+ * Remember a benchmark's median, if it's new to the baseline or
+ * $NOVAPROVA_BENCH_UPDATE is "yes".  Otherwise the baseline stays
+ * put, so that a series of small slowdowns still adds up to a
+ * regression.
+ */
+void
+baseline_t::record(const string &name, double median)
+{
+    if (path_.empty())
+	return;
+    if (!update_ && medians_.find(name) != medians_.end())
+	return;
+    medians_[name] = median;
+    dirty_ = true;
+}
+
+/*
+ * Whether @a b is slower than the baseline median @a base by more
+ * than the threshold, and by enough more than the spread of its
+ * samples that it's unlikely to be noise.
+ */
+bool
+baseline_t::is_regression(const benchmark_t *b, double base) const
+{
+    if (base <= 0)
+	return false;
+    return (b->median_ / base - 1.0 > threshold_ &&
+	    b->median_ - 3 * b->mad_ > base);
+}
+
+// close the namespace
+};
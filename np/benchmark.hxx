@@ -0,0 +1,78 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __NP_BENCHMARK_H__
+#define __NP_BENCHMARK_H__ 1
+
+#include "np/util/common.hxx"
+#include <string>
+#include <map>
+
+namespace np {
+
+/*
+ * The timing of one benchmark function, measured in the child by
+ * calling it over and over.  All times are per call.  This is sent
+ * as is over the proxy pipe, so keep it plain old data.
+ */
+struct benchmark_t
+{
+    uint64_t iterations_;	/* calls in each sample */
+    uint32_t nsamples_;
+    uint32_t pad_;
+    double median_;		/* in nanoseconds */
+    double mad_;		/* median absolute deviation */
+    double min_;		/* fastest sample */
+
+    double get_throughput() const { return (median_ > 0 ? 1e9 / median_ : 0); }
+    std::string as_string() const;
+    void measure(void (*fn)(void));
+};
+
+/*
+ * The median time of each benchmark from an earlier run, to compare
+ * against, keyed by the job's name.  By default kept in the discovery
+ * cache directory as text.  Benchmarks are added the first time they
+ * run, and only updated when asked.
+ */
+class baseline_t
+{
+public:
+    baseline_t();
+    ~baseline_t();
+
+    void load();
+    void save();
+
+    bool get(const std::string &name, double *medianp) const;
+    void record(const std::string &name, double median);
+    bool is_regression(const benchmark_t *b, double base) const;
+    /* how much slower than the baseline is a regression, 0.1 = 10% */
+    double get_threshold() const { return threshold_; }
+    /* replacing the baseline rather than comparing against it */
+    bool is_updating() const { return update_; }
+
+private:
+    std::string path_;
+    std::map<std::string, double> medians_;
+    double threshold_;
+    bool update_;		/* replace existing entries */
+    bool dirty_;
+};
+
+// close the namespace
+};
+
+#endif /* __NP_BENCHMARK_H__ */
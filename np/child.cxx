@@ -17,23 +17,30 @@
 #include "np/testnode.hxx"
 #include "np/job.hxx"
 #include "np/event.hxx"
-#include "np/proxy_listener.hxx"
 #include "np_priv.h"
+#include <sys/syscall.h>
 
 namespace np {
 
 child_t::child_t(pid_t pid, int fd, job_t *j)
  :  pid_(pid),
+    host_(0),
     event_pipe_(fd),
+    decoder_(fd),
+    pidfd_(-1),
     job_(j),
     result_(R_UNKNOWN),
-    state_(RUNNING)
+    state_(RUNNING),
+    rerun_(false),
+    cancelled_(false)
 {
 }
 
 child_t::~child_t()
 {
     close(event_pipe_);
+    if (pidfd_ >= 0)
+	close(pidfd_);
     delete job_;
 }
 
@@ -46,7 +53,7 @@ child_t::handle_input()
 #endif
     if (state_ == FINISHED)
 	return;
-    if (!proxy_listener_t::handle_call(event_pipe_, job_, &result_))
+    if (!decoder_.handle_input(job_, &result_))
     {
 #if _NP_DEBUG
 	fprintf(stderr, "np: child now finished\n");
@@ -55,6 +62,54 @@ child_t::handle_input()
     }
 }
 
+/* most bytes drain_input() reads, in case a grandchild
+ * which inherited the pipe keeps writing to it */
+#define DRAIN_MAX   (1024*1024)
+
+/*
+ * Called after the child has exited, to decode any events still
+ * sitting in the pipe.  Never blocks.
+ */
+void
+child_t::drain_input()
+{
+    size_t limit = decoder_.get_bytes_read() + DRAIN_MAX;
+
+    while (state_ != FINISHED)
+    {
+	if (decoder_.get_bytes_read() >= limit)
+	{
+	    fprintf(stderr, "np: discarding further events from "
+			    "process %d\n", (int)pid_);
+	    break;
+	}
+	struct pollfd pfd;
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = event_pipe_;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+	    break;
+	handle_input();
+    }
+}
+
+/*
+ * Send @sig to the child.  A child which is a thread is sent it
+ * alone, and its host ends just that thread, see serve_threads();
+ * but SIGKILL can't be caught, so it takes down the whole host and
+ * the tests still running there are run again.
+ */
+void
+child_t::send_signal(int sig)
+{
+    if (!host_)
+	kill(pid_, sig);
+    else if (sig == SIGKILL)
+	kill(host_, sig);
+    else
+	syscall(SYS_tgkill, host_, pid_, sig);
+}
+
 void
 child_t::handle_timeout(int64_t end)
 {
@@ -68,13 +123,13 @@ child_t::handle_timeout(int64_t end)
 	    event_t ev(EV_TIMEOUT, buf);
 	    merge_result(np::runner_t::running()->raise_event(job_, &ev));
 
-	    kill(pid_, SIGTERM);
+	    send_signal(SIGTERM);
 	    state_ = TIMEOUT1;
 	    deadline_ = end + 3 * NANOSEC_PER_SEC;
 	}
 	break;
     case TIMEOUT1:
-	kill(pid_, SIGKILL);
+	send_signal(SIGKILL);
 	state_ = TIMEOUT2;
 	deadline_ = 0;
 	break;
@@ -83,6 +138,24 @@ child_t::handle_timeout(int64_t end)
     }
 }
 
+/*
+ * Kill the child because the run is being cut short, escalating
+ * as for a timeout if it doesn't die promptly.  Returns true if
+ * the child has a new deadline.  A child which has already timed
+ * out or finished is left to be reported as such.
+ */
+bool
+child_t::cancel(int64_t now)
+{
+    if (state_ != RUNNING)
+	return false;
+    cancelled_ = true;
+    send_signal(SIGTERM);
+    state_ = TIMEOUT1;
+    deadline_ = now + 3 * NANOSEC_PER_SEC;
+    return true;
+}
+
 void
 child_t::merge_result(result_t r)
 {
@@ -18,6 +18,7 @@
 
 #include "np/util/common.hxx"
 #include "np/types.hxx"
+#include "np/proxy_listener.hxx"
 #include <sys/poll.h>
 
 namespace np {
@@ -31,19 +32,33 @@ public:
     ~child_t();
 
     pid_t get_pid() const { return pid_; }
+    void set_host(pid_t h) { host_ = h; }
     job_t *get_job() const { return job_; }
+    job_t *release_job() { job_t *j = job_; job_ = 0; return j; }
+    bool is_rerun() const { return rerun_; }
+    void set_rerun() { rerun_ = true; }
     result_t get_result() const { return result_; }
 
     int get_input_fd() const { return (state_ == FINISHED ? -1 : event_pipe_); }
     void handle_input();
+    void drain_input();
+    int get_pidfd() const { return pidfd_; }
+    void set_pidfd(int fd) { pidfd_ = fd; }
     int64_t get_deadline() const { return deadline_; }
     void set_deadline(int64_t d) { deadline_ = d; }
     void handle_timeout(int64_t);
+    bool cancel(int64_t);
+    bool is_cancelled() const { return cancelled_; }
     void merge_result(result_t r);
 
 private:
+    void send_signal(int sig);
+
     pid_t pid_;
+    pid_t host_;	    /* thread host, if pid_ is one of its threads */
     int event_pipe_;	    /* read end of the pipe */
+    proxy_decoder_t decoder_;
+    int pidfd_;		    /* -1 if not available */
     job_t *job_;
     result_t result_;
     enum {
@@ -53,6 +68,8 @@ private:
 	FINISHED,
     } state_;
     int64_t deadline_;
+    bool rerun_;	    /* re-running a finished job under Valgrind */
+    bool cancelled_;	    /* killed because the run is being cut short */
 };
 
 // close the namespace
@@ -0,0 +1,357 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np/discovery_cache.hxx"
+#include "np/spiegel/platform/common.hxx"
+#include "np_priv.h"
+#include <sys/stat.h>
+
+namespace np {
+using namespace std;
+using namespace np::util;
+using np::spiegel::dwarf::reference_t;
+using np::spiegel::dwarf::state_t;
+
+/* bump this whenever the file format or the discovery rules change */
+#define CACHE_MAGIC	0x4e504443	/* "NPDC" */
+#define CACHE_VERSION	8
+
+/*
+ * The cache directory is $NOVAPROVA_CACHE if set, or the novaprova
+ * subdirectory of the XDG cache directory.  Setting NOVAPROVA_CACHE
+ * to "no" disables the cache.
+ */
+string
+cache_directory()
+{
+    const char *env = getenv("NOVAPROVA_CACHE");
+    if (env)
+	return (!strcmp(env, "no") ? string() : string(env));
+
+    string dir;
+    if ((env = getenv("XDG_CACHE_HOME")) && env[0])
+	dir = env;
+    else if ((env = getenv("HOME")) && env[0])
+	dir = string(env) + "/.cache";
+    else
+	return string();
+    mkdir(dir.c_str(), 0700);
+    return dir + "/novaprova";
+}
+
+/* FNV-1a, just to make a short filename */
+static uint64_t
+hash_string(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for ( ; *s ; s++)
+    {
+	h ^= (unsigned char)*s;
+	h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+ * Return the path of the file in the cache directory with the
+ * given suffix which belongs to this executable, or an empty
+ * string if caching is disabled.  The file is named for the
+ * executable's path, so that rebuilding the executable replaces
+ * its cache files rather than adding more.
+ */
+string
+cache_filename(const char *suffix)
+{
+    string dir = cache_directory();
+    if (dir.empty())
+	return dir;
+    char *exe = np::spiegel::platform::self_exe();
+    if (!exe)
+	return string();
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/%016llx",
+	     (unsigned long long)hash_string(exe));
+    free(exe);
+    return dir + buf + suffix;
+}
+
+/*
+ * The cache file is normally found in the cache directory, but can
+ * be given as @path, which is then only read.
+ */
+discovery_cache_t::discovery_cache_t(state_t *state, const char *path)
+ :  state_(state),
+    readonly_(false)
+{
+    if (path)
+    {
+	key_ = state_->get_identity();
+	path_ = path;
+	readonly_ = true;
+	return;
+    }
+    dir_ = cache_directory();
+    if (dir_.empty())
+	return;
+    key_ = state_->get_identity();
+    path_ = cache_filename(".dcache");
+}
+
+discovery_cache_t::~discovery_cache_t()
+{
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+static void
+write_u32(FILE *fp, uint32_t x)
+{
+    fwrite(&x, sizeof(x), 1, fp);
+}
+
+static void
+write_u64(FILE *fp, uint64_t x)
+{
+    fwrite(&x, sizeof(x), 1, fp);
+}
+
+static void
+write_string(FILE *fp, const string &s)
+{
+    write_u32(fp, s.length());
+    fwrite(s.data(), 1, s.length(), fp);
+}
+
+static void
+write_reference(FILE *fp, reference_t ref)
+{
+    write_u32(fp, ref.cu);
+    write_u32(fp, ref.offset);
+}
+
+static bool
+read_u32(FILE *fp, uint32_t *xp)
+{
+    return (fread(xp, sizeof(*xp), 1, fp) == 1);
+}
+
+static bool
+read_u64(FILE *fp, uint64_t *xp)
+{
+    return (fread(xp, sizeof(*xp), 1, fp) == 1);
+}
+
+static bool
+read_string(FILE *fp, string &s)
+{
+    uint32_t len;
+    if (!read_u32(fp, &len) || len > 1024*1024)
+	return false;
+    s.resize(len);
+    return (!len || fread(&s[0], 1, len, fp) == len);
+}
+
+static bool
+read_reference(FILE *fp, reference_t &ref)
+{
+    return (read_u32(fp, &ref.cu) && read_u32(fp, &ref.offset));
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+/*
+ * Load discovery results, the address index and the function
+ * name index from the cache.
+ * Returns false on a cache miss, or if the cache file is unusable
+ * for any reason, in which case the caller should discover the hard
+ * way and save() the results.
+ */
+bool
+discovery_cache_t::load(vector<discovery_t> &discs, function_index_t &functions)
+{
+    if (path_.empty())
+	return false;
+
+    FILE *fp = fopen(path_.c_str(), "r");
+    if (!fp)
+	return false;
+
+    bool r = false;
+    uint32_t magic, version, n;
+    string key;
+    uint32_t ncus = state_->get_compile_units().size();
+    vector<discovery_t> dd;
+    vector<state_t::address_range_t> ranges;
+    function_index_t ff;
+
+    if (!read_u32(fp, &magic) || magic != CACHE_MAGIC ||
+	!read_u32(fp, &version) || version != CACHE_VERSION ||
+	!read_string(fp, key) || key != key_)
+	goto out;
+
+    if (!read_u32(fp, &n))
+	goto out;
+    dd.resize(n);
+    for (uint32_t i = 0 ; i < n ; i++)
+    {
+	discovery_t &d = dd[i];
+	uint32_t type;
+	if (!read_u32(fp, &type) || type >= FT_NUM ||
+	    !read_string(fp, d.path_) ||
+	    !read_reference(fp, d.function_) || d.function_.cu >= ncus ||
+	    !read_reference(fp, d.target_) ||
+	    !read_string(fp, d.name_))
+	    goto out;
+	d.type_ = (functype_t)type;
+	if (d.type_ == FT_MOCK && d.target_.cu >= ncus)
+	    goto out;
+    }
+
+    if (!read_u32(fp, &n))
+	goto out;
+    ranges.resize(n);
+    for (uint32_t i = 0 ; i < n ; i++)
+    {
+	uint64_t lo, hi;
+	if (!read_u64(fp, &lo) || !read_u64(fp, &hi) ||
+	    !read_reference(fp, ranges[i].ref) ||
+	    ranges[i].ref.cu >= ncus)
+	    goto out;
+	ranges[i].lo = lo;
+	ranges[i].hi = hi;
+    }
+
+    if (!read_u32(fp, &n))
+	goto out;
+    for (uint32_t i = 0 ; i < n ; i++)
+    {
+	string name;
+	reference_t ref;
+	if (!read_string(fp, name) ||
+	    !read_reference(fp, ref) || ref.cu >= ncus)
+	    goto out;
+	ff[name] = ref;
+    }
+
+    if (!read_u32(fp, &magic) || magic != CACHE_MAGIC)
+	goto out;
+
+    state_->set_address_index(ranges);
+    discs.swap(dd);
+    functions.swap(ff);
+    r = true;
+#if _NP_DEBUG
+    fprintf(stderr, "np: loaded %u discoveries from cache %s\n",
+	    (unsigned)discs.size(), path_.c_str());
+#endif
+out:
+    fclose(fp);
+    return r;
+}
+
+/*
+ * Save discovery results, the address index and the function
+ * name index to the cache.
+ * Failure is harmless, we'll just have to discover again next time.
+ */
+void
+discovery_cache_t::save(const vector<discovery_t> &discs,
+			const function_index_t &functions)
+{
+    if (path_.empty() || readonly_)
+	return;
+
+    mkdir(dir_.c_str(), 0700);
+    /* write to a temporary file and rename into place, so that
+     * concurrent runs never see a partly written cache file */
+    char tmppath[PATH_MAX];
+    snprintf(tmppath, sizeof(tmppath), "%s.%d", path_.c_str(), (int)getpid());
+    FILE *fp = fopen(tmppath, "w");
+    if (!fp)
+	return;
+
+    write(fp, discs, functions);
+
+    if (ferror(fp) | fclose(fp) ||
+	rename(tmppath, path_.c_str()) < 0)
+    {
+	unlink(tmppath);
+	return;
+    }
+#if _NP_DEBUG
+    fprintf(stderr, "np: saved %u discoveries to cache %s\n",
+	    (unsigned)discs.size(), path_.c_str());
+#endif
+}
+
+/*
+ * Save discovery results to the already open file @fd, whatever
+ * the cache directory is.  Returns false on failure.
+ */
+bool
+discovery_cache_t::save(int fd, const vector<discovery_t> &discs,
+			const function_index_t &functions)
+{
+    if (key_.empty())
+	key_ = state_->get_identity();
+    FILE *fp = fdopen(dup(fd), "w");
+    if (!fp)
+	return false;
+    write(fp, discs, functions);
+    return !(ferror(fp) | fclose(fp));
+}
+
+void
+discovery_cache_t::write(FILE *fp, const vector<discovery_t> &discs,
+			 const function_index_t &functions)
+{
+    write_u32(fp, CACHE_MAGIC);
+    write_u32(fp, CACHE_VERSION);
+    write_string(fp, key_);
+
+    write_u32(fp, discs.size());
+    vector<discovery_t>::const_iterator i;
+    for (i = discs.begin() ; i != discs.end() ; ++i)
+    {
+	write_u32(fp, i->type_);
+	write_string(fp, i->path_);
+	write_reference(fp, i->function_);
+	write_reference(fp, i->target_);
+	write_string(fp, i->name_);
+    }
+
+    vector<state_t::address_range_t> ranges = state_->get_address_index();
+    write_u32(fp, ranges.size());
+    vector<state_t::address_range_t>::const_iterator j;
+    for (j = ranges.begin() ; j != ranges.end() ; ++j)
+    {
+	write_u64(fp, j->lo);
+	write_u64(fp, j->hi);
+	write_reference(fp, j->ref);
+    }
+
+    write_u32(fp, functions.size());
+    function_index_t::const_iterator k;
+    for (k = functions.begin() ; k != functions.end() ; ++k)
+    {
+	write_string(fp, k->first);
+	write_reference(fp, k->second);
+    }
+
+    write_u32(fp, CACHE_MAGIC);
+}
+
+// close the namespace
+};
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __NP_DISCOVERY_CACHE_H__
+#define __NP_DISCOVERY_CACHE_H__ 1
+
+#include "np/util/common.hxx"
+#include "np/types.hxx"
+#include "np/spiegel/dwarf/reference.hxx"
+#include "np/spiegel/dwarf/state.hxx"
+#include "np/testmanager.hxx"
+#include <string>
+#include <vector>
+
+namespace np {
+
+extern std::string cache_directory();
+extern std::string cache_filename(const char *suffix);
+
+/*
+ * Persistent cache of discovery results, so that a test executable
+ * which hasn't changed since the last run can skip walking all the
+ * DWARF info at startup.  The index of function names is saved
+ * too, for looking up mock targets.  The cache is keyed by the build-id, mtime
+ * and size of every object we read DWARF info from.
+ */
+class discovery_cache_t
+{
+public:
+    discovery_cache_t(spiegel::dwarf::state_t *, const char *path = 0);
+    ~discovery_cache_t();
+
+    bool load(std::vector<discovery_t> &, function_index_t &);
+    void save(const std::vector<discovery_t> &, const function_index_t &);
+    bool save(int fd, const std::vector<discovery_t> &, const function_index_t &);
+
+private:
+    void write(FILE *, const std::vector<discovery_t> &, const function_index_t &);
+
+    spiegel::dwarf::state_t *state_;
+    std::string key_;
+    std::string dir_;		/* empty if caching is disabled */
+    std::string path_;
+    bool readonly_;		/* path_ was given, don't replace it */
+};
+
+// close the namespace
+};
+
+#endif /* __NP_DISCOVERY_CACHE_H__ */
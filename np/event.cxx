@@ -135,6 +135,11 @@ event_t::get_result() const
     case EV_TIMEOUT:
     case EV_FDLEAK:
     case EV_EXCEPTION:
+    case EV_SANITIZER:
+    case EV_MEMLEAK:
+    case EV_RESOURCE:
+    case EV_RLIMIT:
+    case EV_BENCHMARK:
 	return R_FAIL;
     case EV_EXPASS:
 	return R_PASS;
@@ -158,7 +163,8 @@ event_t::which_as_string() const
 	"NONE", "ASSERT", "EXIT", "SIGNAL",
 	"SYSLOG", "FIXTURE", "EXPASS", "EXFAIL",
 	"EXNA", "VALGRIND", "SLMATCH", "TIMEOUT",
-	"FDLEAK", "EXCEPTION"
+	"FDLEAK", "EXCEPTION", "SANITIZER", "MEMLEAK",
+	"RESOURCE", "RLIMIT", "BENCHMARK"
     };
     const char *wstr = ((unsigned)which < arraysize(whichstrs))
 			? whichstrs[(unsigned)which] : "unknown";
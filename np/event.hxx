@@ -38,6 +38,11 @@ enum events_t
     EV_TIMEOUT,		/* child took too long */
     EV_FDLEAK,		/* file descriptor leak */
     EV_EXCEPTION,	/* C++ exception thrown */
+    EV_SANITIZER,	/* AddressSanitizer spotted a memleak or error */
+    EV_MEMLEAK,		/* our own leak tracker spotted a memleak */
+    EV_RESOURCE,	/* test used more CPU or memory than allowed */
+    EV_RLIMIT,		/* test ran into one of its resource limits */
+    EV_BENCHMARK,	/* benchmark is slower than its baseline */
 };
 
 class event_t
@@ -93,7 +98,7 @@ public:
 	lineno = l;
 	return *this;
     }
-    event_t &at_line(std::string f, unsigned int l)
+    event_t &at_line(const std::string &f, unsigned int l)
     {
 	return at_line(f.c_str(), l);
     }
@@ -103,7 +108,7 @@ public:
 	filename = f;
 	return *this;
     }
-    event_t &in_file(std::string f)
+    event_t &in_file(const std::string &f)
     {
 	return in_file(f.c_str());
     }
@@ -114,7 +119,7 @@ public:
 	function = fn;
 	return *this;
     }
-    event_t &in_function(std::string fn)
+    event_t &in_function(const std::string &fn)
     {
 	return in_function(fn.c_str());
     }
@@ -0,0 +1,233 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np/governor.hxx"
+#include <fcntl.h>
+
+namespace np {
+using namespace std;
+using namespace np::util;
+
+#define SAMPLE_INTERVAL	    (NANOSEC_PER_SEC/2)
+
+governor_t::governor_t(unsigned int min, unsigned int max)
+ :  min_(min),
+    max_(max)
+{
+    ncpus_ = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus_ < 1)
+	ncpus_ = 1;
+    limit_ = ncpus_;
+    if (limit_ < min_)
+	limit_ = min_;
+    if (limit_ > max_)
+	limit_ = max_;
+
+    has_pressure_ = !access("/proc/pressure/cpu", R_OK);
+    take_sample(last_);
+    next_ = last_.when_ + SAMPLE_INTERVAL;
+}
+
+governor_t::~governor_t()
+{
+}
+
+static bool
+read_file(const char *path, char *buf, size_t len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+	return false;
+    ssize_t r = read(fd, buf, len-1);
+    close(fd);
+    if (r < 0)
+	return false;
+    buf[r] = '\0';
+    return true;
+}
+
+/*
+ * Returns the cumulative time in usec that some tasks were stalled
+ * on the resource, from the first line of a /proc/pressure file:
+ * "some avg10=0.00 avg60=0.00 avg300=0.00 total=12345"
+ */
+uint64_t
+governor_t::parse_pressure(const char *buf)
+{
+    if (strncmp(buf, "some ", 5))
+	return 0;
+    const char *end = strchr(buf, '\n');
+    const char *p = strstr(buf, " total=");
+    return (p && (!end || p < end) ? strtoull(p+7, 0, 10) : 0);
+}
+
+static uint64_t
+read_pressure(const char *path)
+{
+    char buf[256];
+    if (!read_file(path, buf, sizeof(buf)))
+	return 0;
+    return governor_t::parse_pressure(buf);
+}
+
+/*
+ * Returns the value in kB of the named field, e.g. "MemAvailable",
+ * from the contents of /proc/meminfo, or 0 if it's missing.
+ */
+uint64_t
+governor_t::parse_meminfo(const char *buf, const char *name)
+{
+    size_t len = strlen(name);
+    for (const char *p = buf ; p ; p = strchr(p, '\n'))
+    {
+	if (*p == '\n')
+	    p++;
+	if (!strncmp(p, name, len) && p[len] == ':')
+	    return strtoull(p+len+1, 0, 10);
+    }
+    return 0;
+}
+
+/*
+ * Gets the CPU time in clock ticks used by a process, from the
+ * contents of its /proc/PID/stat file.  The command name may
+ * contain spaces and parentheses, so skip past its last ')';
+ * utime and stime are the 14th and 15th fields.
+ */
+bool
+governor_t::parse_stat(const char *buf, uint64_t *ticks)
+{
+    const char *p = strrchr(buf, ')');
+    if (!p || p[1] != ' ')
+	return false;
+    unsigned long utime, stime;
+    if (sscanf(p+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+	       &utime, &stime) != 2)
+	return false;
+    *ticks = utime + stime;
+    return true;
+}
+
+bool
+governor_t::take_sample(sample_t &s)
+{
+    s.when_ = rel_now();
+    if (has_pressure_)
+    {
+	s.cpu_stall_ = read_pressure("/proc/pressure/cpu");
+	s.memory_stall_ = read_pressure("/proc/pressure/memory");
+	s.io_stall_ = read_pressure("/proc/pressure/io");
+    }
+    char buf[4096];
+    if (!read_file("/proc/meminfo", buf, sizeof(buf)))
+	return false;
+    s.mem_total_ = parse_meminfo(buf, "MemTotal");
+    s.mem_available_ = parse_meminfo(buf, "MemAvailable");
+    return true;
+}
+
+/*
+ * Returns the CPU time in clock ticks used by the children since the
+ * last call, forgetting about those which have gone away.
+ */
+uint64_t
+governor_t::child_cpu(const vector<pid_t> &pids)
+{
+    map<pid_t, uint64_t> ticks;
+    uint64_t used = 0;
+
+    vector<pid_t>::const_iterator i;
+    for (i = pids.begin() ; i != pids.end() ; ++i)
+    {
+	char path[64];
+	char buf[1024];
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)*i);
+	uint64_t t;
+	if (!read_file(path, buf, sizeof(buf)) || !parse_stat(buf, &t))
+	    continue;
+	map<pid_t, uint64_t>::iterator old = child_ticks_.find(*i);
+	used += t - (old == child_ticks_.end() ? 0 : old->second);
+	ticks[*i] = t;
+    }
+    child_ticks_.swap(ticks);
+    return used;
+}
+
+/*
+ * Take a new sample if it's time, and adjust the limit.  Called
+ * with the pids of the running children.  Returns the limit.
+ */
+unsigned int
+governor_t::update(const vector<pid_t> &pids)
+{
+    int64_t now = rel_now();
+    if (now < next_)
+	return limit_;
+    next_ = now + SAMPLE_INTERVAL;
+
+    sample_t s;
+    if (!take_sample(s))
+	return limit_;
+    uint64_t ticks = child_cpu(pids);
+
+    /* fractions of the interval; stalls are in usec */
+    double wall = (double)(s.when_ - last_.when_) / NANOSEC_PER_SEC;
+    double cpu = (s.cpu_stall_ - last_.cpu_stall_) / 1e6 / wall;
+    double memory = (s.memory_stall_ - last_.memory_stall_) / 1e6 / wall;
+    double io = (s.io_stall_ - last_.io_stall_) / 1e6 / wall;
+    /* how busy each child kept a CPU */
+    double busy = (pids.size() ?
+		   ticks / (double)sysconf(_SC_CLK_TCK) / wall / pids.size() : 0.0);
+    /* how much of the machine the children used */
+    double load = busy * pids.size() / ncpus_;
+    last_ = s;
+
+    unsigned int limit = limit_;
+    if (memory > 0.10 || (s.mem_total_ && s.mem_available_ < s.mem_total_/20))
+    {
+	/* back off hard before the OOM killer gets involved */
+	limit = limit * 3 / 4;
+	if (limit == limit_)
+	    limit--;
+    }
+    else if (cpu > 0.50 || io > 0.50)
+    {
+	limit--;
+    }
+    else if (pids.size() >= limit_ && load < 0.90 &&
+	     (!has_pressure_ || (cpu < 0.10 && io < 0.20)))
+    {
+	/* all the slots are in use, but the children are leaving
+	 * CPUs idle and nothing is queueing */
+	limit++;
+    }
+    if (limit < min_)
+	limit = min_;
+    if (limit > max_)
+	limit = max_;
+
+#if _NP_DEBUG
+    fprintf(stderr, "np: [%s] governor: cpu %.2f memory %.2f io %.2f "
+		    "available %lluk busy %.2f load %.2f children %u limit %u -> %u\n",
+	    rel_timestamp(), cpu, memory, io,
+	    (unsigned long long)s.mem_available_, busy, load,
+	    (unsigned)pids.size(), limit_, limit);
+#endif
+    limit_ = limit;
+    return limit_;
+}
+
+// close the namespace
+};
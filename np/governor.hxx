@@ -0,0 +1,77 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __NP_GOVERNOR_H__
+#define __NP_GOVERNOR_H__ 1
+
+#include "np/util/common.hxx"
+#include <vector>
+#include <map>
+
+namespace np {
+
+/*
+ * Decides how many test jobs to run at once, between a lower and
+ * an upper bound, by watching how hard the system and the running
+ * children are working.  More jobs are started while the children
+ * leave the CPUs idle, e.g. because they sleep or wait on sockets,
+ * and fewer when the system reports that tasks are stalling for
+ * CPU, memory or I/O, or memory runs low.
+ */
+class governor_t : public np::util::zalloc
+{
+public:
+    governor_t(unsigned int min, unsigned int max);
+    ~governor_t();
+
+    unsigned int get_limit() const { return limit_; }
+    /* when update() will next take a sample */
+    int64_t get_next_sample() const { return next_; }
+    unsigned int update(const std::vector<pid_t> &pids);
+
+    /* parse the contents of /proc files */
+    static uint64_t parse_pressure(const char *buf);
+    static uint64_t parse_meminfo(const char *buf, const char *name);
+    static bool parse_stat(const char *buf, uint64_t *ticks);
+
+private:
+    struct sample_t
+    {
+	int64_t when_;
+	/* cumulative time some tasks stalled, in usec */
+	uint64_t cpu_stall_;
+	uint64_t memory_stall_;
+	uint64_t io_stall_;
+	uint64_t mem_total_;		/* kB */
+	uint64_t mem_available_;	/* kB */
+    };
+
+    bool take_sample(sample_t &);
+    uint64_t child_cpu(const std::vector<pid_t> &pids);
+
+    unsigned int min_;
+    unsigned int max_;
+    unsigned int ncpus_;
+    unsigned int limit_;
+    int64_t next_;
+    bool has_pressure_;		/* kernel reports PSI */
+    sample_t last_;
+    std::map<pid_t, uint64_t> child_ticks_;	/* utime+stime */
+};
+
+// close the namespace
+};
+
+#endif /* __NP_GOVERNOR_H__ */
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np/history.hxx"
+#include "np/discovery_cache.hxx"
+#include <sys/stat.h>
+
+namespace np {
+using namespace std;
+using namespace np::util;
+
+/* bump this whenever the file format changes */
+#define HISTORY_MAGIC	0x4e504448	/* "NPDH" */
+#define HISTORY_VERSION	2
+
+history_t::history_t()
+ :  default_(-1),
+    dirty_(false)
+{
+}
+
+history_t::~history_t()
+{
+}
+
+static bool
+read_u32(FILE *fp, uint32_t *xp)
+{
+    return (fread(xp, sizeof(*xp), 1, fp) == 1);
+}
+
+static bool
+read_u64(FILE *fp, uint64_t *xp)
+{
+    return (fread(xp, sizeof(*xp), 1, fp) == 1);
+}
+
+static void
+write_u32(FILE *fp, uint32_t x)
+{
+    fwrite(&x, sizeof(x), 1, fp);
+}
+
+static void
+write_u64(FILE *fp, uint64_t x)
+{
+    fwrite(&x, sizeof(x), 1, fp);
+}
+
+/*
+ * Load the durations and failures recorded by previous runs.
+ * A missing or unusable history file just means we know nothing
+ * yet.  Setting NOVAPROVA_HISTORY to "no" ignores the history
+ * file and doesn't update it, which makes the order of tests
+ * predictable.  A @a readonly history is used but never saved.
+ */
+void
+history_t::load(bool readonly)
+{
+    const char *env = getenv("NOVAPROVA_HISTORY");
+    string path = (env && !strcmp(env, "no") ? string() : cache_filename(".history"));
+    read(path);
+    path_ = (readonly ? string() : path);
+}
+
+/*
+ * Load a history file given explicitly, e.g. a copy frozen for
+ * all the shards of a run to share.  The file is never saved.
+ * Returns false if the file cannot be read.
+ */
+bool
+history_t::load(const char *path)
+{
+    path_.clear();
+    return read(path);
+}
+
+bool
+history_t::read(const string &path)
+{
+    bool ok = false;
+    entries_.clear();
+    dirty_ = false;
+
+    if (!path.empty())
+    {
+	FILE *fp = fopen(path.c_str(), "r");
+	if (fp)
+	{
+	    uint32_t magic, version, n;
+	    map<string, entry_t> ee;
+	    if (read_u32(fp, &magic) && magic == HISTORY_MAGIC &&
+		read_u32(fp, &version) && version == HISTORY_VERSION &&
+		read_u32(fp, &n))
+	    {
+		uint32_t i;
+		for (i = 0 ; i < n ; i++)
+		{
+		    uint32_t len, flags;
+		    uint64_t elapsed;
+		    if (!read_u32(fp, &len) || len > 64*1024)
+			break;
+		    string name(len, '\0');
+		    if ((len && fread(&name[0], 1, len, fp) != len) ||
+			!read_u64(fp, &elapsed) ||
+			!read_u32(fp, &flags))
+			break;
+		    ee[name].elapsed_ = elapsed;
+		    ee[name].failed_ = !!(flags & 1);
+		    ee[name].known_ = false;
+		}
+		if (i == n)
+		{
+		    entries_.swap(ee);
+		    ok = true;
+		}
+	    }
+	    fclose(fp);
+	}
+    }
+
+    /* Jobs we haven't seen before are expected to take
+     * $NOVAPROVA_DURATION_DEFAULT milliseconds, or as long as
+     * the average job we have seen. */
+    const char *env = getenv("NOVAPROVA_DURATION_DEFAULT");
+    if (env && *env)
+    {
+	default_ = (int64_t)strtoul(env, 0, 0) * NANOSEC_PER_SEC / 1000;
+    }
+    else
+    {
+	int64_t total = 0;
+	map<string, entry_t>::const_iterator i;
+	for (i = entries_.begin() ; i != entries_.end() ; ++i)
+	    total += i->second.elapsed_;
+	default_ = (entries_.size() ? total / (int64_t)entries_.size() : 0);
+    }
+#if _NP_DEBUG
+    fprintf(stderr, "np: loaded %u jobs from history %s\n",
+	    (unsigned)entries_.size(), path.c_str());
+#endif
+    return ok;
+}
+
+/*
+ * Save the history of the jobs which are still in the discovered
+ * test tree, whether or not they were in this run's plan, which
+ * drops those of tests which have since been removed or renamed.
+ * Failure is harmless, we just won't know as much next time.
+ */
+void
+history_t::save()
+{
+    if (path_.empty() || !dirty_)
+	return;
+
+    mkdir(cache_directory().c_str(), 0700);
+    /* write to a temporary file and rename into place, so that
+     * concurrent runs never see a partly written file */
+    char tmppath[PATH_MAX];
+    snprintf(tmppath, sizeof(tmppath), "%s.%d", path_.c_str(), (int)getpid());
+    FILE *fp = fopen(tmppath, "w");
+    if (!fp)
+	return;
+
+    uint32_t n = 0;
+    map<string, entry_t>::const_iterator i;
+    for (i = entries_.begin() ; i != entries_.end() ; ++i)
+	n += i->second.known_;
+
+    write_u32(fp, HISTORY_MAGIC);
+    write_u32(fp, HISTORY_VERSION);
+    write_u32(fp, n);
+    for (i = entries_.begin() ; i != entries_.end() ; ++i)
+    {
+	if (!i->second.known_)
+	    continue;
+	write_u32(fp, i->first.length());
+	fwrite(i->first.data(), 1, i->first.length(), fp);
+	write_u64(fp, i->second.elapsed_);
+	write_u32(fp, (i->second.failed_ ? 1 : 0));
+    }
+
+    if (ferror(fp) | fclose(fp) ||
+	rename(tmppath, path_.c_str()) < 0)
+    {
+	unlink(tmppath);
+	return;
+    }
+    dirty_ = false;
+}
+
+/* Returns how long the named job is expected to take, in nanoseconds */
+int64_t
+history_t::get_expected(const string &name) const
+{
+    map<string, entry_t>::const_iterator i = entries_.find(name);
+    return (i == entries_.end() ? default_ : i->second.elapsed_);
+}
+
+/* Returns true if the named job failed the last time it was run */
+bool
+history_t::get_failed(const string &name) const
+{
+    map<string, entry_t>::const_iterator i = entries_.find(name);
+    return (i != entries_.end() && i->second.failed_);
+}
+
+/* Notes that the named job still exists, whether it runs or not */
+void
+history_t::add_known(const string &name)
+{
+    map<string, entry_t>::iterator i = entries_.find(name);
+    if (i != entries_.end())
+	i->second.known_ = true;
+}
+
+void
+history_t::record(const string &name, int64_t elapsed, bool failed)
+{
+    if (path_.empty())
+	return;
+    map<string, entry_t>::iterator i = entries_.find(name);
+    if (i == entries_.end())
+    {
+	entries_[name].elapsed_ = elapsed;
+    }
+    else
+    {
+	/* smooth out the noise with a moving average */
+	i->second.elapsed_ = (i->second.elapsed_ + elapsed) / 2;
+    }
+    entries_[name].failed_ = failed;
+    entries_[name].known_ = true;
+    dirty_ = true;
+}
+
+// close the namespace
+};
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __NP_HISTORY_H__
+#define __NP_HISTORY_H__ 1
+
+#include "np/util/common.hxx"
+#include <string>
+#include <map>
+
+namespace np {
+
+/*
+ * Persistent record of how long each job took on previous runs,
+ * and whether it failed last time, keyed by the job's name, so
+ * that the runner can start the most interesting jobs first.
+ * Kept in the discovery cache directory.
+ */
+class history_t
+{
+public:
+    history_t();
+    ~history_t();
+
+    void load(bool readonly = false);
+    bool load(const char *path);
+    void save();
+
+    int64_t get_expected(const std::string &name) const;
+    bool get_failed(const std::string &name) const;
+    bool is_saved() const { return !path_.empty(); }
+    void add_known(const std::string &name);
+    void record(const std::string &name, int64_t elapsed, bool failed);
+
+private:
+    bool read(const std::string &path);
+
+    struct entry_t
+    {
+	int64_t elapsed_;	/* in nanoseconds */
+	bool failed_;
+	bool known_;		/* still in the discovered test tree */
+    };
+
+    std::string path_;		/* empty if the history is disabled */
+    std::map<std::string, entry_t> entries_;
+    int64_t default_;		/* for jobs with no history */
+    bool dirty_;
+};
+
+// close the namespace
+};
+
+#endif /* __NP_HISTORY_H__ */
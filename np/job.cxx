@@ -26,23 +26,55 @@ unsigned int job_t::next_id_ = 1;
 job_t::job_t(const plan_t::iterator &i)
  :  id_(next_id_++),
     node_(i.get_node()),
-    assigns_(i.get_assignments())
+    assigns_(i.get_assignments()),
+    stdout_fd_(-1),
+    stderr_fd_(-1),
+    base_rss_(0),
+    ticket_(0)
+{
+}
+
+job_t::job_t(testnode_t *tn, const vector<testnode_t::assignment_t> &assigns)
+ :  id_(next_id_++),
+    node_(tn),
+    assigns_(assigns),
+    stdout_fd_(-1),
+    stderr_fd_(-1),
+    base_rss_(0),
+    ticket_(0)
+{
+}
+
+/* copies everything except the output, which stays with @a o */
+job_t::job_t(const job_t &o)
+ :  id_(o.id_),
+    node_(o.node_),
+    assigns_(o.assigns_),
+    start_(o.start_),
+    end_(o.end_),
+    stdout_fd_(-1),
+    stderr_fd_(-1),
+    rusage_(o.rusage_),
+    has_rusage_(o.has_rusage_),
+    base_rss_(o.base_rss_),
+    ticket_(o.ticket_)
 {
 }
 
 job_t::~job_t()
 {
-    if (stdout_path_ != "")
-	unlink(stdout_path_.c_str());
-    if (stderr_path_ != "")
-	unlink(stderr_path_.c_str());
+    if (stdout_fd_ >= 0)
+	close(stdout_fd_);
+    if (stderr_fd_ >= 0)
+	close(stderr_fd_);
 }
 
-string job_t::as_string() const
+string job_t::as_string(const testnode_t *tn,
+			const vector<testnode_t::assignment_t> &assigns)
 {
-    string s = node_->get_fullname();
+    string s = tn->get_fullname();
     vector<testnode_t::assignment_t>::const_iterator i;
-    for (i = assigns_.begin() ; i != assigns_.end() ; ++i)
+    for (i = assigns.begin() ; i != assigns.end() ; ++i)
 	s += string("[") + i->as_string() + "]";
     return s;
 }
@@ -79,6 +111,16 @@ job_t::post_run(bool in_parent)
 	i->unapply();
 }
 
+/*
+ * Returns a copy of the job as it is now, without its output, for
+ * another thread to look at while this one carries on changing it.
+ */
+job_t *
+job_t::snapshot() const
+{
+    return new job_t(*this);
+}
+
 int64_t
 job_t::get_elapsed() const
 {
@@ -88,53 +130,138 @@ job_t::get_elapsed() const
     return end - start_;
 }
 
+static size_t
+get_output_limit(const char *var)
+{
+    const char *e = getenv(var);
+    if (e && *e)
+	return strtoul(e, 0, 0);
+    return 64*1024;
+}
+
+static size_t
+output_head()
+{
+    static size_t head = get_output_limit("NOVAPROVA_OUTPUT_HEAD");
+    return head;
+}
+
+static size_t
+output_tail()
+{
+    static size_t tail = get_output_limit("NOVAPROVA_OUTPUT_TAIL");
+    return tail;
+}
+
+static bool
+read_fully(int fd, char *b, size_t len, off_t off)
+{
+    while (len > 0)
+    {
+	ssize_t r = pread(fd, b, len, off);
+	if (r <= 0)
+	    return false;
+	len -= r;
+	b += r;
+	off += r;
+    }
+    return true;
+}
+
+/*
+ * Free the pages of a captured output file which get_output() will
+ * never read, i.e. those between the head and the tail.  The test may
+ * still be writing, so the file keeps its size and the hole reads
+ * back as zeroes, but it no longer uses memory.
+ */
+static void
+trim_file(int fd)
+{
+    static bool broken = false;
+    struct stat sb;
+
+    if (fd < 0 || broken || fstat(fd, &sb) < 0)
+	return;
+
+    size_t size = sb.st_size;
+    if (size <= output_head() + output_tail())
+	return;
+    size_t page = getpagesize();
+    off_t start = (output_head() + page - 1) & ~(page - 1);
+    off_t end = (size - output_tail()) & ~(page - 1);
+    if (end <= start)
+	return;
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+		  start, end - start) < 0)
+    {
+	/* e.g. the fallback file is on a filesystem without holes */
+	if (errno == EOPNOTSUPP || errno == ENOSYS)
+	    broken = true;
+	else
+	    perror("np: fallocate");
+    }
+}
+
+void
+job_t::trim_output() const
+{
+    trim_file(stdout_fd_);
+    trim_file(stderr_fd_);
+}
+
+/*
+ * Return what a test wrote to a captured output file.  To bound the
+ * memory used by a chatty test, at most the first HEAD and the last
+ * TAIL bytes are returned, with a marker where the middle was cut.
+ */
 static string
-get_file_contents(const string &path)
+get_output(int fd)
 {
+    size_t head = output_head();
+    size_t tail = output_tail();
     struct stat sb;
-    int r;
-    int fd;
-    int remain;
-    char *b;
     string buf;
 
-    fd = open(path.c_str(), O_RDONLY, 0);
     if (fd < 0)
-    {
-	perror(path.c_str());
 	return string("");
-    }
-
-    r = fstat(fd, &sb);
-    if (r < 0)
+    if (fstat(fd, &sb) < 0)
     {
-	perror(path.c_str());
+	perror("np: fstat");
 	return string("");
     }
-    buf.resize(sb.st_size);
 
-    remain = sb.st_size;
-    b = (char *)buf.c_str();
-    while (remain > 0 && (r = read(fd, b, remain)) > 0)
+    size_t size = sb.st_size;
+    if (size <= head + tail)
     {
-	remain -= r;
-	b += r;
+	buf.resize(size);
+	if (size && !read_fully(fd, &buf[0], size, 0))
+	    return string("");
+	return buf;
     }
 
-    close(fd);
+    char marker[64];
+    snprintf(marker, sizeof(marker), "\n[... %llu bytes omitted ...]\n",
+	     (unsigned long long)(size - head - tail));
+    size_t mlen = strlen(marker);
+    buf.resize(head + mlen + tail);
+    if (head && !read_fully(fd, &buf[0], head, 0))
+	return string("");
+    memcpy(&buf[head], marker, mlen);
+    if (tail && !read_fully(fd, &buf[head+mlen], tail, size-tail))
+	return string("");
     return buf;
 }
 
 string
 job_t::get_stdout() const
 {
-    return get_file_contents(stdout_path_);
+    return get_output(stdout_fd_);
 }
 
 string
 job_t::get_stderr() const
 {
-    return get_file_contents(stderr_path_);
+    return get_output(stderr_fd_);
 }
 
 // close the namespace
@@ -19,6 +19,7 @@
 #include "np/util/common.hxx"
 #include "np/testnode.hxx"
 #include "np/plan.hxx"
+#include <sys/resource.h>
 
 namespace np {
 
@@ -26,22 +27,44 @@ class job_t : public np::util::zalloc
 {
 public:
     job_t(const plan_t::iterator &);
+    job_t(testnode_t *, const std::vector<testnode_t::assignment_t> &);
     ~job_t();
 
-    std::string as_string() const;
+    std::string as_string() const { return as_string(node_, assigns_); }
+    static std::string as_string(const testnode_t *,
+				 const std::vector<testnode_t::assignment_t> &);
     testnode_t *get_node() const { return node_; }
+    const std::vector<testnode_t::assignment_t> &get_assignments() const { return assigns_; }
     void pre_run(bool in_parent);
     void post_run(bool in_parent);
 
     int64_t get_start() const { return start_; }
     int64_t get_elapsed() const;
+    job_t *snapshot() const;
 
-    void set_stdout_path(const char *path) { stdout_path_ = std::string(path); }
-    void set_stderr_path(const char *path) { stderr_path_ = std::string(path); }
+    void set_stdout_fd(int fd) { stdout_fd_ = fd; }
+    void set_stderr_fd(int fd) { stderr_fd_ = fd; }
+    int get_stdout_fd() const { return stdout_fd_; }
+    int get_stderr_fd() const { return stderr_fd_; }
     std::string get_stdout() const;
     std::string get_stderr() const;
+    void trim_output() const;
+
+    /* what the job's process used, once it has been reaped */
+    void set_rusage(const struct rusage &ru) { rusage_ = ru; has_rusage_ = true; }
+    const struct rusage *get_rusage() const { return has_rusage_ ? &rusage_ : 0; }
+    /* KiB resident in the job's process before the test ran */
+    void set_base_rss(long kib) { base_rss_ = kib; }
+    long get_base_rss() const { return base_rss_; }
+    /* when the job's process must wait for the listeners to
+     * announce it, see reporter_t::wait_begun(); 0 if it needn't */
+    void set_ticket(uint32_t t) { ticket_ = t; }
+    uint32_t get_ticket() const { return ticket_; }
 
 private:
+    job_t(const job_t &);
+    job_t &operator=(const job_t &);	/* not implemented */
+
     static unsigned int next_id_;
 
     unsigned int id_;
@@ -49,8 +72,12 @@ private:
     std::vector<testnode_t::assignment_t> assigns_;
     int64_t start_;
     int64_t end_;
-    std::string stdout_path_;
-    std::string stderr_path_;
+    int stdout_fd_;
+    int stderr_fd_;
+    struct rusage rusage_;
+    bool has_rusage_;
+    long base_rss_;
+    uint32_t ticket_;
 };
 
 // close the namespace
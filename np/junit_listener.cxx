@@ -15,9 +15,12 @@
  */
 #include "np/util/common.hxx"
 #include <sys/stat.h>
-#include <libxml/tree.h>
+#include <sys/fcntl.h>
+#include <libxml/xmlwriter.h>
+#include <set>
 #include "np/junit_listener.hxx"
 #include "np/job.hxx"
+#include "np/plan.hxx"
 #include "except.h"
 
 namespace np {
@@ -26,15 +29,99 @@ using namespace np::util;
 
 /*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
 
+junit_listener_t::~junit_listener_t()
+{
+    map<string, suite_t*>::iterator sitr;
+    for (sitr = suites_.begin() ; sitr != suites_.end() ; ++sitr)
+	delete sitr->second;
+    if (spool_fd_ >= 0)
+	close(spool_fd_);
+}
+
 bool
 junit_listener_t::needs_stdout() const
 {
     return true;
 }
 
+string
+junit_listener_t::get_suitename(const job_t *j)
+{
+    /* a failed suite teardown is reported in the suite itself */
+    testnode_t *tn = j->get_node();
+    if (!tn->get_function(FT_TEST))
+	return tn->get_fullname();
+    return tn->get_parent()->get_fullname();
+}
+
+string
+junit_listener_t::get_casename(const job_t *j, const string &suitename)
+{
+    string jobname = j->as_string();
+    if (jobname == suitename)
+	return "teardown_suite";
+    int off = jobname.find(suitename);
+    return string(jobname, off+suitename.length()+1);
+}
+
+junit_listener_t::suite_t *
+junit_listener_t::find_suite(const string &suitename)
+{
+    suite_t *&suite = suites_[suitename];
+    if (!suite)
+	suite = new suite_t;
+    return suite;
+}
+
+void
+junit_listener_t::set_plan(plan_t *plan)
+{
+    /* each shard of a plan writes its own files, so that the
+     * reports from all the shards can be collected together */
+    if (plan->get_nshards() > 1)
+	shardname_ = string(".shard") + dec(plan->get_shard()) +
+		     "of" + dec(plan->get_nshards());
+
+    /* count the jobs in each suite so we know when it's done */
+    plan_t::iterator pitr = plan->begin();
+    plan_t::iterator pend = plan->end();
+    testnode_t *tn = 0;
+    suite_t *suite = 0;
+    set<testnode_t*> teardowns;
+    for ( ; pitr != pend ; ++pitr)
+    {
+	if (pitr.get_node() != tn)
+	{
+	    tn = pitr.get_node();
+	    suite = find_suite(tn->get_parent()->get_fullname());
+
+	    /* a suite teardown may fail after all of the suite's tests
+	     * have ended, so those suites are written at the end */
+	    for (testnode_t *sn = tn->get_suite() ; sn ;
+		 sn = (sn->get_parent() ? sn->get_parent()->get_suite() : 0))
+	    {
+		if (sn->get_function(FT_AFTER_SUITE) && teardowns.insert(sn).second)
+		    find_suite(sn->get_fullname())->remaining_++;
+	    }
+	}
+	suite->remaining_++;
+    }
+}
+
 void
 junit_listener_t::begin()
 {
+    hostname_ = get_hostname();
+
+    // TODO: mkdir_p
+    directory_ = "reports";
+    int r = mkdir(directory_.c_str(), 0777);
+    if (r < 0 && errno != EEXIST)
+    {
+	fprintf(stderr, "np: cannot make directory %s: %s\n",
+		directory_.c_str(), strerror(errno));
+	broken_ = true;
+    }
 }
 
 string
@@ -56,128 +143,332 @@ junit_listener_t::get_hostname() const
 #define s(x) ((const xmlChar *)(const char *)(x))
 #define ss(x) ((const xmlChar *)(x).c_str())
 
-void
-junit_listener_t::end()
+/*
+ * Append a test's output to the spool file, and return where it went.
+ */
+junit_listener_t::span_t
+junit_listener_t::spool(const string &casename, const string &text)
 {
-    string hostname = get_hostname();
-    string timestamp = abs_format_iso8601(abs_now());
+    span_t span;
+    if (text == "")
+	return span;
+    if (spool_fd_ < 0)
+	spool_fd_ = anon_file("novaprova.junit");
 
-    // TODO: mkdir_p
-    string directory = "reports";
-    int r = mkdir(directory.c_str(), 0777);
-    if (r < 0 && errno != EEXIST)
+    string buf = string("===") + casename + string("===\n") + text;
+    const char *b = buf.c_str();
+    size_t remain = buf.length();
+    span.off_ = spool_end_;
+    while (remain > 0)
     {
-	fprintf(stderr, "np: cannot make directory %s: %s\n",
-		directory.c_str(), strerror(errno));
-	return;
+	ssize_t r = pwrite(spool_fd_, b, remain, spool_end_);
+	if (r < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    perror("np: spooling test output");
+	    break;
+	}
+	remain -= r;
+	b += r;
+	spool_end_ += r;
     }
+    span.len_ = spool_end_ - span.off_;
+    return span;
+}
 
-    map<string, suite_t>::iterator sitr;
-    for (sitr = suites_.begin() ; sitr != suites_.end() ; ++sitr)
+/*
+ * Returns how many bytes at the end of the buffer are the start of
+ * an incomplete UTF-8 sequence, which must not be split off from
+ * the rest of the sequence when writing the spool in chunks.
+ */
+static size_t
+utf8_partial(const char *buf, size_t len)
+{
+    for (size_t i = 1 ; i <= 3 && i <= len ; i++)
     {
-	const string &suitename = sitr->first;
-	suite_t *suite = &sitr->second;
-
-	xmlDoc *xdoc = xmlNewDoc(s("1.0"));
-	// If only there were a standard DTD URL...
-	// instead we have a Schema from
-	// http://windyroad.org/dl/OpenSource/JUnit.xsd
-
-	xmlNode *xsuite = xmlNewNode(NULL, s("testsuite"));
-	xmlDocSetRootElement(xdoc, xsuite);
-	xmlNewProp(xsuite, s("name"), ss(suitename));
-	xmlNewProp(xsuite, s("failures"), s("0"));
-	xmlNewProp(xsuite, s("tests"), ss(dec(suite->cases_.size())));
-	xmlNewProp(xsuite, s("hostname"), ss(hostname));
-	xmlNewProp(xsuite, s("timestamp"), ss(timestamp));
-
-	xmlAddChild(xsuite, xmlNewNode(NULL, s("properties")));
-
-	unsigned int nerrs = 0;
-	int64_t sns = 0;
-	map<string, case_t>::iterator citr;
-	string all_stdout;
-	string all_stderr;
-	for (citr = suite->cases_.begin() ; citr != suite->cases_.end() ; ++citr)
-	{
-	    const string &casename = citr->first;
-	    case_t *c = &citr->second;
+	unsigned char c = buf[len-i];
+	if ((c & 0xc0) == 0x80)
+	    continue;	    /* continuation byte */
+	if (c < 0xc0)
+	    return 0;
+	size_t seqlen = (c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2);
+	return (seqlen > i ? i : 0);
+    }
+    return 0;
+}
 
-	    xmlNode *xcase = xmlAddChild(xsuite, xmlNewNode(NULL, s("testcase")));
-	    xmlNewProp(xcase, s("name"), ss(casename));
-	    // TODO: this is wrong
-	    xmlNewProp(xcase, s("classname"), ss(casename));
+static void
+write_spool(xmlTextWriterPtr w, int fd, off_t off, size_t len)
+{
+    char buf[65536+1];
+    size_t have = 0;
+    ssize_t r;
 
-	    sns += c->elapsed_;
-	    xmlNewProp(xcase, s("time"), ss(rel_format(c->elapsed_)));
+    while (len > 0 &&
+	   (r = pread(fd, buf+have, min(sizeof(buf)-1-have, len), off)) > 0)
+    {
+	off += r;
+	len -= r;
+	size_t n = have + r;
+	size_t partial = utf8_partial(buf, n);
+	char carry[4];
+	memcpy(carry, buf+n-partial, partial);
+	buf[n-partial] = '\0';
+	xmlTextWriterWriteString(w, s(buf));
+	memcpy(buf, carry, partial);
+	have = partial;
+    }
+    if (have)
+    {
+	buf[have] = '\0';
+	xmlTextWriterWriteString(w, s(buf));
+    }
+}
 
-	    if (c->event_)
-	    {
-		event_t *e = c->event_;
-		xmlNode *xerror = xmlAddChild(xcase, xmlNewNode(NULL, s("error")));
-		xmlNewProp(xerror, s("type"), ss(e->which_as_string()));
-		xmlNewProp(xerror, s("message"), s(e->description));
-		xmlAddChild(xerror, xmlNewText(ss(e->as_string() +
-				       "\n" +
-				       e->get_long_location())));
-	    }
-	    if (c->result_ == R_FAIL)
-		nerrs++;
+/*
+ * Once a suite's report is written its tests' output is no longer
+ * needed, so we give back the memory it used in the spool file.
+ */
+static void
+free_spool(int fd, off_t off, size_t len)
+{
+    if (len)
+	fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, off, len);
+}
 
-	    if (c->stdout_ != "")
-	    {
-		all_stdout += string("===") + casename + string("===\n");
-		all_stdout += c->stdout_;
-	    }
-	    if (c->stderr_ != "")
-	    {
-		all_stderr += string("===") + casename + string("===\n");
-		all_stderr += c->stderr_;
-	    }
-	}
-	xmlNewProp(xsuite, s("errors"), ss(dec(nerrs)));
-	xmlNewProp(xsuite, s("time"), ss(rel_format(sns)));
+static void
+write_property(xmlTextWriterPtr w, const string &name, const string &value)
+{
+    xmlTextWriterStartElement(w, s("property"));
+    xmlTextWriterWriteAttribute(w, s("name"), ss(name));
+    xmlTextWriterWriteAttribute(w, s("value"), ss(value));
+    xmlTextWriterEndElement(w);
+}
 
-	xmlAddChild(xmlAddChild(xsuite, xmlNewNode(NULL, s("system-out"))), xmlNewText(ss(all_stdout)));
-	xmlAddChild(xmlAddChild(xsuite, xmlNewNode(NULL, s("system-err"))), xmlNewText(ss(all_stderr)));
+static int64_t
+timeval_ns(const struct timeval &tv)
+{
+    return (int64_t)tv.tv_sec * NANOSEC_PER_SEC + (int64_t)tv.tv_usec * 1000;
+}
 
-	string filename = directory + string("/TEST-") + suitename + ".xml";
+static void
+write_rusage(xmlTextWriterPtr w, const string &casename, const struct rusage *ru)
+{
+    write_property(w, casename + ".utime", rel_format(timeval_ns(ru->ru_utime)));
+    write_property(w, casename + ".stime", rel_format(timeval_ns(ru->ru_stime)));
+    write_property(w, casename + ".maxrss", dec((unsigned int)ru->ru_maxrss));
+    write_property(w, casename + ".majflt", dec((unsigned int)ru->ru_majflt));
+    write_property(w, casename + ".minflt", dec((unsigned int)ru->ru_minflt));
+    write_property(w, casename + ".nvcsw", dec((unsigned int)ru->ru_nvcsw));
+    write_property(w, casename + ".nivcsw", dec((unsigned int)ru->ru_nivcsw));
+}
 
-	int r = xmlSaveFileEnc(filename.c_str(), xdoc, "UTF-8");
-	if (r < 0)
+static string
+decimal(double x)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.3f", x);
+    return string(buf);
+}
+
+static void
+write_benchmark(xmlTextWriterPtr w, const string &casename, const benchmark_t *b)
+{
+    write_property(w, casename + ".median_ns", decimal(b->median_));
+    write_property(w, casename + ".mad_ns", decimal(b->mad_));
+    write_property(w, casename + ".min_ns", decimal(b->min_));
+    write_property(w, casename + ".calls_per_sec", decimal(b->get_throughput()));
+}
+
+void
+junit_listener_t::write_suite(const string &suitename, const suite_t *suite)
+{
+    if (broken_ || !suite->cases_.size())
+	return;
+
+    unsigned int nerrs = 0;
+    unsigned int nskipped = 0;
+    int64_t sns = 0;
+    map<string, case_t>::const_iterator citr;
+    for (citr = suite->cases_.begin() ; citr != suite->cases_.end() ; ++citr)
+    {
+	sns += citr->second.elapsed_;
+	if (citr->second.skipped_)
+	    nskipped++;
+	else if (citr->second.result_ == R_FAIL)
+	    nerrs++;
+    }
+
+    string filename = directory_ + string("/TEST-") + suitename + shardname_ + ".xml";
+    xmlTextWriterPtr w = xmlNewTextWriterFilename(filename.c_str(), 0);
+    if (!w)
+    {
+	fprintf(stderr, "np: failed to write JUnit XML file %s: %s\n",
+		filename.c_str(), strerror(errno));
+	return;
+    }
+
+    xmlTextWriterStartDocument(w, NULL, "UTF-8", NULL);
+    // If only there were a standard DTD URL...
+    // instead we have a Schema from
+    // http://windyroad.org/dl/OpenSource/JUnit.xsd
+
+    xmlTextWriterStartElement(w, s("testsuite"));
+    xmlTextWriterWriteAttribute(w, s("name"), ss(suitename));
+    xmlTextWriterWriteAttribute(w, s("failures"), s("0"));
+    xmlTextWriterWriteAttribute(w, s("tests"), ss(dec(suite->cases_.size())));
+    xmlTextWriterWriteAttribute(w, s("hostname"), ss(hostname_));
+    xmlTextWriterWriteAttribute(w, s("timestamp"), ss(suite->timestamp_));
+    xmlTextWriterWriteAttribute(w, s("errors"), ss(dec(nerrs)));
+    if (nskipped)
+	xmlTextWriterWriteAttribute(w, s("skipped"), ss(dec(nskipped)));
+    xmlTextWriterWriteAttribute(w, s("time"), ss(rel_format(sns)));
+
+    /* the schema allows properties only for the whole suite, so
+     * each test's resource usage and timing are named after the test */
+    xmlTextWriterStartElement(w, s("properties"));
+    for (citr = suite->cases_.begin() ; citr != suite->cases_.end() ; ++citr)
+    {
+	if (citr->second.has_rusage_)
+	    write_rusage(w, citr->first, &citr->second.rusage_);
+	if (citr->second.has_benchmark_)
+	    write_benchmark(w, citr->first, &citr->second.benchmark_);
+    }
+    xmlTextWriterEndElement(w);
+
+    for (citr = suite->cases_.begin() ; citr != suite->cases_.end() ; ++citr)
+    {
+	const string &casename = citr->first;
+	const case_t *c = &citr->second;
+
+	xmlTextWriterStartElement(w, s("testcase"));
+	xmlTextWriterWriteAttribute(w, s("name"), ss(casename));
+	// TODO: this is wrong
+	xmlTextWriterWriteAttribute(w, s("classname"), ss(casename));
+	xmlTextWriterWriteAttribute(w, s("time"), ss(rel_format(c->elapsed_)));
+
+	if (c->skipped_)
+	{
+	    xmlTextWriterStartElement(w, s("skipped"));
+	    xmlTextWriterEndElement(w);
+	}
+	else if (c->event_)
 	{
-	    fprintf(stderr, "np: failed to write JUnit XML file %s: %s\n",
-		    filename.c_str(), strerror(errno));
+	    event_t *e = c->event_;
+	    xmlTextWriterStartElement(w, s("error"));
+	    xmlTextWriterWriteAttribute(w, s("type"), ss(e->which_as_string()));
+	    xmlTextWriterWriteAttribute(w, s("message"), s(e->description));
+	    xmlTextWriterWriteString(w, ss(e->as_string() +
+					   "\n" +
+					   e->get_long_location()));
+	    xmlTextWriterEndElement(w);
 	}
-	xmlFreeDoc(xdoc);
+	xmlTextWriterEndElement(w);
+    }
+
+    /* the output of each test, in the same order as the testcases */
+    xmlTextWriterStartElement(w, s("system-out"));
+    for (citr = suite->cases_.begin() ; citr != suite->cases_.end() ; ++citr)
+	write_spool(w, spool_fd_, citr->second.stdout_.off_, citr->second.stdout_.len_);
+    xmlTextWriterEndElement(w);
+    xmlTextWriterStartElement(w, s("system-err"));
+    for (citr = suite->cases_.begin() ; citr != suite->cases_.end() ; ++citr)
+	write_spool(w, spool_fd_, citr->second.stderr_.off_, citr->second.stderr_.len_);
+    xmlTextWriterEndElement(w);
+
+    xmlTextWriterEndElement(w);
+    int r = xmlTextWriterEndDocument(w);
+    if (r < 0)
+    {
+	fprintf(stderr, "np: failed to write JUnit XML file %s: %s\n",
+		filename.c_str(), strerror(errno));
     }
+    xmlFreeTextWriter(w);
+
+    for (citr = suite->cases_.begin() ; citr != suite->cases_.end() ; ++citr)
+    {
+	free_spool(spool_fd_, citr->second.stdout_.off_, citr->second.stdout_.len_);
+	free_spool(spool_fd_, citr->second.stderr_.off_, citr->second.stderr_.len_);
+    }
+}
+
+void
+junit_listener_t::end()
+{
+    /* suites whose jobs didn't all run, or which weren't in the plan */
+    map<string, suite_t*>::iterator sitr;
+    for (sitr = suites_.begin() ; sitr != suites_.end() ; ++sitr)
+    {
+	write_suite(sitr->first, sitr->second);
+	delete sitr->second;
+    }
+    suites_.clear();
 }
 
 junit_listener_t::case_t *
 junit_listener_t::find_case(const job_t *j)
 {
-    string suitename = j->get_node()->get_parent()->get_fullname();
-
-    string jobname = j->as_string();
-    int off = jobname.find(suitename);
-    string casename(jobname, off+suitename.length()+1);
-
-    return &suites_[suitename].cases_[casename];
+    string suitename = get_suitename(j);
+    return &find_suite(suitename)->cases_[get_casename(j, suitename)];
 }
 
 void
-junit_listener_t::begin_job(const job_t *j __attribute__((unused)))
+junit_listener_t::begin_job(const job_t *j)
 {
+    suite_t *suite = find_suite(get_suitename(j));
+    if (suite->timestamp_ == "")
+	suite->timestamp_ = abs_format_iso8601(abs_now());
 }
 
 void
 junit_listener_t::end_job(const job_t *j, result_t res)
 {
-    case_t *c = find_case(j);
+    string suitename = get_suitename(j);
+    string casename = get_casename(j, suitename);
+    suite_t *suite = find_suite(suitename);
+    case_t *c = &suite->cases_[casename];
     c->result_ = res;
     c->elapsed_ = j->get_elapsed();
-    c->stdout_ = j->get_stdout();
-    c->stderr_ = j->get_stderr();
+    c->stdout_ = spool(casename, j->get_stdout());
+    c->stderr_ = spool(casename, j->get_stderr());
+    job_done(suitename, suite);
+}
+
+void
+junit_listener_t::skip_job(const job_t *j)
+{
+    string suitename = get_suitename(j);
+    suite_t *suite = find_suite(suitename);
+    suite->cases_[get_casename(j, suitename)].skipped_ = true;
+    job_done(suitename, suite);
+}
+
+void
+junit_listener_t::job_resources(const job_t *j, const struct rusage *ru)
+{
+    case_t *c = find_case(j);
+    c->rusage_ = *ru;
+    c->has_rusage_ = true;
+}
+
+void
+junit_listener_t::add_benchmark(const job_t *j, const benchmark_t *b)
+{
+    case_t *c = find_case(j);
+    c->benchmark_ = *b;
+    c->has_benchmark_ = true;
+}
+
+void
+junit_listener_t::job_done(const string &suitename, suite_t *suite)
+{
+    if (suite->remaining_ && !--suite->remaining_)
+    {
+	write_suite(suitename, suite);
+	delete suite;
+	suites_.erase(suitename);
+    }
 }
 
 void
@@ -17,52 +17,95 @@
 #define __NP_JUNIT_LISTENER_H__ 1
 
 #include "np/listener.hxx"
+#include "np/benchmark.hxx"
+#include <sys/resource.h>
 
 namespace np {
 
 class junit_listener_t : public listener_t
 {
 public:
-    junit_listener_t() {}
-    ~junit_listener_t() {}
+    junit_listener_t() : broken_(false), spool_fd_(-1), spool_end_(0) {}
+    ~junit_listener_t();
 
     // TODO: methods to allow changing the base directory
 
     bool needs_stdout() const;
+    void set_plan(plan_t *);
     void begin();
     void end();
     void begin_job(const job_t *);
     void end_job(const job_t *, result_t);
+    void skip_job(const job_t *);
+    void job_resources(const job_t *, const struct rusage *);
+    void add_benchmark(const job_t *, const benchmark_t *);
     void add_event(const job_t *, const event_t *);
 
 private:
+    /* some of a test's output, in the spool file */
+    struct span_t
+    {
+	span_t() : off_(0), len_(0) {}
+
+	off_t off_;
+	size_t len_;
+    };
+
     struct case_t
     {
 	case_t()
 	 :  result_(R_UNKNOWN),
 	    event_(0),
-	    elapsed_(0)
+	    elapsed_(0),
+	    skipped_(false),
+	    has_rusage_(false),
+	    has_benchmark_(false)
 	{ }
 	~case_t();
 
-	std::string name_;
 	result_t result_;
 	event_t *event_;
 	int64_t elapsed_;
-	std::string stdout_;
-	std::string stderr_;
+	bool skipped_;
+	bool has_rusage_;
+	struct rusage rusage_;
+	bool has_benchmark_;
+	benchmark_t benchmark_;
+	span_t stdout_;
+	span_t stderr_;
     };
 
+    /*
+     * A suite's report is written as soon as the last of its jobs in
+     * the plan has ended.  Until then only a small case_t is kept in
+     * memory for each test, and the tests' output is appended to a
+     * single anonymous spool file shared by all the suites.
+     */
     struct suite_t
     {
+	suite_t() : remaining_(0) {}
+
+	unsigned int remaining_;    /* jobs in the plan not yet ended */
+	std::string timestamp_;
 	std::map<std::string, case_t> cases_;
     };
 
     std::string get_hostname() const;
-    std::string get_timestamp() const;
+    static std::string get_suitename(const job_t *j);
+    static std::string get_casename(const job_t *j, const std::string &suitename);
+    suite_t *find_suite(const std::string &suitename);
     case_t *find_case(const job_t *j);
+    span_t spool(const std::string &casename, const std::string &text);
+    void write_suite(const std::string &suitename, const suite_t *);
+    void job_done(const std::string &suitename, suite_t *);
 
-    std::map<std::string, suite_t> suites_;
+    std::string directory_;
+    std::string shardname_;	/* suffix for filenames, when sharded */
+    std::string hostname_;
+    bool broken_;
+    int spool_fd_;
+    off_t spool_end_;
+    std::map<std::string, suite_t*> suites_;
 };
 
 // close the namespace
@@ -0,0 +1,754 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np/leak_tracker.hxx"
+#include "np/spiegel/platform/common.hxx"
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * We define malloc() and friends here, which takes precedence over
+ * the C library's.  Each passes the call on to the next definition,
+ * i.e. the C library's or the ASan runtime's, found with dlsym().
+ * When not tracking that is all they do.
+ *
+ * While tracking, live blocks are kept in an open addressing hash
+ * table in memory from mmap(), along with a few addresses from the
+ * stack of the caller.  A simple spinlock makes that safe for tests
+ * which start threads, and is held across fork() so that the child
+ * gets a consistent table.
+ */
+
+namespace np {
+using namespace std;
+using namespace np::util;
+
+#define MAXPCS		6
+#define SKIPPCS		3	/* get_stacktrace(), track_alloc() and malloc() */
+#define EMPTY		((uintptr_t)0)
+#define DELETED		((uintptr_t)1)
+
+struct block_t
+{
+    uintptr_t addr_;
+    size_t size_;
+    np::spiegel::addr_t pcs_[MAXPCS];
+};
+
+struct range_t
+{
+    uintptr_t lo_;
+    uintptr_t hi_;
+};
+
+bool leak_tracker_t::enabled_;
+void (*leak_tracker_t::failure_handler_)(size_t);
+
+static volatile int tracking;
+static uintptr_t stack_top;	/* where the test's stack frames start */
+static volatile int lock_;
+static block_t *table;
+static size_t capacity;	    /* a power of 2 */
+static size_t used;	    /* including DELETED slots */
+
+typedef void *(*malloc_fn_t)(size_t);
+typedef void *(*calloc_fn_t)(size_t, size_t);
+typedef void *(*realloc_fn_t)(void *, size_t);
+typedef void (*free_fn_t)(void *);
+typedef int (*posix_memalign_fn_t)(void **, size_t, size_t);
+typedef void *(*memalign_fn_t)(size_t, size_t);
+static malloc_fn_t real_malloc;
+static calloc_fn_t real_calloc;
+static realloc_fn_t real_realloc;
+static free_fn_t real_free;
+static posix_memalign_fn_t real_posix_memalign;
+static memalign_fn_t real_aligned_alloc;
+static memalign_fn_t real_memalign;
+
+/* dlsym() can allocate memory while we're looking up the real
+ * functions, so for that short time we allocate from here */
+static bool resolving;
+static char bootstrap[4096] __attribute__((aligned(16)));
+static size_t bootstrap_used;
+
+static void *
+bootstrap_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (bootstrap_used + size > sizeof(bootstrap))
+	return 0;
+    void *p = bootstrap + bootstrap_used;
+    bootstrap_used += size;
+    return p;
+}
+
+static bool
+is_bootstrap(void *p)
+{
+    return ((char *)p >= bootstrap && (char *)p < bootstrap + sizeof(bootstrap));
+}
+
+static void
+resolve()
+{
+    resolving = true;
+    real_malloc = (malloc_fn_t)dlsym(RTLD_NEXT, "malloc");
+    real_calloc = (calloc_fn_t)dlsym(RTLD_NEXT, "calloc");
+    real_realloc = (realloc_fn_t)dlsym(RTLD_NEXT, "realloc");
+    real_free = (free_fn_t)dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = (posix_memalign_fn_t)dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = (memalign_fn_t)dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = (memalign_fn_t)dlsym(RTLD_NEXT, "memalign");
+    resolving = false;
+    if (!real_malloc || !real_calloc || !real_realloc || !real_free ||
+	!real_posix_memalign || !real_aligned_alloc || !real_memalign)
+    {
+	static const char msg[] = "np: cannot find the real malloc\n";
+	ssize_t r __attribute__((unused)) =
+		write(STDERR_FILENO, msg, sizeof(msg)-1);
+	abort();
+    }
+}
+
+static void
+take_lock()
+{
+    while (__sync_lock_test_and_set(&lock_, 1))
+	sched_yield();
+}
+
+static void
+drop_lock()
+{
+    __sync_lock_release(&lock_);
+}
+
+/* in the child only the thread which forked is left, and it holds the lock */
+static void
+reset_lock()
+{
+    lock_ = 0;
+}
+
+static void *
+map_pages(size_t len)
+{
+    void *p = mmap(0, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    return (p == MAP_FAILED ? 0 : p);
+}
+
+static inline size_t
+hash(uintptr_t addr)
+{
+    return (size_t)((addr >> 4) * 0x9e3779b97f4a7c15ULL) & (capacity-1);
+}
+
+static block_t *
+find_slot(uintptr_t addr, bool for_insert)
+{
+    block_t *tomb = 0;
+    for (size_t i = hash(addr) ; ; i = (i+1) & (capacity-1))
+    {
+	block_t *b = &table[i];
+	if (b->addr_ == addr)
+	    return b;
+	if (b->addr_ == EMPTY)
+	    return (for_insert ? (tomb ? tomb : b) : 0);
+	if (b->addr_ == DELETED && !tomb)
+	    tomb = b;
+    }
+}
+
+/* Called with the lock held.  Returns false if out of memory. */
+static bool
+grow_table()
+{
+    size_t oldcap = capacity;
+    block_t *old = table;
+
+    capacity = (oldcap ? 2*oldcap : 4096);
+    table = (block_t *)map_pages(capacity * sizeof(block_t));
+    if (!table)
+    {
+	table = old;
+	capacity = oldcap;
+	return false;
+    }
+    used = 0;
+    for (size_t i = 0 ; i < oldcap ; i++)
+    {
+	if (old[i].addr_ > DELETED)
+	{
+	    *find_slot(old[i].addr_, true) = old[i];
+	    used++;
+	}
+    }
+    if (old)
+	munmap(old, oldcap * sizeof(block_t));
+    return true;
+}
+
+static void __attribute__((noinline))
+track_alloc(void *p, size_t size)
+{
+    np::spiegel::addr_t pcs[SKIPPCS+MAXPCS];
+    unsigned int npcs = np::spiegel::platform::get_stacktrace(pcs, SKIPPCS+MAXPCS);
+
+    take_lock();
+    if (tracking && ((used+1)*2 <= capacity || grow_table()))
+    {
+	block_t *b = find_slot((uintptr_t)p, true);
+	if (b->addr_ <= DELETED)
+	{
+	    if (b->addr_ == EMPTY)
+		used++;
+	    b->addr_ = (uintptr_t)p;
+	}
+	b->size_ = size;
+	memset(b->pcs_, 0, sizeof(b->pcs_));
+	if (npcs > SKIPPCS)
+	    memcpy(b->pcs_, pcs+SKIPPCS, (npcs-SKIPPCS) * sizeof(pcs[0]));
+    }
+    drop_lock();
+}
+
+static void
+untrack(void *p)
+{
+    take_lock();
+    if (table)
+    {
+	block_t *b = find_slot((uintptr_t)p, false);
+	if (b)
+	    b->addr_ = DELETED;
+    }
+    drop_lock();
+}
+
+// close the namespace
+};
+
+using namespace np;
+
+extern "C" void *
+malloc(size_t size) __THROW
+{
+    if (!real_malloc)
+    {
+	if (resolving)
+	    return bootstrap_alloc(size);
+	resolve();
+    }
+    void *p = real_malloc(size);
+    if (tracking && p)
+	track_alloc(p, size);
+    if (!p && size)
+	leak_tracker_t::alloc_failed(size);
+    return p;
+}
+
+extern "C" void *
+calloc(size_t n, size_t size) __THROW
+{
+    if (!real_calloc)
+    {
+	if (resolving)
+	    return bootstrap_alloc(n * size);	/* already zeroed */
+	resolve();
+    }
+    void *p = real_calloc(n, size);
+    if (tracking && p)
+	track_alloc(p, n * size);
+    if (!p && n && size)
+	leak_tracker_t::alloc_failed(n * size);
+    return p;
+}
+
+extern "C" void *
+realloc(void *old, size_t size) __THROW
+{
+    if (!real_realloc)
+    {
+	if (resolving)
+	    return bootstrap_alloc(size);
+	resolve();
+    }
+    if (old && is_bootstrap(old))
+    {
+	void *p = malloc(size);
+	if (p)
+	{
+	    size_t avail = bootstrap + sizeof(bootstrap) - (char *)old;
+	    memcpy(p, old, (size < avail ? size : avail));
+	}
+	return p;
+    }
+    if (tracking && old)
+	untrack(old);
+    void *p = real_realloc(old, size);
+    if (tracking && p)
+	track_alloc(p, size);
+    if (!p && size)
+	leak_tracker_t::alloc_failed(size);
+    return p;
+}
+
+/*
+ * The C library's aligned allocators don't go through malloc(),
+ * so they need tracking too.  Nothing asks for alignment while
+ * we're resolving, so there's no bootstrap for them.
+ */
+extern "C" int
+posix_memalign(void **pp, size_t align, size_t size) __THROW
+{
+    if (!real_posix_memalign)
+	resolve();
+    int r = real_posix_memalign(pp, align, size);
+    if (tracking && !r)
+	track_alloc(*pp, size);
+    if (r == ENOMEM)
+	leak_tracker_t::alloc_failed(size);
+    return r;
+}
+
+extern "C" void *
+aligned_alloc(size_t align, size_t size) __THROW
+{
+    if (!real_aligned_alloc)
+	resolve();
+    void *p = real_aligned_alloc(align, size);
+    if (tracking && p)
+	track_alloc(p, size);
+    if (!p && size && errno == ENOMEM)
+	leak_tracker_t::alloc_failed(size);
+    return p;
+}
+
+extern "C" void *
+memalign(size_t align, size_t size) __THROW
+{
+    if (!real_memalign)
+	resolve();
+    void *p = real_memalign(align, size);
+    if (tracking && p)
+	track_alloc(p, size);
+    if (!p && size && errno == ENOMEM)
+	leak_tracker_t::alloc_failed(size);
+    return p;
+}
+
+extern "C" void
+free(void *p) __THROW
+{
+    if (!p || is_bootstrap(p))
+	return;
+    if (tracking)
+	untrack(p);
+    if (!real_free)
+	resolve();
+    real_free(p);
+}
+
+namespace np {
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+void
+leak_tracker_t::begin()
+{
+    if (!enabled_)
+	return;
+    static bool registered = false;
+    if (!registered)
+    {
+	pthread_atfork(take_lock, drop_lock, reset_lock);
+	registered = true;
+    }
+    /* the first stack trace may allocate, get that out of the way */
+    np::spiegel::addr_t pc;
+    np::spiegel::platform::get_stacktrace(&pc, 1);
+    take_lock();
+    if (table)
+	memset(table, 0, capacity * sizeof(block_t));
+    used = 0;
+    stack_top = (uintptr_t)__builtin_frame_address(0);
+    tracking = 1;
+    drop_lock();
+}
+
+/*
+ * Scanning memory for pointers to the live blocks.  Anything
+ * writable could hold one, so we look through every private
+ * writable mapping listed in /proc/self/maps, except for the part
+ * of our stack which the test used, which holds whatever it left
+ * behind, and the tracker's own memory.  The blocks themselves are
+ * only scanned once something else points to them, so a leaked
+ * block and all the blocks only it points to are reported.  This
+ * is the same conservative approach as LeakSanitizer takes.
+ */
+struct scan_t
+{
+    range_t *blocks_;	    /* live blocks, sorted by address */
+    size_t nblocks_;
+    bool *marked_;
+    size_t *work_;	    /* marked blocks not yet scanned */
+    size_t nwork_;
+    range_t exclude_[5];
+    unsigned int nexclude_;
+};
+
+static void
+mark(scan_t *s, size_t i)
+{
+    if (s->marked_[i])
+	return;
+    s->marked_[i] = true;
+    s->work_[s->nwork_++] = i;
+}
+
+static void
+scan_words(scan_t *s, uintptr_t lo, uintptr_t hi)
+{
+    uintptr_t min = s->blocks_[0].lo_;
+    uintptr_t max = s->blocks_[s->nblocks_-1].hi_;
+
+    lo = (lo + sizeof(uintptr_t)-1) & ~(uintptr_t)(sizeof(uintptr_t)-1);
+    for (const uintptr_t *p = (const uintptr_t *)lo ; (uintptr_t)(p+1) <= hi ; p++)
+    {
+	uintptr_t w = *p;
+	if (w < min || w >= max)
+	    continue;
+	/* find the last block starting at or before w */
+	size_t l = 0, h = s->nblocks_;
+	while (h - l > 1)
+	{
+	    size_t m = (l + h) / 2;
+	    if (s->blocks_[m].lo_ <= w)
+		l = m;
+	    else
+		h = m;
+	}
+	/* pointers into the middle count, but not to the last few
+	 * bytes, which overlap the header of the next heap chunk
+	 * that glibc points at when it's free */
+	if (w < (s->blocks_[l].hi_ & ~(uintptr_t)(2*sizeof(uintptr_t)-1)) ||
+	    w == s->blocks_[l].lo_)
+	    mark(s, l);
+    }
+}
+
+/* scan around any of the blocks which lie within lo..hi */
+static void
+scan_outside_blocks(scan_t *s, uintptr_t lo, uintptr_t hi)
+{
+    /* find the first block ending after lo */
+    size_t l = 0, h = s->nblocks_;
+    while (l < h)
+    {
+	size_t m = (l + h) / 2;
+	if (s->blocks_[m].hi_ <= lo)
+	    l = m+1;
+	else
+	    h = m;
+    }
+    for ( ; l < s->nblocks_ && s->blocks_[l].lo_ < hi ; l++)
+    {
+	if (s->blocks_[l].lo_ > lo)
+	    scan_words(s, lo, s->blocks_[l].lo_);
+	if (s->blocks_[l].hi_ > lo)
+	    lo = s->blocks_[l].hi_;
+    }
+    if (lo < hi)
+	scan_words(s, lo, hi);
+}
+
+static void
+scan_range(scan_t *s, uintptr_t lo, uintptr_t hi, unsigned int first = 0)
+{
+    for (unsigned int i = first ; i < s->nexclude_ ; i++)
+    {
+	const range_t &x = s->exclude_[i];
+	if (x.hi_ <= lo || x.lo_ >= hi)
+	    continue;
+	if (lo < x.lo_)
+	    scan_range(s, lo, x.lo_, i+1);
+	if (x.hi_ < hi)
+	    scan_range(s, x.hi_, hi, i+1);
+	return;
+    }
+    scan_outside_blocks(s, lo, hi);
+}
+
+/*
+ * Freed memory in the heap often still holds pointers to blocks
+ * which have since been reallocated, and which would hide leaks.
+ * So we walk glibc's chunks and skip the free ones, including
+ * those cached for reuse, which are marked with a random key.
+ * That relies on glibc's private chunk layout, so first we check
+ * it with blocks of our own: one kept while we scan, whose chunk
+ * the walk must land on, and one freed to learn the key.  If
+ * anything doesn't look as we expect, the heap is scanned whole.
+ */
+#define PROBE_WORDS	4
+#define PROBE_FILL	((uintptr_t)0x6e70726f6265ULL)	/* "nprobe" */
+
+struct heap_probe_t
+{
+    uintptr_t *live_;	/* kept until the scan is done */
+    uintptr_t chunk_;	/* its chunk, 0 if the layout isn't glibc's */
+    uintptr_t key_;	/* marks cached chunks, 0 if unknown */
+};
+
+static void
+probe_heap(heap_probe_t *probe)
+{
+    static const uintptr_t W = sizeof(uintptr_t);
+    memset(probe, 0, sizeof(*probe));
+#if defined(__GLIBC__)
+    uintptr_t *p = (uintptr_t *)real_malloc(PROBE_WORDS*W);
+    uintptr_t *q = (uintptr_t *)real_malloc(PROBE_WORDS*W);
+    if (!p || !q)
+    {
+	real_free(p);
+	real_free(q);
+	return;
+    }
+    for (unsigned int i = 0 ; i < PROBE_WORDS ; i++)
+	p[i] = q[i] = PROBE_FILL;
+    probe->live_ = q;
+
+    /* an in-use chunk from the heap: it isn't mmapped, and its
+     * size word, just before its user memory, agrees with
+     * malloc_usable_size() */
+    uintptr_t size = q[-1] & ~(uintptr_t)7;
+    if (!(q[-1] & 2) && size == malloc_usable_size(q) + W &&
+	size >= (PROBE_WORDS+1)*W)
+	probe->chunk_ = (uintptr_t)q - 2*W;
+
+    /* a cached chunk gets the key where our fill was */
+    real_free(p);
+    if (probe->chunk_ && p[1] != PROBE_FILL)
+	probe->key_ = p[1];
+#endif
+}
+
+/*
+ * Walk the chunks of the heap in lo..hi, calling scan_range() on
+ * those in use if @s is set.  Returns false if the chunks don't
+ * look as we expect, or don't include the probe's, if it's there.
+ */
+static bool
+walk_heap(scan_t *s, uintptr_t lo, uintptr_t hi, const heap_probe_t *probe)
+{
+    static const uintptr_t W = sizeof(uintptr_t);
+    uintptr_t c = lo;
+    bool found = !(probe->chunk_ >= lo && probe->chunk_ < hi);
+
+    /* the first chunk always has the PREV_INUSE bit set */
+    if (c + 2*W > hi || !(((uintptr_t *)c)[1] & 1))
+	return false;
+    while (c + 2*W <= hi)
+    {
+	uintptr_t size = ((uintptr_t *)c)[1] & ~(uintptr_t)7;
+	uintptr_t next = c + size;
+	if (size < 4*W || (size & (2*W-1)) || next > hi)
+	    return false;
+	found = found || (c == probe->chunk_);
+	if (next + 2*W > hi)
+	    break;	/* the top chunk, which is free */
+	/* in use if the next chunk says so and it's not cached */
+	uintptr_t *user = (uintptr_t *)(c + 2*W);
+	if (s && (((uintptr_t *)next)[1] & 1) &&
+	    !(probe->key_ && user[1] == probe->key_))
+	    scan_range(s, (uintptr_t)user, next + W);
+	c = next;
+    }
+    return found;
+}
+
+static void
+scan_heap(scan_t *s, uintptr_t lo, uintptr_t hi, const heap_probe_t *probe)
+{
+    if (probe->chunk_ && walk_heap(0, lo, hi, probe))
+	walk_heap(s, lo, hi, probe);
+    else
+	scan_range(s, lo, hi);
+}
+
+static void
+scan_mappings(scan_t *s)
+{
+    heap_probe_t probe;
+    probe_heap(&probe);
+
+    /* read the whole maps file into memory the scan will skip */
+    size_t buflen = 1024*1024;
+    char *buf = (char *)map_pages(buflen);
+    if (!buf)
+    {
+	real_free(probe.live_);
+	return;
+    }
+    s->exclude_[s->nexclude_].lo_ = (uintptr_t)buf;
+    s->exclude_[s->nexclude_].hi_ = (uintptr_t)buf + buflen;
+    s->nexclude_++;
+
+    size_t len = 0;
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd >= 0)
+    {
+	ssize_t r;
+	while (len < buflen-1 && (r = read(fd, buf+len, buflen-1-len)) > 0)
+	    len += r;
+	close(fd);
+    }
+    buf[len] = '\0';
+
+    for (char *line = buf ; *line ; )
+    {
+	char *eol = strchr(line, '\n');
+	if (eol)
+	    *eol = '\0';
+
+	char *end;
+	uintptr_t lo = strtoul(line, &end, 16);
+	uintptr_t hi = strtoul(end+1, &end, 16);
+	const char *perms = end+1;
+	if (!strncmp(perms, "rw-p", 4))
+	{
+	    /* on the stack, only what's above the test is live */
+	    if (stack_top >= lo && stack_top < hi)
+		lo = stack_top;
+	    if (strstr(perms, "[heap]"))
+		scan_heap(s, lo, hi, &probe);
+	    else
+		scan_range(s, lo, hi);
+	}
+
+	if (!eol)
+	    break;
+	line = eol+1;
+    }
+    munmap(buf, buflen);
+    real_free(probe.live_);
+}
+
+static void
+unmap_pages(void *p, size_t len)
+{
+    if (p)
+	munmap(p, len);
+}
+
+static int
+compare_ranges(const void *v1, const void *v2)
+{
+    const range_t *r1 = (const range_t *)v1;
+    const range_t *r2 = (const range_t *)v2;
+    return (r1->lo_ < r2->lo_ ? -1 : r1->lo_ > r2->lo_ ? 1 : 0);
+}
+
+/*
+ * Stop tracking and return the leaked blocks in @leaks.
+ * Returns false if we weren't tracking.
+ */
+bool
+leak_tracker_t::end(vector<leak_t> &leaks)
+{
+    if (!tracking)
+	return false;
+    take_lock();
+    tracking = 0;
+    drop_lock();
+
+    size_t nlive = 0;
+    for (size_t i = 0 ; i < capacity ; i++)
+	nlive += (table[i].addr_ > DELETED);
+    if (!nlive)
+	return true;
+
+    /* nothing from malloc() from here until we've scanned,
+     * or the scan would find our own copies of the pointers */
+    scan_t s;
+    memset(&s, 0, sizeof(s));
+    size_t blen = nlive * sizeof(range_t);
+    size_t mlen = nlive * sizeof(bool);
+    size_t wlen = nlive * sizeof(size_t);
+    s.blocks_ = (range_t *)map_pages(blen);
+    s.marked_ = (bool *)map_pages(mlen);
+    s.work_ = (size_t *)map_pages(wlen);
+    if (!s.blocks_ || !s.marked_ || !s.work_)
+    {
+	unmap_pages(s.blocks_, blen);
+	unmap_pages(s.marked_, mlen);
+	unmap_pages(s.work_, wlen);
+	return true;
+    }
+    s.exclude_[s.nexclude_].lo_ = (uintptr_t)table;
+    s.exclude_[s.nexclude_].hi_ = (uintptr_t)(table + capacity);
+    s.nexclude_++;
+    s.exclude_[s.nexclude_].lo_ = (uintptr_t)s.blocks_;
+    s.exclude_[s.nexclude_].hi_ = (uintptr_t)s.blocks_ + blen;
+    s.nexclude_++;
+    s.exclude_[s.nexclude_].lo_ = (uintptr_t)s.marked_;
+    s.exclude_[s.nexclude_].hi_ = (uintptr_t)s.marked_ + mlen;
+    s.nexclude_++;
+    s.exclude_[s.nexclude_].lo_ = (uintptr_t)s.work_;
+    s.exclude_[s.nexclude_].hi_ = (uintptr_t)s.work_ + wlen;
+    s.nexclude_++;
+
+    for (size_t i = 0 ; i < capacity ; i++)
+    {
+	if (table[i].addr_ > DELETED)
+	{
+	    s.blocks_[s.nblocks_].lo_ = table[i].addr_;
+	    s.blocks_[s.nblocks_].hi_ = table[i].addr_ + table[i].size_;
+	    s.nblocks_++;
+	}
+    }
+    qsort(s.blocks_, s.nblocks_, sizeof(range_t), compare_ranges);
+
+    scan_mappings(&s);
+    /* then everything reachable from there */
+    while (s.nwork_)
+    {
+	const range_t &r = s.blocks_[s.work_[--s.nwork_]];
+	scan_words(&s, r.lo_, r.hi_);
+    }
+
+    for (size_t i = 0 ; i < s.nblocks_ ; i++)
+    {
+	if (s.marked_[i])
+	    continue;
+	block_t *b = find_slot(s.blocks_[i].lo_, false);
+	leak_t leak;
+	leak.addr_ = b->addr_;
+	leak.size_ = b->size_;
+	for (unsigned int j = 0 ; j < MAXPCS && b->pcs_[j] ; j++)
+	    leak.stack_.push_back(b->pcs_[j]);
+	leaks.push_back(leak);
+    }
+
+    unmap_pages(s.blocks_, blen);
+    unmap_pages(s.marked_, mlen);
+    unmap_pages(s.work_, wlen);
+    return true;
+}
+
+// close the namespace
+};
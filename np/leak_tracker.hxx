@@ -0,0 +1,61 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __NP_LEAK_TRACKER_H__
+#define __NP_LEAK_TRACKER_H__ 1
+
+#include "np/util/common.hxx"
+#include "np/spiegel/common.hxx"
+#include <vector>
+
+namespace np {
+
+/*
+ * A lightweight heap leak checker, used on request when neither
+ * Valgrind nor LeakSanitizer is available.  The library's own
+ * malloc() and friends record every block allocated between begin()
+ * and end(), and end() reports those still allocated which nothing
+ * seems to point to.
+ */
+class leak_tracker_t
+{
+public:
+    struct leak_t
+    {
+	unsigned long addr_;
+	size_t size_;
+	std::vector<np::spiegel::addr_t> stack_;
+    };
+
+    static void set_enabled(bool b) { enabled_ = b; }
+    static void begin();
+    static bool end(std::vector<leak_t> &leaks);
+    /* called, outside any locks, when the real allocator fails */
+    static void set_failure_handler(void (*fn)(size_t)) { failure_handler_ = fn; }
+    static void alloc_failed(size_t size)
+    {
+	if (failure_handler_)
+	    failure_handler_(size);
+    }
+
+private:
+    static bool enabled_;
+    static void (*failure_handler_)(size_t);
+};
+
+// close the namespace
+};
+
+#endif /* __NP_LEAK_TRACKER_H__ */
@@ -19,11 +19,14 @@
 #include "np/util/common.hxx"
 #include "np/types.hxx"
 
+struct rusage;
 
 namespace np {
 
 class event_t;
 class job_t;
+struct benchmark_t;
+class plan_t;
 
 class listener_t
 {
@@ -32,11 +35,21 @@ public:
     virtual ~listener_t() {}
 
     virtual bool needs_stdout() const { return false; }
+    /* called with the plan about to be run, before begin() */
+    virtual void set_plan(plan_t *) {}
     virtual void begin() = 0;
     virtual void end() = 0;
     virtual void begin_job(const job_t *) = 0;
     virtual void end_job(const job_t *, result_t) = 0;
+    /* called instead of end_job() for a job which was cancelled or
+     * never started, because the run was cut short */
+    virtual void skip_job(const job_t *) {}
+    /* called just before end_job() with the resources used by the
+     * job's process, when they are known */
+    virtual void job_resources(const job_t *, const struct rusage *) {}
     virtual void add_event(const job_t *, const event_t *) = 0;
+    /* called with the timing of a benchmark job, before end_job() */
+    virtual void add_benchmark(const job_t *, const benchmark_t *) {}
 };
 
 // close the namespace
@@ -17,7 +17,9 @@
 #include "np/testnode.hxx"
 #include "np/job.hxx"
 #include "np/testmanager.hxx"
+#include "np/history.hxx"
 #include "np_priv.h"
+#include <algorithm>
 
 namespace np {
 using namespace std;
@@ -28,6 +30,7 @@ plan_t::plan_t()
 
 plan_t::~plan_t()
 {
+    delete history_;
 }
 
 void
@@ -54,35 +57,161 @@ plan_t::add_specs(int nspec, const char **specs)
 
 /*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
 
-plan_t::iterator::iterator(vector<testnode_t*>::iterator first,
+/*
+ * A plan can be split into shards, so that N separate runs with
+ * shards 1..N between them run every job in the plan exactly once.
+ * By default each job goes to a shard chosen by hashing its name,
+ * which needs no coordination between the runs at all.  Sharding
+ * by duration instead balances the expected run times from a
+ * history file, which every run must be given a frozen copy of.
+ */
+bool
+plan_t::set_shard(unsigned int k, unsigned int n)
+{
+    if (n < 1 || k < 1 || k > n)
+	return false;
+    shard_ = k;
+    nshards_ = n;
+    balanced_ = false;
+    return true;
+}
+
+bool
+plan_t::set_shard_history(const char *path)
+{
+    delete history_;
+    history_ = 0;
+    balanced_ = false;
+    if (!path)
+	return true;
+    history_ = new history_t;
+    return history_->load(path);
+}
+
+/* FNV-1a */
+static uint32_t
+hash_string(const char *s)
+{
+    uint32_t h = 2166136261U;
+    for ( ; *s ; s++)
+    {
+	h ^= (unsigned char)*s;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+bool
+plan_t::in_shard(const string &jobname) const
+{
+    if (nshards_ <= 1)
+	return true;
+    if (history_)
+	return (jobs_.find(jobname) != jobs_.end());
+    return (hash_string(jobname.c_str()) % nshards_ == shard_-1);
+}
+
+struct shard_order
+{
+    bool operator()(const pair<int64_t, string> &a,
+		    const pair<int64_t, string> &b) const
+    {
+	if (a.first != b.first)
+	    return a.first > b.first;
+	return a.second < b.second;
+    }
+};
+
+/*
+ * Deal out the jobs longest first, each to the shard with the
+ * least expected work so far.  Every run computes the same answer
+ * from the same history, regardless of the order of the plan.
+ */
+void
+plan_t::balance_shards()
+{
+    vector<pair<int64_t, string> > jobs;
+    for (iterator itr(0, nodes_.begin(), nodes_.end()) ; itr != end() ; ++itr)
+    {
+	string name = job_t::as_string(itr.get_node(), itr.get_assignments());
+	jobs.push_back(make_pair(history_->get_expected(name), name));
+    }
+    sort(jobs.begin(), jobs.end(), shard_order());
+
+    vector<int64_t> load(nshards_, 0);
+    jobs_.clear();
+    vector<pair<int64_t, string> >::iterator i;
+    for (i = jobs.begin() ; i != jobs.end() ; ++i)
+    {
+	unsigned int least = 0;
+	for (unsigned int k = 1 ; k < nshards_ ; k++)
+	    if (load[k] < load[least])
+		least = k;
+	load[least] += i->first;
+	if (least == shard_-1)
+	    jobs_.insert(i->second);
+    }
+    balanced_ = true;
+}
+
+plan_t::iterator
+plan_t::begin()
+{
+    if (nshards_ > 1 && history_ && !balanced_)
+	balance_shards();
+    return iterator(this, nodes_.begin(), nodes_.end());
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+plan_t::iterator::iterator(const plan_t *plan,
+			   vector<testnode_t*>::iterator first,
 			   vector<testnode_t*>::iterator last)
- :  vitr_(first),
+ :  plan_(plan),
+    vitr_(first),
     vend_(last)
 {
     if (vitr_ != vend_)
     {
 	nitr_ = *vitr_;
 	find_testable_node();
+	find_shard_job();
     }
 }
 
 plan_t::iterator &
 plan_t::iterator::operator++()
+{
+    next();
+    find_shard_job();
+    return *this;
+}
+
+void plan_t::iterator::next()
 {
     // walk to the next assignment state
     if (!bump(assigns_))
-	return *this;
+	return;
     assigns_.clear();
 
     // no more assignment states: walk to the next node
     // in preorder which has a test function
     ++nitr_;
     find_testable_node();
-    return *this;
+}
+
+// skip jobs which belong to other shards
+void plan_t::iterator::find_shard_job()
+{
+    if (!plan_)
+	return;
+    while (vitr_ != vend_ &&
+	   !plan_->in_shard(job_t::as_string(*nitr_, assigns_)))
+	next();
 }
 
 // walk to the first testnode at or after the iterator's
-// current state, which has a test function
+// current state, which has a test or benchmark function
 void plan_t::iterator::find_testable_node()
 {
     for (;;)
@@ -95,7 +224,7 @@ void plan_t::iterator::find_testable_node()
 	    if (vitr_ == vend_)
 		return;	    // end of iteration
 	}
-	if ((*nitr_)->get_function(FT_TEST))
+	if ((*nitr_)->get_function(FT_TEST) || (*nitr_)->get_function(FT_BENCH))
 	{
 	    assigns_ = (*nitr_)->create_assignments();
 	    return;		    // found a node
@@ -158,6 +287,49 @@ np_plan_add_specs(np_plan_t *plan, int nspec, const char **spec)
     return plan->add_specs(nspec, spec);
 }
 
+/**
+ * Restrict the plan to one shard of its tests.  The tests are split
+ * between @a n shards so that running the same plan @a n times, once
+ * with each value of @a k from 1 to @a n, runs every test (and every
+ * combination of parameter values) exactly once.  The runs can be on
+ * different machines.  If no test specifications are added to the
+ * plan, all the discovered tests are split.
+ *
+ * @param plan	    the plan object
+ * @param k	    which shard to run, from 1 to @a n
+ * @param n	    number of shards
+ * @return	    false if @a k or @a n is out of range, true on success.
+ *
+ * \ingroup main
+ */
+extern "C" bool
+np_plan_set_shard(np_plan_t *plan, unsigned int k, unsigned int n)
+{
+    return plan->set_shard(k, n);
+}
+
+/**
+ * Choose how a sharded plan splits its tests.  By default each test
+ * goes to a shard chosen from a hash of its name, which is stable
+ * but not balanced.  If @a path names a history file, the tests are
+ * dealt out so that every shard is expected to take about the same
+ * time, based on the test durations recorded in that file.  Every
+ * shard must be given an identical copy of the file, or tests may be
+ * missed, so copy the history from a previous run rather than using
+ * the live one.  Sharded runs never update the history.
+ *
+ * @param plan	    the plan object
+ * @param path	    history file to balance by, or NULL to hash
+ * @return	    false if the history file cannot be read, true on success.
+ *
+ * \ingroup main
+ */
+extern "C" bool
+np_plan_set_shard_history(np_plan_t *plan, const char *path)
+{
+    return plan->set_shard_history(path);
+}
+
 
 // close the namespace
 };
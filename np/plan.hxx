@@ -19,11 +19,13 @@
 #include "np/util/common.hxx"
 #include "np/testnode.hxx"
 #include <vector>
+#include <set>
 
 class np_testmanager_t;
 
 namespace np {
 
+class history_t;
 
 class plan_t : public np::util::zalloc
 {
@@ -33,13 +35,18 @@ public:
 
     void add_node(testnode_t *tn);
     bool add_specs(int nspec, const char **specs);
+    bool set_shard(unsigned int k, unsigned int n);
+    bool set_shard_history(const char *path);
+    unsigned int get_shard() const { return shard_; }
+    unsigned int get_nshards() const { return nshards_; }
 
     class iterator
     {
     public:
 	iterator() {}
 	iterator(const iterator &o)
-	 :  vitr_(o.vitr_),
+	 :  plan_(o.plan_),
+	    vitr_(o.vitr_),
 	    vend_(o.vend_),
 	    nitr_(o.nitr_),
 	    assigns_(o.assigns_)
@@ -47,6 +54,7 @@ public:
 	iterator &operator++();
 	iterator &operator=(const iterator &o)
 	{
+	    plan_ = o.plan_;
 	    vitr_ = o.vitr_;
 	    vend_ = o.vend_;
 	    nitr_ = o.nitr_;
@@ -68,10 +76,14 @@ public:
 	std::vector<testnode_t::assignment_t> const &get_assignments() const { return assigns_; }
 
     private:
-	iterator(std::vector<testnode_t*>::iterator first,
+	iterator(const plan_t *plan,
+		 std::vector<testnode_t*>::iterator first,
 		 std::vector<testnode_t*>::iterator last);
+	void next();
 	void find_testable_node();
+	void find_shard_job();
 
+	const plan_t *plan_;	/* or 0 to ignore sharding */
 	std::vector<testnode_t*>::iterator vitr_;
 	std::vector<testnode_t*>::iterator vend_;
 	testnode_t::preorder_iterator nitr_;
@@ -79,11 +91,20 @@ public:
 
 	friend class plan_t;
     };
-    iterator begin() { return iterator(nodes_.begin(), nodes_.end()); }
-    iterator end() { return iterator(nodes_.end(), nodes_.end()); }
+    bool empty() const { return nodes_.empty(); }
+    iterator begin();
+    iterator end() { return iterator(0, nodes_.end(), nodes_.end()); }
 
 private:
+    bool in_shard(const std::string &jobname) const;
+    void balance_shards();
+
     std::vector<testnode_t*> nodes_;
+    unsigned int shard_;	/* 1-based, or 0 if not sharded */
+    unsigned int nshards_;
+    history_t *history_;	/* frozen, when sharding by duration */
+    bool balanced_;
+    std::set<std::string> jobs_;    /* in this shard, when history_ */
 };
 
 // close the namespace
@@ -14,138 +14,128 @@
  * limitations under the License.
  */
 #include "np/proxy_listener.hxx"
+#include "np/job.hxx"
+#include "np/benchmark.hxx"
 #include "except.h"
 #include "np_priv.h"
 
 namespace np {
+using namespace std;
 
+/*
+ * The wire format is a sequence of frames, each a header of two
+ * native uint32_t words (payload length, frame type) followed by the
+ * payload, padded to a multiple of 4 bytes.  Filenames and function
+ * names are sent once per child in a PROXY_STRING frame and thereafter
+ * referred to by ID, with ID 0 meaning no string.  All the frames for
+ * one listener call are sent with a single writev() so the parent sees
+ * them arrive together.
+ */
 enum proxy_call
 {
     PROXY_INVALID = 0,
-    PROXY_EVENT = 1,
-    PROXY_FINISHED = 2,
+    PROXY_EVENT = 1,		/* which locflags lineno functype
+				   fileid funcid description\0 */
+    PROXY_FINISHED = 2,		/* result */
+    PROXY_STRING = 3,		/* id string\0 */
+    PROXY_BENCHMARK = 4,	/* benchmark_t */
+    PROXY_BASE_RSS = 5,		/* KiB */
 };
 
-/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+#define PROXY_HEADER_WORDS  2
+#define PROXY_EVENT_WORDS   6
+#define PROXY_MAX_FRAME	    (16*1024*1024)
+#define PROXY_READ_SIZE	    (64*1024)
+/* frames are padded so that every header is word aligned */
+#define PROXY_PAD(n)	    (((n) + sizeof(uint32_t)-1) & ~(sizeof(uint32_t)-1))
 
-static void
-serialise_uint(int fd, unsigned int i)
-{
-    write(fd, &i, sizeof(i));
-}
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
 
-static void
-serialise_string(int fd, const char *s)
+void
+proxy_listener_t::frame_t::add(uint32_t type,
+			       const uint32_t *words, unsigned int nwords,
+			       const char *tail, unsigned int taillen)
 {
-    unsigned int len = (s ? strlen(s) : 0);
-    serialise_uint(fd, len);
-    if (len)
-    {
-	write(fd, s, len);
-	write(fd, "\0", 1);
-    }
-}
+    uint32_t *hdr = words_ + nwords_;
 
-static void
-serialise_event(int fd, const event_t *ev)
-{
-    serialise_uint(fd, ev->which);
-    serialise_string(fd, ev->description);
-    serialise_uint(fd, ev->locflags);
-    serialise_string(fd, ev->filename);
-    serialise_uint(fd, ev->lineno);
-    serialise_string(fd, ev->function);
-    serialise_uint(fd, ev->functype);
-}
+    assert(nwords_ + PROXY_HEADER_WORDS + nwords <=
+	   sizeof(words_)/sizeof(words_[0]));
+    assert(niov_ + 3 <= sizeof(iov_)/sizeof(iov_[0]));
 
-static bool
-deserialise_bytes(int fd, char *p, unsigned int len)
-{
-    int r;
+    hdr[0] = nwords * sizeof(uint32_t) + taillen;
+    hdr[1] = type;
+    memcpy(hdr + PROXY_HEADER_WORDS, words, nwords * sizeof(uint32_t));
+    nwords_ += PROXY_HEADER_WORDS + nwords;
 
-    while (len)
+    iov_[niov_].iov_base = hdr;
+    iov_[niov_].iov_len = (PROXY_HEADER_WORDS + nwords) * sizeof(uint32_t);
+    niov_++;
+    if (taillen)
     {
-	r = read(fd, p, len);
-	if (r < 0) {
-	    perror("np: error reading from proxy");
-	    return false;
+	static const char zeroes[sizeof(uint32_t)] = { 0 };
+	iov_[niov_].iov_base = (void *)tail;
+	iov_[niov_].iov_len = taillen;
+	niov_++;
+	if (PROXY_PAD(taillen) != taillen)
+	{
+	    iov_[niov_].iov_base = (void *)zeroes;
+	    iov_[niov_].iov_len = PROXY_PAD(taillen) - taillen;
+	    niov_++;
 	}
-	if (r == 0) {
-	    fprintf(stderr, "np: unexpected EOF deserialising from proxy\n");
-	    return false;
-	}
-	len -= r;
-	p += r;
     }
-    return true;
 }
 
-static bool
-deserialise_uint(int fd, unsigned int *ip)
+/*
+ * Returns the ID for string @s, adding a PROXY_STRING frame
+ * to @frame the first time we see it.
+ */
+uint32_t
+proxy_listener_t::intern(frame_t &frame, const char *s)
 {
-    return deserialise_bytes(fd, (char *)ip, sizeof(*ip));
-}
+    if (!s)
+	return 0;
 
-static bool
-deserialise_string(int fd, char **buf)
-{
-    unsigned int len;
+    map<string, uint32_t>::iterator itr = strings_.find(s);
+    if (itr != strings_.end())
+	return itr->second;
 
-    if (!(deserialise_uint(fd, &len)))
-	return false;
-    *buf = (char *) malloc(sizeof(char) * (len + 1));
-    if (!len)
-    {
-        *buf[0] = '\0';
-        return true;
-    }
-    return deserialise_bytes(fd, *buf, len+1);
+    uint32_t id = strings_.size() + 1;
+    /* the map owns a copy, which outlives the writev() */
+    itr = strings_.insert(make_pair(string(s), id)).first;
+    frame.add(PROXY_STRING, &id, 1,
+	      itr->first.c_str(), itr->first.length()+1);
+    return id;
 }
 
-static bool
-deserialise_event(int fd, event_t *ev)
+void
+proxy_listener_t::flush(frame_t &frame)
 {
-    unsigned int which;
-    unsigned int locflags;
-    unsigned int lineno;
-    unsigned int ft;
-    char * description = NULL;
-    char * filename = NULL;
-    char * function = NULL;
-
-    if (!(deserialise_uint(fd, &which)))
-	return false;
-    if (!(deserialise_string(fd, &description)))
-	return false;
-    if (!(deserialise_uint(fd, &locflags)))
-	return false;
-    if (!(deserialise_string(fd, &filename)))
-	return false;
-    if (!(deserialise_uint(fd, &lineno)))
-	return false;
-    if (!(deserialise_string(fd, &function)))
-	return false;
-    if (!(deserialise_uint(fd, &ft)))
-	return false;
-    ev->which = (enum events_t)which;
-    ev->description = description;
-    ev->locflags = locflags;
-    ev->lineno = lineno;
-    ev->filename = filename;
-    ev->function = function;
-    ev->functype = (functype_t)ft;
-    return true;
-}
+    struct iovec *iov = frame.iov_;
+    unsigned int niov = frame.niov_;
 
-static void
-deserialise_event_cleanup(event_t *ev)
-{
-    if (ev->description)
-        free((void *)ev->description);
-    if (ev->filename)
-        free((void *)ev->filename);
-    if (ev->function)
-        free((void *)ev->function);
+    while (niov)
+    {
+	ssize_t r = writev(fd_, iov, niov);
+	if (r < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    perror("np: error writing to proxy");
+	    return;
+	}
+	/* skip over whatever was written, handling short writes */
+	while (niov && (size_t)r >= iov->iov_len)
+	{
+	    r -= iov->iov_len;
+	    iov++;
+	    niov--;
+	}
+	if (niov)
+	{
+	    iov->iov_base = (char *)iov->iov_base + r;
+	    iov->iov_len -= r;
+	}
+    }
 }
 
 /*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
@@ -178,71 +168,255 @@ void
 proxy_listener_t::end_job(const job_t *j __attribute__((unused)),
 			  result_t res)
 {
-    serialise_uint(fd_, PROXY_FINISHED);
-    serialise_uint(fd_, res);
+    frame_t frame;
+    uint32_t w = res;
+    frame.add(PROXY_FINISHED, &w, 1, 0, 0);
+    flush(frame);
 }
 
 void
 proxy_listener_t::add_event(const job_t *j __attribute__((unused)),
 			    const event_t *ev)
 {
-    serialise_uint(fd_, PROXY_EVENT);
-    serialise_event(fd_, ev);
+    frame_t frame;
+    uint32_t w[PROXY_EVENT_WORDS];
+    const char *desc = xstr(ev->description);
+
+    w[0] = ev->which;
+    w[1] = ev->locflags;
+    w[2] = ev->lineno;
+    w[3] = ev->functype;
+    w[4] = intern(frame, ev->filename);
+    w[5] = intern(frame, ev->function);
+    frame.add(PROXY_EVENT, w, PROXY_EVENT_WORDS, desc, strlen(desc)+1);
+    flush(frame);
 }
 
-/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+/*
+ * Format the frames for @a ev into @a buf, to be written to the
+ * event pipe later when it's not safe to allocate memory.  The event
+ * can't have a filename or function, which would need interning.
+ * Returns the length, or 0 if it doesn't fit.
+ */
+size_t
+proxy_listener_t::format_event(const event_t *ev, char *buf, size_t maxlen)
+{
+    frame_t frame;
+    uint32_t w[PROXY_EVENT_WORDS];
+    const char *desc = xstr(ev->description);
+
+    assert(!ev->filename && !ev->function);
+    w[0] = ev->which;
+    w[1] = ev->locflags;
+    w[2] = ev->lineno;
+    w[3] = ev->functype;
+    w[4] = 0;
+    w[5] = 0;
+    frame.add(PROXY_EVENT, w, PROXY_EVENT_WORDS, desc, strlen(desc)+1);
+
+    size_t len = 0;
+    for (unsigned int i = 0 ; i < frame.niov_ ; i++)
+    {
+	if (len + frame.iov_[i].iov_len > maxlen)
+	    return 0;
+	memcpy(buf + len, frame.iov_[i].iov_base, frame.iov_[i].iov_len);
+	len += frame.iov_[i].iov_len;
+    }
+    return len;
+}
+
+void
+proxy_listener_t::add_benchmark(const job_t *j __attribute__((unused)),
+				const benchmark_t *b)
+{
+    frame_t frame;
+    uint32_t w[sizeof(benchmark_t)/sizeof(uint32_t)];
+    memcpy(w, b, sizeof(benchmark_t));
+    frame.add(PROXY_BENCHMARK, w, sizeof(w)/sizeof(w[0]), 0, 0);
+    flush(frame);
+}
 
 /*
- * Handles input on the read end of the event pipe.  Returns false
- * when we should stop calling it, which might be due to a normal
- * end of test condition (FINISHED proxy call) or to some error.
- * Updates *@resp if necessary.
+ * Tell the parent how much memory was resident in the child before
+ * the test ran, so it can tell how much the test itself used.
  */
-bool
-proxy_listener_t::handle_call(int fd, job_t *j, result_t *resp)
+void
+proxy_listener_t::base_rss(unsigned long kib)
+{
+    frame_t frame;
+    uint32_t w = kib;
+    frame.add(PROXY_BASE_RSS, &w, 1, 0, 0);
+    flush(frame);
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+proxy_decoder_t::proxy_decoder_t(int fd)
+ :  fd_(fd),
+    start_(0),
+    end_(0),
+    nread_(0)
+{
+}
+
+proxy_decoder_t::~proxy_decoder_t()
 {
-    unsigned int which = PROXY_INVALID;
-    event_t ev;
-    unsigned int res;
+}
 
+proxy_decoder_t::status_t
+proxy_decoder_t::handle_frame(uint32_t type, const char *p, uint32_t len,
+			      job_t *j, result_t *resp)
+{
+    const uint32_t *w = (const uint32_t *)p;
+
+    switch (type)
+    {
+    case PROXY_STRING:
 #if _NP_DEBUG
-    fprintf(stderr, "np: proxy_listener_t::handle_call()\n");
+	fprintf(stderr, "np: deserializing STRING\n");
 #endif
-    if (deserialise_uint(fd, &which))
+	if (len <= sizeof(uint32_t) || p[len-1] != '\0' ||
+	    w[0] != strings_.size() + 1)
+	    break;
+	strings_.push_back(string(p + sizeof(uint32_t)));
+	return ST_MORE;
+
+    case PROXY_EVENT:
     {
-        switch (which)
-        {
-        case PROXY_EVENT:
 #if _NP_DEBUG
-            fprintf(stderr, "np: deserializing EVENT\n");
+	fprintf(stderr, "np: deserializing EVENT\n");
 #endif
-            if (deserialise_event(fd, &ev))
-            {
-                *resp = merge(*resp, np::runner_t::running()->raise_event(j, &ev));
-                deserialise_event_cleanup(&ev);
-                return true;  /* call me again */
-            }
-            deserialise_event_cleanup(&ev);
-            break;
-        case PROXY_FINISHED:
+	size_t fixed = PROXY_EVENT_WORDS * sizeof(uint32_t);
+	if (len <= fixed || p[len-1] != '\0' ||
+	    w[4] > strings_.size() || w[5] > strings_.size())
+	    break;
+	event_t ev;
+	ev.which = (enum events_t)w[0];
+	ev.locflags = w[1];
+	ev.lineno = w[2];
+	ev.functype = (functype_t)w[3];
+	ev.filename = (w[4] ? strings_[w[4]-1].c_str() : "");
+	ev.function = (w[5] ? strings_[w[5]-1].c_str() : "");
+	ev.description = p + fixed;
+	*resp = merge(*resp, np::runner_t::running()->raise_event(j, &ev));
+	return ST_MORE;
+    }
+
+    case PROXY_BENCHMARK:
+    {
+#if _NP_DEBUG
+	fprintf(stderr, "np: deserializing BENCHMARK\n");
+#endif
+	if (len != sizeof(benchmark_t))
+	    break;
+	benchmark_t b;
+	memcpy(&b, p, sizeof(b));
+	*resp = merge(*resp, np::runner_t::running()->add_benchmark(j, &b));
+	return ST_MORE;
+    }
+
+    case PROXY_BASE_RSS:
+#if _NP_DEBUG
+	fprintf(stderr, "np: deserializing BASE_RSS\n");
+#endif
+	if (len != sizeof(uint32_t))
+	    break;
+	j->set_base_rss(w[0]);
+	return ST_MORE;
+
+    case PROXY_FINISHED:
+#if _NP_DEBUG
+	fprintf(stderr, "np: deserializing FINISHED\n");
+#endif
+	if (len != sizeof(uint32_t))
+	    break;
+	*resp = merge(*resp, (result_t)w[0]);
+	return ST_FINISHED;   /* end of test, expect no more calls */
+
+    default:
+	break;
+    }
+
+    fprintf(stderr, "np: can't decode proxy call (which=%u)\n", type);
+    return ST_ERROR;
+}
+
+/*
+ * Handles input on the read end of the event pipe.  Reads whatever is
+ * available and decodes all the complete frames.  Returns false when
+ * we should stop calling it, which might be due to a normal end of
+ * test condition (FINISHED proxy call) or to some error.  Updates
+ * *@resp if necessary.
+ */
+bool
+proxy_decoder_t::handle_input(job_t *j, result_t *resp)
+{
 #if _NP_DEBUG
-            fprintf(stderr, "np: deserializing FINISHED\n");
+    fprintf(stderr, "np: proxy_decoder_t::handle_input()\n");
 #endif
-            if (deserialise_uint(fd, &res))
-            {
-                *resp = merge(*resp, (result_t)res);
-                return false;	      /* end of test, expect no more calls */
-            }
-            break;
-        default:
-            break;
-        }
+
+    /* make room for a decent sized read */
+    if (start_ == end_)
+	start_ = end_ = 0;
+    if (buf_.size() - end_ < PROXY_READ_SIZE)
+    {
+	if (start_)
+	{
+	    memmove(&buf_[0], &buf_[start_], end_ - start_);
+	    end_ -= start_;
+	    start_ = 0;
+	}
+	if (buf_.size() - end_ < PROXY_READ_SIZE)
+	    buf_.resize(end_ + PROXY_READ_SIZE);
     }
 
-    /* Decoding failed somehow so fail the test and tell the user */
-    *resp = merge(*resp, R_FAIL);
-    fprintf(stderr, "np: can't decode proxy call (which=%u)\n", which);
-    return false;
+    ssize_t r = read(fd_, &buf_[end_], buf_.size() - end_);
+    if (r < 0)
+    {
+	if (errno == EINTR || errno == EAGAIN)
+	    return true;
+	perror("np: error reading from proxy");
+	*resp = merge(*resp, R_FAIL);
+	return false;
+    }
+    if (r == 0)
+    {
+	fprintf(stderr, "np: unexpected EOF deserialising from proxy\n");
+	*resp = merge(*resp, R_FAIL);
+	return false;
+    }
+    end_ += r;
+    nread_ += r;
+
+    const size_t hdrlen = PROXY_HEADER_WORDS * sizeof(uint32_t);
+    while (end_ - start_ >= hdrlen)
+    {
+	uint32_t hdr[PROXY_HEADER_WORDS];
+	memcpy(hdr, &buf_[start_], hdrlen);
+	if (hdr[0] > PROXY_MAX_FRAME)
+	{
+	    fprintf(stderr, "np: can't decode proxy call (length=%u)\n", hdr[0]);
+	    *resp = merge(*resp, R_FAIL);
+	    return false;
+	}
+	if (end_ - start_ < hdrlen + PROXY_PAD(hdr[0]))
+	    break;	    /* partial frame, wait for more */
+
+	const char *p = &buf_[start_ + hdrlen];
+	start_ += hdrlen + PROXY_PAD(hdr[0]);
+
+	switch (handle_frame(hdr[1], p, hdr[0], j, resp))
+	{
+	case ST_MORE:
+	    break;
+	case ST_FINISHED:
+	    return false;
+	case ST_ERROR:
+	    *resp = merge(*resp, R_FAIL);
+	    return false;
+	}
+    }
+    return true;	/* call me again */
 }
 
 // close the namespace
@@ -18,6 +18,7 @@
 
 #include "np/util/common.hxx"
 #include "np/listener.hxx"
+#include <sys/uio.h>
 
 namespace np {
 
@@ -32,12 +33,56 @@ public:
     void begin_job(const job_t *);
     void end_job(const job_t *, result_t);
     void add_event(const job_t *, const event_t *ev);
+    void add_benchmark(const job_t *, const benchmark_t *);
 
-    /* proxyl.c */
-    static bool handle_call(int fd, job_t *, result_t *resp);
+    static size_t format_event(const event_t *ev, char *buf, size_t maxlen);
+    void base_rss(unsigned long kib);
 
 private:
+    struct frame_t
+    {
+	frame_t() : nwords_(0), niov_(0) {}
+
+	void add(uint32_t type, const uint32_t *words, unsigned int nwords,
+		 const char *tail, unsigned int taillen);
+
+	uint32_t words_[24];
+	unsigned int nwords_;
+	struct iovec iov_[9];
+	unsigned int niov_;
+    };
+
+    uint32_t intern(frame_t &, const char *);
+    void flush(frame_t &);
+
+    int fd_;
+    std::map<std::string, uint32_t> strings_;
+};
+
+/*
+ * Parent side of the proxy protocol.  Decodes frames from the read
+ * end of the event pipe, buffering partial frames across calls.
+ */
+class proxy_decoder_t
+{
+public:
+    proxy_decoder_t(int fd);
+    ~proxy_decoder_t();
+
+    bool handle_input(job_t *, result_t *resp);
+    size_t get_bytes_read() const { return nread_; }
+
+private:
+    enum status_t { ST_MORE, ST_FINISHED, ST_ERROR };
+    status_t handle_frame(uint32_t type, const char *p, uint32_t len,
+			  job_t *, result_t *resp);
+
     int fd_;
+    std::vector<char> buf_;
+    size_t start_;	    /* first undecoded byte in buf_ */
+    size_t end_;	    /* first unused byte in buf_ */
+    size_t nread_;	    /* total bytes read from fd_ */
+    std::vector<std::string> strings_;
 };
 
 // close the namespace
@@ -25,12 +25,21 @@ namespace np {
 class redirect_t : public spiegel::intercept_t
 {
 public:
-    redirect_t(spiegel::addr_t from, const char *fromname, spiegel::addr_t to)
+    /*
+     * With @got the redirect only has to catch calls from other link
+     * objects, so if @from is in a shared library it can be done by
+     * patching the callers' GOT slots instead of trapping every call.
+     */
+    redirect_t(spiegel::addr_t from, const char *fromname, spiegel::addr_t to,
+	       bool got = false)
      :  intercept_t(from, fromname),
-	to_(to)
+	to_(to),
+	got_(got)
     {}
     ~redirect_t() {}
 
+    spiegel::addr_t get_got_redirect() const { return (got_ ? to_ : 0); }
+
     void before(spiegel::call_t &call)
     {
 	call.redirect(to_);
@@ -39,6 +48,7 @@ public:
 
 private:
     spiegel::addr_t to_;
+    bool got_;
 };
 
 // close the namespace
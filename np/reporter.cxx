@@ -0,0 +1,263 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np/reporter.hxx"
+#include "np/listener.hxx"
+#include "np/event.hxx"
+#include "np/job.hxx"
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace np {
+using namespace std;
+
+reporter_t::reporter_t(const vector<listener_t*> *listeners)
+ :  listeners_(listeners)
+{
+    pthread_mutex_init(&mutex_, 0);
+    pthread_cond_init(&work_cond_, 0);
+    pthread_cond_init(&space_cond_, 0);
+    void *p = mmap(0, sizeof(gate_t), PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	perror("np: mmap");
+    else
+    {
+	gate_ = (gate_t *)p;
+	gate_->pid_ = getpid();
+    }
+}
+
+reporter_t::~reporter_t()
+{
+    stop();
+    pthread_mutex_destroy(&mutex_);
+    pthread_cond_destroy(&work_cond_);
+    pthread_cond_destroy(&space_cond_);
+    if (gate_)
+	munmap(gate_, sizeof(gate_t));
+}
+
+/*
+ * Start the thread.  Returns false if it couldn't be started, in
+ * which case the caller should call the listeners itself.
+ */
+bool
+reporter_t::start()
+{
+    /* Signals are for the runner's thread; in particular SIGCHLD
+     * must stay blocked everywhere for its signalfd to see it. */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    stopping_ = false;
+    int r = pthread_create(&thread_, 0, thread_main, this);
+    pthread_sigmask(SIG_SETMASK, &saved, 0);
+    if (r)
+    {
+	fprintf(stderr, "np: cannot start reporter thread: %s\n", strerror(r));
+	return false;
+    }
+    running_ = true;
+    return true;
+}
+
+/*
+ * Deliver everything still queued, then stop the thread.
+ */
+void
+reporter_t::stop()
+{
+    if (!running_)
+	return;
+    pthread_mutex_lock(&mutex_);
+    stopping_ = true;
+    pthread_cond_signal(&work_cond_);
+    pthread_mutex_unlock(&mutex_);
+    pthread_join(thread_, 0);
+    running_ = false;
+}
+
+void *
+reporter_t::thread_main(void *closure)
+{
+    ((reporter_t *)closure)->run();
+    return 0;
+}
+
+void
+reporter_t::run()
+{
+    pthread_mutex_lock(&mutex_);
+    for (;;)
+    {
+	while (!queue_.size() && !stopping_)
+	    pthread_cond_wait(&work_cond_, &mutex_);
+	if (!queue_.size())
+	    break;	/* stopping, and nothing left to deliver */
+
+	record_t rec = queue_.front();
+	queue_.pop_front();
+	busy_ = true;
+	pthread_mutex_unlock(&mutex_);
+
+	dispatch(rec);
+
+	pthread_mutex_lock(&mutex_);
+	busy_ = false;
+	pthread_cond_broadcast(&space_cond_);
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+void
+reporter_t::dispatch(const record_t &rec)
+{
+    vector<listener_t*>::const_iterator i;
+    for (i = listeners_->begin() ; i != listeners_->end() ; ++i)
+    {
+	switch (rec.kind_)
+	{
+	case record_t::BEGIN_JOB:
+	    (*i)->begin_job(rec.job_);
+	    break;
+	case record_t::EVENT:
+	    (*i)->add_event(rec.job_, rec.event_);
+	    break;
+	case record_t::RESOURCES:
+	    (*i)->job_resources(rec.job_, &rec.rusage_);
+	    break;
+	case record_t::BENCHMARK:
+	    (*i)->add_benchmark(rec.job_, &rec.benchmark_);
+	    break;
+	case record_t::END_JOB:
+	    (*i)->end_job(rec.job_, rec.result_);
+	    break;
+	case record_t::SKIP_JOB:
+	    (*i)->skip_job(rec.job_);
+	    break;
+	}
+    }
+
+    if (rec.kind_ == record_t::BEGIN_JOB && gate_)
+    {
+	/* the listeners are done with it, let its process go */
+	__sync_synchronize();
+	gate_->begun_ = rec.ticket_;
+	syscall(SYS_futex, &gate_->begun_, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+    }
+
+    /* the records own these */
+    delete rec.event_;
+    delete rec.job_;
+}
+
+void
+reporter_t::post(const record_t &rec)
+{
+    pthread_mutex_lock(&mutex_);
+    while (queue_.size() >= MAX_QUEUED)
+	pthread_cond_wait(&space_cond_, &mutex_);
+    queue_.push_back(rec);
+    pthread_cond_signal(&work_cond_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+void
+reporter_t::sync()
+{
+    pthread_mutex_lock(&mutex_);
+    while (queue_.size() || busy_)
+	pthread_cond_wait(&space_cond_, &mutex_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+uint32_t
+reporter_t::begin_job(const job_t *j)
+{
+    record_t rec(record_t::BEGIN_JOB, j->snapshot());
+    /* only ever called from the runner's thread */
+    rec.ticket_ = ++next_ticket_;
+    if (!rec.ticket_)
+	rec.ticket_ = ++next_ticket_;	/* 0 means don't wait */
+    post(rec);
+    return rec.ticket_;
+}
+
+/*
+ * Called in a job's process before it runs any test code.  Gives up
+ * if the runner has gone away, as the listeners never will announce
+ * the job then.
+ */
+void
+reporter_t::wait_begun(const gate_t *gate, uint32_t ticket)
+{
+    for (;;)
+    {
+	uint32_t begun = gate->begun_;
+	/* tickets wrap, so compare by distance */
+	if ((int32_t)(begun - ticket) >= 0)
+	    break;
+	struct timespec ts = { 1, 0 };
+	if (syscall(SYS_futex, &gate->begun_, FUTEX_WAIT, begun, &ts, 0, 0) < 0 &&
+	    errno == ETIMEDOUT &&
+	    kill(gate->pid_, 0) < 0 && errno == ESRCH)
+	    break;
+    }
+    __sync_synchronize();
+}
+
+void
+reporter_t::add_event(const job_t *j, const event_t *ev)
+{
+    record_t rec(record_t::EVENT, j->snapshot());
+    rec.event_ = ev->clone();
+    post(rec);
+}
+
+void
+reporter_t::job_resources(const job_t *j, const struct rusage *ru)
+{
+    record_t rec(record_t::RESOURCES, j->snapshot());
+    rec.rusage_ = *ru;
+    post(rec);
+}
+
+void
+reporter_t::add_benchmark(const job_t *j, const benchmark_t *b)
+{
+    record_t rec(record_t::BENCHMARK, j->snapshot());
+    rec.benchmark_ = *b;
+    post(rec);
+}
+
+void
+reporter_t::end_job(job_t *j, result_t res)
+{
+    record_t rec(record_t::END_JOB, j);
+    rec.result_ = res;
+    post(rec);
+}
+
+void
+reporter_t::skip_job(job_t *j)
+{
+    post(record_t(record_t::SKIP_JOB, j));
+}
+
+// close the namespace
+};
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __NP_REPORTER_H__
+#define __NP_REPORTER_H__ 1
+
+#include "np/util/common.hxx"
+#include "np/types.hxx"
+#include "np/benchmark.hxx"
+#include <sys/resource.h>
+#include <pthread.h>
+#include <vector>
+#include <deque>
+
+namespace np {
+
+class event_t;
+class job_t;
+class listener_t;
+
+/*
+ * Passes what happens to each job on to the listeners from a thread
+ * of its own, so that a slow listener, e.g. one writing to a blocked
+ * stderr pipe, doesn't hold up the runner reaping children and
+ * starting new jobs.  The runner queues records which the thread
+ * delivers in the same order.  Until a job has ended the runner is
+ * still changing it, so each record carries a snapshot of the job
+ * taken when it was queued; after that the record owns the job.
+ * The queue is bounded, so a runner which gets too far ahead of the
+ * listeners waits for them.
+ *
+ * A test whose output goes straight to ours must not write anything
+ * before the listeners have announced it.  Rather than the runner
+ * waiting for that, each job begun is given a ticket, and the thread
+ * publishes the ticket of the last job it announced in a page shared
+ * with every process forked afterward, where the job's process waits
+ * for it with wait_begun().
+ */
+class reporter_t : public np::util::zalloc
+{
+public:
+    reporter_t(const std::vector<listener_t*> *);
+    ~reporter_t();
+
+    bool start();
+    void stop();
+
+    struct gate_t
+    {
+	volatile uint32_t begun_;   /* ticket of the last job announced */
+	pid_t pid_;		    /* the runner */
+    };
+
+    /* returns the job's ticket */
+    uint32_t begin_job(const job_t *);
+    void add_event(const job_t *, const event_t *);
+    void job_resources(const job_t *, const struct rusage *);
+    void add_benchmark(const job_t *, const benchmark_t *);
+    void end_job(job_t *, result_t);
+    void skip_job(job_t *);
+
+    /* wait until the listeners have seen everything queued */
+    void sync();
+    const gate_t *get_gate() const { return gate_; }
+    /* wait until the listeners have announced the job with @a ticket */
+    static void wait_begun(const gate_t *, uint32_t ticket);
+
+private:
+    struct record_t
+    {
+	enum kind_t
+	{
+	    BEGIN_JOB,
+	    EVENT,
+	    RESOURCES,
+	    BENCHMARK,
+	    END_JOB,
+	    SKIP_JOB
+	};
+
+	record_t(kind_t k, const job_t *j)
+	 :  kind_(k),
+	    job_(j),
+	    event_(0),
+	    result_(R_UNKNOWN),
+	    ticket_(0)
+	{
+	    memset(&rusage_, 0, sizeof(rusage_));
+	    memset(&benchmark_, 0, sizeof(benchmark_));
+	}
+
+	kind_t kind_;
+	const job_t *job_;	    /* owned */
+	event_t *event_;	    /* a copy, for EVENT */
+	result_t result_;	    /* for END_JOB */
+	struct rusage rusage_;	    /* for RESOURCES */
+	benchmark_t benchmark_;	    /* for BENCHMARK */
+	uint32_t ticket_;	    /* for BEGIN_JOB */
+    };
+
+    static const unsigned int MAX_QUEUED = 1024;
+
+    void post(const record_t &);
+    void dispatch(const record_t &);
+    static void *thread_main(void *);
+    void run();
+
+    const std::vector<listener_t*> *listeners_;
+    pthread_t thread_;
+    bool running_;
+    pthread_mutex_t mutex_;	    /* protects the rest */
+    pthread_cond_t work_cond_;	    /* a record was queued, or stopping */
+    pthread_cond_t space_cond_;	    /* a record was delivered */
+    std::deque<record_t> queue_;
+    bool busy_;			    /* delivering a record */
+    bool stopping_;
+    uint32_t next_ticket_;
+    gate_t *gate_;		    /* shared with our children */
+};
+
+// close the namespace
+};
+
+#endif /* __NP_REPORTER_H__ */
@@ -21,14 +21,30 @@
 #include "np/proxy_listener.hxx"
 #include "np/junit_listener.hxx"
 #include "np/child.hxx"
+#include "np/leak_tracker.hxx"
+#include "np/governor.hxx"
+#include "np/reporter.hxx"
 #include "np/spiegel/spiegel.hxx"
 #include "np_priv.h"
 #include "except.h"
 #if HAVE_VALGRIND
 #include <valgrind/memcheck.h>
 #endif
-
-__np_exceptstate_t __np_exceptstate;
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio_ext.h>
+#include <algorithm>
+#include <functional>
+
+static __np_exceptstate_t main_exceptstate;
+__thread __np_exceptstate_t *__np_exceptstatep = &main_exceptstate;
 
 void __np_uncaught_event(void)
 {
@@ -39,6 +55,25 @@ void __np_uncaught_event(void)
     abort();
 }
 
+/*
+ * Test executables built with -fsanitize=address contain the ASan
+ * runtime, which these weak references find when it's there.
+ */
+extern "C" {
+extern void __asan_set_error_report_callback(void (*)(const char *))
+    __attribute__((weak));
+extern int __lsan_do_recoverable_leak_check(void) __attribute__((weak));
+
+/* Leaks are checked after each test, so the usual check at exit
+ * would only find the runner's own.  The test executable can
+ * still define this itself. */
+__attribute__((weak)) const char *
+__lsan_default_options(void)
+{
+    return "leak_check_at_exit=0";
+}
+};
+
 namespace np {
 using namespace std;
 using namespace np::util;
@@ -52,6 +87,9 @@ using namespace np::util;
 
 runner_t *runner_t::running_;
 
+/* where a thread running a test sends its events, see run_thread_job() */
+static __thread listener_t *thread_listener;
+
 static int
 choose_timeout()
 {
@@ -68,17 +106,150 @@ choose_timeout()
     return timeout;
 }
 
+/*
+ * Our own leak tracker slows down every allocation, so it's only
+ * used when asked for, and nothing better is watching the heap.
+ */
+static bool
+choose_leak_tracker()
+{
+    if (__lsan_do_recoverable_leak_check)
+	return false;
+#if HAVE_VALGRIND
+    if (RUNNING_ON_VALGRIND)
+	return false;
+#endif
+    const char *env = getenv("NOVAPROVA_LEAKCHECK");
+    return (env && !strcmp(env, "yes"));
+}
+
+/*
+ * Tests may be failed for using too much CPU time or memory, but
+ * the figures mean nothing when Valgrind is running the test.
+ */
+static void
+choose_resource_limits(int64_t *max_cpu, long *max_rss)
+{
+#if HAVE_VALGRIND
+    if (RUNNING_ON_VALGRIND)
+	return;
+#endif
+    const char *env = getenv("NOVAPROVA_MAX_CPU");
+    if (env && *env)
+	*max_cpu = strtoll(env, 0, 0) * (NANOSEC_PER_SEC/1000);
+    env = getenv("NOVAPROVA_MAX_RSS");
+    if (env && *env)
+	*max_rss = strtol(env, 0, 0);
+}
+
+/*
+ * Default resource limits for each test, from the environment.
+ */
+static void
+choose_limits(unsigned long *limits)
+{
+    static const char * const vars[L_NUM] =
+    {
+	"NOVAPROVA_LIMIT_CPU", "NOVAPROVA_LIMIT_MEM",
+	"NOVAPROVA_LIMIT_NOFILE", "NOVAPROVA_LIMIT_FSIZE"
+    };
+    for (int i = 0 ; i < L_NUM ; i++)
+    {
+	const char *env = getenv(vars[i]);
+	if (env && *env)
+	    limits[i] = strtoul(env, 0, 0);
+    }
+}
+
+/*
+ * How many jobs each worker process runs before it's replaced,
+ * or 0 to fork every job from the runner itself.
+ */
+static unsigned int
+choose_workers()
+{
+    const char *env = getenv("NOVAPROVA_WORKERS");
+    if (!env || !*env || !strcmp(env, "no"))
+	return 0;
+    if (!strcmp(env, "yes"))
+	return 1000;
+    return strtoul(env, 0, 0);
+}
+
+/*
+ * Whether tests marked with NP_THREADED may be run in threads.
+ */
+static bool
+choose_threads()
+{
+    const char *env = getenv("NOVAPROVA_THREADED");
+    return !(env && !strcmp(env, "no"));
+}
+
+/*
+ * Whether child exits may be noticed with pidfds, if the kernel
+ * has them.  Setting NOVAPROVA_PIDFD=no forces the signalfd
+ * fallback, so the tests can cover it.
+ */
+static bool
+choose_pidfds()
+{
+    const char *env = getenv("NOVAPROVA_PIDFD");
+    return !(env && !strcmp(env, "no"));
+}
+
 runner_t::runner_t()
 {
     maxchildren_ = 1;
     timeout_ = choose_timeout();
+    epoll_fd_ = -1;
+    sigchld_fd_ = -1;
+    rerun_cache_fd_ = -1;
+#if HAVE_VALGRIND
+    const char *env = getenv("NOVAPROVA_VALGRIND");
+    if (env && !strcmp(env, "failed") && !RUNNING_ON_VALGRIND &&
+	!np::spiegel::platform::is_running_under_debugger())
+    {
+	valgrind_rerun_ = true;
+	env = getenv("NOVAPROVA_VALGRIND_SAMPLE");
+	if (env && *env)
+	    valgrind_sample_ = atoi(env);
+    }
+#endif
+    leak_tracker_t::set_enabled(choose_leak_tracker());
+    choose_resource_limits(&max_cpu_, &max_rss_);
+    choose_limits(limits_);
+    worker_jobs_ = choose_workers();
+    threads_ = choose_threads();
 }
 
 runner_t::~runner_t()
 {
+    delete reporter_;
+    delete governor_;
     destroy_listeners();
 }
 
+/*
+ * Stop the run after @n tests have failed, or never if @n is 0.
+ */
+void
+runner_t::set_fail_fast(unsigned int n)
+{
+    fail_fast_ = n;
+}
+
+/*
+ * Set the default for one of the resource limits applied to each
+ * test, which tests may override with NP_LIMIT().  A @value of 0
+ * means no limit.
+ */
+void
+runner_t::set_limit(limit_t which, unsigned long value)
+{
+    limits_[which] = value;
+}
+
 void
 runner_t::set_concurrency(int n)
 {
@@ -90,6 +261,40 @@ runner_t::set_concurrency(int n)
     if (n < 1)
 	n = 1;
     maxchildren_ = n;
+    delete governor_;
+    governor_ = 0;
+}
+
+/*
+ * Let the number of jobs run at once vary between @min and @max,
+ * depending on the load on the system.  A @max of 0 means a few
+ * jobs per online CPU.
+ */
+void
+runner_t::set_concurrency_range(int min, int max)
+{
+    if (max == 0)
+	max = 4 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (min < 1)
+	min = 1;
+    if (max < min)
+	max = min;
+    maxchildren_ = max;
+    delete governor_;
+    governor_ = new governor_t(min, max);
+}
+
+/* How many jobs may be running right now */
+unsigned int
+runner_t::concurrency_limit()
+{
+    if (!governor_)
+	return maxchildren_;
+    vector<pid_t> pids;
+    map<pid_t, child_t*>::iterator itr;
+    for (itr = children_.begin() ; itr != children_.end() ; ++itr)
+	pids.push_back(itr->first);
+    return governor_->update(pids);
 }
 
 void
@@ -100,9 +305,11 @@ runner_t::list_tests(plan_t *plan) const
     {
 	/* build a default plan with all the tests */
 	plan = new plan_t();
-	plan->add_node(testmanager_t::instance()->get_root());
 	ourplan = true;
     }
+    /* a plan without any specs covers all the tests */
+    if (plan->empty())
+	plan->add_node(testmanager_t::instance()->get_root());
 
     /* iterate over all tests */
     testnode_t *tn = 0;
@@ -122,35 +329,109 @@ runner_t::list_tests(plan_t *plan) const
 	delete plan;
 }
 
+struct scheduled_t
+{
+    bool failed_;	/* failed last time */
+    int64_t expected_;	/* how long it took last time */
+    job_t *job_;
+};
+
+struct schedule_order
+{
+    bool longest_first_;
+
+    schedule_order(bool lf) : longest_first_(lf) {}
+    bool operator()(const scheduled_t &a, const scheduled_t &b) const
+    {
+	if (a.failed_ != b.failed_)
+	    return a.failed_;
+	return (longest_first_ && a.expected_ > b.expected_);
+    }
+};
+
+/*
+ * Return the jobs in the plan in the order they should be started.
+ * A serial run keeps the plan's order, so its output is the same
+ * every time.  When running several jobs at once, or stopping at
+ * the first failures, jobs which failed last time go first, so
+ * that a developer finds out as soon as possible whether they're
+ * still failing.  When running several jobs at once, the ones
+ * which took longest last time go next, so that they don't hold
+ * up the end of the run.
+ */
+vector<job_t*>
+runner_t::schedule_jobs(plan_t *plan)
+{
+    vector<scheduled_t> sched;
+    plan_t::iterator pitr = plan->begin();
+    plan_t::iterator pend = plan->end();
+    for ( ; pitr != pend ; ++pitr)
+    {
+	scheduled_t s;
+	s.job_ = new job_t(pitr);
+	string name = s.job_->as_string();
+	s.failed_ = history_.get_failed(name);
+	s.expected_ = history_.get_expected(name);
+	sched.push_back(s);
+    }
+
+    if (maxchildren_ > 1 || fail_fast_)
+	stable_sort(sched.begin(), sched.end(), schedule_order(maxchildren_ > 1));
+
+    vector<job_t*> jobs;
+    jobs.reserve(sched.size());
+    vector<scheduled_t>::iterator i;
+    for (i = sched.begin() ; i != sched.end() ; ++i)
+	jobs.push_back(i->job_);
+    return jobs;
+}
+
 int
 runner_t::run_tests(plan_t *plan)
 {
+    const char *rerun = getenv("__NP_RERUN");
+    if (rerun)
+	rerun_job(rerun);
+
     bool ourplan = false;
     if (!plan)
     {
 	/* build a default plan with all the tests */
 	plan =  new plan_t();
-	plan->add_node(testmanager_t::instance()->get_root());
 	ourplan = true;
     }
+    /* a plan without any specs covers all the tests */
+    if (plan->empty())
+	plan->add_node(testmanager_t::instance()->get_root());
 
     if (!listeners_.size())
 	add_listener(new text_listener_t);
 
-    begin();
-    plan_t::iterator pitr = plan->begin();
-    plan_t::iterator pend = plan->end();
+    begin(plan);
+    vector<job_t*> jobs = schedule_jobs(plan);
+    vector<job_t*>::iterator jitr = jobs.begin();
     for (;;)
     {
-	while (children_.size() < maxchildren_ && pitr != pend)
+	while (!cancelled_ &&
+	       children_.size() + npending_ < concurrency_limit() &&
+	       jitr != jobs.end())
 	{
-	    begin_job(new job_t(pitr));
-	    ++pitr;
+	    begin_job(*jitr);
+	    ++jitr;
 	}
-	if (!children_.size())
+	if (!children_.size() && !npending_)
 	    break;
+	/* with jobs waiting, look again later in case we can start more */
+	tick_ = (governor_ && !cancelled_ && jitr != jobs.end() ?
+		 governor_->get_next_sample() : 0);
 	wait();
+	if (fail_fast_ && nfailed_ >= fail_fast_ && !cancelled_)
+	    cancel_children();
     }
+    tick_ = 0;
+    /* jobs we never started because we gave up early */
+    for ( ; jitr != jobs.end() ; ++jitr)
+	skip_job(*jitr);
     end();
 
     if (ourplan)
@@ -185,31 +466,118 @@ runner_t::set_listener(listener_t *l)
     listeners_.push_back(l);
 }
 
-static volatile int caught_sigchld = 0;
-static void
-handle_sigchld(int sig __attribute__((unused)))
+/*
+ * What an epoll registration refers to.  The pid and kind are packed
+ * into the epoll data so that stale events for a child we've already
+ * reaped can be recognised and ignored.
+ */
+enum watch_kind_t
+{
+    WK_EVENTS,		/* read end of a child's event pipe */
+    WK_PIDFD,		/* a child's pidfd, readable when it exits */
+    WK_SIGCHLD,		/* the signalfd fallback, readable on SIGCHLD */
+    WK_WORKER,		/* our end of a worker's control socket */
+};
+#define WATCH_DATA(pid, kind)	(((uint64_t)(pid) << 2) | (kind))
+#define WATCH_PID(d)		((pid_t)((d) >> 2))
+#define WATCH_KIND(d)		((unsigned int)((d) & 3))
+
+static int
+open_pidfd(pid_t pid)
 {
-    caught_sigchld = 1;
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
 }
 
 void
-runner_t::begin()
+runner_t::begin(plan_t *plan)
 {
-    static bool init = false;
-
-    if (!init)
+    if (epoll_fd_ < 0)
     {
-	signal(SIGCHLD, handle_sigchld);
-	init = true;
+	epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd_ < 0)
+	{
+	    perror("np: epoll_create1");
+	    exit(1);
+	}
+
+	/* If the kernel can't give us pidfds, learn about child
+	 * exits from a signalfd instead. */
+	int pidfd = (choose_pidfds() ? open_pidfd(getpid()) : -1);
+	if (pidfd >= 0)
+	{
+	    close(pidfd);
+	}
+	else
+	{
+	    sigset_t mask;
+	    sigemptyset(&mask);
+	    sigaddset(&mask, SIGCHLD);
+	    sigprocmask(SIG_BLOCK, &mask, NULL);
+	    sigchld_fd_ = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+	    if (sigchld_fd_ < 0)
+	    {
+		perror("np: signalfd");
+		exit(1);
+	    }
+	    watch_fd(sigchld_fd_, 0, WK_SIGCHLD);
+	}
     }
 
+    /* each shard runs only some of the jobs, so recording them
+     * would make the history depend on which shard ran last */
+    history_.load(plan->get_nshards() > 1);
+    if (history_.is_saved())
+    {
+	/* keep the history of every test which still exists,
+	 * not just of the ones this run is going to run */
+	plan_t all;
+	all.add_node(testmanager_t::instance()->get_root());
+	plan_t::iterator pitr = all.begin();
+	plan_t::iterator pend = all.end();
+	for ( ; pitr != pend ; ++pitr)
+	    history_.add_known(job_t::as_string(pitr.get_node(), pitr.get_assignments()));
+    }
+    baseline_.load();
+    if (valgrind_rerun_ && rerun_cache_fd_ < 0)
+	rerun_cache_fd_ = testmanager_t::instance()->save_discoveries();
     running_ = this;
+    dispatch_listeners(set_plan, plan);
     dispatch_listeners(begin);
+
+    reporter_ = new reporter_t(&listeners_);
+    if (!reporter_->start())
+    {
+	delete reporter_;
+	reporter_ = 0;
+    }
+    gate_ = (reporter_ ? reporter_->get_gate() : 0);
 }
 
 void
 runner_t::end()
 {
+    if (reporter_)
+    {
+	/* let the listeners catch up */
+	reporter_->stop();
+	delete reporter_;
+	reporter_ = 0;
+	gate_ = 0;
+    }
+    end_workers();
+    end_suites();
+    if (rerun_cache_fd_ >= 0)
+    {
+	close(rerun_cache_fd_);
+	rerun_cache_fd_ = -1;
+    }
+    history_.save();
+    baseline_.save();
     dispatch_listeners(end);
     running_ = 0;
 }
@@ -220,15 +588,165 @@ runner_t::raise_event(job_t *j, const event_t *ev)
 {
     event_t n_ev;
     n_ev.normalise(ev);
-    dispatch_listeners(add_event, j, &n_ev);
+    /* when re-running a job under Valgrind, the first
+     * run already reported everything except this */
+    if (!rerun_ || n_ev.which == EV_VALGRIND)
+    {
+	if (thread_listener)
+	    thread_listener->add_event(j, &n_ev);
+	else if (reporter_)
+	    reporter_->add_event(j, &n_ev);
+	else
+	    dispatch_listeners(add_event, j, &n_ev);
+    }
     return n_ev.get_result();
 }
 
-static const char tmpfile_template[] = "/tmp/novaprova.out.XXXXXX";
-#define TMPFILE_MAX (sizeof(tmpfile_template))
+/*
+ * Suite fixtures run once, in a fork server process per test node
+ * with suite fixtures.  Every test at or below that node is then
+ * forked from the server, so it starts with whatever state the
+ * suite setup left behind, and the test's own changes are thrown
+ * away with its process as usual.  The server for a nested suite
+ * is forked from the server for the enclosing suite.
+ *
+ * The runner still supervises every test process directly.  It
+ * makes itself a child subreaper, and a server double-forks, so the
+ * test process is reparented to the runner when the intermediate
+ * process exits.  The server only replies with the new pid after
+ * that, so the runner can treat it like any child it forked itself.
+ *
+ * The server runs the suite setup before it reads the first request,
+ * so the runner waits for the first reply no longer than a test may
+ * run, and kills the server if the setup is still going.  When the
+ * runner is done with the server it shuts down its end of the socket,
+ * and the server runs the suite teardown and replies with what went
+ * wrong, if anything, which the runner reports as a job of its own.
+ */
+struct runner_t::suite_t
+{
+    testnode_t *node_;
+    pid_t pid_;		/* 0 once reaped */
+    int sock_;		/* our end of the control socket */
+    int64_t deadline_;	/* for the suite setup, 0 once it's done */
+    bool timed_out_;	/* killed for taking too long */
+};
+
+enum suite_request_kind_t
+{
+    SR_TEST,		/* fds: event pipe, optionally stdout & stderr */
+    SR_SUITE,		/* fds: control socket for a nested server */
+};
+
+/*
+ * Sent over a SOCK_SEQPACKET socket with the descriptors attached.
+ * The pointers are valid in the server because it was forked from
+ * the runner after the testnode tree was built.
+ */
+struct suite_request_t
+{
+    uint32_t kind;
+    uint32_t nassigns;
+    uint32_t ticket;	/* see job_t::get_ticket() */
+    testnode_t *node;
+    /* followed by nassigns testnode_t::assignment_t */
+};
+#define SUITE_MAXMSG	4096
+#define SUITE_MAXFDS	3
+
+/*
+ * With NOVAPROVA_WORKERS set, jobs outside any suite are not forked
+ * from the runner.  Instead a pool of worker processes is forked from
+ * it, up to one per job slot, and each worker forks a process for
+ * every job it's sent.  The runner then never has its large heap
+ * copied for a test, nor takes a copy-on-write fault for every page
+ * it touches after each fork, and several workers can be forking
+ * at once.
+ *
+ * Unlike a suite server, a worker doesn't hand the processes it
+ * forks over to the runner.  It waits for them itself and reports
+ * how they exited, so a job costs only the one fork.  The runner
+ * still reads their events, enforces timeouts and kills them, and
+ * as a child subreaper it inherits any left running if the worker
+ * dies.  A worker is replaced after it has been sent
+ * NOVAPROVA_WORKERS jobs, or after any of its jobs exits abnormally,
+ * in case the test disturbed some state they share.
+ *
+ * Tests marked with NP_THREADED are sent to a different kind of
+ * worker, a thread host, which starts a thread for each job instead
+ * of forking.  The thread's id stands in for a pid, so the runner
+ * supervises it like any other job, but the tests share the host's
+ * address space.  If one crashes, the host dies with all its
+ * threads, and the jobs which hadn't finished are run again in
+ * processes of their own, as is everything marked NP_THREADED after.
+ */
+struct runner_t::worker_t
+{
+    struct pending_t
+    {
+	job_t *job_;
+	int event_fd_;	/* read end of the job's event pipe */
+	int outfd_;
+	int errfd_;
+    };
+
+    pid_t pid_;
+    bool threaded_;	/* a thread host */
+    bool exited_;	/* reaped by reap_children() */
+    int status_;	/* how it exited, once reaped */
+    int sock_;		/* our end of the control socket */
+    unsigned int njobs_;	/* jobs sent so far */
+    bool retiring_;	/* will be sent no more jobs */
+    std::deque<pending_t> pending_;	/* sent but not started, in order */
+    std::set<pid_t> running_;	/* started and not exited */
+
+    unsigned int get_load() const { return pending_.size() + running_.size(); }
+};
+
+enum worker_report_kind_t
+{
+    WR_STARTED,		/* forked a process or thread for the oldest request */
+    WR_EXITED,		/* a process it forked has been reaped, or a thread finished */
+};
+
+struct worker_report_t
+{
+    uint32_t kind;
+    pid_t pid;
+    int status;		/* WR_EXITED only */
+    struct rusage ru;	/* WR_EXITED only */
+};
+
+static pid_t
+do_fork(void)
+{
+    pid_t pid;
+    int delay_ms = 10;
+    int max_sleeps = 20;
+
+    for (;;)
+    {
+	pid = fork();
+	if (pid < 0)
+	{
+	    if (errno == EAGAIN && max_sleeps-- > 0)
+	    {
+		/* rats, we fork-bombed, try again after a delay */
+		fprintf(stderr, "np: fork bomb! sleeping %u ms.\n",
+			delay_ms);
+		poll(0, 0, delay_ms);
+		delay_ms += (delay_ms>>1);	/* exponential backoff */
+		continue;
+	    }
+	    perror("np: fork");
+	    exit(1);
+	}
+	return pid;
+    }
+}
 
 child_t *
-runner_t::fork_child(job_t *j)
+runner_t::fork_child(job_t *j, bool rerun)
 {
     pid_t pid;
 #define PIPE_READ 0
@@ -236,11 +754,7 @@ runner_t::fork_child(job_t *j)
     int pipefd[2];
     int outfd = -1;
     int errfd = -1;
-    char outpath[TMPFILE_MAX];
-    char errpath[TMPFILE_MAX];
     child_t *child;
-    int delay_ms = 10;
-    int max_sleeps = 20;
     int r;
 
     r = pipe(pipefd);
@@ -250,150 +764,1334 @@ runner_t::fork_child(job_t *j)
 	exit(1);
     }
 
-    if (needs_stdout_)
+    if (rerun)
     {
-	strcpy(outpath, tmpfile_template);
-	outfd = mkstemp(outpath);
-	if (outfd < 0)
-	{
-	    perror(outpath);
-	    exit(1);
-	}
-
-	strcpy(errpath, tmpfile_template);
-	errfd = mkstemp(errpath);
-	if (errfd < 0)
-	{
-	    perror(errpath);
-	    exit(1);
-	}
+	/* append to the first run's output */
+	outfd = j->get_stdout_fd();
+	errfd = j->get_stderr_fd();
+    }
+    else if (needs_stdout_)
+    {
+	outfd = anon_file("novaprova.stdout");
+	errfd = anon_file("novaprova.stderr");
     }
 
-    for (;;)
+    /* a re-run does its own suite setup after exec */
+    testnode_t *sn = (rerun ? 0 : j->get_node()->get_suite());
+    if (sn)
     {
-	pid = fork();
+	/* the suite's fork server forks the child for us */
+	int fds[3] = { pipefd[PIPE_WRITE], outfd, errfd };
+	suite_t *s = get_suite(sn);
+	bool setup = !!s->deadline_;
+	pid = suite_fork(s, SR_TEST, j->get_node(), j,
+			 fds, (needs_stdout_ ? 3 : 1));
+	/* the suite setup's time isn't the test's */
+	if (setup)
+	    j->pre_run(true);
 	if (pid < 0)
 	{
-	    if (errno == EAGAIN && max_sleeps-- > 0)
+	    /* The server is gone, most likely because a suite fixture
+	     * crashed or hung.  Fail the test in a child of our own. */
+	    pid = do_fork();
+	    if (!pid)
 	    {
-		/* rats, we fork-bombed, try again after a delay */
-		fprintf(stderr, "np: fork bomb! sleeping %u ms.\n",
-			delay_ms);
-		poll(0, 0, delay_ms);
-		delay_ms += (delay_ms>>1);	/* exponential backoff */
-		continue;
+		if (s->timed_out_)
+		    suite_failure_ = new event_t(EV_TIMEOUT, "suite setup timed out");
+		else
+		    suite_failure_ = new event_t(EV_FIXTURE, "suite fixture process died");
+		suite_failure_->in_functype(FT_BEFORE_SUITE);
 	    }
-	    perror("np: fork");
-	    exit(1);
 	}
-	break;
+    }
+    else
+    {
+	pid = do_fork();
     }
 
     if (!pid)
     {
 	/* child process: return, will run the test */
 	close(pipefd[PIPE_READ]);
-	event_pipe_ = pipefd[PIPE_WRITE];
-	if (needs_stdout_)
-	{
-	    dup2(outfd, STDOUT_FILENO);
-	    close(outfd);
-	    dup2(errfd, STDERR_FILENO);
-	    close(errfd);
-	}
+	become_child(pipefd[PIPE_WRITE], outfd, errfd);
 	return NULL;
     }
 
     /* parent process */
+    close(pipefd[PIPE_WRITE]);
+    child = add_child(pid, j, pipefd[PIPE_READ], outfd, errfd, rerun);
+    if (sigchld_fd_ < 0)
+    {
+	int pidfd = open_pidfd(pid);
+	if (pidfd < 0)
+	{
+	    perror("np: pidfd_open");
+	    exit(1);
+	}
+	child->set_pidfd(pidfd);
+	watch_fd(pidfd, pid, WK_PIDFD);
+    }
+    return child;
+#undef PIPE_READ
+#undef PIPE_WRITE
+}
 
+/*
+ * Start supervising a newly forked process @pid which is running
+ * job @j and sending its events down @event_fd.
+ */
+child_t *
+runner_t::add_child(pid_t pid, job_t *j, int event_fd, int outfd, int errfd, bool rerun)
+{
 #if _NP_DEBUG
     fprintf(stderr, "np: spawned child process %d for %s\n",
 	    (int)pid, j->as_string().c_str());
 #endif
-    close(pipefd[PIPE_WRITE]);
-    child = new child_t(pid, pipefd[PIPE_READ], j);
-    if (timeout_)
+    child_t *child = new child_t(pid, event_fd, j);
+    watch_fd(event_fd, pid, WK_EVENTS);
+    if (rerun)
+    {
+	child->set_rerun();
+	if (timeout_)
+	{
+	    /* same allowance as choose_timeout() gives under Valgrind */
+	    child->set_deadline(rel_now() + 3 * timeout_ * NANOSEC_PER_SEC);
+	    add_deadline(child);
+	}
+    }
+    else if (timeout_)
+    {
 	child->set_deadline(j->get_start() + timeout_ * NANOSEC_PER_SEC);
+	add_deadline(child);
+    }
     if (needs_stdout_)
     {
-	close(outfd);
-	close(errfd);
-	j->set_stdout_path(outpath);
-	j->set_stderr_path(errpath);
+	/* the job keeps these open and reads them when it's done */
+	j->set_stdout_fd(outfd);
+	j->set_stderr_fd(errfd);
     }
-    children_.push_back(child);
+    children_[pid] = child;
 
     return child;
-#undef PIPE_READ
-#undef PIPE_WRITE
 }
 
+/*
+ * Called in a newly forked child process, to drop the parent's
+ * supervision state and connect up the given descriptors.
+ */
 void
-runner_t::handle_events()
+runner_t::become_child(int event_fd, int outfd, int errfd)
 {
-    int r;
-    unsigned int nzeroes = 0;
-
-    if (!children_.size())
-	return;
-
-    while (!caught_sigchld)
+    /* its thread didn't survive the fork, so listeners
+     * are called directly from here on */
+    reporter_ = 0;
+    /* but the thread may have been half way through calling
+     * them, so the ones we inherited can't be trusted.  Nor can
+     * their stdio buffers; glibc resets the stdio locks in the
+     * child of a fork, but what they had buffered is the parent's
+     * to write out */
+    listeners_.clear();
+    __fpurge(stdout);
+    __fpurge(stderr);
+    if (epoll_fd_ >= 0)
     {
-	int64_t start = rel_now();
-	int64_t timeout = -1;
-	pfd_.clear();
-	vector<child_t*>::iterator citr;
-	for (citr = children_.begin() ; citr != children_.end() ; ++citr)
-	{
-	    struct pollfd p;
-	    memset(&p, 0, sizeof(struct pollfd));
-	    int fd = (*citr)->get_input_fd();
-	    if (fd >= 0)
-	    {
-		p.fd = fd;
-		p.events |= POLLIN;
-	    }
-	    pfd_.push_back(p);
-
-	    int64_t deadline = (*citr)->get_deadline();
-	    if (deadline)
+	close(epoll_fd_);
+	epoll_fd_ = -1;
+    }
+    if (sigchld_fd_ >= 0)
+    {
+	close(sigchld_fd_);
+	sigchld_fd_ = -1;
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    }
+    /* don't hold the suite servers' sockets open,
+     * or they would never see EOF and shut down */
+    while (suites_.size())
+    {
+	close(suites_.back()->sock_);
+	delete suites_.back();
+	suites_.pop_back();
+    }
+    /* nor the workers' sockets, for the same reason */
+    while (workers_.size())
+    {
+	close(workers_.back()->sock_);
+	delete workers_.back();
+	workers_.pop_back();
+    }
+    event_pipe_ = event_fd;
+    if (outfd >= 0)
+    {
+	dup2(outfd, STDOUT_FILENO);
+	close(outfd);
+    }
+    if (errfd >= 0)
+    {
+	dup2(errfd, STDERR_FILENO);
+	close(errfd);
+    }
+}
+
+runner_t::suite_t *
+runner_t::get_suite(testnode_t *sn)
+{
+    vector<suite_t*>::iterator i;
+    for (i = suites_.begin() ; i != suites_.end() ; ++i)
+    {
+	if ((*i)->node_ == sn)
+	    return *i;
+    }
+
+    /* start the servers for any enclosing suites first */
+    suite_t *parent = 0;
+    testnode_t *psn = (sn->get_parent() ? sn->get_parent()->get_suite() : 0);
+    if (psn)
+	parent = get_suite(psn);
+
+    if (!suites_.size() &&
+	prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) < 0)
+    {
+	perror("np: prctl(PR_SET_CHILD_SUBREAPER)");
+	exit(1);
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0)
+    {
+	perror("np: socketpair");
+	exit(1);
+    }
+
+    pid_t pid;
+    if (parent)
+    {
+	pid = suite_fork(parent, SR_SUITE, sn, 0, &sv[1], 1);
+    }
+    else
+    {
+	pid = do_fork();
+	if (!pid)
+	{
+	    close(sv[0]);
+	    become_child(-1, -1, -1);
+	    serve_suite(sn, sv[1]);
+	}
+    }
+    close(sv[1]);
+#if _NP_DEBUG
+    fprintf(stderr, "np: [%s] suite server %d for %s\n",
+	    rel_timestamp(), (int)pid, sn->get_fullname().c_str());
+#endif
+
+    suite_t *s = new suite_t;
+    s->node_ = sn;
+    s->pid_ = (pid < 0 ? 0 : pid);
+    s->sock_ = sv[0];
+    s->deadline_ = suite_deadline();
+    /* a nested server fails the same way as the one which didn't start it */
+    s->timed_out_ = (pid < 0 && parent && parent->timed_out_);
+    suites_.push_back(s);
+    return s;
+}
+
+/*
+ * Send a request to fork a process for @tn to a suite server or
+ * worker, with the descriptors @fds attached.  Returns false if the
+ * server is gone.
+ */
+static bool
+send_request(int sock, unsigned int kind, testnode_t *tn,
+	     const job_t *j, const int *fds, unsigned int nfds)
+{
+    uint64_t buf[SUITE_MAXMSG/sizeof(uint64_t)];
+    suite_request_t *req = (suite_request_t *)buf;
+    size_t len = sizeof(*req);
+
+    req->kind = kind;
+    req->nassigns = 0;
+    req->ticket = 0;
+    req->node = tn;
+    if (j)
+    {
+	req->ticket = j->get_ticket();
+	const vector<testnode_t::assignment_t> &assigns = j->get_assignments();
+	req->nassigns = assigns.size();
+	len += assigns.size() * sizeof(testnode_t::assignment_t);
+	assert(len <= sizeof(buf));
+	if (assigns.size())
+	    memcpy(req+1, &assigns[0], len - sizeof(*req));
+    }
+
+    union
+    {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(SUITE_MAXFDS * sizeof(int))];
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+    return (sendmsg(sock, &msg, MSG_NOSIGNAL) >= 0);
+}
+
+/*
+ * Receive a request sent by send_request() into @buf, which holds
+ * SUITE_MAXMSG bytes, and the descriptors attached to it.  Returns
+ * 1 for a well formed request, 0 when the runner is done with us,
+ * or -1 for anything else; any descriptors must be closed anyway.
+ */
+static int
+recv_request(int sock, uint64_t *buf, int *fds, unsigned int *nfdsp)
+{
+    union
+    {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(SUITE_MAXFDS * sizeof(int))];
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    ssize_t n;
+
+    *nfdsp = 0;
+    do
+    {
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = SUITE_MAXMSG;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	n = recvmsg(sock, &msg, 0);
+    }
+    while (n < 0 && errno == EINTR);
+    if (n <= 0)
+	return 0;
+
+    unsigned int nfds = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+	nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+    }
+    *nfdsp = nfds;
+
+    const suite_request_t *req = (const suite_request_t *)buf;
+    if ((size_t)n >= sizeof(*req) &&
+	(size_t)n == sizeof(*req) + req->nassigns * sizeof(testnode_t::assignment_t) &&
+	nfds >= 1)
+	return 1;
+    return -1;
+}
+
+/*
+ * Returns the time by which a suite fixture must finish, or 0 if
+ * there's no limit.
+ */
+int64_t
+runner_t::suite_deadline() const
+{
+    return (timeout_ ? rel_now() + timeout_ * NANOSEC_PER_SEC : 0);
+}
+
+/*
+ * Wait for suite server @s to reply, for no later than @deadline
+ * unless it's 0.  A server which is too late is killed, and false
+ * returned.  @what names the fixture it's running, for the message.
+ */
+bool
+runner_t::wait_suite(suite_t *s, int64_t deadline, const char *what)
+{
+    if (!deadline)
+	return true;
+
+    struct pollfd pfd;
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = s->sock_;
+    pfd.events = POLLIN;
+    int r;
+    do
+    {
+	int64_t left = deadline - rel_now();
+	r = (left > 0 ? poll(&pfd, 1, (int)((left + 999999) / 1000000)) : 0);
+    }
+    while (r < 0 && errno == EINTR);
+    if (r)
+	return true;
+
+    fprintf(stderr, "np: suite %s for %s timed out, killing it\n",
+	    what, s->node_->get_fullname().c_str());
+    kill(s->pid_, SIGKILL);
+    while (waitpid(s->pid_, 0, 0) < 0 && errno == EINTR)
+	;
+    s->pid_ = 0;
+    s->timed_out_ = true;
+    return false;
+}
+
+/*
+ * Ask a suite server to fork a process, and wait for its pid.
+ * Returns -1 if the server is gone.
+ */
+pid_t
+runner_t::suite_fork(suite_t *s, unsigned int kind, testnode_t *tn,
+		     const job_t *j, const int *fds, unsigned int nfds)
+{
+    if (!s->pid_ || !send_request(s->sock_, kind, tn, j, fds, nfds))
+	return -1;
+    /* the first reply comes after the suite setup */
+    if (!wait_suite(s, s->deadline_, "setup"))
+	return -1;
+    s->deadline_ = 0;
+
+    pid_t pid;
+    ssize_t r;
+    do
+	r = read(s->sock_, &pid, sizeof(pid));
+    while (r < 0 && errno == EINTR);
+    return (r == sizeof(pid) ? pid : -1);
+}
+
+/*
+ * Main loop of a suite server.  Runs the suite setup, forks a process
+ * for every request until the runner shuts down its end of the
+ * socket, then runs the suite teardown, replies with the description
+ * of its failure if it fails, and exits.
+ */
+void
+runner_t::serve_suite(testnode_t *sn, int sock)
+{
+    np::spiegel::function_t *f;
+    event_t *ev;
+
+    /* events go to the listeners in the tests we fork, not here */
+    destroy_listeners();
+
+    if ((f = sn->get_function(FT_BEFORE_SUITE)))
+    {
+	np_try
+	{
+	    run_function(FT_BEFORE_SUITE, f);
+	}
+	np_catch(ev)
+	{
+	    /* every test in the suite will report this */
+	    ev->in_functype(FT_BEFORE_SUITE);
+	    suite_failure_ = ev->clone();
+	}
+    }
+    fflush(stdout);
+    fflush(stderr);
+
+    for (;;)
+    {
+	uint64_t buf[SUITE_MAXMSG/sizeof(uint64_t)];
+	int fds[SUITE_MAXFDS];
+	unsigned int nfds;
+
+	int r = recv_request(sock, buf, fds, &nfds);
+	if (!r)
+	    break;	/* runner is done with us */
+
+	pid_t pid = -1;
+	if (r > 0)
+	    pid = suite_spawn(sock, (const suite_request_t *)buf, fds, nfds);
+
+	for (unsigned int i = 0 ; i < nfds ; i++)
+	    close(fds[i]);
+	if (write(sock, &pid, sizeof(pid)) != sizeof(pid))
+	    break;
+    }
+
+    if (!suite_failure_ && (f = sn->get_function(FT_AFTER_SUITE)))
+    {
+	np_try
+	{
+	    run_function(FT_AFTER_SUITE, f);
+	}
+	np_catch(ev)
+	{
+	    const char *desc = (ev->description ? ev->description : "suite teardown failed");
+	    if (send(sock, desc, strlen(desc), MSG_NOSIGNAL) < 0)
+		perror("np: send");
+	}
+    }
+    exit(0);
+}
+
+/*
+ * In a suite server, fork a test process or nested suite server as
+ * asked, and return its pid once it's been reparented to the runner.
+ */
+pid_t
+runner_t::suite_spawn(int sock, const void *vreq, const int *fds, unsigned int nfds)
+{
+    const suite_request_t *req = (const suite_request_t *)vreq;
+    int pidpipe[2];
+    pid_t ipid, pid;
+
+    if (pipe(pidpipe) < 0)
+    {
+	perror("np: pipe");
+	return -1;
+    }
+
+    ipid = do_fork();
+    if (!ipid)
+    {
+	/* intermediate process: fork the real one and get
+	 * out of the way so it's reparented to the runner */
+	close(pidpipe[0]);
+	pid = do_fork();
+	if (pid)
+	{
+	    if (write(pidpipe[1], &pid, sizeof(pid)) != sizeof(pid))
+		_exit(1);
+	    _exit(0);
+	}
+	close(pidpipe[1]);
+	close(sock);
+
+	if (req->kind == SR_SUITE)
+	    serve_suite(req->node, fds[0]);
+
+	become_child(fds[0], (nfds > 1 ? fds[1] : -1), (nfds > 2 ? fds[2] : -1));
+	const testnode_t::assignment_t *a = (const testnode_t::assignment_t *)(req+1);
+	vector<testnode_t::assignment_t> assigns(a, a + req->nassigns);
+	job_t *j = new job_t(req->node, assigns);
+	j->set_ticket(req->ticket);
+	run_job(j);
+    }
+
+    close(pidpipe[1]);
+    if (read(pidpipe[0], &pid, sizeof(pid)) != sizeof(pid))
+	pid = -1;
+    close(pidpipe[0]);
+    while (waitpid(ipid, 0, 0) < 0 && errno == EINTR)
+	;
+    return pid;
+}
+
+/*
+ * Shut down all the suite servers, which runs the suite teardowns,
+ * and report the ones which fail.  The innermost suites were started
+ * last, so they're shut down first.
+ */
+void
+runner_t::end_suites()
+{
+    while (suites_.size())
+    {
+	suite_t *s = suites_.back();
+	suites_.pop_back();
+
+	char desc[1024];
+	ssize_t n = 0;
+	if (s->pid_)
+	{
+	    shutdown(s->sock_, SHUT_WR);
+	    if (wait_suite(s, suite_deadline(), "teardown"))
+	    {
+		do
+		    n = recv(s->sock_, desc, sizeof(desc)-1, 0);
+		while (n < 0 && errno == EINTR);
+	    }
+	    else
+	    {
+		n = snprintf(desc, sizeof(desc), "suite teardown timed out");
+	    }
+	}
+	close(s->sock_);
+	if (s->pid_)
+	{
+	    while (waitpid(s->pid_, 0, 0) < 0 && errno == EINTR)
+		;
+	}
+	if (n > 0)
+	{
+	    desc[n] = '\0';
+	    fail_suite(s->node_, desc);
+	}
+	delete s;
+    }
+}
+
+/*
+ * Report the failure of the suite teardown at @sn.  Every test in
+ * the suite has already ended, so it's reported as a job of its own,
+ * which fails with a FIXTURE event.
+ */
+void
+runner_t::fail_suite(testnode_t *sn, const char *desc)
+{
+    job_t *j = new job_t(sn, vector<testnode_t::assignment_t>());
+    j->pre_run(true);
+    dispatch_listeners(begin_job, j);
+    event_t ev(EV_FIXTURE, desc);
+    ev.in_functype(FT_AFTER_SUITE);
+    raise_event(j, &ev);
+    j->post_run(true);
+    nfailed_++;
+    nrun_++;
+    finish_job(j, R_FAIL);
+}
+
+/*
+ * Choose the worker to send the next job to: the least busy one,
+ * unless they're all busy and there's room for another.  There's
+ * only ever one thread host, which runs as many threads as needed.
+ */
+runner_t::worker_t *
+runner_t::get_worker(bool threaded)
+{
+    worker_t *best = 0;
+    unsigned int nlive = 0;
+    vector<worker_t*>::iterator i;
+    for (i = workers_.begin() ; i != workers_.end() ; ++i)
+    {
+	worker_t *w = *i;
+	if (w->retiring_ || w->exited_ || w->threaded_ != threaded)
+	    continue;
+	nlive++;
+	if (!best || w->get_load() < best->get_load())
+	    best = w;
+    }
+    if (best && (threaded || !best->get_load() || nlive >= maxchildren_))
+	return best;
+
+    /* processes a dead worker leaves running are reparented to us */
+    if (!workers_.size() &&
+	prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) < 0)
+    {
+	perror("np: prctl(PR_SET_CHILD_SUBREAPER)");
+	exit(1);
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0)
+    {
+	perror("np: socketpair");
+	exit(1);
+    }
+
+    pid_t pid = do_fork();
+    if (!pid)
+    {
+	close(sv[0]);
+	become_child(-1, -1, -1);
+	if (threaded)
+	    serve_threads(sv[1]);
+	serve_worker(sv[1]);
+    }
+    close(sv[1]);
+#if _NP_DEBUG
+    fprintf(stderr, "np: [%s] %s %d\n", rel_timestamp(),
+	    (threaded ? "thread host" : "worker"), (int)pid);
+#endif
+
+    worker_t *w = new worker_t;
+    w->pid_ = pid;
+    w->threaded_ = threaded;
+    w->exited_ = false;
+    w->status_ = 0;
+    w->sock_ = sv[0];
+    w->njobs_ = 0;
+    w->retiring_ = false;
+    watch_fd(w->sock_, pid, WK_WORKER);
+    workers_.push_back(w);
+    return w;
+}
+
+/*
+ * Whether job @j can be run in a thread of the thread host: it must
+ * be marked NP_THREADED, and need no process of its own for suite
+ * fixtures, resource limits or Valgrind's diagnostics.
+ */
+bool
+runner_t::is_threadable(const job_t *j) const
+{
+    testnode_t *tn = j->get_node();
+    if (!threads_ || rerun_ || !tn->is_threaded() ||
+	!tn->get_function(FT_TEST) || tn->get_suite())
+	return false;
+#if HAVE_VALGRIND
+    if (RUNNING_ON_VALGRIND)
+	return false;
+#endif
+    for (int i = 0 ; i < L_NUM ; i++)
+    {
+	if (get_limit(j, (limit_t)i))
+	    return false;
+    }
+    return true;
+}
+
+/*
+ * Hand job @j to a worker to be run.  The worker replies later with
+ * the pid of the process it forked, see handle_worker().  Returns
+ * false if the job should be forked from here instead.
+ */
+bool
+runner_t::worker_fork(job_t *j)
+{
+    bool threaded = is_threadable(j);
+    if (!threaded && (!worker_jobs_ || j->get_node()->get_suite()))
+	return false;
+
+    worker_t::pending_t p;
+    int pipefd[2];
+    if (pipe(pipefd) < 0)
+    {
+	perror("np: pipe");
+	exit(1);
+    }
+    p.job_ = j;
+    p.event_fd_ = pipefd[0];
+    p.outfd_ = -1;
+    p.errfd_ = -1;
+    /* threads share the host's stdout and stderr */
+    if (needs_stdout_ && !threaded)
+    {
+	p.outfd_ = anon_file("novaprova.stdout");
+	p.errfd_ = anon_file("novaprova.stderr");
+    }
+
+    worker_t *w = get_worker(threaded);
+    int fds[3] = { pipefd[1], p.outfd_, p.errfd_ };
+    bool sent = send_request(w->sock_, SR_TEST, j->get_node(), j,
+			     fds, (p.outfd_ >= 0 ? 3 : 1));
+    close(pipefd[1]);
+    if (!sent)
+    {
+	/* it died, we'll hear about that soon enough */
+	retire_worker(w);
+	close(p.event_fd_);
+	if (p.outfd_ >= 0)
+	    close(p.outfd_);
+	if (p.errfd_ >= 0)
+	    close(p.errfd_);
+	return false;
+    }
+
+    w->pending_.push_back(p);
+    npending_++;
+    if (++w->njobs_ >= worker_jobs_ && !threaded)
+	retire_worker(w);
+    return true;
+}
+
+/*
+ * Send a worker no more jobs.  It exits when the ones it has
+ * already been sent are finished.
+ */
+void
+runner_t::retire_worker(worker_t *w)
+{
+    if (w->retiring_)
+	return;
+    w->retiring_ = true;
+    shutdown(w->sock_, SHUT_WR);
+}
+
+/*
+ * Main loop of a worker.  Forks a process for every request until
+ * the runner shuts down its end of the socket, and reports when each
+ * process starts and exits.  Exits when they have all exited.
+ */
+void
+runner_t::serve_worker(int sock)
+{
+    /* events go to the listeners in the tests we fork, not here */
+    destroy_listeners();
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    /* become_child() undoes this in the processes we fork */
+    sigchld_fd_ = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+    if (sigchld_fd_ < 0)
+    {
+	perror("np: signalfd");
+	exit(1);
+    }
+
+    bool accepting = true;
+    unsigned int nrunning = 0;
+    while (accepting || nrunning)
+    {
+	struct pollfd pfd[2];
+	pfd[0].fd = sigchld_fd_;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = (accepting ? sock : -1);
+	pfd[1].events = POLLIN;
+	if (poll(pfd, 2, -1) < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    perror("np: poll");
+	    exit(1);
+	}
+
+	if (pfd[0].revents)
+	{
+	    struct signalfd_siginfo si;
+	    while (read(sigchld_fd_, &si, sizeof(si)) == sizeof(si))
+		;
+	    worker_report_t rep;
+	    memset(&rep, 0, sizeof(rep));
+	    rep.kind = WR_EXITED;
+	    while ((rep.pid = wait4(-1, &rep.status, WNOHANG, &rep.ru)) > 0)
+	    {
+		send(sock, &rep, sizeof(rep), MSG_NOSIGNAL);
+		nrunning--;
+	    }
+	}
+
+	if (pfd[1].revents)
+	{
+	    uint64_t buf[SUITE_MAXMSG/sizeof(uint64_t)];
+	    int fds[SUITE_MAXFDS];
+	    unsigned int nfds;
+
+	    int r = recv_request(sock, buf, fds, &nfds);
+	    if (r > 0)
+	    {
+		const suite_request_t *req = (const suite_request_t *)buf;
+		pid_t pid = do_fork();
+		if (!pid)
+		{
+		    close(sock);
+		    become_child(fds[0], (nfds > 1 ? fds[1] : -1), (nfds > 2 ? fds[2] : -1));
+		    const testnode_t::assignment_t *a = (const testnode_t::assignment_t *)(req+1);
+		    vector<testnode_t::assignment_t> assigns(a, a + req->nassigns);
+		    job_t *j = new job_t(req->node, assigns);
+		    j->set_ticket(req->ticket);
+		    run_job(j);
+		}
+		nrunning++;
+
+		worker_report_t rep;
+		memset(&rep, 0, sizeof(rep));
+		rep.kind = WR_STARTED;
+		rep.pid = pid;
+		send(sock, &rep, sizeof(rep), MSG_NOSIGNAL);
+	    }
+	    for (unsigned int i = 0 ; i < nfds ; i++)
+		close(fds[i]);
+	    if (!r)
+		accepting = false;	/* runner is done with us */
+	}
+    }
+    exit(0);
+}
+
+/*
+ * Shared between the threads of a thread host.
+ */
+struct thread_host_t
+{
+    pthread_mutex_t lock_;
+    pthread_cond_t cond_;
+    int sock_;
+    unsigned int nrunning_;
+    /* handed to each thread as it starts */
+    job_t *job_;
+    int event_fd_;
+    bool started_;
+};
+
+/*
+ * Where a test thread jumps back to when the runner sends it
+ * SIGTERM, see thread_main().
+ */
+static __thread sigjmp_buf *thread_stop;
+
+/*
+ * SIGTERM handler of a thread host.  The runner sends a test thread
+ * SIGTERM, with tgkill(), when it times out or the run is cancelled;
+ * just that thread is ended.  A SIGTERM sent to the whole host, or
+ * to a thread which isn't running a test, kills the host as usual.
+ */
+static void
+handle_thread_sigterm(int sig, siginfo_t *si, void *)
+{
+    if (si->si_code == SI_TKILL && thread_stop)
+	siglongjmp(*thread_stop, sig);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/*
+ * Main loop of a thread host.  Starts a thread for every request
+ * until the runner shuts down its end of the socket, then exits
+ * when they have all finished.  Functions intercepted with
+ * breakpoints keep their state in globals, and the intercept tables
+ * aren't locked, so neither is safe with several threads calling
+ * through them.  The built-in syslog() and exit() mocks are
+ * installed once for the life of the host instead, but only if
+ * they can all be done by rewriting GOT slots; their events go to
+ * the calling thread's listener.  Otherwise a test which calls
+ * exit() takes the host down and is then run again in its own
+ * process, and syslog() isn't checked.
+ */
+void
+runner_t::serve_threads(int sock)
+{
+    destroy_listeners();
+
+    testnode_t *root = testmanager_t::instance()->get_root();
+    bool mocked = root->install_got_redirects();
+#if _NP_DEBUG
+    fprintf(stderr, "np: [%s] thread host %s the built-in mocks\n",
+	    rel_timestamp(), (mocked ? "installed" : "cannot install"));
+#endif
+
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = handle_thread_sigterm;
+    act.sa_flags = SA_SIGINFO;
+    sigaction(SIGTERM, &act, NULL);
+
+    thread_host_t host;
+    pthread_mutex_init(&host.lock_, 0);
+    pthread_cond_init(&host.cond_, 0);
+    host.sock_ = sock;
+    host.nrunning_ = 0;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (;;)
+    {
+	uint64_t buf[SUITE_MAXMSG/sizeof(uint64_t)];
+	int fds[SUITE_MAXFDS];
+	unsigned int nfds;
+
+	int r = recv_request(sock, buf, fds, &nfds);
+	if (!r)
+	    break;	/* runner is done with us */
+	for (unsigned int i = (r > 0 ? 1 : 0) ; i < nfds ; i++)
+	    close(fds[i]);
+	if (r < 0)
+	    continue;
+
+	const suite_request_t *req = (const suite_request_t *)buf;
+	const testnode_t::assignment_t *a = (const testnode_t::assignment_t *)(req+1);
+	vector<testnode_t::assignment_t> assigns(a, a + req->nassigns);
+
+	/* wait for the thread to report its id, so the
+	 * runner hears about them in the order it asked */
+	pthread_mutex_lock(&host.lock_);
+	host.job_ = new job_t(req->node, assigns);
+	host.job_->set_ticket(req->ticket);
+	host.event_fd_ = fds[0];
+	host.started_ = false;
+	pthread_t thread;
+	int err = pthread_create(&thread, &attr, thread_main, &host);
+	if (err)
+	{
+	    /* the runner runs it in a process when we exit */
+	    fprintf(stderr, "np: pthread_create: %s\n", strerror(err));
+	    fflush(stderr);
+	    _exit(1);
+	}
+	host.nrunning_++;
+	while (!host.started_)
+	    pthread_cond_wait(&host.cond_, &host.lock_);
+	pthread_mutex_unlock(&host.lock_);
+    }
+
+    pthread_mutex_lock(&host.lock_);
+    while (host.nrunning_)
+	pthread_cond_wait(&host.cond_, &host.lock_);
+    pthread_mutex_unlock(&host.lock_);
+    if (mocked)
+	root->uninstall_intercepts();	/* we're calling exit() */
+    exit(0);
+}
+
+/*
+ * Body of a thread started by serve_threads() to run one job.
+ */
+void *
+runner_t::thread_main(void *arg)
+{
+    thread_host_t *host = (thread_host_t *)arg;
+    __np_exceptstate_t exceptstate;
+    exceptstate.catching = false;
+    __np_exceptstatep = &exceptstate;
+
+    pthread_mutex_lock(&host->lock_);
+    job_t *j = host->job_;
+    int event_fd = host->event_fd_;
+    worker_report_t rep;
+    memset(&rep, 0, sizeof(rep));
+    rep.kind = WR_STARTED;
+    rep.pid = syscall(SYS_gettid);
+    send(host->sock_, &rep, sizeof(rep), MSG_NOSIGNAL);
+    host->started_ = true;
+    pthread_cond_broadcast(&host->cond_);
+    pthread_mutex_unlock(&host->lock_);
+
+    struct rusage before;
+    getrusage(RUSAGE_THREAD, &before);
+    sigjmp_buf stop;
+    int sig = sigsetjmp(stop, 1);
+    if (!sig)
+    {
+	thread_stop = &stop;
+	running_->run_thread_job(j, event_fd);
+    }
+    else
+    {
+	/* Abandoned mid-test, and whatever it held is lost with it,
+	 * perhaps even the malloc lock.  So the job is leaked, and
+	 * nothing but system calls and the host's lock, which the
+	 * test never takes, is used to tell the runner, which then
+	 * retires the host. */
+	thread_listener = 0;
+	close(event_fd);
+	rep.status = sig;	/* as if killed by the signal */
+    }
+    thread_stop = 0;
+    getrusage(RUSAGE_THREAD, &rep.ru);
+    timersub(&rep.ru.ru_utime, &before.ru_utime, &rep.ru.ru_utime);
+    timersub(&rep.ru.ru_stime, &before.ru_stime, &rep.ru.ru_stime);
+    rep.ru.ru_minflt -= before.ru_minflt;
+    rep.ru.ru_majflt -= before.ru_majflt;
+    rep.ru.ru_nvcsw -= before.ru_nvcsw;
+    rep.ru.ru_nivcsw -= before.ru_nivcsw;
+    /* this is for the whole process, so says nothing about the test */
+    rep.ru.ru_maxrss = 0;
+
+    pthread_mutex_lock(&host->lock_);
+    rep.kind = WR_EXITED;
+    send(host->sock_, &rep, sizeof(rep), MSG_NOSIGNAL);
+    host->nrunning_--;
+    pthread_cond_broadcast(&host->cond_);
+    pthread_mutex_unlock(&host->lock_);
+    return 0;
+}
+
+/*
+ * Run job @j in a thread of the thread host, sending its events
+ * down @event_fd.  Like run_job() but without exiting, and only
+ * the events of this thread go to its listener.
+ */
+void
+runner_t::run_thread_job(job_t *j, int event_fd)
+{
+    proxy_listener_t proxy(event_fd);
+    thread_listener = &proxy;
+    result_t res = run_test_code(j);
+    proxy.end_job(j, res);
+    thread_listener = 0;
+    close(event_fd);
+    delete j;
+}
+
+/*
+ * Handle whatever a worker has reported: start supervising the
+ * processes it has forked, and queue up the exits of those it has
+ * reaped for reap_children().
+ */
+void
+runner_t::handle_worker(worker_t *w)
+{
+    for (;;)
+    {
+	worker_report_t rep;
+	ssize_t n = recv(w->sock_, &rep, sizeof(rep), MSG_DONTWAIT);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return;
+	if (n != sizeof(rep))
+	{
+	    worker_exited(w);
+	    return;
+	}
+
+	if (rep.kind == WR_STARTED && w->pending_.size())
+	{
+	    worker_t::pending_t p = w->pending_.front();
+	    w->pending_.pop_front();
+	    npending_--;
+	    child_t *child = add_child(rep.pid, p.job_, p.event_fd_,
+				       p.outfd_, p.errfd_, false);
+	    w->running_.insert(rep.pid);
+	    if (w->threaded_)
+		child->set_host(w->pid_);
+	    if (cancelled_ && child->cancel(rel_now()))
+		add_deadline(child);
+	}
+	else if (rep.kind == WR_EXITED && w->running_.erase(rep.pid))
+	{
+	    exit_t e;
+	    e.pid_ = rep.pid;
+	    e.status_ = rep.status;
+	    e.lost_ = false;
+	    e.rusage_ = rep.ru;
+	    exits_.push_back(e);
+	    reapable_ = true;
+	    if (!WIFEXITED(rep.status) || WEXITSTATUS(rep.status))
+		retire_worker(w);
+	}
+    }
+}
+
+/*
+ * A worker has closed its socket, which means it has exited.  If it
+ * died early, jobs it never started are forked from here instead,
+ * and its processes which are still running are now our children.
+ */
+void
+runner_t::worker_exited(worker_t *w)
+{
+    unwatch_fd(w->sock_);
+    close(w->sock_);
+    if (!w->exited_)
+    {
+	while (waitpid(w->pid_, &w->status_, 0) < 0 && errno == EINTR)
+	    ;
+    }
+    if (w->pending_.size() || w->running_.size())
+    {
+	fprintf(stderr, "np: %s %d exited early\n",
+		(w->threaded_ ? "thread host" : "worker process"), (int)w->pid_);
+	/* don't crash it again */
+	if (w->threaded_)
+	    threads_ = false;
+    }
+
+    vector<worker_t*>::iterator i = find(workers_.begin(), workers_.end(), w);
+    workers_.erase(i);
+
+    set<pid_t>::iterator ritr;
+    for (ritr = w->running_.begin() ; ritr != w->running_.end() ; ++ritr)
+    {
+	pid_t pid = *ritr;
+	if (w->threaded_)
+	{
+	    /* its threads died with it */
+	    child_t *child = children_[pid];
+	    if (!child->is_cancelled() && child->get_input_fd() >= 0 &&
+		child->get_result() == R_UNKNOWN)
+	    {
+		/* nothing went wrong yet, so it may not have been this
+		 * test which crashed; run it again in its own process */
+		unwatch_fd(child->get_input_fd());
+		children_.erase(pid);
+		job_t *j = child->release_job();
+		delete child;
+		if (!fork_child(j, false))
+		    run_job(j);
+		continue;
+	    }
+	    exit_t e;
+	    memset(&e, 0, sizeof(e));
+	    e.pid_ = pid;
+	    /* it may have finished just before */
+	    e.status_ = (child->get_input_fd() < 0 ? 0 : w->status_);
+	    exits_.push_back(e);
+	}
+	else if (kill(pid, 0) < 0 && errno == ESRCH)
+	{
+	    /* the worker reaped it and never told us how it went */
+	    exit_t e;
+	    memset(&e, 0, sizeof(e));
+	    e.pid_ = pid;
+	    e.lost_ = true;
+	    exits_.push_back(e);
+	}
+	else if (sigchld_fd_ < 0)
+	{
+	    int pidfd = open_pidfd(pid);
+	    if (pidfd >= 0)
 	    {
-		int64_t to = deadline - start;
-		if (to <= 0)
-		    timeout = 0;	/* already overdue */
-		else if (timeout < 0 || timeout > to)
-		    timeout = to;
+		children_[pid]->set_pidfd(pidfd);
+		watch_fd(pidfd, pid, WK_PIDFD);
 	    }
 	}
+    }
+    reapable_ = true;
+
+    while (w->pending_.size())
+    {
+	worker_t::pending_t p = w->pending_.front();
+	w->pending_.pop_front();
+	npending_--;
+	close(p.event_fd_);
+	if (p.outfd_ >= 0)
+	    close(p.outfd_);
+	if (p.errfd_ >= 0)
+	    close(p.errfd_);
+	if (!fork_child(p.job_, false))
+	    run_job(p.job_);
+    }
+    delete w;
+}
 
-	if (timeout == 0)
+/*
+ * Shut down all the workers.  By now they have no jobs left.
+ */
+void
+runner_t::end_workers()
+{
+    while (workers_.size())
+    {
+	worker_t *w = workers_.back();
+	workers_.pop_back();
+	unwatch_fd(w->sock_);
+	close(w->sock_);
+	if (!w->exited_)
 	{
-	    if (++nzeroes > 5)
-		timeout = NANOSEC_PER_SEC;
+	    while (waitpid(w->pid_, 0, 0) < 0 && errno == EINTR)
+		;
 	}
-	else
+	delete w;
+    }
+}
+
+void
+runner_t::watch_fd(int fd, pid_t pid, unsigned int kind)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = WATCH_DATA(pid, kind);
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+	perror("np: epoll_ctl");
+	exit(1);
+    }
+}
+
+void
+runner_t::unwatch_fd(int fd)
+{
+    /* Explicitly removed rather than relying on close(), because
+     * children forked later inherit a reference to the same file */
+    if (fd >= 0)
+	epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+}
+
+typedef pair<int64_t, pid_t> deadline_t;
+
+void
+runner_t::add_deadline(child_t *child)
+{
+    deadlines_.push_back(deadline_t(child->get_deadline(), child->get_pid()));
+    push_heap(deadlines_.begin(), deadlines_.end(), greater<deadline_t>());
+}
+
+/*
+ * Returns the earliest deadline of any live child, or 0 if there is
+ * none.  Entries are not removed from the heap when a child's deadline
+ * changes or it is reaped, so we discard stale ones here.
+ */
+int64_t
+runner_t::next_deadline()
+{
+    while (deadlines_.size())
+    {
+	const deadline_t &d = deadlines_.front();
+	map<pid_t, child_t*>::iterator itr = children_.find(d.second);
+	if (itr != children_.end() && itr->second->get_deadline() == d.first)
+	    return d.first;
+	pop_heap(deadlines_.begin(), deadlines_.end(), greater<deadline_t>());
+	deadlines_.pop_back();
+    }
+    return 0;
+}
+
+void
+runner_t::handle_timeouts(int64_t now)
+{
+    int64_t deadline;
+
+    while ((deadline = next_deadline()) && deadline <= now)
+    {
+	child_t *child = children_[deadlines_.front().second];
+	pop_heap(deadlines_.begin(), deadlines_.end(), greater<deadline_t>());
+	deadlines_.pop_back();
+	child->handle_timeout(now);
+	if (child->get_deadline())
+	    add_deadline(child);
+    }
+}
+
+/* how often to free the middle of each test's captured output */
+#define TRIM_INTERVAL	(NANOSEC_PER_SEC/10)
+
+/*
+ * A chatty test can write far more output than we will ever report,
+ * so we don't let it accumulate until the test is done.
+ */
+void
+runner_t::trim_outputs(int64_t now)
+{
+    map<pid_t, child_t*>::iterator itr;
+    for (itr = children_.begin() ; itr != children_.end() ; ++itr)
+	itr->second->get_job()->trim_output();
+    trim_ = now + TRIM_INTERVAL;
+}
+
+/*
+ * Wait for and handle events from children, until at least
+ * one child has exited and is ready to be reaped.
+ */
+void
+runner_t::handle_events()
+{
+    struct epoll_event events[64];
+    int r;
+
+    reapable_ = false;
+    while ((children_.size() || npending_) && !reapable_)
+    {
+	int timeout = -1;
+	int64_t deadline = next_deadline();
+	if (tick_ && (!deadline || tick_ < deadline))
+	    deadline = tick_;
+	if (needs_stdout_ && !trim_)
+	    trim_ = rel_now() + TRIM_INTERVAL;
+	if (trim_ && (!deadline || trim_ < deadline))
+	    deadline = trim_;
+	if (deadline)
 	{
-	    nzeroes = 0;
+	    int64_t to = deadline - rel_now();
+	    /* round up to millisec so we don't wake early and spin */
+	    timeout = (to <= 0 ? 0 : (to + 999999) / 1000000);
 	}
 
-	/* convert timeout for poll(): from nanosec to millisec
-	 * and smash all negative values to -1 */
-	timeout = (timeout < 0 ? -1 : (timeout+500000)/1000000);
-
 #if _NP_DEBUG
-	fprintf(stderr, "np: [%s] about to poll([%d fds] timeout=%lld msec)\n",
-		rel_timestamp(), (int)pfd_.size(), (long long)timeout);
+	fprintf(stderr, "np: [%s] about to epoll_wait([%d children] timeout=%d msec)\n",
+		rel_timestamp(), (int)children_.size(), timeout);
 #endif
-	r = poll(pfd_.data(), pfd_.size(), timeout);
+	r = epoll_wait(epoll_fd_, events, sizeof(events)/sizeof(events[0]), timeout);
 #if _NP_DEBUG
 	{
 	    int e = errno;
-	    fprintf(stderr, "np: [%s] poll returned %d errno %d(%s)\n",
+	    fprintf(stderr, "np: [%s] epoll_wait returned %d errno %d(%s)\n",
 		    rel_timestamp(), r, e, strerror(e));
-	    vector<struct pollfd>::iterator pitr;
-	    for (pitr = pfd_.begin() ; pitr != pfd_.end() ; ++pitr)
-		fprintf(stderr, "np:     fd %d revents %d\n",
-			pitr->fd, pitr->revents);
 	    errno = e;
 	}
 #endif
@@ -401,25 +2099,64 @@ runner_t::handle_events()
 	{
 	    if (errno == EINTR)
 		continue;
-	    perror("np: poll");
+	    perror("np: epoll_wait");
 	    return;
 	}
-	if (r == 0)
-	{
-	    /* poll() timed out */
-	    int64_t end = rel_now();
-	    for (citr = children_.begin() ; citr != children_.end() ; ++citr)
-		(*citr)->handle_timeout(end);
-	}
-	else
+
+	for (int i = 0 ; i < r ; i++)
 	{
-	    /* poll indicated some fds are available */
-	    vector<struct pollfd>::iterator pitr;
-	    for (pitr = pfd_.begin(), citr = children_.begin() ;
-		 citr != children_.end() ; ++pitr, ++citr)
-		if ((pitr->revents & POLLIN))
-		    (*citr)->handle_input();
+	    uint64_t data = events[i].data.u64;
+	    switch (WATCH_KIND(data))
+	    {
+	    case WK_SIGCHLD:
+		{
+		    struct signalfd_siginfo si;
+		    while (read(sigchld_fd_, &si, sizeof(si)) == sizeof(si))
+			;
+		    reapable_ = true;
+		}
+		break;
+	    case WK_PIDFD:
+		reapable_ = true;
+		break;
+	    case WK_WORKER:
+		{
+		    vector<worker_t*>::iterator witr;
+		    for (witr = workers_.begin() ; witr != workers_.end() ; ++witr)
+		    {
+			if ((*witr)->pid_ == WATCH_PID(data))
+			{
+			    handle_worker(*witr);
+			    break;
+			}
+		    }
+		}
+		break;
+	    case WK_EVENTS:
+		{
+		    map<pid_t, child_t*>::iterator itr = children_.find(WATCH_PID(data));
+		    if (itr == children_.end())
+			break;	    /* stale */
+		    child_t *child = itr->second;
+		    int fd = child->get_input_fd();
+		    if ((events[i].events & EPOLLIN))
+			child->handle_input();
+		    /* stop watching on EOF or end of test, otherwise
+		     * a hung up pipe would wake us continually */
+		    if (!(events[i].events & EPOLLIN) ||
+			child->get_input_fd() < 0)
+			unwatch_fd(fd);
+		}
+		break;
+	    }
 	}
+
+	int64_t now = rel_now();
+	handle_timeouts(now);
+	if (trim_ && trim_ <= now)
+	    trim_outputs(now);
+	if (tick_ && tick_ <= now)
+	    break;
     }
 }
 
@@ -428,7 +2165,7 @@ runner_t::reap_children()
 {
     pid_t pid;
     int status;
-    char msg[1024];
+    struct rusage ru;
 
 #if _NP_DEBUG
     fprintf(stderr, "np: [%s] reap_children()\n",
@@ -440,7 +2177,7 @@ runner_t::reap_children()
 	fprintf(stderr, "np: [%s] about to call waitpid\n",
 		rel_timestamp());
 #endif
-	pid = waitpid(-1, &status, WNOHANG);
+	pid = wait4(-1, &status, WNOHANG, &ru);
 #if _NP_DEBUG > 1
 	{
 	    int e = errno;
@@ -455,7 +2192,7 @@ runner_t::reap_children()
 	{
 	    if (errno == ESRCH || errno == ECHILD)
 		break;
-	    perror("np: waitpid");
+	    perror("np: wait4");
 	    return;
 	}
 	if (WIFSTOPPED(status))
@@ -468,32 +2205,117 @@ runner_t::reap_children()
 	fprintf(stderr, "np: [%s] reaped process %d\n",
 		rel_timestamp(), (int)pid);
 #endif
-	vector<child_t*>::iterator itr;
-	for (itr = children_.begin() ;
-	     itr != children_.end() && (*itr)->get_pid() != pid ;
-	     ++itr)
-	    ;
-	if (itr == children_.end())
+	if (children_.find(pid) == children_.end())
 	{
+	    vector<suite_t*>::iterator sitr;
+	    for (sitr = suites_.begin() ; sitr != suites_.end() ; ++sitr)
+	    {
+		if ((*sitr)->pid_ == pid)
+		    break;
+	    }
+	    if (sitr != suites_.end())
+	    {
+		/* a suite server died early; its tests will fail */
+		fprintf(stderr, "np: suite fork server %d for %s exited\n",
+			(int)pid, (*sitr)->node_->get_fullname().c_str());
+		(*sitr)->pid_ = 0;
+		continue;
+	    }
+	    vector<worker_t*>::iterator witr;
+	    for (witr = workers_.begin() ; witr != workers_.end() ; ++witr)
+	    {
+		if ((*witr)->pid_ == pid)
+		    break;
+	    }
+	    if (witr != workers_.end())
+	    {
+		/* its socket tells us when it's gone, and why */
+		(*witr)->exited_ = true;
+		(*witr)->status_ = status;
+		continue;
+	    }
 	    /* some other process */
 	    fprintf(stderr, "np: reaped stray process %d\n", (int)pid);
 	    /* TODO: this is probably eventworthy */
 	    continue;	    /* whatever */
 	}
-	child_t *child = *itr;
+	reap_child(pid, status, ru, false);
+    }
+
+    /* and those which workers have reaped for us */
+    for (size_t i = 0 ; i < exits_.size() ; i++)
+    {
+	if (children_.find(exits_[i].pid_) != children_.end())
+	    reap_child(exits_[i].pid_, exits_[i].status_,
+		       exits_[i].rusage_, exits_[i].lost_);
+    }
+    exits_.clear();
+    /* nothing to reap here, move along */
+}
+
+/*
+ * Finish with a child process which has exited with @status, having
+ * used the resources in @ru.  If @lost its worker died after reaping
+ * it and we never learned how it exited, so @status and @ru mean
+ * nothing.
+ */
+void
+runner_t::reap_child(pid_t pid, int status, const struct rusage &ru, bool lost)
+{
+    char msg[1024];
+    map<pid_t, child_t*>::iterator itr = children_.find(pid);
+    child_t *child = itr->second;
+    int event_fd = child->get_input_fd();
+
+    /* pick up any events sent just before exiting */
+    child->drain_input();
 
-	if (WIFEXITED(status))
+    if (child->is_rerun())
+    {
+	/* how a re-run exits was already reported by the first run */
+    }
+    else if (child->is_cancelled())
+    {
+	/* we killed it, so how it exited says nothing about the
+	 * test, but a result it reported before then still stands */
+	if (child->get_result() == R_UNKNOWN)
 	{
-	    if (WEXITSTATUS(status))
-	    {
-		snprintf(msg, sizeof(msg),
-			 "child process %d exited with %d",
-			 (int)pid, WEXITSTATUS(status));
-		event_t ev(EV_EXIT, msg);
-		child->merge_result(raise_event(child->get_job(), &ev));
-	    }
+	    unwatch_fd(event_fd);
+	    unwatch_fd(child->get_pidfd());
+	    children_.erase(itr);
+	    skip_job(child->release_job());
+	    delete child;
+	    return;
+	}
+    }
+    else if (lost)
+    {
+	snprintf(msg, sizeof(msg),
+		 "lost track of child process %d when its worker died",
+		 (int)pid);
+	event_t ev(EV_EXIT, msg);
+	child->merge_result(raise_event(child->get_job(), &ev));
+    }
+    else if (WIFEXITED(status))
+    {
+	if (WEXITSTATUS(status))
+	{
+	    snprintf(msg, sizeof(msg),
+		     "child process %d exited with %d",
+		     (int)pid, WEXITSTATUS(status));
+	    event_t ev(EV_EXIT, msg);
+	    child->merge_result(raise_event(child->get_job(), &ev));
 	}
-	else if (WIFSIGNALED(status))
+    }
+    else if (WIFSIGNALED(status))
+    {
+	if (limit_breached(child->get_job(), WTERMSIG(status), ru,
+			   msg, sizeof(msg)))
+	{
+	    event_t ev(EV_RLIMIT, msg);
+	    child->merge_result(raise_event(child->get_job(), &ev));
+	}
+	else
 	{
 	    snprintf(msg, sizeof(msg),
 		    "child process %d died on signal %d",
@@ -501,23 +2323,101 @@ runner_t::reap_children()
 	    event_t ev(EV_SIGNAL, msg);
 	    child->merge_result(raise_event(child->get_job(), &ev));
 	}
+    }
+    if (!child->is_rerun() && !lost)
+	child->merge_result(resource_usage(child->get_job(), ru));
+
+    /* test is finished; if nothing went wrong then PASS */
+    child->merge_result(np::R_PASS);
 
-	/* test is finished; if nothing went wrong then PASS */
-	child->merge_result(np::R_PASS);
+    job_t *j = child->get_job();
+    result_t res = child->get_result();
+    bool rerun = (!child->is_rerun() && !child->is_cancelled() &&
+		  wants_rerun(j, res));
+    if (!child->is_rerun())
+    {
+	j->post_run(true);
+	history_.record(j->as_string(), j->get_elapsed(), res == R_FAIL);
+    }
 
+    /* detach and clean up, the job lives on */
+    unwatch_fd(event_fd);
+    unwatch_fd(child->get_pidfd());
+    children_.erase(itr);
+    child->release_job();
+    delete child;
+
+    if (!rerun)
+    {
 	/* notify listeners */
-	nfailed_ += (child->get_result() == R_FAIL);
+	nfailed_ += (res == R_FAIL);
 	nrun_++;
-	child->get_job()->post_run(true);
-	dispatch_listeners(end_job, child->get_job(), child->get_result());
+	finish_job(j, res);
+    }
 
-	/* detach and clean up */
-	children_.erase(itr);
-	delete child;
+    if (rerun)
+    {
+	/* the job isn't over until the re-run reports */
+	child = fork_child(j, true);
+	if (!child)
+	    exec_rerun(j);
+	child->merge_result(res);
     }
+}
 
-    caught_sigchld = 0;
-    /* nothing to reap here, move along */
+/*
+ * Stop all the running children, because enough tests have failed
+ * that the run is being cut short.  They'll be reaped as usual.
+ */
+void
+runner_t::cancel_children()
+{
+    int64_t now = rel_now();
+
+    cancelled_ = true;
+    map<pid_t, child_t*>::iterator itr;
+    for (itr = children_.begin() ; itr != children_.end() ; ++itr)
+    {
+	child_t *child = itr->second;
+	if (child->cancel(now))
+	    add_deadline(child);
+    }
+}
+
+/*
+ * Tell the listeners a job has ended, and let go of it.
+ */
+void
+runner_t::finish_job(job_t *j, result_t res)
+{
+    if (reporter_)
+    {
+	if (j->get_rusage())
+	    reporter_->job_resources(j, j->get_rusage());
+	reporter_->end_job(j, res);
+	return;
+    }
+    if (j->get_rusage())
+	dispatch_listeners(job_resources, j, j->get_rusage());
+    dispatch_listeners(end_job, j, res);
+    delete j;
+}
+
+/*
+ * Tell the listeners a job was never run or didn't get to finish,
+ * and let go of it.
+ */
+void
+runner_t::skip_job(job_t *j)
+{
+    nskipped_++;
+    if (reporter_)
+    {
+	reporter_->skip_job(j);
+	return;
+    }
+    dispatch_listeners(skip_job, j);
+    delete j;
 }
 
 void
@@ -544,57 +2444,238 @@ runner_t::run_function(functype_t ft, np::spiegel::function_t *f)
     }
 }
 
-void
-runner_t::run_fixtures(testnode_t *tn, functype_t type)
-{
-    list<np::spiegel::function_t*> fixtures = tn->get_fixtures(type);
-    list<np::spiegel::function_t*>::iterator itr;
-    for (itr = fixtures.begin() ; itr != fixtures.end() ; ++itr)
-	run_function(type, *itr);
+/*
+ * Time a benchmark function, in the child, and send the results to
+ * the parent to compare against the baseline.  The function is
+ * called directly rather than through spiegel, which would add
+ * more overhead than many benchmarks take.
+ */
+void
+runner_t::run_benchmark(job_t *j, np::spiegel::function_t *f)
+{
+    void (*fn)(void) = (void (*)(void))f->get_address();
+
+    /* the timing would mean nothing, just check it works */
+    bool timing = !rerun_;
+#if HAVE_VALGRIND
+    if (RUNNING_ON_VALGRIND)
+	timing = false;
+#endif
+    if (!timing)
+    {
+	fn();
+	return;
+    }
+
+    benchmark_t b;
+    memset(&b, 0, sizeof(b));
+    b.measure(fn);
+    dispatch_listeners(add_benchmark, j, &b);
+}
+
+/*
+ * Called in the parent with a benchmark's timing from the child.
+ * Fails the job if the benchmark has regressed from its baseline.
+ */
+result_t
+runner_t::add_benchmark(job_t *j, const benchmark_t *b)
+{
+    result_t res = R_UNKNOWN;
+    string name = j->as_string();
+    double base;
+
+    if (reporter_)
+	reporter_->add_benchmark(j, b);
+    else
+	dispatch_listeners(add_benchmark, j, b);
+
+    if (!baseline_.is_updating() && baseline_.get(name, &base) &&
+	baseline_.is_regression(b, base))
+    {
+	char msg[256];
+	snprintf(msg, sizeof(msg),
+		 "benchmark took %.3f ns, %.0f%% slower than the baseline %.3f ns",
+		 b->median_, (b->median_ / base - 1.0) * 100.0, base);
+	event_t ev(EV_BENCHMARK, msg);
+	res = raise_event(j, &ev);
+    }
+    if (res != R_FAIL)
+	baseline_.record(name, b->median_);
+
+    return res;
+}
+
+void
+runner_t::run_fixtures(const list<np::spiegel::function_t*> &fixtures, functype_t type)
+{
+    list<np::spiegel::function_t*>::const_iterator itr;
+    for (itr = fixtures.begin() ; itr != fixtures.end() ; ++itr)
+	run_function(type, *itr);
+}
+
+result_t
+runner_t::valgrind_errors(job_t *j, result_t res)
+{
+#if HAVE_VALGRIND
+    unsigned long leaked = 0;
+    unsigned long dubious __attribute__((unused)) = 0;
+    unsigned long reachable __attribute__((unused)) = 0;
+    unsigned long suppressed __attribute__((unused)) = 0;
+    unsigned long nerrors;
+    char msg[1024];
+
+    VALGRIND_DO_LEAK_CHECK;
+    VALGRIND_COUNT_LEAKS(leaked, dubious, reachable, suppressed);
+    if (leaked)
+    {
+	snprintf(msg, sizeof(msg),
+		 "%lu bytes of memory leaked", leaked);
+	event_t ev(EV_VALGRIND, msg);
+	res = merge(res, raise_event(j, &ev));
+    }
+
+    nerrors = VALGRIND_COUNT_ERRORS;
+    if (nerrors)
+    {
+	snprintf(msg, sizeof(msg),
+		 "%lu unsuppressed errors found by valgrind", nerrors);
+	event_t ev(EV_VALGRIND, msg);
+	res = merge(res, raise_event(j, &ev));
+    }
+#endif
+
+    return res;
+}
+
+/*
+ * Trim a sanitizer's report to start at its "==PID==ERROR: " line,
+ * without the prefix, so the event's description starts with what
+ * went wrong.  Anything before that is the sanitizer warning about
+ * itself, e.g. about threads which didn't survive the fork.
+ */
+static string
+sanitizer_description(const string &report)
+{
+    string::size_type e = report.find("ERROR: ");
+    if (e == string::npos)
+	return report;
+    string::size_type bol = report.rfind('\n', e);
+    bol = (bol == string::npos ? 0 : bol+1);
+    if (report.compare(bol, 2, "==") != 0 || report.compare(e-2, 2, "==") != 0)
+	return report.substr(bol);
+    return report.substr(e + 7);
+}
+
+/*
+ * Called by ASan with its report just before it kills the process,
+ * which the runner will see as the test failing anyway.  Pass the
+ * report on while we still can.
+ */
+static void
+sanitizer_report(const char *report)
+{
+    string desc = sanitizer_description(report);
+    event_t ev(EV_SANITIZER, desc.c_str());
+    runner_t::running()->raise_event(0, &ev);
+}
+
+result_t
+runner_t::sanitizer_errors(job_t *j, result_t res)
+{
+    if (!__lsan_do_recoverable_leak_check)
+	return res;
+
+    /* LeakSanitizer writes its report to stderr, catch it there */
+    fflush(stderr);
+    int fd = anon_file("novaprova.lsan");
+    int saved = dup(STDERR_FILENO);
+    dup2(fd, STDERR_FILENO);
+    int leaked = __lsan_do_recoverable_leak_check();
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+
+    if (leaked)
+    {
+	string report;
+	char buf[4096];
+	off_t off = 0;
+	ssize_t r;
+	while ((r = pread(fd, buf, sizeof(buf), off)) > 0)
+	{
+	    report.append(buf, r);
+	    off += r;
+	}
+	string desc = sanitizer_description(report);
+	event_t ev(EV_SANITIZER, desc.c_str());
+	res = merge(res, raise_event(j, &ev));
+    }
+    close(fd);
+
+    return res;
 }
 
 result_t
-runner_t::valgrind_errors(job_t *j, result_t res)
+runner_t::heap_leaks(job_t *j, result_t res)
 {
-#if HAVE_VALGRIND
+    vector<leak_tracker_t::leak_t> leaks;
+    if (!leak_tracker_t::end(leaks) || leaks.empty())
+	return res;
+
     unsigned long leaked = 0;
-    unsigned long dubious __attribute__((unused)) = 0;
-    unsigned long reachable __attribute__((unused)) = 0;
-    unsigned long suppressed __attribute__((unused)) = 0;
-    unsigned long nerrors;
-    char msg[1024];
+    vector<leak_tracker_t::leak_t>::iterator itr;
+    for (itr = leaks.begin() ; itr != leaks.end() ; ++itr)
+	leaked += itr->size_;
 
-    VALGRIND_DO_LEAK_CHECK;
-    VALGRIND_COUNT_LEAKS(leaked, dubious, reachable, suppressed);
-    if (leaked)
+    char msg[1024];
+    snprintf(msg, sizeof(msg), "%lu bytes of memory leaked in %lu blocks\n",
+	     leaked, (unsigned long)leaks.size());
+    string desc = msg;
+    /* the first few are usually enough to go on */
+    unsigned int n = 0;
+    for (itr = leaks.begin() ; itr != leaks.end() && n < 10 ; ++itr, ++n)
     {
-	snprintf(msg, sizeof(msg),
-		 "%lu bytes of memory leaked", leaked);
-	event_t ev(EV_VALGRIND, msg);
-	res = merge(res, raise_event(j, &ev));
+	snprintf(msg, sizeof(msg), "%lu bytes allocated at\n",
+		 (unsigned long)itr->size_);
+	desc += msg;
+	desc += np::spiegel::describe_stacktrace(itr->stack_);
     }
-
-    nerrors = VALGRIND_COUNT_ERRORS;
-    if (nerrors)
+    if (itr != leaks.end())
     {
-	snprintf(msg, sizeof(msg),
-		 "%lu unsuppressed errors found by valgrind", nerrors);
-	event_t ev(EV_VALGRIND, msg);
-	res = merge(res, raise_event(j, &ev));
+	snprintf(msg, sizeof(msg), "... and %lu more blocks\n",
+		 (unsigned long)(leaks.end() - itr));
+	desc += msg;
     }
-#endif
+    desc.resize(desc.length()-1);	/* trailing newline */
 
-    return res;
+    event_t ev(EV_MEMLEAK, desc.c_str());
+    return merge(res, raise_event(j, &ev));
 }
 
 result_t
 runner_t::descriptor_leaks(job_t *j, const vector<string> &prefds, result_t res)
 {
-    vector<string> postfds = np::spiegel::platform::get_file_descriptors();
     unsigned int fd = 0;
     string none;
     char msg[1024];
 
+    if (applied_[L_NOFILE])
+    {
+	/* with none left, they can't even be listed */
+	int testfd = open("/dev/null", O_RDONLY);
+	if (testfd < 0 && errno == EMFILE)
+	{
+	    snprintf(msg, sizeof(msg),
+		     "test used all of its %lu file descriptors",
+		     applied_[L_NOFILE]);
+	    event_t ev(EV_RLIMIT, msg);
+	    return merge(res, raise_event(j, &ev));
+	}
+	if (testfd >= 0)
+	    close(testfd);
+    }
+
+    vector<string> postfds = np::spiegel::platform::get_file_descriptors();
+
     unsigned maxfd = max(prefds.size(), postfds.size());
     for (fd = 0 ; fd < maxfd ; fd++)
     {
@@ -629,36 +2710,70 @@ runner_t::run_test_code(job_t *j)
     testnode_t *tn = j->get_node();
     result_t res = R_UNKNOWN;
     event_t *ev;
+    /* a test in a thread shares the process with others, so
+     * the checks on the whole process can't be pinned on it */
+    bool isolated = !thread_listener;
+    vector<string> prefds;
+    /* made before the leak tracker starts, as a failing fixture
+     * never returns to free them */
+    list<np::spiegel::function_t*> befores = tn->get_fixtures(FT_BEFORE);
+    list<np::spiegel::function_t*> afters = tn->get_fixtures(FT_AFTER);
+
+    /* our output must come after the listeners announce us */
+    if (j->get_ticket() && gate_)
+	reporter_t::wait_begun(gate_, j->get_ticket());
+
+    if (isolated)
+    {
+	if (__asan_set_error_report_callback)
+	    __asan_set_error_report_callback(sanitizer_report);
 
-    j->pre_run(false);
+	j->pre_run(false);
 
-    vector<string> prefds = np::spiegel::platform::get_file_descriptors();
+	prefds = np::spiegel::platform::get_file_descriptors();
 
-    np_try
+	/* tracking every allocation would be timed too */
+	if (tn->get_function(FT_TEST))
+	    leak_tracker_t::begin();
+    }
+
+    if (suite_failure_)
     {
-	run_fixtures(tn, FT_BEFORE);
+	/* the suite setup failed in our fork server */
+	res = merge(res, raise_event(j, suite_failure_));
     }
-    np_catch(ev)
+    else
     {
-	ev->in_functype(FT_BEFORE);
-	res = merge(res, raise_event(j, ev));
+	np_try
+	{
+	    run_fixtures(befores, FT_BEFORE);
+	}
+	np_catch(ev)
+	{
+	    ev->in_functype(FT_BEFORE);
+	    res = merge(res, raise_event(j, ev));
+	}
     }
 
     if (res == R_UNKNOWN)
     {
+	functype_t ft = (tn->get_function(FT_TEST) ? FT_TEST : FT_BENCH);
 	np_try
 	{
-	    run_function(FT_TEST, tn->get_function(FT_TEST));
+	    if (ft == FT_TEST)
+		run_function(FT_TEST, tn->get_function(FT_TEST));
+	    else
+		run_benchmark(j, tn->get_function(FT_BENCH));
 	}
 	np_catch(ev)
 	{
-	    ev->in_functype(FT_TEST);
+	    ev->in_functype(ft);
 	    res = merge(res, raise_event(j, ev));
 	}
 
 	np_try
 	{
-	    run_fixtures(tn, FT_AFTER);
+	    run_fixtures(afters, FT_AFTER);
 	}
 	np_catch(ev)
 	{
@@ -671,22 +2786,262 @@ runner_t::run_test_code(job_t *j)
 	res = merge(res, R_PASS);
     }
 
-    j->post_run(false);
+    if (isolated)
+    {
+	j->post_run(false);
+
+	res = descriptor_leaks(j, prefds, res);
+	prefds.clear();
+
+	res = valgrind_errors(j, res);
+	res = sanitizer_errors(j, res);
+	res = heap_leaks(j, res);
+    }
+
+    return res;
+}
+
+
+static int64_t
+timeval_ns(const struct timeval &tv)
+{
+    return (int64_t)tv.tv_sec * NANOSEC_PER_SEC + (int64_t)tv.tv_usec * 1000;
+}
 
-    res = descriptor_leaks(j, prefds, res);
-    prefds.clear();
+/*
+ * Called in the parent with the resources used by a job's process,
+ * as reported when it was reaped.  Fails the test if it used more
+ * than the configured limits.  The process starts out with all the
+ * memory its parent had resident, so its maximum resident set size
+ * counts only how far the test took it above that.
+ */
+result_t
+runner_t::resource_usage(job_t *j, const struct rusage &cru)
+{
+    result_t res = R_UNKNOWN;
+    char msg[256];
 
-    res = valgrind_errors(j, res);
+    struct rusage ru = cru;
+    ru.ru_maxrss = max(ru.ru_maxrss - j->get_base_rss(), 0L);
+    j->set_rusage(ru);
 
+    int64_t cpu = timeval_ns(ru.ru_utime) + timeval_ns(ru.ru_stime);
+    if (max_cpu_ && cpu > max_cpu_)
+    {
+	snprintf(msg, sizeof(msg),
+		 "test used %lld ms of CPU time, more than the %lld ms allowed",
+		 (long long)(cpu / (NANOSEC_PER_SEC/1000)),
+		 (long long)(max_cpu_ / (NANOSEC_PER_SEC/1000)));
+	event_t ev(EV_RESOURCE, msg);
+	res = merge(res, raise_event(j, &ev));
+    }
+    if (max_rss_ && ru.ru_maxrss > max_rss_)
+    {
+	snprintf(msg, sizeof(msg),
+		 "test used %ld KiB of memory, more than the %ld KiB allowed",
+		 (long)ru.ru_maxrss, max_rss_);
+	event_t ev(EV_RESOURCE, msg);
+	res = merge(res, raise_event(j, &ev));
+    }
     return res;
 }
 
+/*
+ * The resource limit for a job: the one set on its testnode or the
+ * nearest ancestor with NP_LIMIT(), else the default.  Limits make
+ * no sense when Valgrind is running the test.
+ */
+unsigned long
+runner_t::get_limit(const job_t *j, limit_t which) const
+{
+#if HAVE_VALGRIND
+    if (RUNNING_ON_VALGRIND)
+	return 0;
+#endif
+    unsigned long value;
+    if (j->get_node()->get_limit(which, &value))
+	return value;
+    return limits_[which];
+}
+
+static void
+set_rlimit(int resource, rlim_t soft, rlim_t hard)
+{
+    struct rlimit rl;
+    if (getrlimit(resource, &rl) < 0)
+    {
+	perror("np: getrlimit");
+	return;
+    }
+    /* only a privileged process can raise the hard limit */
+    if (rl.rlim_max != RLIM_INFINITY)
+    {
+	hard = min(hard, rl.rlim_max);
+	soft = min(soft, hard);
+    }
+    rl.rlim_cur = soft;
+    rl.rlim_max = hard;
+    if (setrlimit(resource, &rl) < 0)
+	perror("np: setrlimit");
+}
+
+/*
+ * The KiB figure for @field in /proc/self/status.  Doesn't
+ * allocate, so it can be called when malloc() has failed.
+ */
+static unsigned long
+status_kib(const char *field)
+{
+    char buf[4096];
+    int fd = open("/proc/self/status", O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+	return 0;
+    ssize_t r = read(fd, buf, sizeof(buf)-1);
+    close(fd);
+    if (r <= 0)
+	return 0;
+    buf[r] = '\0';
+    const char *p = strstr(buf, field);
+    return (p ? strtoul(p+strlen(field), 0, 10) : 0);
+}
+
+/* KiB of private writable memory mapped, which RLIMIT_DATA limits */
+static unsigned long
+data_size()
+{
+    return status_kib("\nVmData:");
+}
+
+/*
+ * The RLIMIT event for a test running out of memory is formatted
+ * before the test starts, because when it's needed the test has
+ * nothing left to format it with.
+ */
+static char memory_event[512];
+static size_t memory_event_len;
+static int memory_event_fd = -1;
+static rlim_t memory_limit;	/* RLIMIT_DATA, in bytes */
+
+/*
+ * Called in the child process before running the test, to apply its
+ * resource limits.  The memory limit counts only what the test
+ * allocates, not the runner's own memory inherited across fork().
+ */
+void
+runner_t::apply_limits(const job_t *j)
+{
+    for (int i = 0 ; i < L_NUM ; i++)
+    {
+	limit_t which = (limit_t)i;
+	unsigned long value = get_limit(j, which);
+	if (!value)
+	    continue;
+	switch (which)
+	{
+	case L_CPU:
+	    /* SIGXCPU first, then SIGKILL a second later if ignored */
+	    set_rlimit(RLIMIT_CPU, value, value+1);
+	    break;
+	case L_MEM:
+	    /* ASan reserves terabytes of address space for itself */
+	    if (__lsan_do_recoverable_leak_check)
+		continue;
+	    {
+		rlim_t data = (data_size() + value) * 1024;
+		set_rlimit(RLIMIT_DATA, data, data);
+		memory_limit = data;
+	    }
+	    {
+		char msg[128];
+		snprintf(msg, sizeof(msg),
+			 "test exceeded its memory limit of %lu KiB", value);
+		event_t ev(EV_RLIMIT, msg);
+		memory_event_len = proxy_listener_t::format_event(&ev,
+				    memory_event, sizeof(memory_event));
+		memory_event_fd = event_pipe_;
+	    }
+	    leak_tracker_t::set_failure_handler(memory_exhausted);
+	    break;
+	case L_NOFILE:
+	    set_rlimit(RLIMIT_NOFILE, value, value);
+	    break;
+	case L_FSIZE:
+	    set_rlimit(RLIMIT_FSIZE, value * 1024, value * 1024);
+	    break;
+	default:
+	    break;
+	}
+	applied_[which] = value;
+    }
+}
+
+/*
+ * Called in the child by malloc() when it fails.  If the request
+ * would have taken the test past its memory limit, the test has
+ * used up its allowance and may well crash soon after, so report it
+ * now.  There's no memory to spare, so the event prepared earlier
+ * is written straight to the event pipe.
+ */
+void
+runner_t::memory_exhausted(size_t size)
+{
+    static bool reported = false;
+    if (reported || !memory_event_len)
+	return;
+    /* requests that large fail whatever the limit */
+    if (size >= (size_t)PTRDIFF_MAX)
+	return;
+    if ((rlim_t)data_size() * 1024 + size <= memory_limit)
+	return;
+    reported = true;
+
+    const char *p = memory_event;
+    size_t len = memory_event_len;
+    while (len)
+    {
+	ssize_t r = write(memory_event_fd, p, len);
+	if (r < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    return;
+	}
+	p += r;
+	len -= r;
+    }
+}
+
+/*
+ * Called in the parent when a job's process dies on signal @sig, to
+ * tell whether that was the kernel enforcing one of its limits.
+ */
+bool
+runner_t::limit_breached(const job_t *j, int sig, const struct rusage &ru,
+			 char *msg, size_t maxlen) const
+{
+    unsigned long cpu = get_limit(j, L_CPU);
+    unsigned long fsize = get_limit(j, L_FSIZE);
+
+    if (cpu && (sig == SIGXCPU ||
+	(sig == SIGKILL && (unsigned long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) >= cpu)))
+    {
+	snprintf(msg, maxlen,
+		 "test exceeded its CPU time limit of %lu seconds", cpu);
+	return true;
+    }
+    if (fsize && sig == SIGXFSZ)
+    {
+	snprintf(msg, maxlen,
+		 "test exceeded its file size limit of %lu KiB", fsize);
+	return true;
+    }
+    return false;
+}
 
 void
 runner_t::begin_job(job_t *j)
 {
     child_t *child;
-    result_t res;
 
 //     {
 // 	static int n = 0;
@@ -699,15 +3054,46 @@ runner_t::begin_job(job_t *j)
 	    rel_timestamp(), j->as_string().c_str());
 #endif
 
-    dispatch_listeners(begin_job, j);
+    /* before the listeners see the job, so they see its start */
     j->pre_run(true);
+    if (reporter_)
+    {
+	uint32_t ticket = reporter_->begin_job(j);
+	/* a test's output goes straight to ours, so it must come
+	 * after the listeners announce the test; its process waits
+	 * for that rather than us, see run_test_code() */
+	if (!needs_stdout_)
+	{
+	    if (gate_)
+		j->set_ticket(ticket);
+	    else
+		reporter_->sync();
+	}
+    }
+    else
+    {
+	dispatch_listeners(begin_job, j);
+    }
 
-    child = fork_child(j);
+    if (worker_fork(j))
+	return;	/* a worker will fork the child */
+    child = fork_child(j, false);
     if (child)
 	return; /* parent process */
 
     /* child process */
-    set_listener(new proxy_listener_t(event_pipe_));
+    run_job(j);
+}
+
+void
+runner_t::run_job(job_t *j)
+{
+    result_t res;
+
+    apply_limits(j);
+    proxy_listener_t *proxy = new proxy_listener_t(event_pipe_);
+    set_listener(proxy);
+    proxy->base_rss(status_kib("\nVmRSS:"));
     res = run_test_code(j);
     dispatch_listeners(end_job, j, res);
 #if _NP_DEBUG
@@ -718,6 +3104,128 @@ runner_t::begin_job(job_t *j)
     exit(0);
 }
 
+/*
+ * In hybrid Valgrind mode tests are run natively, and those that
+ * failed are run again under Valgrind for its diagnostics.  So can a
+ * sample of those that passed, picked by name so the same ones are
+ * re-run every time.
+ */
+bool
+runner_t::wants_rerun(const job_t *j, result_t res) const
+{
+    if (!valgrind_rerun_)
+	return false;
+    if (res == R_FAIL)
+	return true;
+    if (res != R_PASS || !valgrind_sample_)
+	return false;
+
+    string name = j->as_string();
+    unsigned long hash = 5381;
+    for (const char *p = name.c_str() ; *p ; p++)
+	hash = hash * 33 + (unsigned char)*p;
+    return (hash % 100 < valgrind_sample_);
+}
+
+/*
+ * Called in a newly forked child process to re-run a job under
+ * Valgrind.  The test executable is exec'd from scratch, and told
+ * through the environment which job to run and where to send events.
+ */
+void
+runner_t::exec_rerun(job_t *j)
+{
+#if HAVE_VALGRIND
+    char fdbuf[32];
+    snprintf(fdbuf, sizeof(fdbuf), "%d", event_pipe_);
+    setenv("__NP_RERUN", j->as_string().c_str(), 1);
+    setenv("__NP_RERUN_FD", fdbuf, 1);
+    if (rerun_cache_fd_ >= 0)
+    {
+	/* a path rather than the fd itself, so that each re-run
+	 * reads the file from the start */
+	char pathbuf[64];
+	snprintf(pathbuf, sizeof(pathbuf), "/proc/self/fd/%d", rerun_cache_fd_);
+	fcntl(rerun_cache_fd_, F_SETFD, 0);
+	setenv("__NP_RERUN_CACHE", pathbuf, 1);
+    }
+    fprintf(stderr, "[%s] np: re-running %s under valgrind\n",
+	    rel_timestamp(), j->as_string().c_str());
+    fflush(stderr);
+    __np_exec_valgrind();
+#else
+    fprintf(stderr, "np: cannot re-run %s, no valgrind\n",
+	    j->as_string().c_str());
+    exit(1);
+#endif
+}
+
+/*
+ * In a process started by exec_rerun(), find the named job, run its
+ * suite setup and then the job itself, and exit.
+ */
+void
+runner_t::rerun_job(const char *name)
+{
+    const char *fd = getenv("__NP_RERUN_FD");
+    if (!fd)
+    {
+	fprintf(stderr, "np: no event pipe to re-run %s\n", name);
+	exit(1);
+    }
+    event_pipe_ = atoi(fd);
+    rerun_ = true;
+    running_ = this;
+
+    job_t *j = 0;
+    plan_t plan;
+    plan.add_node(testmanager_t::instance()->get_root());
+    plan_t::iterator pitr = plan.begin();
+    plan_t::iterator pend = plan.end();
+    for ( ; !j && pitr != pend ; ++pitr)
+    {
+	j = new job_t(pitr);
+	if (j->as_string() != name)
+	{
+	    delete j;
+	    j = 0;
+	}
+    }
+    if (!j)
+    {
+	fprintf(stderr, "np: cannot find test %s to re-run\n", name);
+	exit(1);
+    }
+
+    /* outermost suite first */
+    vector<testnode_t*> suites;
+    testnode_t *sn = j->get_node()->get_suite();
+    while (sn)
+    {
+	suites.insert(suites.begin(), sn);
+	sn = (sn->get_parent() ? sn->get_parent()->get_suite() : 0);
+    }
+    vector<testnode_t*>::iterator itr;
+    for (itr = suites.begin() ; itr != suites.end() && !suite_failure_ ; ++itr)
+    {
+	np::spiegel::function_t *f = (*itr)->get_function(FT_BEFORE_SUITE);
+	event_t *ev;
+	if (!f)
+	    continue;
+	np_try
+	{
+	    run_function(FT_BEFORE_SUITE, f);
+	}
+	np_catch(ev)
+	{
+	    ev->in_functype(FT_BEFORE_SUITE);
+	    suite_failure_ = ev->clone();
+	}
+    }
+
+    run_job(j);
+}
+
 void
 runner_t::wait()
 {
@@ -751,6 +3259,72 @@ np_set_concurrency(np_runner_t *runner, int n)
     runner->set_concurrency(n);
 }
 
+/**
+ * Let the runner choose how many test jobs to run at once
+ *
+ * @param runner	the runner object
+ * @param min		fewest jobs to run at once
+ * @param max		most jobs to run at once
+ *
+ * The number of test jobs run at the same time starts at one per
+ * online CPU and is adjusted as the tests run, within the range
+ * @a min to @a max.  More jobs are run when the tests leave CPUs
+ * idle, for example because they sleep or wait for the network,
+ * and fewer when the system reports that tasks are stalling for
+ * CPU, memory or I/O, or free memory runs low.  A @a max of 0 is
+ * shorthand for four jobs per online CPU.
+ *
+ * \ingroup main
+ */
+extern "C" void
+np_set_concurrency_range(np_runner_t *runner, int min, int max)
+{
+    runner->set_concurrency_range(min, max);
+}
+
+/**
+ * Stop running tests after some have failed
+ *
+ * @param runner	the runner object
+ * @param n		number of failures to stop after
+ *
+ * After @a n tests have failed, no more tests are started and any
+ * tests still running are killed.  Listeners are told which tests
+ * were skipped.  The default value is 0, meaning all the tests are
+ * run however many fail.
+ *
+ * \ingroup main
+ */
+extern "C" void
+np_set_fail_fast(np_runner_t *runner, unsigned int n)
+{
+    runner->set_fail_fast(n);
+}
+
+/**
+ * Set a default resource limit for tests
+ *
+ * @param runner	the runner object
+ * @param which		which resource to limit
+ * @param value		the limit, or 0 for no limit
+ *
+ * Each test's process is limited to @a value seconds of CPU time, KiB
+ * of memory allocated, open file descriptors, or KiB written to any
+ * one file, depending on @a which.  Tests which run into a limit
+ * fail.  Tests in a source file using the @c NP_LIMIT() macro get
+ * the limit given there instead.  The defaults come from the
+ * environment variables @c NOVAPROVA_LIMIT_CPU, @c NOVAPROVA_LIMIT_MEM,
+ * @c NOVAPROVA_LIMIT_NOFILE and @c NOVAPROVA_LIMIT_FSIZE, or are 0.
+ *
+ * \ingroup main
+ */
+extern "C" void
+np_set_limit(np_runner_t *runner, enum np_limit which, unsigned long value)
+{
+    if ((unsigned)which < L_NUM)
+	runner->set_limit((np::limit_t)which, value);
+}
+
 /**
  * Print the names of the tests in the plan to stdout.
  *
@@ -18,7 +18,15 @@
 
 #include "np/util/common.hxx"
 #include "np/types.hxx"
+#include "np/history.hxx"
+#include "np/benchmark.hxx"
+#include "np/reporter.hxx"
+#include <sys/resource.h>
 #include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <list>
 
 namespace np { namespace spiegel { class function_t; }; };
 
@@ -30,6 +38,7 @@ class plan_t;
 class child_t;
 class testnode_t;
 class job_t;
+class governor_t;
 
 class runner_t : public np::util::zalloc
 {
@@ -38,41 +47,132 @@ public:
     ~runner_t();
 
     void set_concurrency(int n);
+    void set_concurrency_range(int min, int max);
+    void set_fail_fast(unsigned int n);
+    void set_limit(limit_t, unsigned long);
     void add_listener(listener_t *);
     void list_tests(plan_t *) const;
     int run_tests(plan_t *);
     static runner_t *running() { return running_; }
     result_t raise_event(job_t *, const event_t *);
+    result_t add_benchmark(job_t *, const benchmark_t *);
     int get_timeout() const { return timeout_; }
 
 private:
     void destroy_listeners();
-    void begin();
+    void begin(plan_t *);
+    std::vector<job_t*> schedule_jobs(plan_t *);
     void end();
     void set_listener(listener_t *);
-    child_t *fork_child(job_t *);
+    child_t *fork_child(job_t *, bool rerun);
+    bool wants_rerun(const job_t *, result_t) const;
+    void exec_rerun(job_t *) __attribute__((noreturn));
+    void rerun_job(const char *name) __attribute__((noreturn));
+    void become_child(int event_fd, int outfd, int errfd);
+    void run_job(job_t *) __attribute__((noreturn));
+    struct suite_t;
+    suite_t *get_suite(testnode_t *);
+    pid_t suite_fork(suite_t *, unsigned int kind, testnode_t *,
+		     const job_t *, const int *fds, unsigned int nfds);
+    int64_t suite_deadline() const;
+    bool wait_suite(suite_t *, int64_t deadline, const char *what);
+    void serve_suite(testnode_t *, int sock) __attribute__((noreturn));
+    pid_t suite_spawn(int sock, const void *req, const int *fds, unsigned int nfds);
+    void end_suites();
+    void fail_suite(testnode_t *, const char *desc);
+    struct worker_t;
+    worker_t *get_worker(bool threaded);
+    bool is_threadable(const job_t *) const;
+    bool worker_fork(job_t *);
+    void serve_worker(int sock) __attribute__((noreturn));
+    void serve_threads(int sock) __attribute__((noreturn));
+    static void *thread_main(void *);
+    void run_thread_job(job_t *, int event_fd);
+    void retire_worker(worker_t *);
+    void handle_worker(worker_t *);
+    void worker_exited(worker_t *);
+    void end_workers();
+    void watch_fd(int fd, pid_t pid, unsigned int kind);
+    void unwatch_fd(int fd);
+    void add_deadline(child_t *);
+    int64_t next_deadline();
+    void handle_timeouts(int64_t now);
+    void trim_outputs(int64_t now);
     void handle_events();
+    child_t *add_child(pid_t, job_t *, int event_fd, int outfd, int errfd, bool rerun);
     void reap_children();
+    void reap_child(pid_t, int status, const struct rusage &, bool lost);
+    void cancel_children();
+    void finish_job(job_t *, result_t);
+    void skip_job(job_t *);
     void run_function(functype_t ft, spiegel::function_t *f);
-    void run_fixtures(testnode_t *tn, functype_t type);
+    void run_benchmark(job_t *, spiegel::function_t *f);
+    void run_fixtures(const std::list<spiegel::function_t*> &, functype_t type);
     result_t valgrind_errors(job_t *, result_t);
+    result_t sanitizer_errors(job_t *, result_t);
+    result_t heap_leaks(job_t *, result_t);
+    result_t resource_usage(job_t *, const struct rusage &);
+    unsigned long get_limit(const job_t *, limit_t) const;
+    void apply_limits(const job_t *);
+    bool limit_breached(const job_t *, int sig, const struct rusage &,
+			char *msg, size_t maxlen) const;
+    static void memory_exhausted(size_t);
     result_t descriptor_leaks(job_t *j, const std::vector<std::string> &prefds, result_t res);
     result_t run_test_code(job_t *);
     void begin_job(job_t *);
+    unsigned int concurrency_limit();
     void wait();
 
     static runner_t *running_;
 
     /* runtime state */
     std::vector<listener_t*> listeners_;
+    reporter_t *reporter_;	/* calls listeners_, while running in the parent */
+    const reporter_t::gate_t *gate_;	/* outlives reporter_ in children */
     unsigned int nrun_;
     unsigned int nfailed_;
+    unsigned int nskipped_;
+    unsigned int fail_fast_;	/* stop after this many failures, or 0 */
+    bool cancelled_;		/* stopped early, start no more jobs */
     int event_pipe_;		/* only in child processes */
-    std::vector<child_t*> children_;	// only in the parent process
-    unsigned int maxchildren_;
-    std::vector<struct pollfd> pfd_;
+    std::map<pid_t, child_t*> children_;	// only in the parent process
+    unsigned int maxchildren_;	/* the upper bound, with a governor_ */
+    governor_t *governor_;	/* varies the limit, or 0 */
+    int64_t tick_;		/* when to stop waiting and re-check it */
+    int64_t trim_;		/* when to next trim captured output */
+    int epoll_fd_;
+    int sigchld_fd_;		/* only when pidfds are unavailable */
+    bool reapable_;
+    /* min-heap of (deadline, pid), may contain stale entries */
+    std::vector<std::pair<int64_t, pid_t> > deadlines_;
+    /* fork servers for suite fixtures, outermost first */
+    std::vector<suite_t*> suites_;	// only in the parent process
+    event_t *suite_failure_;	/* only in children, if suite setup failed */
+    /* fork servers for jobs outside any suite */
+    std::vector<worker_t*> workers_;	// only in the parent process
+    unsigned int worker_jobs_;	/* jobs per worker, 0 to fork jobs here */
+    unsigned int npending_;	/* jobs sent to workers, not yet started */
+    struct exit_t
+    {
+	pid_t pid_;
+	int status_;
+	bool lost_;		/* worker died without saying how it exited */
+	struct rusage rusage_;
+    };
+    std::vector<exit_t> exits_;	/* reported by workers, not yet reaped */
+    bool threads_;		/* may run NP_THREADED tests in threads */
     int timeout_;	/* in seconds, 0 to disable */
+    bool valgrind_rerun_;	/* re-run some tests under Valgrind */
+    int rerun_cache_fd_;	/* discovery results for re-runs, or -1 */
+    unsigned int valgrind_sample_;  /* percentage of passes re-run */
+    int64_t max_cpu_;		/* in ns of user+system time, 0 for no limit */
+    long max_rss_;		/* in KiB, 0 for no limit */
+    unsigned long limits_[L_NUM];   /* defaults, 0 for no limit */
+    unsigned long applied_[L_NUM];  /* only in children: what was set */
+    bool rerun_;		/* this process is re-running one job */
     bool needs_stdout_;
+    history_t history_;		/* how long jobs took last time */
+    baseline_t baseline_;	/* how fast benchmarks were */
 };
 
 #define np_raise(ev) \
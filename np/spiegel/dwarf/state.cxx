@@ -15,12 +15,14 @@
  */
 #include "np/spiegel/common.hxx"
 #include <sys/fcntl.h>
+#include <sys/stat.h>
 #include <bfd.h>
 #include "state.hxx"
 #include "reader.hxx"
 #include "compile_unit.hxx"
 #include "walker.hxx"
 #include "np/spiegel/platform/common.hxx"
+#include "np/util/parallel.hxx"
 
 namespace np { namespace spiegel { namespace dwarf {
 using namespace std;
@@ -31,6 +33,7 @@ static const char *get_partial_name(reference_t ref);
 state_t *state_t::instance_ = 0;
 
 state_t::state_t()
+ :  indexed_(false)
 {
     assert(!instance_);
     instance_ = this;
@@ -74,6 +77,8 @@ state_t::linkobj_t::map_sections()
 	goto error;
     }
 
+    read_identity(b);
+
     /* Extract the file shape of the DWARF sections */
 #if _NP_DEBUG
     fprintf(stderr, "np: sections:\n");
@@ -213,6 +218,52 @@ out:
     return r;
 }
 
+/*
+ * Record enough about the file to tell whether it has changed since
+ * some earlier run: the GNU build-id note if the linker emitted one,
+ * and the modification time and size in any case.
+ */
+void
+state_t::linkobj_t::read_identity(struct bfd *b)
+{
+    char buf[128];
+    struct stat sb;
+
+    identity_ = filename_;
+
+    asection *sec = bfd_get_section_by_name(b, ".note.gnu.build-id");
+    if (sec)
+    {
+	unsigned long size = sec->size;
+	vector<unsigned char> note(size);
+	/* Elf_Nhdr: namesz, descsz, type, then the padded name and desc */
+	if (size >= 16 &&
+	    bfd_get_section_contents(b, sec, &note[0], 0, size))
+	{
+	    uint32_t namesz = *(uint32_t *)&note[0];
+	    uint32_t descsz = *(uint32_t *)&note[4];
+	    unsigned long off = 12 + ((namesz + 3) & ~3);
+	    if (off + descsz <= size)
+	    {
+		identity_ += " build-id ";
+		for (uint32_t i = 0 ; i < descsz ; i++)
+		{
+		    snprintf(buf, sizeof(buf), "%02x", note[off+i]);
+		    identity_ += buf;
+		}
+	    }
+	}
+    }
+
+    if (stat(filename_, &sb) == 0)
+    {
+	snprintf(buf, sizeof(buf), " mtime %lld.%09ld size %lld",
+		 (long long)sb.st_mtim.tv_sec, (long)sb.st_mtim.tv_nsec,
+		 (long long)sb.st_size);
+	identity_ += buf;
+    }
+}
+
 void
 state_t::linkobj_t::unmap_sections()
 {
@@ -230,23 +281,38 @@ state_t::read_compile_units(linkobj_t *lo)
     fprintf(stderr, "np: reading compile units for linkobj %s\n", lo->filename_);
 #endif
     reader_t infor = lo->sections_[DW_sec_info].get_contents();
-    reader_t abbrevr = lo->sections_[DW_sec_abbrev].get_contents();
+    unsigned first = compile_units_.size();
 
+    /* Each header gives the offset of the next, so these
+     * have to be read in order... */
     compile_unit_t *cu = 0;
     for (;;)
     {
 	cu = new compile_unit_t(compile_units_.size(), lo->index_);
 	if (!cu->read_header(infor))
 	    break;
-
-	cu->read_abbrevs(abbrevr);
-
 	compile_units_.push_back(cu);
     }
     delete cu;
+
+    /* ...but the abbreviation tables are independent */
+    abbrevs_job_t job;
+    job.state_ = this;
+    job.lo_ = lo;
+    job.first_ = first;
+    np::util::parallel_for(compile_units_.size() - first, read_abbrevs_1, &job);
     return true;
 }
 
+void
+state_t::read_abbrevs_1(void *closure, unsigned i)
+{
+    abbrevs_job_t *job = (abbrevs_job_t *)closure;
+    /* every thread needs its own reader */
+    reader_t abbrevr = job->lo_->sections_[DW_sec_abbrev].get_contents();
+    job->state_->compile_units_[job->first_ + i]->read_abbrevs(abbrevr);
+}
+
 static bool
 filename_is_ignored(const char *filename)
 {
@@ -304,8 +370,6 @@ state_t::add_self()
     }
 
     r = read_linkobjs();
-    if (r)
-	prepare_address_index();
     free(exe);
     return r;
 }
@@ -316,10 +380,7 @@ state_t::add_executable(const char *filename)
     linkobj_t *lo = get_linkobj(filename);
     if (!lo)
 	return false;
-    bool r = read_linkobjs();
-    if (r)
-	prepare_address_index();
-    return r;
+    return read_linkobjs();
 }
 
 state_t::linkobj_t *
@@ -660,8 +721,12 @@ state_t::dump_abbrevs()
 }
 
 void
-state_t::insert_ranges(const walker_t &w, reference_t funcref)
+state_t::insert_ranges(const walker_t &w, reference_t funcref,
+		       vector<address_range_t> &res)
 {
+    address_range_t ar;
+    ar.ref = funcref;
+
     const entry_t *e = w.get_entry();
     bool has_lo = (e->get_attribute(DW_AT_low_pc) != 0);
     uint64_t lo = e->get_uint64_attribute(DW_AT_low_pc);
@@ -678,7 +743,9 @@ state_t::insert_ranges(const walker_t &w, reference_t funcref)
 	if (w.get_dwarf_version() == 4 &&
 	    e->get_attribute_form(DW_AT_high_pc) != DW_FORM_addr)
 	    hi += lo;
-	address_index_.insert(lo, hi, funcref);
+	ar.lo = lo;
+	ar.hi = hi;
+	res.push_back(ar);
     }
     else if (ranges)
     {
@@ -701,34 +768,109 @@ state_t::insert_ranges(const walker_t &w, reference_t funcref)
 	    }
 	    start += base;
 	    end += base;
-	    address_index_.insert(start, end, funcref);
+	    ar.lo = start;
+	    ar.hi = end;
+	    res.push_back(ar);
 	}
     }
     else if (has_lo)
     {
-	address_index_.insert(lo, funcref);
+	ar.lo = ar.hi = lo;
+	res.push_back(ar);
     }
 }
 
+string
+state_t::get_identity() const
+{
+    string id;
+    char buf[32];
+
+    vector<linkobj_t*>::const_iterator i;
+    for (i = linkobjs_.begin() ; i != linkobjs_.end() ; ++i)
+    {
+	id += (*i)->identity_;
+	id += "\n";
+    }
+    snprintf(buf, sizeof(buf), "%u compile units\n",
+	     (unsigned)compile_units_.size());
+    id += buf;
+    return id;
+}
+
+vector<state_t::address_range_t>
+state_t::get_address_index()
+{
+    vector<address_range_t> res;
+
+    prepare_address_index();
+    np::util::rangetree<addr_t, reference_t>::const_iterator i;
+    for (i = address_index_.begin() ; i != address_index_.end() ; ++i)
+    {
+	address_range_t r;
+	r.lo = i->first.lo;
+	r.hi = i->first.hi;
+	r.ref = i->second;
+	res.push_back(r);
+    }
+    return res;
+}
+
+void
+state_t::set_address_index(const vector<address_range_t> &ranges)
+{
+    address_index_.clear();
+    vector<address_range_t>::const_iterator i;
+    for (i = ranges.begin() ; i != ranges.end() ; ++i)
+	address_index_.insert(i->lo, i->hi, i->ref);
+    indexed_ = true;
+}
+
+/*
+ * Build the index, unless it was loaded from the discovery cache.
+ * The test runner calls this before forking any children, so they
+ * all share one copy; otherwise it's built the first time it's needed.
+ */
 void
 state_t::prepare_address_index()
 {
+    if (indexed_)
+	return;
+    indexed_ = true;
+
+    /* Walk the compile units in parallel, then merge their
+     * ranges in the same order the serial walk used to, so
+     * any overlapping ranges resolve the same way. */
+    ranges_job_t job;
+    job.state_ = this;
+    job.ranges_.resize(compile_units_.size());
+    np::util::parallel_for(compile_units_.size(), prepare_address_index_1, &job);
+
+    vector< vector<address_range_t> >::iterator i;
+    for (i = job.ranges_.begin() ; i != job.ranges_.end() ; ++i)
+    {
+	vector<address_range_t>::iterator j;
+	for (j = i->begin() ; j != i->end() ; ++j)
+	    address_index_.insert(j->lo, j->hi, j->ref);
+    }
+}
+
+void
+state_t::prepare_address_index_1(void *closure, unsigned i)
+{
+    ranges_job_t *job = (ranges_job_t *)closure;
     reference_t funcref;
 
-    vector<compile_unit_t*>::iterator i;
-    for (i = compile_units_.begin() ; i != compile_units_.end() ; ++i)
+    walker_t w(job->state_->compile_units_[i]);
+    w.set_filter_tag(DW_TAG_subprogram);
+    while (const entry_t *e = w.move_preorder())
     {
-	walker_t w(*i);
-	w.set_filter_tag(DW_TAG_subprogram);
-	while (const entry_t *e = w.move_preorder())
-	{
-	    assert(e->get_tag() == DW_TAG_subprogram);
-	    if (e->get_attribute(DW_AT_specification))
-		funcref = e->get_reference_attribute(DW_AT_specification);
-	    else
-		funcref = w.get_reference();
-	    insert_ranges(w, funcref);
-	}
+	assert(e->get_tag() == DW_TAG_subprogram);
+	if (e->get_attribute(DW_AT_specification))
+	    funcref = e->get_reference_attribute(DW_AT_specification);
+	else
+	    funcref = w.get_reference();
+	insert_ranges(w, funcref, job->ranges_[i]);
     }
 }
 
@@ -806,6 +948,7 @@ state_t::describe_address(np::spiegel::addr_t addr,
     funcref = reference_t::null;
     offset = 0;
 
+    const_cast<state_t *>(this)->prepare_address_index();
     if (address_index_.size())
     {
 	np::util::rangetree<addr_t, reference_t>::const_iterator i = address_index_.find(addr);
@@ -875,6 +1018,78 @@ state_t::get_full_name(reference_t ref)
     return full;
 }
 
+/*
+ * Append to @names the name, and the fully qualified name where that
+ * is different, of every named function at the top level of compile
+ * unit @cu.  This gives the same names as calling get_full_name() for
+ * each function, but in a single walk of the unit rather than one
+ * walk per function.
+ */
+void
+state_t::get_function_names(unsigned int cu,
+			    vector< pair<string, reference_t> > &names)
+{
+    struct function_name_t
+    {
+	const char *name_;
+	reference_t ref_;
+	reference_t spec_;
+    };
+    vector<function_name_t> functions;
+    vector<string> scopes;	    /* qualified name at each level */
+    map<uint32_t, string> qualified;  /* of each subprogram, by offset */
+
+    walker_t w(compile_units_[cu]);
+    while (const entry_t *e = w.move_preorder())
+    {
+	unsigned int level = e->get_level();
+	const char *name = e->get_string_attribute(DW_AT_name);
+
+	scopes.resize(level+1);
+	if (level)
+	{
+	    /* unnamed entries like lexical blocks add nothing */
+	    scopes[level] = scopes[level-1];
+	    if (name)
+	    {
+		if (scopes[level].length())
+		    scopes[level] += "::";
+		scopes[level] += name;
+	    }
+	}
+
+	if (e->get_tag() != DW_TAG_subprogram)
+	    continue;
+	qualified[e->get_offset()] = scopes[level];
+	if (level == 1 && name)
+	{
+	    function_name_t fn;
+	    fn.name_ = name;
+	    fn.ref_ = w.get_reference();
+	    fn.spec_ = reference_t::null;
+	    if (e->get_attribute(DW_AT_specification))
+		fn.spec_ = e->get_reference_attribute(DW_AT_specification);
+	    functions.push_back(fn);
+	}
+    }
+
+    vector<function_name_t>::iterator i;
+    for (i = functions.begin() ; i != functions.end() ; ++i)
+    {
+	names.push_back(make_pair(string(i->name_), i->ref_));
+	if (i->spec_ == reference_t::null)
+	    continue;
+	string full;
+	map<uint32_t, string>::iterator q = qualified.find(i->spec_.offset);
+	if (i->spec_.cu == cu && q != qualified.end())
+	    full = q->second;
+	else
+	    full = get_full_name(i->ref_);
+	if (full != i->name_)
+	    names.push_back(make_pair(full, i->ref_));
+    }
+}
+
 static const char *
 get_partial_name(reference_t ref)
 {
@@ -23,6 +23,8 @@
 #include "reference.hxx"
 #include "enumerations.hxx"
 
+struct bfd;
+
 namespace np {
 namespace spiegel {
 namespace dwarf {
@@ -45,12 +47,27 @@ public:
     void dump_info(bool preorder, bool paths);
     void dump_abbrevs();
 
+    /* Identifies the contents of all the objects we read, for caching */
+    std::string get_identity() const;
+
+    struct address_range_t
+    {
+	np::spiegel::addr_t lo, hi;
+	reference_t ref;
+    };
+    std::vector<address_range_t> get_address_index();
+    void set_address_index(const std::vector<address_range_t> &);
+    /* Prepare an index which will speed up all later calls to describe_address(). */
+    void prepare_address_index();
+
     bool describe_address(np::spiegel::addr_t addr,
 			  reference_t &curef,
 			  unsigned int &lineno,
 			  reference_t &funcref,
 			  unsigned int &offset) const;
     std::string get_full_name(reference_t ref);
+    void get_function_names(unsigned int cu,
+		std::vector< std::pair<std::string, reference_t> > &);
 
     // state_t is a Singleton
     static state_t *instance() { return instance_; }
@@ -78,21 +95,35 @@ private:
 
 	char *filename_;
 	uint32_t index_;
+	std::string identity_;	    /* build-id, mtime and size */
 	section_t sections_[DW_sec_num];
 	std::vector<section_t> mappings_;
 	std::vector<np::spiegel::mapping_t> system_mappings_;
 
 	bool map_sections();
+	void read_identity(struct bfd *);
 	void unmap_sections();
     };
 
     linkobj_t *get_linkobj(const char *filename);
     bool read_linkobjs();
     bool read_compile_units(linkobj_t *);
-    /* Prepare an index which will speed up all later calls to describe_address(). */
-    void prepare_address_index();
+    struct abbrevs_job_t
+    {
+	state_t *state_;
+	linkobj_t *lo_;
+	unsigned first_;
+    };
+    static void read_abbrevs_1(void *, unsigned);
+    struct ranges_job_t
+    {
+	state_t *state_;
+	std::vector< std::vector<address_range_t> > ranges_;
+    };
+    static void prepare_address_index_1(void *, unsigned);
 
-    void insert_ranges(const walker_t &w, reference_t funcref);
+    static void insert_ranges(const walker_t &w, reference_t funcref,
+			      std::vector<address_range_t> &res);
     bool is_within(np::spiegel::addr_t addr, const walker_t &w,
 		   unsigned int &offset) const;
 
@@ -101,6 +132,7 @@ private:
     std::vector<linkobj_t*> linkobjs_;
     std::vector<compile_unit_t*> compile_units_;
     np::util::rangetree<addr_t, reference_t> address_index_;
+    bool indexed_;
 
     friend class walker_t;
     friend class compile_unit_t;
@@ -29,7 +29,7 @@ class walker_t
 {
 public:
     walker_t(compile_unit_t *cu)
-     :  id_(next_id_++),
+     :  id_(__sync_fetch_and_add(&next_id_, 1)),
 	compile_unit_(cu),
 	reader_(cu->get_contents()),
 	level_(0),
@@ -38,7 +38,7 @@ public:
     }
 
     walker_t(const walker_t &o)
-     :  id_(next_id_++),
+     :  id_(__sync_fetch_and_add(&next_id_, 1)),
 	compile_unit_(o.compile_unit_),
 	reader_(o.reader_),
 	// Note: we don't clone the entry, on the assumption
@@ -52,7 +52,7 @@ public:
     }
 
     walker_t(reference_t ref)
-     :  id_(next_id_++),
+     :  id_(__sync_fetch_and_add(&next_id_, 1)),
 	filter_tag_(0)
     {
 	seek(ref);
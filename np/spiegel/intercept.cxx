@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include "np/spiegel/intercept.hxx"
+#include "np/spiegel/spiegel.hxx"
 #include "np/spiegel/platform/common.hxx"
 #include "np/spiegel/dwarf/state.hxx"
 
@@ -21,6 +22,21 @@ namespace np {
 namespace spiegel {
 using namespace std;
 
+/*
+ * Find the debug info for the function at @addr, if we have any,
+ * so the platform code can tell how it passes arguments and returns.
+ */
+static function_t *
+find_function(addr_t addr)
+{
+    location_t loc;
+    if (!np::spiegel::dwarf::state_t::instance() ||
+	!describe_address(addr, loc) ||
+	loc.offset_)
+	return 0;
+    return loc.function_;
+}
+
 map<addr_t, intercept_t::addrstate_t> intercept_t::installed_;
 
 intercept_t::addrstate_t *
@@ -44,6 +60,18 @@ intercept_t::remove_addrstate(addr_t addr)
 intercept_t::intercept_t(addr_t a, const char *name)
 {
     addr_ = np::spiegel::platform::normalise_address(a);
+    /* code which loads a function's address from a GOT slot we
+     * have rewritten gets the redirect's target instead */
+    map<addr_t, addrstate_t>::iterator aitr;
+    for (aitr = installed_.begin() ; aitr != installed_.end() ; ++aitr)
+    {
+	addrstate_t *as = &aitr->second;
+	if (as->got_.size() && as->intercepts_.front()->get_got_redirect() == addr_)
+	{
+	    addr_ = aitr->first;
+	    break;
+	}
+    }
     name_ = np::util::xstrdup(name);
 }
 
@@ -56,17 +84,30 @@ int
 intercept_t::install()
 {
     int r = 0;
+    string err;
     addrstate_t *as = get_addrstate(addr_, /*create*/true);
     as->intercepts_.push_back(this);
     if (as->intercepts_.size() == 1)
     {
-	string err;
-	r = np::spiegel::platform::install_intercept(addr_, as->state_, err);
-	if (r < 0)
-	    fprintf(stderr, "np: failed to install intercepted "
-			    "function %s at 0x%lx: %s\n",
-			    get_name(), (unsigned long)addr_, err.c_str());
+	addr_t to = get_got_redirect();
+	if (to && !np::spiegel::platform::install_got_redirect(addr_, to, as->got_, err))
+	    return 0;
+	/* otherwise fall back to intercepting the function itself */
+	r = np::spiegel::platform::install_intercept(addr_, find_function(addr_),
+						     as->state_, err);
+    }
+    else if (as->got_.size())
+    {
+	/* every intercept needs to see the calls now */
+	r = np::spiegel::platform::uninstall_got_redirect(as->got_, err);
+	if (!r)
+	    r = np::spiegel::platform::install_intercept(addr_, find_function(addr_),
+							 as->state_, err);
     }
+    if (r < 0)
+	fprintf(stderr, "np: failed to install intercepted "
+			"function %s at 0x%lx: %s\n",
+			get_name(), (unsigned long)addr_, err.c_str());
     return r;
 }
 
@@ -87,7 +128,10 @@ intercept_t::uninstall()
     if (as->intercepts_.size() == 0)
     {
 	string err;
-	r = np::spiegel::platform::uninstall_intercept(addr_, as->state_, err);
+	if (as->got_.size())
+	    r = np::spiegel::platform::uninstall_got_redirect(as->got_, err);
+	else
+	    r = np::spiegel::platform::uninstall_intercept(addr_, as->state_, err);
 	if (r < 0)
 	    fprintf(stderr, "np: failed to uninstall intercepted "
 			    "function %s at 0x%lx: %s\n",
@@ -97,6 +141,14 @@ intercept_t::uninstall()
     return r;
 }
 
+/* Returns true if calls are diverted by rewriting GOT slots alone */
+bool
+intercept_t::is_got_redirected() const
+{
+    addrstate_t *as = get_addrstate(addr_, /*create*/false);
+    return (as && as->got_.size());
+}
+
 bool
 intercept_t::is_intercepted(addr_t addr)
 {
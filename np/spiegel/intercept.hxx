@@ -86,8 +86,17 @@ struct intercept_t : public np::util::zalloc
     addr_t get_address() const { return addr_; }
     const char *get_name() const { return (name_ ? name_ : "(unknown)"); }
 
+    /*
+     * Intercepts which do nothing but redirect calls to another
+     * function, and don't need to see calls the function's own
+     * shared library makes internally, return that function here.
+     * The callers' GOT slots are then rewritten to call it directly.
+     */
+    virtual addr_t get_got_redirect() const { return 0; }
+
     int install();
     int uninstall();
+    bool is_got_redirected() const;
 
     // functions for the platform-specific intercept code
     static bool is_intercepted(addr_t);
@@ -99,6 +108,7 @@ private:
     struct addrstate_t
     {
 	np::spiegel::platform::intstate_t state_;
+	std::vector<np::spiegel::platform::got_slot_t> got_;	/* if redirected */
 	std::vector<intercept_t*> intercepts_;
     };
 
@@ -20,7 +20,9 @@
 #include "np/spiegel/mapping.hxx"
 #include <vector>
 
-namespace np { namespace spiegel { namespace platform {
+namespace np { namespace spiegel {
+class function_t;
+namespace platform {
 
 extern bool get_argv(int *argcp, char ***argvp);
 extern char *self_exe();
@@ -29,6 +31,9 @@ struct linkobj_t
 {
     const char *name;
     std::vector<np::spiegel::mapping_t> mappings;
+    np::spiegel::addr_t base;	    /* load bias */
+    const void *dynamic;	    /* the dynamic section, or NULL */
+    np::spiegel::mapping_t relro;   /* read-only after relocation */
 };
 extern std::vector<linkobj_t> get_linkobjs();
 
@@ -40,17 +45,32 @@ np::spiegel::addr_t normalise_address(np::spiegel::addr_t);
 extern int text_map_writable(addr_t addr, size_t len);
 extern int text_restore(addr_t addr, size_t len);
 
+struct got_slot_t
+{
+    np::spiegel::addr_t *slot_;
+    np::spiegel::addr_t orig_;
+    bool relro_;
+};
+extern int install_got_redirect(np::spiegel::addr_t addr,
+				np::spiegel::addr_t to,
+				/*return*/std::vector<got_slot_t> &slots,
+				/*return*/std::string &err);
+extern int uninstall_got_redirect(std::vector<got_slot_t> &slots,
+				  /*return*/std::string &err);
+
 struct intstate_t
 {
 #if defined(_NP_x86) || defined(_NP_x86_64)
-    enum { UNKNOWN, PUSHBP, OTHER } type_;
+    enum { UNKNOWN, PUSHBP, OTHER, JUMP } type_;
     unsigned char orig_;	    /* first byte of original insn */
+    void *tramp_;		    /* JUMP only: platform trampoline */
 
     intstate_t()
-     : type_(UNKNOWN), orig_(0)  {}
+     : type_(UNKNOWN), orig_(0), tramp_(0)  {}
 #endif
 };
 extern int install_intercept(np::spiegel::addr_t,
+			     const np::spiegel::function_t *fn,    /* may be NULL */
 			     intstate_t &state,
 			     /*return*/std::string &err);
 extern int uninstall_intercept(np::spiegel::addr_t,
@@ -58,6 +78,7 @@ extern int uninstall_intercept(np::spiegel::addr_t,
 			     /*return*/std::string &err);
 
 extern std::vector<np::spiegel::addr_t> get_stacktrace();
+extern unsigned int get_stacktrace(np::spiegel::addr_t *stack, unsigned int max);
 
 extern bool is_running_under_debugger();
 
@@ -19,6 +19,7 @@
 #include "common.hxx"
 
 #include <dlfcn.h>
+#include <execinfo.h>
 #include <link.h>
 #include <signal.h>
 #include <memory.h>
@@ -157,6 +158,8 @@ add_one_linkobj(struct dl_phdr_info *info,
 
     linkobj_t lo;
     lo.name = name;
+    lo.base = info->dlpi_addr;
+    lo.dynamic = NULL;
 
     for (int i = 0 ; i < info->dlpi_phnum ; i++)
     {
@@ -164,9 +167,13 @@ add_one_linkobj(struct dl_phdr_info *info,
 	    continue;
 
 	const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
-	lo.mappings.push_back(mapping_t(
-		(unsigned long)ph->p_offset, (unsigned long)ph->p_memsz,
-		(void *)((unsigned long)info->dlpi_addr + ph->p_vaddr)));
+	mapping_t m((unsigned long)ph->p_offset, (unsigned long)ph->p_memsz,
+		    (void *)((unsigned long)info->dlpi_addr + ph->p_vaddr));
+	if (ph->p_type == PT_DYNAMIC)
+	    lo.dynamic = m.get_map();
+	else if (ph->p_type == PT_GNU_RELRO)
+	    lo.relro = m;
+	lo.mappings.push_back(m);
     }
     vec->push_back(lo);
 
@@ -198,15 +205,25 @@ static bool is_in_plt(np::spiegel::addr_t addr)
     return false;
 }
 
+/* PLT entries already looked up, so each costs only one dladdr() */
+static map<np::spiegel::addr_t, np::spiegel::addr_t> plt_targets;
+
 np::spiegel::addr_t normalise_address(np::spiegel::addr_t addr)
 {
     if (is_in_plt(addr))
     {
+	map<np::spiegel::addr_t, np::spiegel::addr_t>::iterator itr = plt_targets.find(addr);
+	if (itr != plt_targets.end())
+	    return itr->second;
+
+	np::spiegel::addr_t target = addr;
 	Dl_info info;
 	memset(&info, 0, sizeof(info));
 	int r = dladdr((void *)addr, &info);
 	if (r)
-	    return (np::spiegel::addr_t)dlsym(RTLD_NEXT, info.dli_sname);
+	    target = (np::spiegel::addr_t)dlsym(RTLD_NEXT, info.dli_sname);
+	plt_targets[addr] = target;
+	return target;
     }
     return addr;
 }
@@ -289,6 +306,230 @@ text_restore(addr_t addr, size_t len)
     return 0;
 }
 
+/*
+ * Functions to redirect the calls other link objects make to a
+ * function in a shared library, by rewriting their GOT slots to point
+ * at the new function, instead of planting a trap in the function's
+ * text.  Calls through the PLT, and through function pointers loaded
+ * from the GOT, then cost nothing extra and the library's text pages
+ * stay shared.  Calls the library makes to the function internally
+ * don't use the GOT, so they are not redirected.
+ */
+
+#if defined(_NP_x86_64)
+#define R_JUMP_SLOT	R_X86_64_JUMP_SLOT
+#define R_GLOB_DAT	R_X86_64_GLOB_DAT
+#define R_SYM(i)	ELF64_R_SYM(i)
+#define R_TYPE(i)	ELF64_R_TYPE(i)
+#elif defined(_NP_x86)
+#define R_JUMP_SLOT	R_386_JMP_SLOT
+#define R_GLOB_DAT	R_386_GLOB_DAT
+#define R_SYM(i)	ELF32_R_SYM(i)
+#define R_TYPE(i)	ELF32_R_TYPE(i)
+#endif
+
+static bool
+is_in_linkobj(const linkobj_t &lo, np::spiegel::addr_t addr)
+{
+    vector<np::spiegel::mapping_t>::const_iterator i;
+    for (i = lo.mappings.begin() ; i != lo.mappings.end() ; ++i)
+    {
+	if (i->contains((void *)addr))
+	    return true;
+    }
+    return false;
+}
+
+static const void *
+dynamic_ptr(const linkobj_t &lo, ElfW(Addr) p)
+{
+    /* glibc relocates these in place, but not on every platform */
+    return (const void *)(p < lo.base ? p + lo.base : p);
+}
+
+static void
+add_got_slot(const linkobj_t &lo,
+	     ElfW(Addr) offset, unsigned long info,
+	     const ElfW(Sym) *symtab, const char *strtab,
+	     np::spiegel::addr_t addr, const char *name,
+	     vector<got_slot_t> &slots)
+{
+    unsigned long type = R_TYPE(info);
+    if (type != R_JUMP_SLOT && type != R_GLOB_DAT)
+	return;
+
+    np::spiegel::addr_t *slot = (np::spiegel::addr_t *)(lo.base + offset);
+    if (*slot != addr)
+    {
+	/* a PLT slot not yet lazily bound points back into its own object */
+	if (type != R_JUMP_SLOT ||
+	    strcmp(strtab + symtab[R_SYM(info)].st_name, name) ||
+	    !is_in_linkobj(lo, *slot))
+	    return;
+    }
+
+    /* glibc makes only the whole pages of the RELRO segment read-only */
+    np::spiegel::addr_t start = (np::spiegel::addr_t)lo.relro.get_map();
+    got_slot_t gs;
+    gs.slot_ = slot;
+    gs.orig_ = *slot;
+    gs.relro_ = (start &&
+		 (np::spiegel::addr_t)slot >= page_round_down(start) &&
+		 (np::spiegel::addr_t)slot < page_round_down(start + lo.relro.get_size()));
+    slots.push_back(gs);
+}
+
+template<class R> static void
+add_got_slots(const linkobj_t &lo, const R *rels, unsigned long size,
+	      const ElfW(Sym) *symtab, const char *strtab,
+	      np::spiegel::addr_t addr, const char *name,
+	      vector<got_slot_t> &slots)
+{
+    if (!rels)
+	return;
+    for (unsigned long i = 0 ; i < size / sizeof(R) ; i++)
+	add_got_slot(lo, rels[i].r_offset, rels[i].r_info,
+		     symtab, strtab, addr, name, slots);
+}
+
+static void
+find_got_slots(const linkobj_t &lo,
+	       np::spiegel::addr_t addr, const char *name,
+	       vector<got_slot_t> &slots)
+{
+    const ElfW(Sym) *symtab = NULL;
+    const char *strtab = NULL;
+    const char *rela = NULL, *rel = NULL, *jmprel = NULL;
+    unsigned long relasz = 0, relsz = 0, pltrelsz = 0;
+    long pltrel = DT_NULL;
+
+    if (!lo.dynamic)
+	return;
+    const ElfW(Dyn) *dyn;
+    for (dyn = (const ElfW(Dyn) *)lo.dynamic ; dyn->d_tag != DT_NULL ; dyn++)
+    {
+	switch (dyn->d_tag)
+	{
+	case DT_SYMTAB: symtab = (const ElfW(Sym) *)dynamic_ptr(lo, dyn->d_un.d_ptr); break;
+	case DT_STRTAB: strtab = (const char *)dynamic_ptr(lo, dyn->d_un.d_ptr); break;
+	case DT_RELA: rela = (const char *)dynamic_ptr(lo, dyn->d_un.d_ptr); break;
+	case DT_RELASZ: relasz = dyn->d_un.d_val; break;
+	case DT_REL: rel = (const char *)dynamic_ptr(lo, dyn->d_un.d_ptr); break;
+	case DT_RELSZ: relsz = dyn->d_un.d_val; break;
+	case DT_JMPREL: jmprel = (const char *)dynamic_ptr(lo, dyn->d_un.d_ptr); break;
+	case DT_PLTRELSZ: pltrelsz = dyn->d_un.d_val; break;
+	case DT_PLTREL: pltrel = dyn->d_un.d_val; break;
+	}
+    }
+    if (!symtab || !strtab)
+	return;
+
+    /* some linkers count the PLT relocations in DT_RELASZ too */
+    if (jmprel && rela && jmprel > rela && jmprel < rela + relasz)
+	relasz = jmprel - rela;
+    if (jmprel && rel && jmprel > rel && jmprel < rel + relsz)
+	relsz = jmprel - rel;
+
+    add_got_slots(lo, (const ElfW(Rela) *)rela, relasz,
+		  symtab, strtab, addr, name, slots);
+    add_got_slots(lo, (const ElfW(Rel) *)rel, relsz,
+		  symtab, strtab, addr, name, slots);
+    if (pltrel == DT_RELA)
+	add_got_slots(lo, (const ElfW(Rela) *)jmprel, pltrelsz,
+		      symtab, strtab, addr, name, slots);
+    else if (pltrel == DT_REL)
+	add_got_slots(lo, (const ElfW(Rel) *)jmprel, pltrelsz,
+		      symtab, strtab, addr, name, slots);
+}
+
+static int
+write_got_slot(const got_slot_t &gs, np::spiegel::addr_t value)
+{
+    np::spiegel::addr_t page = page_round_down((np::spiegel::addr_t)gs.slot_);
+    if (gs.relro_ &&
+	mprotect((void *)page, page_size(), PROT_READ|PROT_WRITE))
+    {
+	perror("np: mprotect");
+	return -1;
+    }
+    *gs.slot_ = value;
+    if (gs.relro_ &&
+	mprotect((void *)page, page_size(), PROT_READ))
+    {
+	perror("np: mprotect");
+	return -1;
+    }
+    return 0;
+}
+
+int
+install_got_redirect(np::spiegel::addr_t addr,
+		     np::spiegel::addr_t to,
+		     vector<got_slot_t> &slots,
+		     string &err)
+{
+    vector<linkobj_t> los = get_linkobjs();
+    vector<linkobj_t>::iterator i;
+
+    /* calls within the executable don't go through its GOT */
+    for (i = los.begin() ; i != los.end() ; ++i)
+    {
+	if (is_in_linkobj(*i, addr))
+	    break;
+    }
+    if (i == los.end() || !i->name)
+    {
+	err = "not in a shared library";
+	return -1;
+    }
+
+    Dl_info info;
+    memset(&info, 0, sizeof(info));
+    if (!dladdr((void *)addr, &info) || !info.dli_sname)
+    {
+	err = "no dynamic symbol";
+	return -1;
+    }
+
+    for (i = los.begin() ; i != los.end() ; ++i)
+	find_got_slots(*i, addr, info.dli_sname, slots);
+    if (!slots.size())
+    {
+	err = "not called through any GOT";
+	return -1;
+    }
+
+    vector<got_slot_t>::iterator s;
+    for (s = slots.begin() ; s != slots.end() ; ++s)
+    {
+	if (write_got_slot(*s, to))
+	{
+	    slots.erase(s, slots.end());
+	    uninstall_got_redirect(slots, err);
+	    err = "cannot make GOT writable";
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+int
+uninstall_got_redirect(vector<got_slot_t> &slots, string &err)
+{
+    int r = 0;
+    vector<got_slot_t>::iterator s;
+    for (s = slots.begin() ; s != slots.end() ; ++s)
+    {
+	if (write_got_slot(*s, s->orig_))
+	{
+	    err = "cannot restore GOT";
+	    r = -1;
+	}
+    }
+    slots.clear();
+    return r;
+}
+
 /* This trick doesn't work - Valgrind actively prevents
  * the simulated program from hijacking it's log fd */
 #if 0
@@ -366,6 +607,23 @@ vector<np::spiegel::addr_t> get_stacktrace()
     return stack;
 }
 
+/*
+ * Like get_stacktrace() but stores at most @max addresses into
+ * @stack without allocating memory, so it can be called from
+ * inside malloc().  Unlike get_stacktrace() it can't rely on the
+ * frame pointer, which code built with optimisation doesn't keep,
+ * so it uses the unwinder.  The first call may allocate while the
+ * unwinder is loaded.  Returns the number of addresses stored.
+ */
+unsigned int get_stacktrace(np::spiegel::addr_t *stack, unsigned int max)
+{
+    void *pcs[64];
+    int n = backtrace(pcs, (max < 64 ? max : 64));
+    for (int i = 0 ; i < n ; i++)
+	stack[i] = (np::spiegel::addr_t)pcs[i]-_NP_ADDRSIZE-1;
+    return (n < 0 ? 0 : n);
+}
+
 /* Return the process id of any process which is ptrace()ing us, or 0 if
  * not being ptrace'd, or -1 on error. */
 static pid_t
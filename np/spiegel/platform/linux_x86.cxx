@@ -201,6 +201,7 @@ intercept_tramp(void)
 	break;
 
     case intstate_t::UNKNOWN:
+    case intstate_t::JUMP:
 	break;
     }
 
@@ -252,6 +253,7 @@ intercept_tramp(void)
 	    VALGRIND_DISCARD_TRANSLATIONS(frame.addr, 1);
 	    break;
 	case intstate_t::UNKNOWN:
+	case intstate_t::JUMP:
 	    break;
 	}
     }
@@ -304,6 +306,7 @@ after:
 	VALGRIND_DISCARD_TRANSLATIONS(frame.addr, 1);
 	break;
     case intstate_t::UNKNOWN:
+    case intstate_t::JUMP:
 	break;
     }
 
@@ -384,7 +387,9 @@ wtf:
 }
 
 int
-install_intercept(np::spiegel::addr_t addr, intstate_t &state, std::string &err)
+install_intercept(np::spiegel::addr_t addr,
+		  const np::spiegel::function_t *fn __attribute__((unused)),
+		  intstate_t &state, std::string &err)
 {
     int r;
 
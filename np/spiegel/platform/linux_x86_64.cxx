@@ -15,12 +15,15 @@
  */
 #include "np/spiegel/common.hxx"
 #include "np/spiegel/intercept.hxx"
+#include "np/spiegel/spiegel.hxx"
 #include "common.hxx"
 
 #include <signal.h>
 #include <memory.h>
 #include <sys/ucontext.h>
 #include <ucontext.h>
+#include <sys/mman.h>
+#include <errno.h>
 #include <valgrind/valgrind.h>
 
 #ifndef MIN
@@ -210,6 +213,7 @@ intercept_tramp(void)
 	break;
 
     case intstate_t::UNKNOWN:
+    case intstate_t::JUMP:
 	break;
     }
 
@@ -262,6 +266,7 @@ intercept_tramp(void)
 	    VALGRIND_DISCARD_TRANSLATIONS(frame.addr, 1);
 	    break;
 	case intstate_t::UNKNOWN:
+	case intstate_t::JUMP:
 	    break;
 	}
     }
@@ -311,6 +316,7 @@ after:
 	VALGRIND_DISCARD_TRANSLATIONS(frame.addr, 1);
 	break;
     case intstate_t::UNKNOWN:
+    case intstate_t::JUMP:
 	break;
     }
 
@@ -388,11 +394,909 @@ wtf:
 }
 
 
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+/*
+ * Signal-free intercepts.
+ *
+ * Where we can, we intercept a function by overwriting its first few
+ * instructions with a 5-byte JMP rel32 to a small trampoline of our
+ * own.  The trampoline loads its own address into %r11 and jumps to
+ * __np_jump_entry, which saves the argument registers, calls the
+ * before() methods, calls either the redirect target or a relocated
+ * copy of the instructions we overwrote (followed by a jump back into
+ * the original function), and then calls the after() methods.
+ *
+ * No signals are delivered and no contexts are switched, so this is a
+ * lot faster than the breakpoint method above.  Each call keeps its
+ * state in its own stack frame, rather than in globals like the
+ * breakpoint method, so recursive functions work.  Installing and
+ * uninstalling intercepts is still not safe while other threads might
+ * be calling through them.  Functions whose prologue we cannot decode
+ * or cannot safely relocate, and functions the debug info shows we
+ * can't call or return from correctly (see classify_function()), fall
+ * back to breakpoints.
+ */
+
+#define INSN_JMP_REL32	    0xe9
+#define JMP_REL32_LEN	    5
+#define JMP_ABS_LEN	    14	    /* jmp *0(%rip); .quad addr */
+#define JUMP_STACK_WORDS    16	    /* stack arguments copied, in words */
+#define SWEEP_LEN	    512	    /* bytes scanned for branches into the patch */
+
+/*
+ * Just enough of an x86-64 instruction length decoder to walk over
+ * the prologues compilers generate, and to find the displacements we
+ * need to adjust when moving the instructions somewhere else.
+ */
+struct insn_t
+{
+    unsigned int len;		/* total length in bytes */
+    unsigned int opoff;		/* offset of the opcode, after prefixes */
+    int disp_off;		/* offset of a %rip-relative disp32, or -1 */
+    int rel_off;		/* offset of a branch displacement, or -1 */
+    unsigned int rel_size;	/* size of the branch displacement, 1 or 4 */
+    bool terminal;		/* execution does not fall through */
+};
+
+enum
+{
+    F_MODRM = (1<<0),
+    F_IMM8 = (1<<1),
+    F_IMM16 = (1<<2),
+    F_IMMZ = (1<<3),		/* 16 or 32 bits depending on operand size */
+    F_IMM64 = (1<<4),
+    F_REL8 = (1<<5),
+    F_REL32 = (1<<6),
+    F_TERMINAL = (1<<7),
+    F_GRP3 = (1<<8),		/* F6/F7: TEST has an immediate */
+    F_GRP5 = (1<<9),		/* FF: /4 and /5 are jumps */
+    F_BAD = (1<<10)
+};
+
+static unsigned int
+onebyte_flags(unsigned char op, bool rexw)
+{
+    if (op < 0x40)
+    {
+	switch (op & 7)
+	{
+	case 0: case 1: case 2: case 3: return F_MODRM;
+	case 4: return F_IMM8;
+	case 5: return F_IMMZ;
+	default: return F_BAD;	/* segment pushes, BCD, prefixes */
+	}
+    }
+    if (op >= 0x50 && op <= 0x5f)
+	return 0;
+    if (op >= 0x70 && op <= 0x7f)
+	return F_REL8;
+    if (op >= 0x84 && op <= 0x8f)
+	return F_MODRM;
+    if (op >= 0x90 && op <= 0x99)
+	return 0;
+    if (op >= 0xb0 && op <= 0xb7)
+	return F_IMM8;
+    if (op >= 0xb8 && op <= 0xbf)
+	return (rexw ? F_IMM64 : F_IMMZ);
+    if (op >= 0xd8 && op <= 0xdf)
+	return F_MODRM;		/* x87 */
+    switch (op)
+    {
+    case 0x63: return F_MODRM;
+    case 0x68: return F_IMMZ;
+    case 0x69: return F_MODRM|F_IMMZ;
+    case 0x6a: return F_IMM8;
+    case 0x6b: return F_MODRM|F_IMM8;
+    case 0x80: case 0x83: return F_MODRM|F_IMM8;
+    case 0x81: return F_MODRM|F_IMMZ;
+    case 0x9b: case 0x9c: case 0x9d: case 0x9e: case 0x9f: return 0;
+    case 0xa4: case 0xa5: case 0xa6: case 0xa7: return 0;
+    case 0xa8: return F_IMM8;
+    case 0xa9: return F_IMMZ;
+    case 0xaa: case 0xab: case 0xac: case 0xad: case 0xae: case 0xaf: return 0;
+    case 0xc0: case 0xc1: case 0xc6: return F_MODRM|F_IMM8;
+    case 0xc2: return F_IMM16|F_TERMINAL;
+    case 0xc3: return F_TERMINAL;
+    case 0xc7: return F_MODRM|F_IMMZ;
+    case 0xc8: return F_IMM16|F_IMM8;
+    case 0xc9: return 0;
+    case 0xcc: return F_TERMINAL;
+    case 0xcd: return F_IMM8;
+    case 0xd0: case 0xd1: case 0xd2: case 0xd3: return F_MODRM;
+    case 0xe8: return F_REL32;
+    case 0xe9: return F_REL32|F_TERMINAL;
+    case 0xeb: return F_REL8|F_TERMINAL;
+    case 0xf4: return F_TERMINAL;
+    case 0xf5: return 0;
+    case 0xf6: case 0xf7: return F_MODRM|F_GRP3;
+    case 0xf8: case 0xf9: case 0xfa: case 0xfb: case 0xfc: case 0xfd: return 0;
+    case 0xfe: return F_MODRM;
+    case 0xff: return F_MODRM|F_GRP5;
+    }
+    /* moffs moves, far calls, loop/jrcxz, port I/O, etc */
+    return F_BAD;
+}
+
+static unsigned int
+twobyte_flags(unsigned char op)
+{
+    if (op >= 0x80 && op <= 0x8f)
+	return F_REL32;		/* jcc rel32 */
+    if (op >= 0xc8 && op <= 0xcf)
+	return 0;		/* bswap */
+    if (op >= 0x30 && op <= 0x37)
+	return 0;		/* wrmsr, rdtsc, sysenter etc */
+    switch (op)
+    {
+    case 0x05: case 0x06: case 0x07: case 0x08: case 0x09: case 0x0e:
+    case 0x77: case 0xa0: case 0xa1: case 0xa2: case 0xa8: case 0xa9: case 0xaa:
+	return 0;
+    case 0x0b:
+	return F_TERMINAL;	/* ud2 */
+    case 0x04: case 0x0a: case 0x0c: case 0x0f:
+    case 0x24: case 0x25: case 0x26: case 0x27:
+    case 0x39: case 0x3b: case 0x3c: case 0x3d: case 0x3e: case 0x3f:
+	return F_BAD;		/* undefined, or 3DNow! */
+    case 0x38:
+	return F_MODRM;		/* three byte map, caller skips the extra byte */
+    case 0x3a:
+	return F_MODRM|F_IMM8;
+    case 0x70: case 0x71: case 0x72: case 0x73:
+    case 0xa4: case 0xac: case 0xba: case 0xc2:
+    case 0xc4: case 0xc5: case 0xc6:
+	return F_MODRM|F_IMM8;
+    }
+    return F_MODRM;
+}
+
+static bool
+decode_insn(const unsigned char *p, insn_t *insn)
+{
+    unsigned int n = 0;
+    bool opsize = false;
+    bool rexw = false;
+    unsigned int flags;
+
+    memset(insn, 0, sizeof(*insn));
+    insn->disp_off = -1;
+    insn->rel_off = -1;
+
+    /* legacy prefixes */
+    for (;;)
+    {
+	unsigned char c = p[n];
+	if (c == 0x66)
+	    opsize = true;
+	else if (c != 0x67 && c != 0xf0 && c != 0xf2 && c != 0xf3 &&
+		 c != 0x2e && c != 0x36 && c != 0x3e && c != 0x26 &&
+		 c != 0x64 && c != 0x65)
+	    break;
+	if (++n > 4)
+	    return false;
+    }
+    /* REX prefix */
+    if ((p[n] & 0xf0) == 0x40)
+    {
+	rexw = !!(p[n] & 0x08);
+	n++;
+    }
+
+    insn->opoff = n;
+    unsigned char op = p[n++];
+    if (op == 0x0f)
+    {
+	op = p[n++];
+	flags = twobyte_flags(op);
+	if (op == 0x38 || op == 0x3a)
+	    n++;
+    }
+    else if (op == 0xc5 || op == 0xc4)
+    {
+	/* VEX */
+	unsigned int map = 1;
+	if (op == 0xc4)
+	{
+	    map = p[n] & 0x1f;
+	    n++;
+	}
+	n++;
+	op = p[n++];
+	switch (map)
+	{
+	case 1: flags = twobyte_flags(op) | F_MODRM; break;
+	case 2: flags = F_MODRM; break;
+	case 3: flags = F_MODRM|F_IMM8; break;
+	default: return false;
+	}
+	if (map == 1 && op == 0x77)
+	    flags = 0;		/* vzeroupper, vzeroall */
+	if (flags & (F_REL32|F_TERMINAL))
+	    return false;
+    }
+    else
+    {
+	flags = onebyte_flags(op, rexw);
+    }
+    if (flags & F_BAD)
+	return false;
+
+    if (flags & F_MODRM)
+    {
+	unsigned char modrm = p[n++];
+	unsigned int mod = modrm >> 6;
+	unsigned int reg = (modrm >> 3) & 7;
+	unsigned int rm = modrm & 7;
+
+	if (mod != 3)
+	{
+	    if (rm == 4)
+	    {
+		unsigned char sib = p[n++];
+		if ((sib & 7) == 5 && mod == 0)
+		    n += 4;
+	    }
+	    else if (rm == 5 && mod == 0)
+	    {
+		insn->disp_off = n;
+		n += 4;
+	    }
+	    if (mod == 1)
+		n += 1;
+	    else if (mod == 2)
+		n += 4;
+	}
+	if ((flags & F_GRP3) && reg < 2)
+	    flags |= (op == 0xf6 ? F_IMM8 : F_IMMZ);
+	if ((flags & F_GRP5) && (reg == 4 || reg == 5))
+	    flags |= F_TERMINAL;
+	if ((flags & F_GRP5) && reg == 7)
+	    return false;
+    }
+
+    if (flags & F_IMM8)
+	n += 1;
+    if (flags & F_IMM16)
+	n += 2;
+    if (flags & F_IMMZ)
+	n += (opsize && !rexw ? 2 : 4);
+    if (flags & F_IMM64)
+	n += 8;
+    if (flags & F_REL8)
+    {
+	insn->rel_off = n;
+	insn->rel_size = 1;
+	n += 1;
+    }
+    if (flags & F_REL32)
+    {
+	insn->rel_off = n;
+	insn->rel_size = 4;
+	n += 4;
+    }
+    if (n > 15)
+	return false;
+
+    insn->len = n;
+    insn->terminal = !!(flags & F_TERMINAL);
+    return true;
+}
+
+static addr_t
+insn_branch_target(addr_t a, const insn_t *insn)
+{
+    const unsigned char *p = (const unsigned char *)a;
+    long rel = (insn->rel_size == 1 ?
+		(long)*(const signed char *)(p + insn->rel_off) :
+		(long)*(const int32_t *)(p + insn->rel_off));
+    return a + insn->len + rel;
+}
+
+static bool
+fits_rel32(long d)
+{
+    return (d >= -0x80000000L && d <= 0x7fffffffL);
+}
+
+enum
+{
+    RET_INTEGER,		/* in %rax, or %rax:%rdx */
+    RET_SSE,			/* in %xmm0, or %xmm0:%xmm1 */
+    RET_MEMORY			/* via a hidden pointer, which %rax returns */
+};
+
+/*
+ * Uses the debug info, if we have any, to work out how the function
+ * returns its value and how many words of arguments it takes on the
+ * stack.  Returns false for functions __np_jump_entry can't handle:
+ * those returning on the x87 stack, and those taking more stack
+ * arguments than it copies.  Without debug info, for example in libc,
+ * we assume the function returns in %rax and takes few arguments.
+ */
+static bool
+classify_function(const np::spiegel::function_t *fn, unsigned char *ret_class)
+{
+    *ret_class = RET_INTEGER;
+    if (!fn)
+	return true;
+
+    unsigned int nint = 0;	/* integer registers used */
+    unsigned int nsse = 0;	/* SSE registers used */
+    unsigned int nstack = 0;	/* words of stack used */
+
+    np::spiegel::type_t *rt = fn->get_return_type();
+    unsigned int tc = rt->get_classification();
+    switch (np::spiegel::type_t::major(tc))
+    {
+    case np::spiegel::type_t::TC_MAJOR_VOID:
+    case np::spiegel::type_t::TC_MAJOR_POINTER:
+	break;
+    case np::spiegel::type_t::TC_MAJOR_INTEGER:
+	if (rt->get_sizeof() > 16)
+	    return false;
+	break;
+    case np::spiegel::type_t::TC_MAJOR_FLOAT:
+	if (tc != np::spiegel::type_t::TC_FLOAT &&
+	    tc != np::spiegel::type_t::TC_DOUBLE)
+	    return false;	/* long double, complex */
+	*ret_class = RET_SSE;
+	break;
+    case np::spiegel::type_t::TC_MAJOR_COMPOUND:
+	if (rt->get_sizeof() > 16)
+	{
+	    *ret_class = RET_MEMORY;
+	    nint++;		/* the hidden pointer */
+	}
+	break;
+    default:
+	return false;
+    }
+
+    vector<np::spiegel::type_t*> params = fn->get_parameter_types();
+    vector<np::spiegel::type_t*>::iterator i;
+    for (i = params.begin() ; i != params.end() ; ++i)
+    {
+	tc = (*i)->get_classification();
+	unsigned int words = ((*i)->get_sizeof() + 7) / 8;
+	if (!words || np::spiegel::type_t::major(tc) ==
+		      np::spiegel::type_t::TC_MAJOR_ARRAY)
+	    words = 1;
+	switch (np::spiegel::type_t::major(tc))
+	{
+	case np::spiegel::type_t::TC_MAJOR_FLOAT:
+	    if (tc == np::spiegel::type_t::TC_FLOAT ||
+		tc == np::spiegel::type_t::TC_DOUBLE)
+	    {
+		if (nsse < 8)
+		    nsse++;
+		else
+		    nstack++;
+	    }
+	    else
+		nstack += words;
+	    break;
+	case np::spiegel::type_t::TC_MAJOR_COMPOUND:
+	    /* small structs might go in either kind of register,
+	     * assuming integer registers can only overestimate */
+	    if (words <= 2 && nint + words <= 6)
+		nint += words;
+	    else
+		nstack += words;
+	    break;
+	default:
+	    if (nint + words <= 6)
+		nint += words;
+	    else
+		nstack += words;
+	    break;
+	}
+    }
+    return (nstack <= JUMP_STACK_WORDS);
+}
+
+/*
+ * Trampolines live in small slots in RWX pages which we map within
+ * the +/-2GB range of a JMP rel32 from the intercepted function.
+ */
+struct trampoline_t
+{
+    unsigned char stub_[24];	/* movabs $this,%r11; jmp *__np_jump_entry */
+    unsigned char reloc_[72];	/* relocated prologue + jump back */
+    addr_t addr_;		/* the intercepted function */
+    unsigned char orig_[15];	/* original bytes we overwrote */
+    unsigned char patch_len_;	/* how many of them */
+    unsigned char ret_class_;	/* where the function returns its value */
+};
+
+
+struct tramp_page_t
+{
+    addr_t base_;
+    unsigned long used_;	/* bitmask of allocated slots */
+};
+static vector<tramp_page_t> tramp_pages;
+
+extern "C" void __np_jump_entry(void);
+
+static bool
+is_near(addr_t a, addr_t b)
+{
+    long d = (long)(a - b);
+    /* leave some slack for the size of the page */
+    return (d > -0x7fff0000L && d < 0x7fff0000L);
+}
+
+static unsigned int
+tramp_slots_per_page(void)
+{
+    return MIN(page_size() / sizeof(trampoline_t),
+	       sizeof(unsigned long) * 8);
+}
+
+static addr_t
+map_page_near(addr_t addr)
+{
+    unsigned long ps = page_size();
+    addr_t base = page_round_down(addr);
+
+    for (unsigned long delta = 16 * ps ; delta < 0x80000000UL ; delta <<= 1)
+    {
+	for (int dir = -1 ; dir <= 1 ; dir += 2)
+	{
+	    if (dir < 0 && delta >= base)
+		continue;
+	    addr_t hint = (dir < 0 ? base - delta : base + delta);
+	    void *p = mmap((void *)hint, ps, PROT_READ|PROT_WRITE|PROT_EXEC,
+			   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	    if (p == MAP_FAILED)
+		continue;
+	    if (is_near((addr_t)p, addr))
+		return (addr_t)p;
+	    munmap(p, ps);
+	}
+    }
+    return 0;
+}
+
+static trampoline_t *
+tramp_alloc(addr_t addr)
+{
+    unsigned int nslots = tramp_slots_per_page();
+    vector<tramp_page_t>::iterator i;
+    for (i = tramp_pages.begin() ; i != tramp_pages.end() ; ++i)
+    {
+	if (!is_near(i->base_, addr))
+	    continue;
+	for (unsigned int s = 0 ; s < nslots ; s++)
+	{
+	    if (!(i->used_ & (1UL<<s)))
+	    {
+		i->used_ |= (1UL<<s);
+		return (trampoline_t *)i->base_ + s;
+	    }
+	}
+    }
+
+    tramp_page_t page;
+    page.base_ = map_page_near(addr);
+    if (!page.base_)
+	return 0;
+    page.used_ = 1UL;
+    tramp_pages.push_back(page);
+    return (trampoline_t *)page.base_;
+}
+
+static void
+tramp_free(trampoline_t *tramp)
+{
+    vector<tramp_page_t>::iterator i;
+    for (i = tramp_pages.begin() ; i != tramp_pages.end() ; ++i)
+    {
+	addr_t a = (addr_t)tramp;
+	if (a >= i->base_ && a < i->base_ + page_size())
+	{
+	    i->used_ &= ~(1UL << ((a - i->base_) / sizeof(trampoline_t)));
+	    memset(tramp, 0, sizeof(*tramp));
+	    return;
+	}
+    }
+}
+
+static bool
+is_mapped(addr_t page)
+{
+    unsigned char vec;
+    return (mincore((void *)page, page_size(), &vec) == 0 || errno != ENOMEM);
+}
+
+/*
+ * Returns true if any relative branch we can find in the first few
+ * hundred bytes of the function lands strictly inside the bytes we
+ * are about to overwrite.  Such a branch would execute half of our
+ * JMP instruction.
+ */
+static bool
+is_branched_into(addr_t addr, unsigned int patch_len)
+{
+    addr_t end = addr + SWEEP_LEN;
+    /* don't wander off the end of the mapped text */
+    addr_t pend = page_round_up(addr + 16);
+    if (end > pend && !is_mapped(pend))
+	end = pend;
+
+    addr_t a = addr;
+    while (a + 15 < end)
+    {
+	insn_t insn;
+	if (!decode_insn((const unsigned char *)a, &insn))
+	    break;
+	if (insn.rel_off >= 0)
+	{
+	    addr_t target = insn_branch_target(a, &insn);
+	    if (target > addr && target < addr + patch_len)
+		return true;
+	}
+	a += insn.len;
+    }
+    return false;
+}
+
+/*
+ * Copy enough whole instructions from the start of the function to
+ * cover a JMP rel32 into the trampoline, adjusting any %rip-relative
+ * operands, and finish with an absolute jump back to the remainder.
+ */
+static bool
+build_trampoline(addr_t addr, trampoline_t *tramp)
+{
+    unsigned char *dst = tramp->reloc_;
+    unsigned char *dend = tramp->reloc_ + sizeof(tramp->reloc_) - JMP_ABS_LEN;
+    unsigned int n = 0;
+
+    while (n < JMP_REL32_LEN)
+    {
+	addr_t a = addr + n;
+	const unsigned char *src = (const unsigned char *)a;
+	insn_t insn;
+
+	if (!decode_insn(src, &insn))
+	    return false;
+	if (insn.terminal && n + insn.len < JMP_REL32_LEN)
+	    return false;	/* function too short to patch */
+	if (dst + insn.len + 4 > dend)
+	    return false;
+
+	if (insn.rel_off >= 0)
+	{
+	    addr_t target = insn_branch_target(a, &insn);
+	    if (target > addr && target < addr + JMP_REL32_LEN + 15)
+		return false;	/* branch within the patched bytes */
+	    if (insn.rel_size == 1)
+	    {
+		/* widen jmp/jcc rel8 to rel32, dropping any prefixes */
+		unsigned char op = src[insn.opoff];
+		if (op == 0xeb)
+		    *dst++ = INSN_JMP_REL32;
+		else
+		{
+		    *dst++ = 0x0f;
+		    *dst++ = 0x80 | (op & 0xf);
+		}
+	    }
+	    else
+	    {
+		memcpy(dst, src, insn.rel_off);
+		dst += insn.rel_off;
+	    }
+	    long d = (long)(target - ((addr_t)dst + 4));
+	    if (!fits_rel32(d))
+		return false;
+	    *(int32_t *)dst = (int32_t)d;
+	    dst += 4;
+	}
+	else if (insn.disp_off >= 0)
+	{
+	    addr_t target = a + insn.len + *(const int32_t *)(src + insn.disp_off);
+	    long d = (long)(target - ((addr_t)dst + insn.len));
+	    if (!fits_rel32(d))
+		return false;
+	    memcpy(dst, src, insn.len);
+	    *(int32_t *)(dst + insn.disp_off) = (int32_t)d;
+	    dst += insn.len;
+	}
+	else
+	{
+	    memcpy(dst, src, insn.len);
+	    dst += insn.len;
+	}
+	n += insn.len;
+    }
+    if (is_branched_into(addr, n))
+	return false;
+
+    /* jmp *0(%rip); .quad addr+n */
+    *dst++ = 0xff;
+    *dst++ = 0x25;
+    *(int32_t *)dst = 0;
+    dst += 4;
+    *(uint64_t *)dst = addr + n;
+
+    /* movabs $tramp,%r11; jmp *0(%rip); .quad __np_jump_entry */
+    unsigned char *s = tramp->stub_;
+    *s++ = 0x49;
+    *s++ = 0xbb;
+    *(uint64_t *)s = (uint64_t)tramp;
+    s += 8;
+    *s++ = 0xff;
+    *s++ = 0x25;
+    *(int32_t *)s = 0;
+    s += 4;
+    *(uint64_t *)s = (uint64_t)&__np_jump_entry;
+
+    tramp->addr_ = addr;
+    tramp->patch_len_ = n;
+    memcpy(tramp->orig_, (void *)addr, n);
+    return true;
+}
+
+/*
+ * The stack frame built by __np_jump_entry, below its saved %rbp.
+ * The offsets are known to the assembly code below.
+ */
+struct jump_frame_t
+{
+    unsigned long regs_[7];	/*   0: %rdi %rsi %rdx %rcx %r8 %r9 %rax */
+    union
+    {
+	unsigned long tramp_;	/*  56: %r11, our trampoline_t */
+	unsigned long ret_class_; /*  56: after jump_before() */
+    };
+    unsigned long xmm_[16];	/*  64: %xmm0-%xmm7 */
+    unsigned long target_;	/* 192: function to call */
+    unsigned long retval_[2];	/* 200: %rax %rdx as returned */
+    unsigned long fpretval_[4];	/* 216: %xmm0 %xmm1 as returned */
+    unsigned long addr_;	/* 248: intercepted function */
+};
+typedef char jump_frame_size_check[sizeof(jump_frame_t) == 256 ? 1 : -1];
+
+static unsigned long jump_before(jump_frame_t *)
+    __asm__("__np_jump_before") __attribute__((used));
+static void jump_after(jump_frame_t *)
+    __asm__("__np_jump_after") __attribute__((used));
+
+class x86_64_jump_call_t : public np::spiegel::call_t
+{
+private:
+    x86_64_jump_call_t(jump_frame_t *frame)
+     :  regs_(frame->regs_),
+	/* the saved %rbp and return address lie between
+	 * the frame and the caller's stack arguments */
+	stack_((unsigned long *)(frame+1) + 2)
+    {}
+
+    unsigned long *regs_;
+    unsigned long *stack_;
+
+    unsigned long *argp(unsigned int i) const
+    {
+	return (i < 6 ? &regs_[i] : &stack_[i-6]);
+    }
+
+    unsigned long get_arg(unsigned int i) const
+    {
+	return *argp(i);
+    }
+    void set_arg(unsigned int i, unsigned long v)
+    {
+	*argp(i) = v;
+    }
+
+    friend unsigned long jump_before(jump_frame_t *);
+    friend void jump_after(jump_frame_t *);
+};
+
+/*
+ * Called from __np_jump_entry before the original function.  Returns
+ * the address to call, or 0 if a before() method called skip(), in
+ * which case the return value is left in the frame.
+ */
+static unsigned long
+jump_before(jump_frame_t *frame)
+{
+    trampoline_t *tramp = (trampoline_t *)frame->tramp_;
+    x86_64_jump_call_t call(frame);
+
+    /* remember the address in the frame in case the
+     * intercept is uninstalled before we return */
+    frame->addr_ = tramp->addr_;
+    frame->ret_class_ = tramp->ret_class_;
+    intercept_t::dispatch_before(frame->addr_, call);
+    if (call.skip_)
+    {
+	memset(frame->retval_, 0, sizeof(frame->retval_));
+	memset(frame->fpretval_, 0, sizeof(frame->fpretval_));
+	switch (frame->ret_class_)
+	{
+	case RET_INTEGER:
+	    frame->retval_[0] = call.retval_;
+	    break;
+	case RET_SSE:
+	    frame->fpretval_[0] = call.retval_;
+	    break;
+	case RET_MEMORY:
+	    /* the caller's buffer is left untouched */
+	    frame->retval_[0] = frame->regs_[0];
+	    break;
+	}
+	return 0;
+    }
+    if (call.redirect_)
+	return call.redirect_;
+    return (unsigned long)tramp->reloc_;
+}
+
+/*
+ * Called from __np_jump_entry after the original function.
+ */
+static void
+jump_after(jump_frame_t *frame)
+{
+    x86_64_jump_call_t call(frame);
+
+    unsigned long *rvp = (frame->ret_class_ == RET_SSE ?
+			  &frame->fpretval_[0] : &frame->retval_[0]);
+
+    call.retval_ = *rvp;
+    intercept_t::dispatch_after(frame->addr_, call);
+    if (frame->ret_class_ != RET_MEMORY)
+	*rvp = call.retval_;
+}
+
+/*
+ * Common code for all trampolines, entered with %r11 pointing at the
+ * trampoline_t and the stack exactly as the intercepted function would
+ * have seen it.  We copy JUMP_STACK_WORDS words of the caller's stack
+ * arguments for the call to the original function; classify_function()
+ * sends functions which need more to the breakpoint method.
+ */
+__asm__(
+"	.text\n"
+"	.p2align 4\n"
+"	.globl __np_jump_entry\n"
+"	.hidden __np_jump_entry\n"
+"	.type __np_jump_entry,@function\n"
+"__np_jump_entry:\n"
+"	.cfi_startproc\n"
+"	pushq %rbp\n"
+"	.cfi_def_cfa_offset 16\n"
+"	.cfi_offset %rbp, -16\n"
+"	movq %rsp, %rbp\n"
+"	.cfi_def_cfa_register %rbp\n"
+"	subq $256, %rsp\n"
+"	movq %rdi, 0(%rsp)\n"
+"	movq %rsi, 8(%rsp)\n"
+"	movq %rdx, 16(%rsp)\n"
+"	movq %rcx, 24(%rsp)\n"
+"	movq %r8, 32(%rsp)\n"
+"	movq %r9, 40(%rsp)\n"
+"	movq %rax, 48(%rsp)\n"
+"	movq %r11, 56(%rsp)\n"
+"	movdqu %xmm0, 64(%rsp)\n"
+"	movdqu %xmm1, 80(%rsp)\n"
+"	movdqu %xmm2, 96(%rsp)\n"
+"	movdqu %xmm3, 112(%rsp)\n"
+"	movdqu %xmm4, 128(%rsp)\n"
+"	movdqu %xmm5, 144(%rsp)\n"
+"	movdqu %xmm6, 160(%rsp)\n"
+"	movdqu %xmm7, 176(%rsp)\n"
+"	movq %rsp, %rdi\n"
+"	call __np_jump_before\n"
+"	testq %rax, %rax\n"
+"	jz 2f\n"
+"	movq %rax, 192(%rsp)\n"
+	/* copy the caller's stack arguments */
+"	subq $128, %rsp\n"
+"	leaq 16(%rbp), %rsi\n"
+"	movq %rsp, %rdi\n"
+"	movl $16, %ecx\n"
+"	rep movsq\n"
+"	movq 128+0(%rsp), %rdi\n"
+"	movq 128+8(%rsp), %rsi\n"
+"	movq 128+16(%rsp), %rdx\n"
+"	movq 128+24(%rsp), %rcx\n"
+"	movq 128+32(%rsp), %r8\n"
+"	movq 128+40(%rsp), %r9\n"
+"	movq 128+48(%rsp), %rax\n"
+"	movdqu 128+64(%rsp), %xmm0\n"
+"	movdqu 128+80(%rsp), %xmm1\n"
+"	movdqu 128+96(%rsp), %xmm2\n"
+"	movdqu 128+112(%rsp), %xmm3\n"
+"	movdqu 128+128(%rsp), %xmm4\n"
+"	movdqu 128+144(%rsp), %xmm5\n"
+"	movdqu 128+160(%rsp), %xmm6\n"
+"	movdqu 128+176(%rsp), %xmm7\n"
+"	movq 128+192(%rsp), %r11\n"
+"	call *%r11\n"
+"	addq $128, %rsp\n"
+"	movq %rax, 200(%rsp)\n"
+"	movq %rdx, 208(%rsp)\n"
+"	movdqu %xmm0, 216(%rsp)\n"
+"	movdqu %xmm1, 232(%rsp)\n"
+"	movq %rsp, %rdi\n"
+"	call __np_jump_after\n"
+"2:\n"
+"	movq 200(%rsp), %rax\n"
+"	movq 208(%rsp), %rdx\n"
+"	movdqu 216(%rsp), %xmm0\n"
+"	movdqu 232(%rsp), %xmm1\n"
+"	leave\n"
+"	.cfi_def_cfa %rsp, 8\n"
+"	ret\n"
+"	.cfi_endproc\n"
+"	.size __np_jump_entry, .-__np_jump_entry\n"
+);
+
+static bool
+install_jump(addr_t addr, const np::spiegel::function_t *fn, intstate_t &state)
+{
+    unsigned char ret_class;
+    if (!classify_function(fn, &ret_class))
+	return false;
+    trampoline_t *tramp = tramp_alloc(addr);
+    if (!tramp)
+	return false;
+    if (!build_trampoline(addr, tramp) ||
+	text_map_writable(addr, tramp->patch_len_))
+    {
+	tramp_free(tramp);
+	return false;
+    }
+
+    unsigned char *p = (unsigned char *)addr;
+    p[0] = INSN_JMP_REL32;
+    *(int32_t *)(p+1) = (int32_t)((addr_t)tramp->stub_ - (addr + JMP_REL32_LEN));
+    /* nothing should ever execute the leftover bytes */
+    memset(p + JMP_REL32_LEN, INSN_INT3, tramp->patch_len_ - JMP_REL32_LEN);
+    VALGRIND_DISCARD_TRANSLATIONS(addr, tramp->patch_len_);
+
+    tramp->ret_class_ = ret_class;
+    state.type_ = intstate_t::JUMP;
+    state.orig_ = tramp->orig_[0];
+    state.tramp_ = tramp;
+    return true;
+}
+
+static int
+uninstall_jump(addr_t addr, intstate_t &state, std::string &err)
+{
+    trampoline_t *tramp = (trampoline_t *)state.tramp_;
+    unsigned int len = tramp->patch_len_;
+
+    if (*(unsigned char *)addr != INSN_JMP_REL32)
+    {
+	err = "intercept not installed";
+	return -1;
+    }
+    memcpy((void *)addr, tramp->orig_, len);
+    VALGRIND_DISCARD_TRANSLATIONS(addr, len);
+    tramp_free(tramp);
+    state.tramp_ = 0;
+    state.type_ = intstate_t::UNKNOWN;
+    int r = text_restore(addr, len);
+    if (r < 0)
+	err = "cannot restore text page";
+    return r;
+}
+
 int
-install_intercept(np::spiegel::addr_t addr, intstate_t &state, std::string &err)
+install_intercept(np::spiegel::addr_t addr,
+		  const np::spiegel::function_t *fn,
+		  intstate_t &state, std::string &err)
 {
     int r;
 
+    if (install_jump(addr, fn, state))
+	return 0;
+
     switch (*(unsigned char *)addr)
     {
     case INSN_PUSH_RBP:
@@ -446,6 +1350,9 @@ install_intercept(np::spiegel::addr_t addr, intstate_t &state, std::string &err)
 int
 uninstall_intercept(np::spiegel::addr_t addr, intstate_t &state, std::string &err)
 {
+    if (state.type_ == intstate_t::JUMP)
+	return uninstall_jump(addr, state, err);
+
     if (*(unsigned char *)addr != (using_int3 ? INSN_INT3 : INSN_HLT))
     {
 	err = "intercept not installed";
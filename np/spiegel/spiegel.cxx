@@ -19,6 +19,7 @@
 #include "np/spiegel/dwarf/entry.hxx"
 #include "np/spiegel/dwarf/enumerations.hxx"
 #include "np/spiegel/platform/common.hxx"
+#include <pthread.h>
 
 namespace np {
 namespace spiegel {
@@ -633,7 +634,14 @@ bool describe_address(addr_t addr, class location_t &loc)
 }
 
 map<np::spiegel::dwarf::reference_t, _cacheable_t*> _cacher_t::cache_;
+/*
+ * Test discovery scans compile units from several threads at once,
+ * so the cache is guarded.  Objects are only ever added, never
+ * removed, so a pointer handed out stays good without the lock.
+ */
+static pthread_mutex_t cacher_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Called with cacher_lock held */
 _cacheable_t *
 _cacher_t::find(np::spiegel::dwarf::reference_t ref)
 {
@@ -643,6 +651,7 @@ _cacher_t::find(np::spiegel::dwarf::reference_t ref)
     return i->second;
 }
 
+/* Called with cacher_lock held */
 _cacheable_t *
 _cacher_t::add(_cacheable_t *cc)
 {
@@ -655,33 +664,39 @@ _cacher_t::make_compile_unit(np::spiegel::dwarf::reference_t ref)
 {
     if (ref == np::spiegel::dwarf::reference_t::null)
 	return 0;
+    pthread_mutex_lock(&cacher_lock);
     _cacheable_t *cc = find(ref);
     if (!cc)
-	cc = add(new compile_unit_t(ref));
-    compile_unit_t *cu = (compile_unit_t *)cc;
-    if (!cu->populate())
     {
-	delete cu;
-	return 0;
+	compile_unit_t *cu = new compile_unit_t(ref);
+	if (cu->populate())
+	    cc = add(cu);
+	else
+	    delete cu;
     }
-    return cu;
+    pthread_mutex_unlock(&cacher_lock);
+    return (compile_unit_t *)cc;
 }
 
 type_t *
 _cacher_t::make_type(np::spiegel::dwarf::reference_t ref)
 {
+    pthread_mutex_lock(&cacher_lock);
     _cacheable_t *cc = find(ref);
     if (!cc)
 	cc = add(new type_t(ref));
+    pthread_mutex_unlock(&cacher_lock);
     return (type_t *)cc;
 }
 
 function_t *
 _cacher_t::make_function(np::spiegel::dwarf::walker_t &w)
 {
+    pthread_mutex_lock(&cacher_lock);
     _cacheable_t *cc = find(w.get_reference());
     if (!cc)
 	cc = add(new function_t(w));
+    pthread_mutex_unlock(&cacher_lock);
     return (function_t *)cc;
 }
 
@@ -696,10 +711,14 @@ _cacher_t::make_function(np::spiegel::dwarf::reference_t ref)
 }
 
 std::string describe_stacktrace()
+{
+    return describe_stacktrace(np::spiegel::platform::get_stacktrace());
+}
+
+std::string describe_stacktrace(const vector<addr_t> &stack)
 {
     string s;
-    vector<addr_t> stack = np::spiegel::platform::get_stacktrace();
-    vector<addr_t>::iterator i;
+    vector<addr_t>::const_iterator i;
     bool first = true;
     bool done = false;
     for (i = stack.begin() ; !done && i != stack.end() ; ++i)
@@ -68,6 +68,8 @@ public:
     _cacheable_t(np::spiegel::dwarf::reference_t ref) : ref_(ref) {}
     ~_cacheable_t() {}
 
+    np::spiegel::dwarf::reference_t get_reference() const { return ref_; }
+
 protected:
     np::spiegel::dwarf::reference_t ref_;
 
@@ -344,6 +346,7 @@ private:
 };
 
 extern std::string describe_stacktrace();
+extern std::string describe_stacktrace(const std::vector<addr_t> &stack);
 
 // close the namespaces
 }; };
@@ -19,6 +19,8 @@
 #include "np/classifier.hxx"
 #include "np/spiegel/spiegel.hxx"
 #include "np/spiegel/dwarf/state.hxx"
+#include "np/discovery_cache.hxx"
+#include "np/util/parallel.hxx"
 
 namespace np {
 using namespace std;
@@ -124,15 +126,24 @@ testmanager_t::setup_classifiers()
 {
     add_classifier("^test_([a-z0-9].*)", false, FT_TEST);
     add_classifier("^[tT]est([A-Z].*)", false, FT_TEST);
+    add_classifier("^bench_([a-z0-9].*)", false, FT_BENCH);
+    add_classifier("^[bB]ench([A-Z].*)", false, FT_BENCH);
     add_classifier("^[sS]etup$", false, FT_BEFORE);
     add_classifier("^set_up$", false, FT_BEFORE);
     add_classifier("^[iI]nit$", false, FT_BEFORE);
     add_classifier("^[tT]ear[dD]own$", false, FT_AFTER);
     add_classifier("^tear_down$", false, FT_AFTER);
     add_classifier("^[cC]leanup$", false, FT_AFTER);
+    add_classifier("^[sS]etup_?[sS]uite$", false, FT_BEFORE_SUITE);
+    add_classifier("^set_up_suite$", false, FT_BEFORE_SUITE);
+    add_classifier("^[tT]ear[dD]own_?[sS]uite$", false, FT_AFTER_SUITE);
+    add_classifier("^tear_down_suite$", false, FT_AFTER_SUITE);
     add_classifier("^mock_(.*)", false, FT_MOCK);
     add_classifier("^[mM]ock([A-Z].*)", false, FT_MOCK);
     add_classifier("^__np_parameter_(.*)", false, FT_PARAM);
+    add_classifier("^__np_limit_(.*)", false, FT_LIMIT);
+    add_classifier("^__np_threaded$", false, FT_THREADED);
+    add_classifier("^__np_virtual_clock$", false, FT_VIRTUAL_CLOCK);
 }
 
 static string
@@ -154,22 +165,59 @@ test_name(np::spiegel::function_t *fn, char *submatch)
     return name;
 }
 
-np::spiegel::function_t *
-testmanager_t::find_mock_target(string name)
+struct testmanager_t::index_job_t
+{
+    np::spiegel::dwarf::state_t *state_;
+    vector< vector< pair<string, np::spiegel::dwarf::reference_t> > > names_;
+};
+
+void
+testmanager_t::index_compile_unit(void *closure, unsigned idx)
+{
+    index_job_t *job = (index_job_t *)closure;
+    job->state_->get_function_names(idx, job->names_[idx]);
+}
+
+/*
+ * Build the index of functions by name, unless it was loaded from
+ * the discovery cache.  It's built once during discovery, before
+ * any test is forked, and saved in the cache, so that tests which
+ * look up functions by name don't each build their own.  Where
+ * several functions have the same name, the first one in compile
+ * unit order wins.
+ */
+void
+testmanager_t::index_functions()
 {
-    vector<np::spiegel::compile_unit_t *> units = np::spiegel::get_compile_units();
-    vector<np::spiegel::compile_unit_t *>::iterator i;
-    for (i = units.begin() ; i != units.end() ; ++i)
+    if (functions_indexed_)
+	return;
+    functions_indexed_ = true;
+
+    index_job_t job;
+    job.state_ = spiegel_;
+    job.names_.resize(spiegel_->get_compile_units().size());
+    np::util::parallel_for(job.names_.size(), index_compile_unit, &job);
+
+    vector< vector< pair<string, np::spiegel::dwarf::reference_t> > >::iterator i;
+    for (i = job.names_.begin() ; i != job.names_.end() ; ++i)
     {
-	vector<np::spiegel::function_t *> fns = (*i)->get_functions();
-	vector<np::spiegel::function_t *>::iterator j;
-	for (j = fns.begin() ; j != fns.end() ; ++j)
-	{
-	    if ((*j)->get_name() == name)
-		return *j;
-	}
+	vector< pair<string, np::spiegel::dwarf::reference_t> >::iterator j;
+	for (j = i->begin() ; j != i->end() ; ++j)
+	    functions_.insert(*j);
     }
-    return 0;
+#if _NP_DEBUG
+    fprintf(stderr, "np: indexed %u function names\n", (unsigned)functions_.size());
+#endif
+}
+
+np::spiegel::function_t *
+testmanager_t::find_mock_target(string name)
+{
+    index_functions();
+    function_index_t::iterator i = functions_.find(name);
+    if (i == functions_.end())
+	return 0;
+    return np::spiegel::_cacher_t::make_function(i->second);
 }
 
 static const struct __np_param_dec *
@@ -180,6 +228,161 @@ get_param_dec(np::spiegel::function_t *fn)
     return (const struct __np_param_dec *)ret.val.vpointer;
 }
 
+static const struct __np_limit_dec *
+get_limit_dec(np::spiegel::function_t *fn)
+{
+    vector<np::spiegel::value_t> args;
+    np::spiegel::value_t ret = fn->invoke(args);
+    return (const struct __np_limit_dec *)ret.val.vpointer;
+}
+
+extern void init_syslog_intercepts(testnode_t *);
+extern void init_exit_intercepts(testnode_t *);
+extern void init_time_intercepts(testnode_t *);
+
+struct testmanager_t::scan_job_t
+{
+    testmanager_t *tm_;
+    vector<np::spiegel::compile_unit_t *> units_;
+    vector< vector<discovery_t> > discs_;
+};
+
+/*
+ * Walk all the functions in one compile unit, recording the ones
+ * which look interesting according to the classifiers.  Called
+ * concurrently for different compile units; mock targets are left
+ * as names in name_ to be resolved afterwards, as finding them
+ * means looking at every compile unit.
+ */
+void
+testmanager_t::scan_compile_unit(void *closure, unsigned idx)
+{
+    scan_job_t *job = (scan_job_t *)closure;
+    np::spiegel::compile_unit_t *cu = job->units_[idx];
+    vector<discovery_t> &discs = job->discs_[idx];
+
+#if _NP_DEBUG
+    fprintf(stderr, "np: scanning compile unit %s\n", cu->get_absolute_path().c_str());
+#endif
+    vector<np::spiegel::function_t *> fns = cu->get_functions();
+    vector<np::spiegel::function_t *>::iterator j;
+    for (j = fns.begin() ; j != fns.end() ; ++j)
+    {
+	np::spiegel::function_t *fn = *j;
+	functype_t type;
+	char submatch[512];
+	discovery_t d;
+
+	// We want functions which are defined in this compile unit
+	if (!fn->get_address())
+	    continue;
+
+	type = job->tm_->classify_function(fn->get_name().c_str(),
+					   submatch, sizeof(submatch));
+#if _NP_DEBUG
+	fprintf(stderr, "np: function %s classified %s submatch \"%s\"\n",
+		fn->get_name().c_str(), np::as_string(type), submatch);
+#endif
+	d.type_ = type;
+	d.function_ = fn->get_reference();
+	d.target_ = np::spiegel::dwarf::reference_t::null;
+	switch (type)
+	{
+	case FT_UNKNOWN:
+	    continue;
+	case FT_TEST:
+	case FT_BENCH:
+	    // Test and benchmark functions need a node name
+	    if (!submatch[0])
+		continue;
+	    // Test function return void
+	    if (fn->get_return_type()->get_classification() != np::spiegel::type_t::TC_VOID)
+		continue;
+	    // Test functions take no arguments
+	    if (fn->get_parameter_types().size() != 0)
+		continue;
+	    d.path_ = test_name(fn, submatch);
+	    break;
+	case FT_BEFORE:
+	case FT_AFTER:
+	case FT_BEFORE_SUITE:
+	case FT_AFTER_SUITE:
+	    // Before/after functions go into the parent node
+	    assert(!submatch[0]);
+	    // Before/after functions return int
+	    if (fn->get_return_type()->get_classification() != np::spiegel::type_t::TC_SIGNED_INT)
+		continue;
+	    // Before/after take no arguments
+	    if (fn->get_parameter_types().size() != 0)
+		continue;
+	    d.path_ = test_name(fn, submatch);
+	    break;
+	case FT_MOCK:
+	    // Mock functions need a target name
+	    if (!submatch[0])
+		continue;
+	    d.path_ = test_name(fn, 0);
+	    d.name_ = submatch;
+	    break;
+	case FT_PARAM:
+	    // Parameters need a name
+	    if (!submatch[0])
+		continue;
+	    d.path_ = test_name(fn, 0);
+	    d.name_ = submatch;
+	    break;
+	case FT_LIMIT:
+	    // Limits need the name of the resource
+	    if (!submatch[0])
+		continue;
+	    d.path_ = test_name(fn, 0);
+	    d.name_ = submatch;
+	    break;
+	case FT_THREADED:
+	case FT_VIRTUAL_CLOCK:
+	    d.path_ = test_name(fn, 0);
+	    break;
+	}
+	discs.push_back(d);
+    }
+}
+
+/*
+ * Scan all the compile units in parallel, then merge the results in
+ * compile unit order so the tests are discovered in the same order
+ * whatever the number of threads.
+ */
+void
+testmanager_t::scan_functions(vector<discovery_t> &discs)
+{
+#if _NP_DEBUG
+    fprintf(stderr, "np: scanning for test functions\n");
+#endif
+    scan_job_t job;
+    job.tm_ = this;
+    job.units_ = np::spiegel::get_compile_units();
+    job.discs_.resize(job.units_.size());
+    np::util::parallel_for(job.units_.size(), scan_compile_unit, &job);
+
+    vector< vector<discovery_t> >::iterator i;
+    for (i = job.discs_.begin() ; i != job.discs_.end() ; ++i)
+    {
+	vector<discovery_t>::iterator j;
+	for (j = i->begin() ; j != i->end() ; ++j)
+	{
+	    if (j->type_ == FT_MOCK)
+	    {
+		np::spiegel::function_t *target = find_mock_target(j->name_);
+		if (!target)
+		    continue;
+		j->target_ = target->get_reference();
+		j->name_.clear();
+	    }
+	    discs.push_back(*j);
+	}
+    }
+}
+
 void
 testmanager_t::discover_functions()
 {
@@ -194,84 +397,93 @@ testmanager_t::discover_functions()
     }
     // else: splice common_ and root_ back together
 
-#if _NP_DEBUG
-    fprintf(stderr, "np: scanning for test functions\n");
-#endif
-    vector<np::spiegel::compile_unit_t *> units = np::spiegel::get_compile_units();
-    vector<np::spiegel::compile_unit_t *>::iterator i;
-    unsigned int ntests = 0;
-    for (i = units.begin() ; i != units.end() ; ++i)
+    vector<discovery_t> &discs = discoveries_;
+    /* a re-run under Valgrind is given its parent's results */
+    const char *rerun_cache = getenv("__NP_RERUN_CACHE");
+    discovery_cache_t cache(spiegel_, rerun_cache);
+    discs.clear();
+    bool loaded = cache.load(discs, functions_);
+    if (!loaded)
     {
-#if _NP_DEBUG
-	fprintf(stderr, "np: scanning compile unit %s\n", (*i)->get_absolute_path().c_str());
-#endif
-	vector<np::spiegel::function_t *> fns = (*i)->get_functions();
-	vector<np::spiegel::function_t *>::iterator j;
-	for (j = fns.begin() ; j != fns.end() ; ++j)
-	{
-	    np::spiegel::function_t *fn = *j;
-	    functype_t type;
-	    char submatch[512];
+	if (rerun_cache)
+	    fprintf(stderr, "np: WARNING: cannot load discovery results "
+			    "from %s, discovering again\n", rerun_cache);
+	discs.clear();
+	functions_.clear();
+	scan_functions(discs);
+    }
+    /* an empty index means it was saved without one */
+    functions_indexed_ = !functions_.empty();
+    if (!loaded || !functions_indexed_)
+    {
+	index_functions();
+	cache.save(discs, functions_);
+    }
+    /* build it now, or every child would build its own */
+    spiegel_->prepare_address_index();
 
-	    // We want functions which are defined in this compile unit
-	    if (!fn->get_address())
-		continue;
+    /* benchmarks are only run when asked for, as existing code may
+     * already have helper functions called bench_something */
+    const char *env = getenv("NOVAPROVA_BENCH");
+    bool benchmarks = (env && !strcmp(env, "yes"));
 
-	    type = classify_function(fn->get_name().c_str(),
-				     submatch, sizeof(submatch));
-#if _NP_DEBUG
-	    fprintf(stderr, "np: function %s classified %s submatch \"%s\"\n",
-		    fn->get_name().c_str(), np::as_string(type), submatch);
-#endif
-	    switch (type)
-	    {
-	    case FT_UNKNOWN:
-		continue;
-	    case FT_TEST:
-		// Test functions need a node name
-		if (!submatch[0])
-		    continue;
-		// Test function return void
-		if (fn->get_return_type()->get_classification() != np::spiegel::type_t::TC_VOID)
-		    continue;
-		// Test functions take no arguments
-		if (fn->get_parameter_types().size() != 0)
-		    continue;
-		root_->make_path(test_name(fn, submatch))->set_function(type, fn);
-		ntests++;
-		break;
-	    case FT_BEFORE:
-	    case FT_AFTER:
-		// Before/after functions go into the parent node
-		assert(!submatch[0]);
-		// Before/after functions return int
-		if (fn->get_return_type()->get_classification() != np::spiegel::type_t::TC_SIGNED_INT)
-		    continue;
-		// Before/after take no arguments
-		if (fn->get_parameter_types().size() != 0)
-		    continue;
-		root_->make_path(test_name(fn, submatch))->set_function(type, fn);
+    unsigned int ntests = 0;
+    vector<discovery_t>::iterator i;
+    for (i = discs.begin() ; i != discs.end() ; ++i)
+    {
+	np::spiegel::function_t *fn = np::spiegel::_cacher_t::make_function(i->function_);
+	if (!fn)
+	    continue;
+	switch (i->type_)
+	{
+	case FT_BENCH:
+	    if (!benchmarks)
 		break;
-	    case FT_MOCK:
-		// Mock functions need a target name
-		if (!submatch[0])
-		    continue;
+	    /* fall through */
+	case FT_TEST:
+	    ntests++;
+	    /* fall through */
+	case FT_BEFORE:
+	case FT_AFTER:
+	case FT_BEFORE_SUITE:
+	case FT_AFTER_SUITE:
+	    root_->make_path(i->path_)->set_function(i->type_, fn);
+	    break;
+	case FT_MOCK:
+	    {
+		np::spiegel::function_t *target = np::spiegel::_cacher_t::make_function(i->target_);
+		if (target)
+		    root_->make_path(i->path_)->add_mock(target, fn);
+	    }
+	    break;
+	case FT_PARAM:
+	    {
+		const struct __np_param_dec *dec = get_param_dec(fn);
+		root_->make_path(i->path_)->add_parameter(
+				i->name_.c_str(), dec->var, dec->values);
+	    }
+	    break;
+	case FT_LIMIT:
+	    {
+		limit_t which;
+		if (!limit_from_string(i->name_.c_str(), &which))
 		{
-		    np::spiegel::function_t *target = find_mock_target(submatch);
-		    if (!target)
-			continue;
-		    root_->make_path(test_name(fn, 0))->add_mock(target, fn);
+		    fprintf(stderr, "np: WARNING: unknown resource limit \"%s\"\n",
+			    i->name_.c_str());
+		    break;
 		}
-		break;
-	    case FT_PARAM:
-		// Parameters need a name
-		if (!submatch[0])
-		    continue;
-		const struct __np_param_dec *dec = get_param_dec(fn);
-		root_->make_path(test_name(fn, 0))->add_parameter(
-				submatch, dec->var, dec->values);
-		break;
+		const struct __np_limit_dec *dec = get_limit_dec(fn);
+		root_->make_path(i->path_)->set_limit(which, dec->value);
 	    }
+	    break;
+	case FT_THREADED:
+	    root_->make_path(i->path_)->set_threaded();
+	    break;
+	case FT_VIRTUAL_CLOCK:
+	    init_time_intercepts(root_->make_path(i->path_));
+	    break;
+	default:
+	    break;
 	}
     }
 
@@ -282,8 +494,23 @@ testmanager_t::discover_functions()
     root_ = root_->detach_common();
 }
 
-extern void init_syslog_intercepts(testnode_t *);
-extern void init_exit_intercepts(testnode_t *);
+/*
+ * Write the discovery results to an anonymous file, which a test
+ * re-run under Valgrind loads instead of discovering all over again
+ * at Valgrind's speed.  Returns the file descriptor, or -1.
+ */
+int
+testmanager_t::save_discoveries()
+{
+    discovery_cache_t cache(spiegel_);
+    int fd = np::util::anon_file("novaprova.discoveries");
+    if (!cache.save(fd, discoveries_, functions_))
+    {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
 
 void
 testmanager_t::setup_builtin_intercepts()
@@ -303,6 +530,12 @@ extern "C" void __np_mock_by_name(const char *fname, void (*to)(void))
     __np_mock((void(*)(void))f->get_address(), f->get_full_name().c_str(), to);
 }
 
+extern "C" np_funcptr_t np_function_by_name(const char *fname)
+{
+    np::spiegel::function_t *f = np::testmanager_t::instance()->find_mock_target(fname);
+    return (f ? (np_funcptr_t)f->get_address() : 0);
+}
+
 extern "C" void np_unmock_by_name(const char *fname)
 {
     np::spiegel::function_t *f = np::testmanager_t::instance()->find_mock_target(fname);
@@ -19,15 +19,31 @@
 #include "np/util/common.hxx"
 #include "np/types.hxx"
 #include "np/testnode.hxx"
+#include "np/spiegel/dwarf/reference.hxx"
 #include <string>
 #include <vector>
+#include <map>
+#include <tr1/unordered_map>
 
 namespace np { namespace spiegel { namespace dwarf { class state_t; } } }
 
 namespace np {
 
+/* all functions by name and by full name */
+typedef std::tr1::unordered_map<std::string, spiegel::dwarf::reference_t> function_index_t;
+
 class classifier_t;
 
+/* One interesting function found by walking the DWARF info */
+struct discovery_t
+{
+    functype_t type_;
+    std::string path_;				/* full name of the testnode */
+    spiegel::dwarf::reference_t function_;
+    spiegel::dwarf::reference_t target_;	/* FT_MOCK: mocked function */
+    std::string name_;				/* FT_PARAM, FT_LIMIT: their name */
+};
+
 class testmanager_t : public np::util::zalloc
 {
 public:
@@ -43,6 +59,7 @@ public:
     static void done() { delete instance_; }
 
     spiegel::function_t *find_mock_target(std::string name);
+    int save_discoveries();
 
 private:
     testmanager_t();
@@ -52,6 +69,12 @@ private:
     functype_t classify_function(const char *func, char *match_return, size_t maxmatch);
     void add_classifier(const char *re, bool case_sensitive, functype_t type);
     void setup_classifiers();
+    void index_functions();
+    struct index_job_t;
+    static void index_compile_unit(void *, unsigned);
+    void scan_functions(std::vector<discovery_t> &);
+    struct scan_job_t;
+    static void scan_compile_unit(void *, unsigned);
     void discover_functions();
     void setup_builtin_intercepts();
 
@@ -59,6 +82,9 @@ private:
 
     std::vector<classifier_t*> classifiers_;
     spiegel::dwarf::state_t *spiegel_;
+    std::vector<discovery_t> discoveries_;
+    function_index_t functions_;
+    bool functions_indexed_;
     testnode_t *root_;
     testnode_t *common_;	// nodes from filesystem root down to root_
 };
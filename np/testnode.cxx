@@ -97,9 +97,10 @@ testnode_t::add_mock(np::spiegel::function_t *target, np::spiegel::function_t *m
 }
 
 void
-testnode_t::add_mock(np::spiegel::addr_t target, const char *name, np::spiegel::addr_t mock)
+testnode_t::add_mock(np::spiegel::addr_t target, const char *name, np::spiegel::addr_t mock,
+		     bool got)
 {
-    intercepts_.push_back(new redirect_t(target, name, mock));
+    intercepts_.push_back(new redirect_t(target, name, mock, got));
 }
 
 void
@@ -164,11 +165,12 @@ testnode_t::is_elidable() const
     /* nodes with mocks or other intercepts cannot be elided */
     if (intercepts_.size() > 0)
 	return false;
-    /* nodes with parameters cannot be elided */
-    if (parameters_.size() > 0)
+    /* nodes with parameters, limits or NP_THREADED() cannot be elided */
+    if (parameters_.size() > 0 || limits_set_ || threaded_)
 	return false;
     /* nodes with tests or fixtures cannot be elided */
-    if (funcs_[FT_BEFORE] || funcs_[FT_TEST] || funcs_[FT_AFTER])
+    if (funcs_[FT_BEFORE] || funcs_[FT_TEST] || funcs_[FT_AFTER] ||
+	funcs_[FT_BEFORE_SUITE] || funcs_[FT_AFTER_SUITE] || funcs_[FT_BENCH])
 	return false;
     /* nodes with more than a single child cannot be elided */
     if (children_ && children_->next_)
@@ -220,6 +222,21 @@ testnode_t::get_fixtures(functype_t type) const
     return fixtures;
 }
 
+/*
+ * Returns the nearest node at or above this one which has suite
+ * fixtures, or 0 if there isn't one.
+ */
+testnode_t *
+testnode_t::get_suite()
+{
+    for (testnode_t *a = this ; a ; a = a->parent_)
+    {
+	if (a->funcs_[FT_BEFORE_SUITE] || a->funcs_[FT_AFTER_SUITE])
+	    return a;
+    }
+    return 0;
+}
+
 testnode_t *
 testnode_t::find(const char *nm)
 {
@@ -395,6 +412,100 @@ testnode_t::create_assignments() const
     return assigns;
 }
 
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+void
+testnode_t::set_limit(limit_t which, unsigned long value)
+{
+    limits_[which] = value;
+    limits_set_ |= (1<<which);
+}
+
+/*
+ * Find the resource limit set on this node or the nearest of its
+ * ancestors, returning false if none of them sets one.
+ */
+bool
+testnode_t::get_limit(limit_t which, unsigned long *valuep) const
+{
+    for (const testnode_t *a = this ; a ; a = a->parent_)
+    {
+	if (a->limits_set_ & (1<<which))
+	{
+	    *valuep = a->limits_[which];
+	    return true;
+	}
+    }
+    return false;
+}
+
+/*
+ * Tests at or below a node marked with NP_THREADED() may share a
+ * process with other tests, unless something on the way down needs
+ * a process to itself: mocks, parameters or resource limits.  The
+ * intercepts on the root are the built-in ones every test shares.
+ */
+/*
+ * Install this node's own intercepts, but only if every one of them
+ * can be done by rewriting GOT slots.  Calls then go straight to the
+ * mocks without touching the intercept tables, so several threads
+ * can make them at once.  Returns false, with nothing installed, if
+ * any would need a breakpoint.
+ */
+bool
+testnode_t::install_got_redirects() const
+{
+    vector<np::spiegel::intercept_t*>::const_iterator itr;
+    for (itr = intercepts_.begin() ; itr != intercepts_.end() ; ++itr)
+    {
+	if (!(*itr)->get_got_redirect())
+	    return false;
+    }
+    bool ok = true;
+    for (itr = intercepts_.begin() ; itr != intercepts_.end() ; ++itr)
+    {
+	(*itr)->install();
+	ok = ok && (*itr)->is_got_redirected();
+    }
+    if (!ok)
+	uninstall_intercepts();
+    return ok;
+}
+
+/* Uninstall this node's own intercepts */
+void
+testnode_t::uninstall_intercepts() const
+{
+    vector<np::spiegel::intercept_t*>::const_iterator itr;
+    for (itr = intercepts_.begin() ; itr != intercepts_.end() ; ++itr)
+	(*itr)->uninstall();
+}
+
+bool
+testnode_t::is_threaded() const
+{
+    bool threaded = false;
+    for (const testnode_t *a = this ; a ; a = a->parent_)
+    {
+	if ((a->parent_ && a->intercepts_.size()) ||
+	    a->parameters_.size() || a->limits_set_)
+	    return false;
+	threaded |= a->threaded_;
+    }
+    return threaded;
+}
+
+/*
+ * Install an intercept for the rest of the current test.  It's
+ * uninstalled and deleted by post_run() when the test is over.
+ */
+void
+add_dynamic_intercept(np::spiegel::intercept_t *ii)
+{
+    dynamic_intercepts.push_back(ii);
+    ii->install();
+}
+
 // close the namespace
 };
 
@@ -407,8 +518,7 @@ extern "C" void __np_mock(void (*from)(void), const char *name, void (*to)(void)
 					      (np::spiegel::addr_t)to);
     // TODO: should we search the dynamic_intercepts list here
     // to be entirely sure the caller doesn't double-mock
-    dynamic_intercepts.push_back(mock);
-    mock->install();
+    np::add_dynamic_intercept(mock);
 }
 
 extern "C" void __np_unmock(void (*from)(void))
@@ -35,7 +35,8 @@ public:
     testnode_t *make_path(std::string name);
     void set_function(functype_t, np::spiegel::function_t *);
     void add_mock(np::spiegel::function_t *target, np::spiegel::function_t *mock);
-    void add_mock(np::spiegel::addr_t target, const char *name, np::spiegel::addr_t mock);
+    void add_mock(np::spiegel::addr_t target, const char *name, np::spiegel::addr_t mock,
+		  bool got = false);
     void add_mock(np::spiegel::addr_t target, np::spiegel::addr_t mock);
 
     testnode_t *detach_common();
@@ -44,8 +45,11 @@ public:
 	return funcs_[type];
     }
     std::list<np::spiegel::function_t*> get_fixtures(functype_t type) const;
+    testnode_t *get_suite();
     void pre_run() const;
     void post_run() const;
+    bool install_got_redirects() const;
+    void uninstall_intercepts() const;
 
     void dump(int level) const;
 
@@ -83,6 +87,12 @@ public:
     void add_parameter(const char *, char **, const char *);
     std::vector<assignment_t> create_assignments() const;
 
+    void set_limit(limit_t, unsigned long);
+    bool get_limit(limit_t, unsigned long *) const;
+
+    void set_threaded() { threaded_ = true; }
+    bool is_threaded() const;
+
     class preorder_iterator
     {
     public:
@@ -118,6 +128,9 @@ private:
     np::spiegel::function_t *funcs_[FT_NUM_SINGULAR];
     std::vector<np::spiegel::intercept_t*> intercepts_;
     std::vector<parameter_t*> parameters_;
+    unsigned long limits_[L_NUM];
+    unsigned int limits_set_;	    /* bitmask of (1<<limit_t) */
+    bool threaded_;		    /* marked with NP_THREADED() */
 
     friend class preorder_iterator;
 };
@@ -125,6 +138,7 @@ private:
 bool bump(std::vector<testnode_t::assignment_t> &a);
 int operator==(const std::vector<testnode_t::assignment_t> &a,
 	       const std::vector<testnode_t::assignment_t> &b);
+void add_dynamic_intercept(np::spiegel::intercept_t *);
 
 // close the namespace
 };
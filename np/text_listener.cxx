@@ -15,6 +15,7 @@
  */
 #include "np/text_listener.hxx"
 #include "np/job.hxx"
+#include "np/benchmark.hxx"
 #include "except.h"
 
 namespace np {
@@ -27,14 +28,19 @@ text_listener_t::begin()
 {
     nrun_ = 0;
     nfailed_ = 0;
+    nskipped_ = 0;
     fprintf(stderr, "np: running\n");
 }
 
 void
 text_listener_t::end()
 {
-    fprintf(stderr, "np: %u run %u failed\n",
-	    nrun_, nfailed_);
+    if (nskipped_)
+	fprintf(stderr, "np: %u run %u failed %u skipped\n",
+		nrun_, nfailed_, nskipped_);
+    else
+	fprintf(stderr, "np: %u run %u failed\n",
+		nrun_, nfailed_);
 }
 
 void
@@ -67,6 +73,13 @@ text_listener_t::end_job(const job_t *j, result_t res)
     }
 }
 
+void
+text_listener_t::skip_job(const job_t *j)
+{
+    nskipped_++;
+    fprintf(stderr, "SKIP %s\n", j->as_string().c_str());
+}
+
 void
 text_listener_t::add_event(const job_t *j __attribute__((unused)),
 			   const event_t *ev)
@@ -79,5 +92,12 @@ text_listener_t::add_event(const job_t *j __attribute__((unused)),
     fputs(s.c_str(), stderr);
 }
 
+void
+text_listener_t::add_benchmark(const job_t *j __attribute__((unused)),
+			       const benchmark_t *b)
+{
+    fprintf(stderr, "BENCH %s\n", b->as_string().c_str());
+}
+
 // close the namespace
 };
@@ -30,11 +30,14 @@ public:
     void end();
     void begin_job(const job_t *);
     void end_job(const job_t *, result_t);
+    void skip_job(const job_t *);
     void add_event(const job_t *, const event_t *ev);
+    void add_benchmark(const job_t *, const benchmark_t *);
 
 private:
     unsigned int nrun_;
     unsigned int nfailed_;
+    unsigned int nskipped_;
 };
 
 // close the namespace
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include "np/types.hxx"
+#include <string.h>
 
 namespace np {
 
@@ -26,11 +27,42 @@ as_string(functype_t type)
     case FT_BEFORE: return "before";
     case FT_TEST: return "test";
     case FT_AFTER: return "after";
+    case FT_BEFORE_SUITE: return "before_suite";
+    case FT_AFTER_SUITE: return "after_suite";
+    case FT_BENCH: return "bench";
     case FT_MOCK: return "mock";
     case FT_PARAM: return "param";
+    case FT_LIMIT: return "limit";
+    case FT_THREADED: return "threaded";
+    case FT_VIRTUAL_CLOCK: return "virtual_clock";
     default: return "INTERNAL ERROR!";
     }
 }
 
+static const char * const limit_names[L_NUM] =
+{
+    "cpu", "mem", "nofile", "fsize"
+};
+
+const char *
+as_string(limit_t which)
+{
+    return ((unsigned)which < L_NUM ? limit_names[which] : "INTERNAL ERROR!");
+}
+
+bool
+limit_from_string(const char *name, limit_t *whichp)
+{
+    for (int i = 0 ; i < L_NUM ; i++)
+    {
+	if (!strcmp(name, limit_names[i]))
+	{
+	    *whichp = (limit_t)i;
+	    return true;
+	}
+    }
+    return false;
+}
+
 // close the namespace
 };
@@ -39,14 +39,33 @@ enum functype_t
     FT_BEFORE,
     FT_TEST,
     FT_AFTER,
-#define FT_NUM_SINGULAR	(FT_AFTER+1)
+    FT_BEFORE_SUITE,
+    FT_AFTER_SUITE,
+    FT_BENCH,
+#define FT_NUM_SINGULAR	(FT_BENCH+1)
     FT_MOCK,
     FT_PARAM,
-#define FT_NUM		(FT_PARAM+1)
+    FT_LIMIT,
+    FT_THREADED,
+    FT_VIRTUAL_CLOCK,
+#define FT_NUM		(FT_VIRTUAL_CLOCK+1)
 };
 
 extern const char *as_string(functype_t);
 
+/* in the same order as enum np_limit in np.h */
+enum limit_t
+{
+    L_CPU,	    /* seconds of CPU time */
+    L_MEM,	    /* KiB of memory allocated by the test */
+    L_NOFILE,	    /* file descriptors */
+    L_FSIZE,	    /* KiB in any one file */
+    L_NUM
+};
+
+extern const char *as_string(limit_t);
+extern bool limit_from_string(const char *, limit_t *);
+
 // close the namespace
 };
 
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 #include "np/util/common.hxx"
+#include <sys/syscall.h>
+#include <fcntl.h>
 
 namespace np {
 namespace util {
@@ -261,6 +263,32 @@ page_round_down(unsigned long x)
     return (x / ps) * ps;
 }
 
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+/*
+ * Open an anonymous read-write file, e.g. to capture a child's
+ * output.  A memfd lives only in memory and vanishes when the last
+ * process closes it, so it costs no disk I/O and nothing is left
+ * lying around in /tmp.  Kernels without memfd_create get a
+ * temporary file which is unlinked straight away.
+ */
+int
+anon_file(const char *name)
+{
+    int fd;
+#ifdef SYS_memfd_create
+    fd = syscall(SYS_memfd_create, name, 1/*MFD_CLOEXEC*/);
+    if (fd >= 0)
+	return fd;
+#endif
+    char path[] = "/tmp/novaprova.XXXXXX";
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0)
+	fatal("cannot make temporary file %s: %s", path, strerror(errno));
+    unlink(path);
+    return fd;
+}
+
 /*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
 // close the namespaces
 }; };
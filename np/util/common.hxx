@@ -111,6 +111,8 @@ extern unsigned long page_size(void);
 extern unsigned long page_round_up(unsigned long x);
 extern unsigned long page_round_down(unsigned long x);
 
+extern int anon_file(const char *name);
+
 // close the namespaces
 }; };
 
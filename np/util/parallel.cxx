@@ -0,0 +1,93 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np/util/parallel.hxx"
+#include <pthread.h>
+
+namespace np { namespace util {
+
+struct parallel_job_t
+{
+    void (*fn_)(void *, unsigned);
+    void *arg_;
+    unsigned n_;
+    volatile unsigned next_;
+};
+
+static void *
+parallel_worker(void *closure)
+{
+    parallel_job_t *job = (parallel_job_t *)closure;
+
+    /* claim indexes one at a time, so a few expensive
+     * items don't leave the other threads idle */
+    for (;;)
+    {
+	unsigned i = __sync_fetch_and_add(&job->next_, 1);
+	if (i >= job->n_)
+	    break;
+	job->fn_(job->arg_, i);
+    }
+    return 0;
+}
+
+static unsigned
+parallel_nthreads(unsigned n)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *e = getenv("NOVAPROVA_THREADS");
+    if (e && *e)
+	ncpus = atoi(e);
+    if (ncpus < 1)
+	ncpus = 1;
+    return ((unsigned)ncpus < n ? (unsigned)ncpus : n);
+}
+
+void
+parallel_for(unsigned n, void (*fn)(void *, unsigned), void *arg)
+{
+    parallel_job_t job;
+    job.fn_ = fn;
+    job.arg_ = arg;
+    job.n_ = n;
+    job.next_ = 0;
+
+    unsigned nthreads = parallel_nthreads(n);
+    std::vector<pthread_t> threads;
+    /* the calling thread is one of the workers */
+    for (unsigned t = 1 ; t < nthreads ; t++)
+    {
+	pthread_t th;
+	int r = pthread_create(&th, 0, parallel_worker, &job);
+	if (r)
+	{
+#if _NP_DEBUG
+	    fprintf(stderr, "np: pthread_create failed: %s\n", strerror(r));
+#endif
+	    /* carry on with however many we have */
+	    break;
+	}
+	threads.push_back(th);
+    }
+
+    parallel_worker(&job);
+
+    std::vector<pthread_t>::iterator i;
+    for (i = threads.begin() ; i != threads.end() ; ++i)
+	pthread_join(*i, 0);
+}
+
+// close the namespaces
+}; };
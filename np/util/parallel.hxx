@@ -0,0 +1,36 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __np_util_parallel_hxx__
+#define __np_util_parallel_hxx__ 1
+
+#include "np/util/common.hxx"
+
+namespace np { namespace util {
+
+/*
+ * Call fn(arg, i) once for every i in [0, n), spread across a small
+ * pool of threads which is torn down again before returning.  The
+ * calls may happen in any order and concurrently, so callers should
+ * write each result into its own slot i and merge the slots in order
+ * afterwards.  With a single CPU, or NOVAPROVA_THREADS=1, or n < 2,
+ * everything runs inline in the calling thread.
+ */
+extern void parallel_for(unsigned n, void (*fn)(void *arg, unsigned i), void *arg);
+
+// close the namespaces
+}; };
+
+#endif /* __np_util_parallel_hxx__ */
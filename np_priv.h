@@ -39,5 +39,6 @@
 #include "np/runner.hxx"
 
 extern void __np_terminate_handler(void);
+extern void __np_exec_valgrind(void) __attribute__((noreturn));
 
 #endif /* __NP_PRIV_H__ */
@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# Run tnbench's benchmark against a baseline it can't meet, one it
+# easily meets, and none at all, and show the results.
+
+TEST="$1"
+
+function rerun()
+{
+    echo "MSG running $*"
+    NOVAPROVA_BENCH=yes NOVAPROVA_LEAKCHECK=yes NOVAPROVA_BENCH_SAMPLES=5 \
+	NOVAPROVA_BENCH_BASELINE=$TEST.baseline ./$TEST 2>&1 |\
+	sed -n -e 's/^\(PASS\|FAIL\|EVENT [A-Z]*\) .*\(tnbench\.[a-z]*\|slower\).*/MSG \1 \2/p' | sort
+    echo "EXIT ${PIPESTATUS[0]}"
+}
+
+echo "0.001 tnbench.leaky" > $TEST.baseline
+rerun "with a fast baseline"
+echo "1000000000 tnbench.leaky" > $TEST.baseline
+rerun "with a slow baseline"
+rm -f $TEST.baseline
+rerun "without a baseline"
+sed -n -e 's/^[0-9.]* \(.*\)/MSG baseline recorded for \1/p' $TEST.baseline
+rm -f $TEST.baseline
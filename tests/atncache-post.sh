@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+# Run tncache again and report whether each run used the discovery
+# cache file written by the first one.  A run which misses writes a
+# new file and renames it into place, so the inode changes.
+
+TEST="$1"
+
+function inode()
+{
+    stat -c %i "$NOVAPROVA_CACHE"/*.dcache 2>/dev/null
+}
+
+function rerun()
+{
+    local before=$(inode)
+    echo "MSG $1"
+    ./$TEST
+    echo "EXIT $?"
+    if [ -z "$(inode)" ] ; then
+	echo "MSG no cache file"
+    elif [ "$(inode)" = "$before" ] ; then
+	echo "MSG cache hit"
+    else
+	echo "MSG cache miss"
+    fi
+}
+
+[ -n "$(inode)" ] && echo "MSG cache written"
+
+rerun "unchanged executable"
+
+touch $TEST
+rerun "touched executable"
+
+echo "garbage" > "$NOVAPROVA_CACHE"/*.dcache
+rerun "corrupt cache file"
+
+rerun "unchanged executable"
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# Run tnfailfast with --fail-fast, and with the history enabled,
+# and show the results of each run in the order they were reported.
+
+TEST="$1"
+
+function rerun()
+{
+    echo "MSG running ${*:-serially}"
+    ./$TEST "$@" 2>&1 | sed -n -e 's/^\(PASS\|FAIL\|SKIP\) \(.*\)/MSG \1 \2/p'
+    echo "EXIT ${PIPESTATUS[0]}"
+}
+
+rerun --fail-fast
+rerun --fail-fast=2
+
+# a serial run keeps traversal order, whatever failed last time
+export NOVAPROVA_HISTORY=
+rerun
+rerun
+
+# but with --fail-fast, what failed last time goes first
+rerun --fail-fast
+export NOVAPROVA_HISTORY=no
+
+# a job which failed before it was killed keeps its result
+TNFAILFAST_SLOW=yes rerun -j2 --fail-fast
@@ -0,0 +1,61 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# Run tnhistory with the history enabled, first whole and then only
+# one of its tests, and show the names kept in the history file each
+# time.  Tests which aren't in a run's plan are kept, but a test which
+# no longer exists is dropped from it.
+
+TEST="$1"
+
+function names()
+{
+    perl -e '
+	local $/;
+	my ($magic, $version, $n, $rest) = unpack("LLLa*", <STDIN>);
+	while ($n--)
+	{
+	    (my $name, undef, undef, $rest) = unpack("L/a Q L a*", $rest);
+	    print "MSG $name\n";
+	}' < "$NOVAPROVA_CACHE"/*.history
+}
+
+function rerun()
+{
+    echo "MSG running ${*:-all tests}"
+    NOVAPROVA_HISTORY= ./$TEST "$@"
+    echo "EXIT $?"
+    names
+}
+
+# add the history of a test which has since been removed
+function add_removed()
+{
+    perl -e '
+	local $/;
+	my ($magic, $version, $n, $rest) = unpack("LLLa*", <STDIN>);
+	print pack("LLL", $magic, $version, $n+1), $rest,
+	      pack("L/a Q L", $ARGV[0], 1000000, 0);' "$1" \
+	< "$NOVAPROVA_CACHE"/*.history > "$NOVAPROVA_CACHE"/history.tmp
+    mv "$NOVAPROVA_CACHE"/history.tmp "$NOVAPROVA_CACHE"/*.history
+    echo "MSG added $1"
+    names
+}
+
+rerun
+rerun $TEST.apple
+add_removed $TEST.cherry
+rerun $TEST.apple
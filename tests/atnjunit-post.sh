@@ -0,0 +1,24 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+# show the JUnit report, without what changes from run to run
+xmllint --format reports/TEST-tnjunit.xml | \
+    sed -r \
+	-e 's/(hostname|timestamp|time|value)="[^"]*"/\1="%\1%"/g' \
+	-e 's|'$PWD'|%PWD%|g' \
+	-e '/^(at|by) 0x/d' \
+	-e 's/^/MSG /'
@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# Run tnoptions with each of several command line options, and show
+# the exit status and whether the usage message was printed.
+
+TEST="$1"
+
+function rerun()
+{
+    echo "MSG running $*"
+    ./$TEST "$@" 2>&1 | sed -n -e 's/^Usage: .*/MSG usage/p' -e 's/^\(PASS .*\)/MSG \1/p'
+    echo "EXIT ${PIPESTATUS[0]}"
+}
+
+rerun -j 2
+rerun -j 2:4
+rerun -j auto
+rerun -j max
+rerun -j 0
+rerun -j 2x
+rerun -j abc
+rerun -j 2:abc
+rerun -j 2:4x
+rerun -j 4:2
+rerun --fail-fast=2
+rerun --fail-fast=0
+rerun --fail-fast=2x
@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# Run tnresource again with JUnit output, and show whether the CPU
+# time and memory the report records for each test are over the
+# limits in tnresource.env.
+
+TEST="$1"
+
+./$TEST -fjunit > /dev/null 2>&1
+echo "EXIT $?"
+perl -n -e '
+    while (m/<property name="resources\[hog=(\w+)\]\.(\w+)" value="([^"]*)"\/>/g)
+    {
+	my ($hog, $prop, $value) = ($1, $2, $3);
+	$cpu{$hog} += $value * 1000 if ($prop eq "utime" || $prop eq "stime");
+	$rss{$hog} = $value if ($prop eq "maxrss");
+    }
+    END
+    {
+	foreach my $hog (sort keys %rss)
+	{
+	    printf "MSG %s cpu %s %d ms\n", $hog,
+		($cpu{$hog} > $ENV{NOVAPROVA_MAX_CPU} ? "over" : "under"),
+		$ENV{NOVAPROVA_MAX_CPU};
+	    printf "MSG %s maxrss %s %d KiB\n", $hog,
+		($rss{$hog} > $ENV{NOVAPROVA_MAX_RSS} ? "over" : "under"),
+		$ENV{NOVAPROVA_MAX_RSS};
+	}
+    }' reports/TEST-$TEST.xml
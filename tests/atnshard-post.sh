@@ -0,0 +1,49 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# Run tnshard in three shards, split by hash and then by duration,
+# and show the jobs which the shards ran between them.
+
+TEST="$1"
+
+function shards()
+{
+    echo "MSG shards $*"
+    for k in 1 2 3 ; do
+	NOVAPROVA_HISTORY= ./$TEST --shard=$k/3 "$@" 2>&1 | sed -n -e 's/^PASS /MSG /p'
+    done | sort
+    ls "$NOVAPROVA_CACHE"/*.history >/dev/null 2>&1 && echo "MSG history written"
+}
+
+function usage()
+{
+    echo "MSG usage $*"
+    ./$TEST "$@" 2>&1 | sed -n -e 's/^\(np: cannot.*\)/MSG \1/p'
+    echo "EXIT ${PIPESTATUS[0]}"
+}
+
+shards --shard-by=hash
+
+# freeze the history of an unsharded run for the shards to share
+NOVAPROVA_HISTORY= ./$TEST > /dev/null 2>&1
+mv "$NOVAPROVA_CACHE"/*.history frozen.history
+shards --shard-by=duration:frozen.history
+rm -f frozen.history
+
+usage --shard=1/3x
+usage --shard=0/3
+usage --shard-by=duration
+usage --shard=1/3 --shard-by=duration:no-such.history
@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# Run tnstall again with its stdout and stderr a pipe which is nearly
+# full, so the listeners block as soon as they announce a test, and
+# only start reading it four seconds later.  The tests check that the
+# runner started them in the meantime.
+
+TEST="$1"
+
+echo "MSG running stalled"
+perl -e '
+    use Fcntl;
+    my $F_SETPIPE_SZ = 1031;
+    pipe(R, W) or die "pipe: $!";
+    # one page, with just enough room left for the banner
+    fcntl(W, $F_SETPIPE_SZ, 4096) or die "F_SETPIPE_SZ: $!";
+    my $filled = 4096 - 128;
+    syswrite(W, "\n" x $filled) == $filled or die "write: $!";
+    open(UP, "/proc/uptime") or die "/proc/uptime: $!";
+    my ($since) = split(/ /, <UP>);
+    close(UP);
+    my $pid = fork();
+    if (!$pid)
+    {
+	close(R);
+	open(STDOUT, ">&W");
+	open(STDERR, ">&W");
+	$ENV{TNSTALL_SINCE} = $since;
+	exec(@ARGV) or die "exec: $!";
+    }
+    close(W);
+    sleep(4);
+    # drop the filler, which is all newlines
+    my $skip = $filled;
+    while ($skip > 0 && sysread(R, my $buf, $skip) > 0)
+    {
+	$skip -= length($buf);
+    }
+    print while (<R>);
+    waitpid($pid, 0);
+    print "EXIT ", ($? >> 8), "\n";
+' ./$TEST -j3 | sort
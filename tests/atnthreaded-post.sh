@@ -0,0 +1,47 @@
+#!/bin/bash
+#
+#  Copyright 2011-2012 Gregory Banks
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# Run tnthreaded's tests in threads, in processes, alongside one
+# which is sent SIGTERM, alongside one which crashes, and alongside
+# ones which call syslog() and exit(), and show the results of each
+# run.
+
+TEST="$1"
+
+function rerun()
+{
+    echo "MSG running $1"
+    shift
+    ./$TEST "$@" 2>&1 |\
+	sed -n -e 's/^\(PASS\|FAIL\|EVENT [A-Z]*\) .*\(tnthreaded\.[a-z]*\|signal [0-9]*\|exit([0-9]*)\).*/MSG \1 \2/p' | sort
+    echo "EXIT ${PIPESTATUS[0]}"
+}
+
+rerun "in threads"
+NOVAPROVA_THREADED=no TNTHREADED_WHERE=process rerun "in processes"
+
+# ending one thread leaves the others running in the host
+TNTHREADED_TERM=yes TNTHREADED_SLOW=yes rerun "with a thread terminated" -j2
+
+# a crash takes the host down, so the tests which hadn't finished
+# are run again in processes, as is everything after them
+TNTHREADED_CRASH=yes TNTHREADED_SLOW=yes TNTHREADED_WHERE=process \
+    rerun "with a thread crashing" -j2
+
+# the built-in mocks catch these in threads too, without taking
+# the host down
+TNTHREADED_SYSLOG=yes TNTHREADED_EXIT=yes TNTHREADED_SLOW=yes \
+    rerun "with syslog and exit in threads" -j2
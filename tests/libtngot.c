@@ -0,0 +1,30 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <syslog.h>
+
+/*
+ * Built twice by the Makefile, as libtngotlazy.so and libtngotnow.so,
+ * so that tngot can call syslog() from link objects whose GOT slots
+ * are bound lazily or at load time.  BINDING names the function.
+ */
+
+#define _tngot_syslog(b)    tngot_##b##_syslog
+#define tngot_syslog(b)	    _tngot_syslog(b)
+
+void tngot_syslog(BINDING)(const char *msg)
+{
+    syslog(LOG_ERR, "%s", msg);
+}
@@ -30,7 +30,7 @@ function fail()
 {
     local mm="$*"
     [ -n "$mm" ] && mm=" ($mm)"
-    msg "FAIL $TEST $TESTARGS$mm"
+    msg "FAIL $TEST $TESTARGS$mm$envmsg"
 
     for a in $TEST $TESTARGS ; do
 	if [ -e a$a-failed.sh ] ; then
@@ -44,7 +44,7 @@ function fail()
 
 function pass()
 {
-    msg "PASS $TEST $TESTARGS"
+    msg "PASS $TEST $TESTARGS$envmsg"
     exit 0
 }
 
@@ -53,11 +53,32 @@ if [ "$VERBOSE" = yes ] ; then
     verbose=yes
 fi
 
+# The order of tests must not depend on earlier runs
+export NOVAPROVA_HISTORY=no
+
 TEST="$1"
 [ -x $TEST ] || fatal "$TEST: No such executable"
 shift
 TESTARGS="$*"
 
+# Each test gets its own discovery cache, which the hooks may
+# inspect, rather than writing to the user's
+mkdir -p .cache
+export NOVAPROVA_CACHE=$PWD/.cache/$TEST
+
+# Environment the test always needs
+if [ -f $TEST.env ] ; then
+    export $(cat $TEST.env)
+fi
+
+# Extra environment for this run, e.g. RUNTEST_ENV="NOVAPROVA_PIDFD=no",
+# which must not change the test's output
+envmsg=
+if [ -n "$RUNTEST_ENV" ] ; then
+    export $RUNTEST_ENV
+    envmsg=" [$RUNTEST_ENV]"
+fi
+
 ID="$TEST"
 [ -n "$TESTARGS" ] && ID="$ID."$(echo "$TESTARGS"|tr ' ' '.')
 
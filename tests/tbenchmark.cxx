@@ -0,0 +1,148 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np/benchmark.hxx"
+#include "fw.h"
+
+using namespace std;
+using namespace np;
+using namespace np::util;
+
+#define BASELINE    "/tmp/novaprova.tbenchmark.baseline"
+
+int
+setup(void)
+{
+    unlink(BASELINE);
+    unsetenv("NOVAPROVA_BENCH_THRESHOLD");
+    unsetenv("NOVAPROVA_BENCH_UPDATE");
+    setenv("NOVAPROVA_BENCH_BASELINE", BASELINE, 1);
+    return 0;
+}
+
+int
+teardown(void)
+{
+    unlink(BASELINE);
+    return 0;
+}
+
+static void
+write_baseline(const char *text)
+{
+    FILE *fp = fopen(BASELINE, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+static benchmark_t
+make_benchmark(double median, double mad)
+{
+    benchmark_t b;
+    memset(&b, 0, sizeof(b));
+    b.median_ = median;
+    b.mad_ = mad;
+    return b;
+}
+
+int
+main(int argc, char **argv __attribute__((unused)))
+{
+    argv0 = argv[0];
+    if (argc != 1)
+	fatal("Usage: %s\n", argv0);
+
+    BEGIN("load");
+    write_baseline("# a comment\n"
+		   "12.500 tbench.alpha\n"
+		   "junk tbench.beta\n"
+		   "7 tbench.gamma[x=1]  \n"
+		   "3.25\n");
+    baseline_t bl;
+    bl.load();
+    double m = 0;
+    CHECK(bl.get("tbench.alpha", &m));
+    CHECK(m == 12.5);
+    CHECK(!bl.get("tbench.beta", &m));
+    CHECK(bl.get("tbench.gamma[x=1]", &m));
+    CHECK(m == 7.0);
+    CHECK(!bl.get("", &m));
+    CHECK(bl.get_threshold() == 0.1);
+    CHECK(!bl.is_updating());
+    END;
+
+    BEGIN("record and save");
+    write_baseline("12.5 tbench.alpha\n");
+    baseline_t bl;
+    bl.load();
+    bl.record("tbench.alpha", 20.0);	/* already there, kept */
+    bl.record("tbench.delta", 4.0);	/* new, added */
+    bl.save();
+    baseline_t bl2;
+    bl2.load();
+    double m = 0;
+    CHECK(bl2.get("tbench.alpha", &m));
+    CHECK(m == 12.5);
+    CHECK(bl2.get("tbench.delta", &m));
+    CHECK(m == 4.0);
+    END;
+
+    BEGIN("update");
+    write_baseline("12.5 tbench.alpha\n");
+    setenv("NOVAPROVA_BENCH_UPDATE", "yes", 1);
+    baseline_t bl;
+    bl.load();
+    CHECK(bl.is_updating());
+    bl.record("tbench.alpha", 20.0);
+    bl.save();
+    unsetenv("NOVAPROVA_BENCH_UPDATE");
+    baseline_t bl2;
+    bl2.load();
+    double m = 0;
+    CHECK(bl2.get("tbench.alpha", &m));
+    CHECK(m == 20.0);
+    END;
+
+#define TESTCASE(threshold, median, mad, base, expected) \
+{ \
+    BEGIN("is_regression(threshold=%s, median=%g, mad=%g, base=%g)", \
+	  *threshold ? threshold : "default", median, mad, base); \
+    if (*threshold) \
+	setenv("NOVAPROVA_BENCH_THRESHOLD", threshold, 1); \
+    baseline_t bl; \
+    bl.load(); \
+    benchmark_t b = make_benchmark(median, mad); \
+    CHECK(bl.is_regression(&b, base) == expected); \
+    END; \
+}
+    /* within 10% of the baseline */
+    TESTCASE("", 109.0, 0.0, 100.0, false);
+    TESTCASE("", 90.0, 0.0, 100.0, false);
+    /* more than 10% slower, with little noise */
+    TESTCASE("", 111.0, 0.0, 100.0, true);
+    TESTCASE("", 111.0, 0.3, 100.0, true);
+    /* more than 10% slower, but within 3 MADs */
+    TESTCASE("", 111.0, 4.0, 100.0, false);
+    TESTCASE("", 200.0, 40.0, 100.0, false);
+    TESTCASE("", 200.0, 30.0, 100.0, true);
+    /* a different threshold */
+    TESTCASE("50", 140.0, 0.0, 100.0, false);
+    TESTCASE("50", 160.0, 0.0, 100.0, true);
+    /* no usable baseline */
+    TESTCASE("", 111.0, 0.0, 0.0, false);
+#undef TESTCASE
+
+    return 0;
+}
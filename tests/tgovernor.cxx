@@ -0,0 +1,96 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "np/governor.hxx"
+#include "fw.h"
+
+using namespace std;
+using namespace np;
+using namespace np::util;
+
+int
+setup(void)
+{
+    return 0;
+}
+
+int
+teardown(void)
+{
+    return 0;
+}
+
+int
+main(int argc, char **argv __attribute__((unused)))
+{
+    argv0 = argv[0];
+    if (argc != 1)
+	fatal("Usage: %s\n", argv0);
+
+#define TESTCASE(in, expected) \
+{ \
+    BEGIN("parse_pressure(\"%s\")", in); \
+    CHECK(governor_t::parse_pressure(in) == expected); \
+    END; \
+}
+    TESTCASE("some avg10=0.00 avg60=0.00 avg300=0.00 total=12345\n"
+	     "full avg10=0.00 avg60=0.00 avg300=0.00 total=678\n", 12345ULL);
+    TESTCASE("some avg10=1.50 avg60=0.25 avg300=0.05 total=18446744073709551615\n",
+	     18446744073709551615ULL);
+    TESTCASE("some avg10=0.00 avg60=0.00 avg300=0.00\n"
+	     "full avg10=0.00 avg60=0.00 avg300=0.00 total=678\n", 0ULL);
+    TESTCASE("full avg10=0.00 avg60=0.00 avg300=0.00 total=678\n", 0ULL);
+    TESTCASE("", 0ULL);
+#undef TESTCASE
+
+    static const char meminfo[] =
+	"MemTotal:       16318572 kB\n"
+	"MemFree:         1203456 kB\n"
+	"MemAvailable:    9876543 kB\n"
+	"Buffers:          123456 kB\n"
+	"SwapTotal:             0 kB\n";
+#define TESTCASE(name, expected) \
+{ \
+    BEGIN("parse_meminfo(\"%s\")", name); \
+    CHECK(governor_t::parse_meminfo(meminfo, name) == expected); \
+    END; \
+}
+    TESTCASE("MemTotal", 16318572ULL);
+    TESTCASE("MemAvailable", 9876543ULL);
+    TESTCASE("SwapTotal", 0ULL);
+    TESTCASE("Total", 0ULL);
+    TESTCASE("Mem", 0ULL);
+    TESTCASE("Cached", 0ULL);
+#undef TESTCASE
+
+#define TESTCASE(in, ok, expected) \
+{ \
+    BEGIN("parse_stat(\"%s\")", in); \
+    uint64_t ticks = 0; \
+    CHECK(governor_t::parse_stat(in, &ticks) == ok); \
+    if (ok) CHECK(ticks == expected); \
+    END; \
+}
+    TESTCASE("1234 (tnfoo) S 1 1234 1234 0 -1 4194560 100 0 0 0 25 17 0 0 20 0 1 0 5",
+	     true, 42ULL);
+    TESTCASE("1234 (a (b) c) R 1 1234 1234 34816 1234 4194304 1 2 3 4 1000 3 0 0 20 0 1 0 5",
+	     true, 1003ULL);
+    TESTCASE("1234 (tnfoo) Z 1 1234 1234 0 -1 4194560 100 0 0 0", false, 0ULL);
+    TESTCASE("1234 tnfoo S 1 1234 1234 0 -1 4194560 100 0 0 0 25 17", false, 0ULL);
+    TESTCASE("", false, 0ULL);
+#undef TESTCASE
+
+    return 0;
+}
@@ -222,6 +222,119 @@ public:
     }
 };
 
+int
+factorial(int n)
+{
+    if (n <= 1)
+	return 1;
+    return n * factorial(n-1);
+}
+
+class recursive_intercept_tester_t : public np::spiegel::intercept_t
+{
+public:
+    recursive_intercept_tester_t()
+     :  intercept_t((np::spiegel::addr_t)&factorial)
+    {
+    }
+    ~recursive_intercept_tester_t()
+    {
+    }
+
+    unsigned int after_count;
+    unsigned int before_count;
+    int depth, max_depth;
+    int r;
+
+    void before(np::spiegel::call_t &call)
+    {
+	if (is_verbose()) printf("BEFORE n=%d\n", (int)call.get_arg(0));
+	before_count++;
+	if (++depth > max_depth)
+	    max_depth = depth;
+    }
+    void after(np::spiegel::call_t &call)
+    {
+	r = call.get_retval();
+	if (is_verbose()) printf("AFTER, returning %d\n", r);
+	after_count++;
+	depth--;
+    }
+};
+
+double
+scaled(double x, int n)
+{
+    return x * n;
+}
+
+struct pair_t
+{
+    long a, b;
+};
+
+pair_t
+pair_of(long a, long b)
+{
+    pair_t p;
+    p.a = a;
+    p.b = b;
+    return p;
+}
+
+long
+very_wide_call(long a1, long a2, long a3, long a4, long a5, long a6,
+	       long a7, long a8, long a9, long a10, long a11, long a12,
+	       long a13, long a14, long a15, long a16, long a17, long a18,
+	       long a19, long a20, long a21, long a22, long a23, long a24)
+{
+    return a1+a2+a3+a4+a5+a6+a7+a8+a9+a10+a11+a12+
+	   a13+a14+a15+a16+a17+a18+a19+a20+a21+a22+a23+a24;
+}
+
+class retval_intercept_tester_t : public np::spiegel::intercept_t
+{
+public:
+    retval_intercept_tester_t(np::spiegel::addr_t addr)
+     :  intercept_t(addr),
+	skip_(false),
+	skip_rv_(0),
+	before_count(0),
+	after_count(0),
+	r(0)
+    {
+    }
+    ~retval_intercept_tester_t()
+    {
+    }
+
+    bool skip_;
+    unsigned long skip_rv_;
+    unsigned int before_count;
+    unsigned int after_count;
+    unsigned long r;
+
+    void before(np::spiegel::call_t &call)
+    {
+	before_count++;
+	if (skip_)
+	    call.skip(skip_rv_);
+    }
+    void after(np::spiegel::call_t &call)
+    {
+	after_count++;
+	r = call.get_retval();
+    }
+};
+
+static unsigned long
+double_bits(double d)
+{
+    unsigned long v;
+    memcpy(&v, &d, sizeof(v));
+    return v;
+}
+
 typedef void (*fn_t)(void);
 
 class libc_intercept_tester_t : public np::spiegel::intercept_t
@@ -425,6 +538,86 @@ main(int argc, char **argv __attribute__((unused)))
     delete it3;
     END;
 
+    /*
+     * Functions which return in registers other than %rax/%eax
+     * must get the right value back whether they are called
+     * through or skipped.
+     */
+    BEGIN("double return");
+    retval_intercept_tester_t *it7 =
+	new retval_intercept_tester_t((np::spiegel::addr_t)&scaled);
+    it7->install();
+    double d = scaled(1.5, 3);
+    CHECK(d == 4.5);
+    CHECK(it7->before_count == 1);
+    CHECK(it7->after_count == 1);
+    CHECK(it7->r == double_bits(4.5));
+    it7->skip_ = true;
+    it7->skip_rv_ = double_bits(-2.25);
+    d = scaled(1.5, 3);
+    CHECK(d == -2.25);
+    CHECK(it7->before_count == 2);
+    CHECK(it7->after_count == 1);
+    it7->uninstall();
+    delete it7;
+    END;
+
+    BEGIN("two register struct return");
+    retval_intercept_tester_t *it8 =
+	new retval_intercept_tester_t((np::spiegel::addr_t)&pair_of);
+    it8->install();
+    pair_t p = pair_of(17, 23);
+    CHECK(p.a == 17);
+    CHECK(p.b == 23);
+    CHECK(it8->r == 17);
+    it8->skip_ = true;
+    it8->skip_rv_ = 42;
+    p = pair_of(17, 23);
+    CHECK(p.a == 42);
+    CHECK(p.b == 0);
+    CHECK(it8->before_count == 2);
+    CHECK(it8->after_count == 1);
+    it8->uninstall();
+    delete it8;
+    END;
+
+    /* more stack arguments than the x86_64 trampoline copies */
+    BEGIN("very large stack frame");
+    retval_intercept_tester_t *it9 =
+	new retval_intercept_tester_t((np::spiegel::addr_t)&very_wide_call);
+    it9->install();
+    long l = very_wide_call(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+			    13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24);
+    CHECK(l == 300);
+    CHECK(it9->r == 300);
+    CHECK(it9->before_count == 1);
+    CHECK(it9->after_count == 1);
+    it9->uninstall();
+    delete it9;
+    END;
+
+    /*
+     * Test interception of a recursive function.  Every level of
+     * the recursion should see both before() and after() called,
+     * properly nested.
+     */
+    BEGIN("recursive");
+    recursive_intercept_tester_t *it6 = new recursive_intercept_tester_t();
+    it6->install();
+    r = factorial(6);
+    CHECK(r == 720);
+    CHECK(it6->r == 720);
+    CHECK(it6->before_count == 6);
+    CHECK(it6->after_count == 6);
+    CHECK(it6->max_depth == 6);
+    CHECK(it6->depth == 0);
+    it6->uninstall();
+    r = factorial(5);
+    CHECK(r == 120);
+    CHECK(it6->before_count == 6);
+    delete it6;
+    END;
+
     /*
      * Test interception of functions in libc.  There are several issues:
      *
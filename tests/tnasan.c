@@ -0,0 +1,58 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Built with -fsanitize=address, so that NovaProva finds the
+ * AddressSanitizer runtime.  The first run overruns a heap buffer,
+ * which ASan reports through its error report callback just before
+ * it kills the child.  The second leaks a buffer, which LeakSanitizer
+ * finds after the test.  Both fail with an EV_SANITIZER event.
+ */
+
+NP_PARAMETER(kind, "overrun,leak");
+
+static void __attribute__((noinline)) overrun(void)
+{
+    char *p = malloc(10);
+    memset(p, 0, 10);
+    p[10] = 'x';
+}
+
+static void __attribute__((noinline)) leak(void)
+{
+    char *p = malloc(10);
+    memset(p, 0, 10);
+}
+
+/* LeakSanitizer only finds leaks no pointer points to, even one
+ * left behind on the stack */
+static void __attribute__((noinline)) scrub(void)
+{
+    volatile char buf[4096];
+    memset((char *)buf, 0, sizeof(buf));
+}
+
+static void test_sanitizer(void)
+{
+    if (!strcmp(kind, "overrun"))
+	overrun();
+    else
+	leak();
+    scrub();
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdlib.h>
+
+/*
+ * A test and a benchmark.  The benchmark only runs when
+ * atnbench-post.sh sets NOVAPROVA_BENCH, and leaks memory on
+ * every call, which isn't reported because benchmarks aren't
+ * leak checked.
+ */
+
+static volatile unsigned long counter;
+
+static void test_counter(void)
+{
+    counter++;
+}
+
+static void bench_leaky(void)
+{
+    void *p = malloc(16);
+    counter += (p != 0);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdio.h>
+
+/*
+ * Run several times by atncache-post.sh, which checks whether each
+ * run used the discovery cache.  The mock and parameter must work
+ * the same whether they were discovered or loaded from the cache.
+ */
+
+int bird_mezcal(int x)
+{
+    return x/2;
+}
+
+int mock_bird_mezcal(int x)
+{
+    return x*2;
+}
+
+NP_PARAMETER(agave, "espadin,tobala");
+
+static void test_cached(void)
+{
+    fprintf(stderr, "MSG agave=%s\n", agave);
+    NP_ASSERT_EQUAL(bird_mezcal(21), 42);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Writes much more to stdout than the runner keeps, which with
+ * NOVAPROVA_OUTPUT_HEAD and NOVAPROVA_OUTPUT_TAIL set in tnchatty.env
+ * is five lines from each end.  The runner is meant to free the rest
+ * while the test is still running, so the test can see its output
+ * file stop growing.
+ */
+
+#define NLINES	    200000
+
+static void test_chatty(void)
+{
+    struct stat sb;
+    char line[32];
+    int i;
+
+    for (i = 0 ; i < NLINES ; i++)
+    {
+	snprintf(line, sizeof(line), "line %06d\n", i);
+	NP_ASSERT_EQUAL(write(1, line, strlen(line)), strlen(line));
+    }
+
+    /* the runner trims every tenth of a second */
+    for (i = 0 ; i < 50 ; i++)
+    {
+	NP_ASSERT_EQUAL(fstat(1, &sb), 0);
+	NP_ASSERT_EQUAL(sb.st_size, NLINES * 12);
+	if (sb.st_blocks * 512 < 64*1024)
+	    break;
+	usleep(100*1000);
+    }
+    NP_ASSERT(sb.st_blocks * 512 < 64*1024);
+}
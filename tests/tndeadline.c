@@ -0,0 +1,32 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <unistd.h>
+
+/*
+ * Run with -j2.  The short job finishes first and the second long
+ * job starts in its place, so the two long jobs time out in the
+ * order they started, a second apart.
+ */
+
+NP_PARAMETER(length, "long1,short,long2");
+
+static void test_sleep(void)
+{
+    int timeout = np_get_timeout();
+    if (!timeout) return;
+    sleep(length[0] == 's' ? 1 : timeout+5);
+}
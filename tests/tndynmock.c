@@ -88,5 +88,9 @@ static void test_dynamic_mocking(void)
     fprintf(stderr, "after, returned %d\n", x);
     NP_ASSERT_EQUAL(x, 21);
     NP_ASSERT_EQUAL(called, 1);
+
+    fprintf(stderr, "looking up by name\n");
+    NP_ASSERT_PTR_EQUAL(np_function_by_name("bird_tequila"), bird_tequila);
+    NP_ASSERT_NULL(np_function_by_name("no_such_function"));
 }
 
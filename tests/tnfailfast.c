@@ -0,0 +1,43 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Run with --fail-fast and with the history enabled by
+ * atnfailfast-post.sh, which shows the order the tests ran in
+ * and which of them were skipped.
+ */
+
+NP_PARAMETER(fruit, "apple,banana,cherry,damson");
+
+static void test_fruit(void)
+{
+    if (getenv("TNFAILFAST_SLOW") && !strcmp(fruit, "damson"))
+	sleep(1);
+    if (!strcmp(fruit, "banana") || !strcmp(fruit, "damson"))
+	NP_FAIL;
+}
+
+static int tear_down(void)
+{
+    /* still running when damson fails, but has already failed */
+    if (getenv("TNFAILFAST_SLOW") && !strcmp(fruit, "banana"))
+	sleep(10);
+    return 0;
+}
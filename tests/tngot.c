@@ -0,0 +1,76 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <dlfcn.h>
+#include <string.h>
+#include <syslog.h>
+
+/*
+ * The builtin syslog() mock is installed by rewriting the GOT slots
+ * which call it.  libtngotlazy.so's slot for syslog() hasn't been
+ * bound yet when the mock is installed, and libtngotnow.so's was
+ * bound at load time and lies in its read-only RELRO segment; calls
+ * from both must reach the mock, and libc's text must be left alone.
+ * A second mock of syslog() installs a trap instead, which sees every
+ * call.
+ */
+
+extern void tngot_lazy_syslog(const char *msg);
+extern void tngot_now_syslog(const char *msg);
+
+NP_PARAMETER(binding, "lazy,now");
+
+static unsigned int ncalls;
+
+static void my_syslog(int prio, const char *fmt, ...)
+{
+    ncalls++;
+}
+
+static void call_syslog(const char *msg)
+{
+    if (!strcmp(binding, "lazy"))
+	tngot_lazy_syslog(msg);
+    else
+	tngot_now_syslog(msg);
+}
+
+/* the first instruction byte of libc's syslog() */
+static unsigned char syslog_text(void)
+{
+    return *(const unsigned char *)dlsym(RTLD_NEXT, "syslog");
+}
+
+static void test_got(void)
+{
+    unsigned char text = syslog_text();
+
+    np_syslog_match("through the GOT", LOG_ERR);
+    call_syslog("through the GOT");
+    NP_ASSERT_EQUAL(np_syslog_count(LOG_ERR), 1);
+
+    np_mock(syslog, my_syslog);
+    NP_ASSERT_NOT_EQUAL(syslog_text(), text);
+    call_syslog("through the trap");
+    syslog(LOG_ERR, "through the trap");
+    NP_ASSERT_EQUAL(ncalls, 2);
+    NP_ASSERT_EQUAL(np_syslog_count(LOG_ERR), 1);
+
+    np_unmock(syslog);
+    call_syslog("through the GOT");
+    NP_ASSERT_EQUAL(ncalls, 2);
+    NP_ASSERT_EQUAL(np_syslog_count(LOG_ERR), 2);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdio.h>
+
+/*
+ * The JUnit report lists the tests, and their output, sorted by
+ * name whatever order they ran and finished in.
+ */
+
+static void test_camel(void)
+{
+    printf("camel out\n");
+    fprintf(stderr, "camel err\n");
+}
+
+static void test_aardvark(void)
+{
+    printf("aardvark out\n");
+}
+
+static void test_bison(void)
+{
+    fprintf(stderr, "bison err\n");
+    NP_FAIL;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+/*
+ * Exercises the built-in leak tracker, which tnleak.env turns on.
+ * Each run allocates in a different way, and the events report
+ * how much was leaked in how many blocks.
+ */
+
+NP_PARAMETER(kind, "none,leak,chain,realloc,aligned,fork,teardown");
+
+struct link
+{
+    struct link *next;
+    char pad[24];
+};
+
+static volatile int stop;
+
+static void *churn(void *arg)
+{
+    while (!stop)
+	free(malloc(32));
+    return arg;
+}
+
+static void test_leaks(void)
+{
+    if (!strcmp(kind, "none"))
+    {
+	free(malloc(16));
+    }
+    else if (!strcmp(kind, "leak"))
+    {
+	NP_ASSERT_NOT_NULL(malloc(16));
+    }
+    else if (!strcmp(kind, "chain"))
+    {
+	/* the second block is only pointed to by the first */
+	struct link *a = malloc(sizeof(*a));
+	a->next = malloc(sizeof(*a));
+	a->next->next = 0;
+    }
+    else if (!strcmp(kind, "realloc"))
+    {
+	/* the block is leaked at its new size */
+	char *p = malloc(16);
+	p = realloc(p, 100);
+	p = malloc(8);
+	free(realloc(p, 4));
+    }
+    else if (!strcmp(kind, "aligned"))
+    {
+	void *p;
+	NP_ASSERT_EQUAL(posix_memalign(&p, 64, 40), 0);
+	NP_ASSERT_NOT_NULL(aligned_alloc(64, 64));
+	NP_ASSERT_NOT_NULL(memalign(64, 24));
+	free(aligned_alloc(64, 128));
+    }
+    else if (!strcmp(kind, "fork"))
+    {
+	/* children forked while another thread is allocating
+	 * mustn't find the tracker locked */
+	pthread_t th;
+	int i;
+	NP_ASSERT_EQUAL(pthread_create(&th, 0, churn, 0), 0);
+	for (i = 0 ; i < 50 ; i++)
+	{
+	    int status;
+	    pid_t pid = fork();
+	    if (!pid)
+	    {
+		free(malloc(64));
+		_exit(0);
+	    }
+	    NP_ASSERT(pid > 0);
+	    NP_ASSERT_EQUAL(waitpid(pid, &status, 0), pid);
+	    NP_ASSERT_EQUAL(status, 0);
+	}
+	stop = 1;
+	pthread_join(th, 0);
+    }
+    else if (!strcmp(kind, "teardown"))
+    {
+	/* failing twice leaks nothing */
+	NP_FAIL;
+    }
+}
+
+static int tear_down(void)
+{
+    if (!strcmp(kind, "teardown"))
+	NP_FAIL;
+    return 0;
+}
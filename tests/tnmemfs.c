@@ -0,0 +1,62 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Test for in-memory files.  The directory doesn't exist, so the
+ * test only passes if none of the calls reach the real filesystem.
+ */
+
+#define DIR "/nonexistent/tnmemfs"
+
+static void test_memfs(void)
+{
+    char buf[64];
+    int fd;
+
+    np_memfs_mount(DIR);
+    np_memfs_put(DIR "/config", "abc", 3);
+
+    fd = open(DIR "/config", O_RDWR|O_APPEND);
+    NP_ASSERT(fd >= 0);
+    NP_ASSERT_EQUAL(read(fd, buf, sizeof(buf)), 3);
+    NP_ASSERT_EQUAL(write(fd, "def", 3), 3);
+    NP_ASSERT_EQUAL(fsync(fd), 0);
+    close(fd);
+    NP_ASSERT_EQUAL(np_memfs_get(DIR "/config", buf, sizeof(buf)), 6);
+    NP_ASSERT(!memcmp(buf, "abcdef", 6));
+
+    /* the usual write-then-rename dance */
+    fd = open(DIR "/data.tmp", O_WRONLY|O_CREAT|O_EXCL, 0644);
+    NP_ASSERT(fd >= 0);
+    NP_ASSERT_EQUAL(write(fd, "hello", 5), 5);
+    NP_ASSERT_EQUAL(fsync(fd), 0);
+    close(fd);
+    NP_ASSERT_EQUAL(rename(DIR "/data.tmp", DIR "/data"), 0);
+    NP_ASSERT_EQUAL(open(DIR "/data.tmp", O_RDONLY), -1);
+    NP_ASSERT_EQUAL(errno, ENOENT);
+    NP_ASSERT_EQUAL(np_memfs_get(DIR "/data", buf, sizeof(buf)), 5);
+    NP_ASSERT(!memcmp(buf, "hello", 5));
+
+    NP_ASSERT_EQUAL(unlink(DIR "/data"), 0);
+    NP_ASSERT_EQUAL(np_memfs_get(DIR "/data", buf, sizeof(buf)), -1);
+    NP_ASSERT_EQUAL(rename(DIR "/config", "/tmp/tnmemfs"), -1);
+    NP_ASSERT_EQUAL(errno, EXDEV);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <string.h>
+
+/*
+ * Events travel from the test's child process to the runner as
+ * framed messages.  The first four runs send event descriptions
+ * needing every amount of padding, the last a longer one.
+ */
+
+NP_PARAMETER(word, "a,ab,abc,abcd,long");
+
+static void test_frames(void)
+{
+    char buf[200];
+
+    if (!strcmp(word, "long"))
+    {
+	memset(buf, 'x', sizeof(buf)-1);
+	buf[sizeof(buf)-1] = '\0';
+	NP_ASSERT_STR_EQUAL(buf, "x");
+    }
+    NP_ASSERT_STR_EQUAL(word, "z");
+}
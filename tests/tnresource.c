@@ -0,0 +1,64 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Run with NOVAPROVA_MAX_CPU and NOVAPROVA_MAX_RSS set from
+ * tnresource.env, so that the tests which use too much CPU time
+ * or memory fail.  atnresource-post.sh checks the figures the
+ * JUnit report records for them.
+ */
+
+#define HOG_CPU_MS	1000
+#define HOG_MEMORY_KB	(128*1024)
+#define RUNNER_MEMORY_KB (96*1024)
+
+/*
+ * Memory which is resident in the runner before any test is forked,
+ * and more than NOVAPROVA_MAX_RSS.  It mustn't count against the
+ * tests, which inherit it.
+ */
+static char *runner_memory;
+
+static void __attribute__((constructor))
+fill_runner(void)
+{
+    runner_memory = (char *)malloc(RUNNER_MEMORY_KB * 1024);
+    if (runner_memory)
+	memset(runner_memory, 0xa5, RUNNER_MEMORY_KB * 1024);
+}
+
+NP_PARAMETER(hog, "none,cpu,memory");
+
+static void test_resources(void)
+{
+    if (!strcmp(hog, "cpu"))
+    {
+	clock_t end = clock() + HOG_CPU_MS * (CLOCKS_PER_SEC / 1000);
+	while (clock() < end)
+	    ;
+    }
+    else if (!strcmp(hog, "memory"))
+    {
+	char *p = (char *)malloc(HOG_MEMORY_KB * 1024);
+	NP_ASSERT_NOT_NULL(p);
+	memset(p, 0x5a, HOG_MEMORY_KB * 1024);
+	free(p);
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Tests which allocate memory under a 32 MiB limit.  Only running
+ * into the limit is reported, and only once.
+ */
+
+NP_LIMIT(mem, 32*1024);
+
+#define CHUNK	(1024*1024)
+
+NP_PARAMETER(usage, "within,impossible,exhaust");
+
+static void test_memory(void)
+{
+    if (!strcmp(usage, "within"))
+    {
+	char *p = (char *)malloc(16*CHUNK);
+	NP_ASSERT_NOT_NULL(p);
+	memset(p, 0x5a, 16*CHUNK);
+	free(p);
+    }
+    else if (!strcmp(usage, "impossible"))
+    {
+	/* fails whatever the limit, and the test copes */
+	volatile size_t huge = SIZE_MAX;
+	NP_ASSERT_NULL(malloc(huge));
+    }
+    else if (!strcmp(usage, "exhaust"))
+    {
+	void *chunks[64];
+	int n = 0;
+	while (n < 64 && (chunks[n] = malloc(CHUNK)))
+	    memset(chunks[n++], 0x5a, CHUNK);
+	NP_ASSERT(n < 64);
+	/* failing again doesn't report again */
+	NP_ASSERT_NULL(malloc(CHUNK));
+	while (n)
+	    free(chunks[--n]);
+    }
+}
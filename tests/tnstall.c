@@ -0,0 +1,65 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * atnstall-post.sh runs this again with -j3 and its stdout a full
+ * pipe which isn't read for four seconds, and TNSTALL_SINCE set to
+ * the uptime when it started.  The listeners can't announce any test
+ * until then, but the runner is meant to start all three at once
+ * anyway, so each checks that its process was forked well before.
+ */
+
+NP_PARAMETER(number, "one,two,three");
+
+/* seconds since boot when this process was forked */
+static double forked_at(void)
+{
+    char buf[1024];
+    unsigned long long start = 0;
+    FILE *fp;
+    char *p;
+    int i;
+
+    fp = fopen("/proc/self/stat", "r");
+    NP_ASSERT_NOT_NULL(fp);
+    NP_ASSERT_NOT_NULL(fgets(buf, sizeof(buf), fp));
+    fclose(fp);
+    /* the fields after the command, which may contain spaces */
+    p = strrchr(buf, ')');
+    NP_ASSERT_NOT_NULL(p);
+    /* starttime is the 22nd field, the 20th after the command */
+    for (i = 0 ; i < 20 ; i++)
+    {
+	p = strchr(p+1, ' ');
+	NP_ASSERT_NOT_NULL(p);
+    }
+    start = strtoull(p+1, 0, 10);
+    return (double)start / sysconf(_SC_CLK_TCK);
+}
+
+static void test_start(void)
+{
+    const char *since = getenv("TNSTALL_SINCE");
+
+    if (!since)
+	return;
+    NP_ASSERT(forked_at() - atof(since) < 2.0);
+}
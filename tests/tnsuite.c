@@ -0,0 +1,60 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdio.h>
+
+/*
+ * Test for suite fixtures.  The suite setup runs once, and every
+ * test starts from the state it left behind.  Changes made by a
+ * test are thrown away with the test's process as usual.
+ */
+
+static int nsetups = 0;
+static int dataset = 0;
+
+static int setup_suite(void)
+{
+    nsetups++;
+    dataset = 42;
+    fprintf(stderr, "MSG setting up suite\n");
+    return 0;
+}
+
+static int teardown_suite(void)
+{
+    fprintf(stderr, "MSG tearing down suite, %d setups\n", nsetups);
+    return 0;
+}
+
+static int setup(void)
+{
+    fprintf(stderr, "MSG setting up test, dataset=%d\n", dataset);
+    return 0;
+}
+
+static void test_one(void)
+{
+    NP_ASSERT_EQUAL(nsetups, 1);
+    NP_ASSERT_EQUAL(dataset, 42);
+    dataset = 0;
+}
+
+static void test_two(void)
+{
+    NP_ASSERT_EQUAL(nsetups, 1);
+    NP_ASSERT_EQUAL(dataset, 42);
+    dataset = 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdio.h>
+
+/*
+ * Test for a failing suite setup.  Every test in the
+ * suite fails, and the suite teardown is not run.
+ */
+
+static int setup_suite(void)
+{
+    fprintf(stderr, "MSG setting up suite\n");
+    return -1;
+}
+
+static int teardown_suite(void)
+{
+    fprintf(stderr, "MSG tearing down suite\n");
+    return 0;
+}
+
+static void test_one(void)
+{
+    fprintf(stderr, "MSG running test one\n");
+}
+
+static void test_two(void)
+{
+    fprintf(stderr, "MSG running test two\n");
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <syslog.h>
+#include <sys/syscall.h>
+
+/*
+ * Run in several ways by atnthreaded-post.sh, which shows where
+ * each test ran and how it ended.
+ */
+
+NP_THREADED;
+
+static const char *where(void)
+{
+    return (syscall(SYS_gettid) == getpid() ? "process" : "thread");
+}
+
+static void test_where(void)
+{
+    const char *expected = getenv("TNTHREADED_WHERE");
+    /* still running when the other tests end */
+    if (getenv("TNTHREADED_SLOW"))
+	sleep(2);
+    NP_ASSERT_STR_EQUAL(where(), expected ? expected : "thread");
+}
+
+static void test_crash(void)
+{
+    if (getenv("TNTHREADED_CRASH"))
+	raise(SIGILL);
+}
+
+static void test_syslog(void)
+{
+    if (getenv("TNTHREADED_SYSLOG"))
+	syslog(LOG_ERR, "logged by tnthreaded.syslog");
+}
+
+static void test_exit(void)
+{
+    if (getenv("TNTHREADED_EXIT"))
+	exit(3);
+}
+
+static void test_term(void)
+{
+    /* as the runner does when a threaded test times out */
+    if (getenv("TNTHREADED_TERM"))
+	syscall(SYS_tgkill, getpid(), syscall(SYS_gettid), SIGTERM);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+
+/*
+ * Test for the virtual clock.  The sleeps add up to far more than
+ * the test timeout, so the test only passes if none of them really
+ * waits, and the clock still moves on by the time they asked for.
+ */
+
+NP_VIRTUAL_CLOCK;
+
+static long long
+now_ms(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void test_sleep(void)
+{
+    long long start = now_ms(CLOCK_MONOTONIC);
+    struct timespec ts = { 60, 0 };
+
+    sleep(60);
+    usleep(500000);
+    nanosleep(&ts, 0);
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, 0);
+    NP_ASSERT_EQUAL(poll(0, 0, 1500), 0);
+    np_clock_advance(1000000000ULL);
+
+    long long elapsed = now_ms(CLOCK_MONOTONIC) - start;
+    NP_ASSERT(elapsed >= 183000);
+    NP_ASSERT(elapsed < 185000);
+}
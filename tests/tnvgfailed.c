@@ -0,0 +1,28 @@
+/*
+ * Copyright 2011-2012 Gregory Banks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <np.h>
+
+/*
+ * With NOVAPROVA_VALGRIND=failed in tnvgfailed.env, the failed test
+ * is run again under Valgrind, which reports nothing more.  The
+ * re-run is given the discovery results, so with the discovery
+ * cache disabled it mustn't warn about discovering again.
+ */
+
+static void test_failed(void)
+{
+    NP_FAIL;
+}